@@ -262,6 +262,22 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Exchange the SyncedMemory holding the data_ of this Blob with the
+   *        one held by Blob other, which must have the same count.
+   *
+   * Used by prefetching data layers to hand a loaded batch over to their top
+   * blob without copying it; the old top buffer is recycled for the next load.
+   */
+  void SwapData(Blob* other);
+  /**
+   * @brief Set the data_ shared_ptr to point to data, which may be shared
+   *        with other Blob%s and must hold at least the capacity of this one.
+   *
+   * Used by Net::Init to let blobs that are never live at the same time
+   * share their memory.
+   */
+  void set_data(const shared_ptr<SyncedMemory>& data);
 
   bool ShapeEquals(const BlobProto& other);
 
@@ -114,6 +114,9 @@ void GlobalFinalize();
 // Header for system entropy source
 int64_t cluster_seedgen(bool sync=true);
 
+class HostAllocator;
+class ThreadPool;
+
   // A singleton class to hold common caffe stuff, such as the handler that
 // caffe is going to use for cublas, curand, etc.
 class Caffe {
@@ -170,6 +173,18 @@ class Caffe {
   static void SetDevice(const int device_id);
   // Prints the current GPU status.
   static void DeviceQuery();
+  // The threads layers split their loops over on CPU, and that the data
+  // layers may decode on; a single thread, the calling one, by default.
+  // Hold on to the pool for the whole of a ParallelFor call, and size any
+  // per-slot scratch from that pool, as set_num_threads() may swap it.
+  static shared_ptr<ThreadPool> thread_pool();
+  static int num_threads();
+  // Replaces the pool at any time: the calls running on the old one finish
+  // on it, and it goes away with the last of them.
+  static void set_num_threads(const int num_threads);
+  // Where the host memory of blobs comes from, with its statistics; shared
+  // by all threads, and never destroyed, as blobs may outlive the singleton.
+  static HostAllocator& host_allocator();
 
 #ifdef USE_MPI
   enum PARALLEL_MODE { NO, MPI };
@@ -217,6 +232,7 @@ class Caffe {
   curandGenerator_t curand_generator_;
 #endif
   shared_ptr<RNG> random_generator_;
+  shared_ptr<ThreadPool> thread_pool_;
 
 #ifdef USE_CUDNN
   int cudnn_mem_richness_;
@@ -363,6 +363,7 @@ class FlattenLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Flatten"; }
+  virtual inline bool SharesBottomData() const { return true; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -443,6 +444,14 @@ class LstmLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Lstm"; }
+  // c_T_ and h_T_ change on every Forward
+  virtual inline bool AllowRecomputeForward() const { return false; }
+
+  /// The state is h then c, a [2, H_] blob.
+  virtual inline bool HasRecurrentState() const { return true; }
+  virtual void SaveRecurrentState(const int n, Blob<Dtype>* state) const;
+  virtual void RestoreRecurrentState(const int n, const Blob<Dtype>& state);
+  virtual void ResetRecurrentState(const int n);
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -460,6 +469,7 @@ class LstmLayer : public Layer<Dtype> {
   int N_; // batch size
 
   Dtype clipping_threshold_; // threshold for clipped gradient
+  bool stream_; // carry the state over without a clip bottom
 
   Blob<Dtype> bias_multiplier_;
   Blob<Dtype> clip_multiplier_;
@@ -533,6 +543,7 @@ class ReshapeLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Reshape"; }
+  virtual inline bool SharesBottomData() const { return true; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -708,6 +719,9 @@ class SplitLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Split"; }
+  virtual inline bool SharesBottomData() const { return true; }
+  // the diffs of the tops are summed into that of the bottom
+  virtual inline bool SharesBottomDiff() const { return false; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
 
@@ -778,6 +792,14 @@ class SliceLayer : public Layer<Dtype> {
                          const vector<Blob<Dtype>*>& top);
 
     virtual inline const char* type() const { return "Gather"; }
+    // in MPI mode top gathers the bottoms of all ranks into memory of its own
+    virtual inline bool SharesBottomData() const {
+#ifdef USE_MPI
+      return Caffe::parallel_mode() != Caffe::MPI;
+#else
+      return true;
+#endif
+    }
     virtual inline int MinBottomBlobs() const { return 1; }
     virtual inline int MinTopBlobs() const { return 1; }
 
@@ -812,6 +834,14 @@ class SliceLayer : public Layer<Dtype> {
                            const vector<Blob<Dtype>*>& top);
 
       virtual inline const char* type() const { return "Scatter"; }
+      // in MPI mode top gets the share of this rank in memory of its own
+      virtual inline bool SharesBottomData() const {
+#ifdef USE_MPI
+        return Caffe::parallel_mode() != Caffe::MPI;
+#else
+        return true;
+#endif
+      }
       virtual inline int MinBottomBlobs() const { return 1; }
       virtual inline int MinTopBlobs() const { return 1; }
       inline virtual bool is_scattering() {return true;}
@@ -848,6 +878,10 @@ class BNLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "BN"; }
+  // unless frozen, Forward updates the moving averages in training
+  virtual inline bool AllowRecomputeForward() const {
+    return frozen_ || this->phase_ == TEST;
+  }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -863,6 +897,23 @@ class BNLayer : public Layer<Dtype> {
 
   void AverageAllExceptChannel(const Dtype* input, Dtype* output);
   void BroadcastChannel(const Dtype* input, Dtype* output);
+  // Normalizes one (image, channel) plane by the moving averages, as Forward
+  // does when frozen or testing; the planes are run at once on the threads of
+  // Caffe::thread_pool(). x_norm_data, if not NULL, gets the normalized input.
+  void FrozenForward_cpu_plane(const Dtype* bottom_data, Dtype* top_data,
+      Dtype* x_norm_data, int plane, int thread_id);
+  // The batch mean and inverse std of one channel, in a single pass over its
+  // planes, whose partial statistics are merged as in Welford's algorithm.
+  void ChannelStatistics_cpu(const Dtype* bottom_data, Dtype* mean_data,
+      Dtype* inv_std_data, int channel, int thread_id);
+  // Normalizes, scales and shifts one channel by the batch statistics in a
+  // single pass, saving the normalized input for Backward.
+  void TrainForward_cpu_channel(const Dtype* bottom_data, Dtype* top_data,
+      Dtype* x_norm_data, int channel, int thread_id);
+  // The gradients of one channel: those of the slope and shift, if not NULL,
+  // are added to, and that of the input is computed in one more pass.
+  void Backward_cpu_channel(const Dtype* top_diff, Dtype* bottom_diff,
+      Dtype* scale_diff, Dtype* shift_diff, int channel, int thread_id);
 
   bool frozen_;
   Dtype bn_momentum_;
@@ -873,6 +924,8 @@ class BNLayer : public Layer<Dtype> {
   int height_;
   int width_;
 
+  // Only the GPU implementation broadcasts the statistics into these, so on
+  // the CPU they never get memory.
   Blob<Dtype> broadcast_buffer_;
   Blob<Dtype> spatial_statistic_;
   Blob<Dtype> batch_statistic_;
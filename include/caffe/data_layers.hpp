@@ -1,6 +1,7 @@
 #ifndef CAFFE_DATA_LAYERS_HPP_
 #define CAFFE_DATA_LAYERS_HPP_
 
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
@@ -15,11 +16,14 @@
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
 
+class SegmentFrameSink;
+
 /**
  * @brief Provides base for data layers that feed blobs to the Net.
  *
@@ -80,13 +84,31 @@ protected:
 	bool output_labels_;
 };
 
+/**
+ * @brief One slot of the prefetch ring: a complete batch as produced by the
+ *        loader thread.
+ */
+template<typename Dtype>
+class Batch {
+public:
+	Blob<Dtype> data_, label_, roi_;
+};
+
+/**
+ * @brief Provides base for data layers that load batches on a background
+ *        thread.
+ *
+ * The loader fills a ring of data_param().prefetch() batches: it pops an
+ * empty batch from prefetch_free_, fills it through load_batch() and pushes it
+ * to prefetch_full_, so it may run several batches ahead of the net. Forward
+ * hands the loaded buffers over to the tops by swapping them instead of
+ * copying, then recycles the batch.
+ */
 template<typename Dtype>
 class BasePrefetchingDataLayer: public BaseDataLayer<Dtype>,
 		public InternalThread {
 public:
-	explicit BasePrefetchingDataLayer(const LayerParameter& param) :
-			BaseDataLayer<Dtype>(param) {
-	}
+	explicit BasePrefetchingDataLayer(const LayerParameter& param);
 	// LayerSetUp: implements common data layer setup functionality, and calls
 	// DataLayerSetUp to do special data layer setup for individual layer types.
 	// This method may not be overridden.
@@ -100,45 +122,37 @@ public:
 
 	virtual void CreatePrefetchThread();
 	virtual void JoinPrefetchThread();
-	// The thread's function
-	virtual void InternalThreadEntry() {
-	}
 
 protected:
-	Blob<Dtype> prefetch_data_;
-	Blob<Dtype> prefetch_label_;
+	// The thread's function: keeps the free batches filled until stopped.
+	virtual void InternalThreadEntry();
+	// Fill one batch; called on the prefetch thread.
+	virtual void load_batch(Batch<Dtype>* batch) = 0;
+
+	vector<shared_ptr<Batch<Dtype> > > prefetch_;
+	BlockingQueue<Batch<Dtype>*> prefetch_free_;
+	BlockingQueue<Batch<Dtype>*> prefetch_full_;
+
 	Blob<Dtype> transformed_data_;
 };
 
+/**
+ * @brief A BasePrefetchingDataLayer which additionally outputs num_rois_
+ *        regions of interest per item as a third top, carried in Batch::roi_.
+ */
 template<typename Dtype>
-class BasePrefetchingROILayer: public BaseDataLayer<Dtype>,
-		public InternalThread {
+class BasePrefetchingROILayer: public BasePrefetchingDataLayer<Dtype> {
 public:
 	explicit BasePrefetchingROILayer(const LayerParameter& param) :
-			BaseDataLayer<Dtype>(param) {
+			BasePrefetchingDataLayer<Dtype>(param), num_rois_(0) {
 	}
-	// LayerSetUp: implements common data layer setup functionality, and calls
-	// DataLayerSetUp to do special data layer setup for individual layer types.
-	// This method may not be overridden.
-	void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
-			const vector<Blob<Dtype>*>& top);
 
 	virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 			const vector<Blob<Dtype>*>& top);
 	virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
 			const vector<Blob<Dtype>*>& top);
 
-	virtual void CreatePrefetchThread();
-	virtual void JoinPrefetchThread();
-	// The thread's function
-	virtual void InternalThreadEntry() {
-	}
-
 protected:
-	Blob<Dtype> prefetch_data_;
-	Blob<Dtype> prefetch_label_;
-	Blob<Dtype> prefetch_roi_;
-	Blob<Dtype> transformed_data_;
 	int num_rois_;
 };
 
@@ -167,7 +181,7 @@ public:
 
 
 protected:
-	virtual void InternalThreadEntry();
+	virtual void load_batch(Batch<Dtype>* batch);
 
 #ifdef USE_MPI
 	inline virtual void advance_cursor() {
@@ -380,7 +394,7 @@ public:
 protected:
 	shared_ptr<Caffe::RNG> prefetch_rng_;
 	virtual void ShuffleImages();
-	virtual void InternalThreadEntry();
+	virtual void load_batch(Batch<Dtype>* batch);
 
 #ifdef USE_MPI
 	inline virtual void advance_cursor() {
@@ -435,12 +449,53 @@ protected:
 	shared_ptr<Caffe::RNG> prefetch_rng_1_;
 	shared_ptr<Caffe::RNG> frame_prefetch_rng_;
 	virtual void ShuffleVideos();
-	virtual void InternalThreadEntry();
+	virtual void load_batch(Batch<Dtype>* batch);
+
+	/**
+	 * @brief One batch item to be decoded by the worker pool: the video it
+	 *        is read from, the sampled segment offsets and the seed of the
+	 *        random stream used to transform it.
+	 */
+	struct DecodeJob {
+		string filename;
+		vector<int> labels;
+		vector<int> offsets;
+		unsigned int seed;
+		bool ok;
+	};
+	// Reads the segments at offsets of one video into sink, from its frame
+	// folders, its packs with video_data_param().packed() or the db.
+	bool ReadVideoFrames(const int thread_id, const string& filename,
+			const vector<int>& offsets, SegmentFrameSink* sink);
+	// Lists the videos of a db built by convert_videoset_db, only the range
+	// of this rank under MPI.
+	void LoadVideosFromDB(const string& source, const int interval);
+	// Draws the next video from the list and samples its segment offsets.
+	void NextDecodeJob(DecodeJob* job);
+	// Decodes and transforms one item into its slot of the batch, with the
+	// transformer and db cursor of decode thread thread_id.
+	bool DecodeItem(const int item_id, const DecodeJob& job,
+			const int thread_id, Batch<Dtype>* batch);
+	void DecodeThreadEntry(const int thread_id, Batch<Dtype>* batch);
+	// Decodes item item_id on slot thread_id of Caffe::thread_pool(), with
+	// num_decode_threads 0.
+	void DecodePoolItem(Batch<Dtype>* batch, const int item_id, const int thread_id);
+
+	vector<DecodeJob> decode_jobs_;
+	// one transformer per decode thread, reseeded for every item
+	vector<shared_ptr<DataTransformer<Dtype> > > decode_transformers_;
+
+	// set when reading from a video db
+	shared_ptr<db::DB> db_;
+	vector<shared_ptr<db::Cursor> > decode_cursors_;
+	std::map<string, int> db_index_;
 
 private:
 
 #ifdef USE_MPI
 	inline virtual void advance_cursor() {
+		// a video db is already sharded by key range
+		if (db_) return;
 		lines_id_++;
 		if (lines_id_ >= lines_.size()) {
 			// We have reached the end. Restart from the first.
@@ -549,7 +604,7 @@ public:
 
 protected:
 	virtual unsigned int PrefetchRand();
-	virtual void InternalThreadEntry();
+	virtual void load_batch(Batch<Dtype>* batch);
 
 #ifdef USE_MPI
 	inline virtual void advance_cursor() {
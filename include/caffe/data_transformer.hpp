@@ -9,6 +9,13 @@
 
 namespace caffe {
 
+/**
+ * @brief The (h_off, w_off) crop offsets picked from with fix_crop: the four
+ *        corners and the center, and eight more with more_crop.
+ */
+void fillFixOffset(int datum_height, int datum_width, int crop_height,
+    int crop_width, bool more_crop, vector<pair<int, int> >& offsets);
+
 /**
  * @brief Applies common transformations to the input data, such as
  * scaling, mirroring, substracting the image mean...
@@ -25,6 +32,13 @@ class DataTransformer {
    */
   void InitRand();
 
+  /**
+   * @brief Initialize the Random number generations from a given seed, so
+   *    that a sequence of transformations can be reproduced independently of
+   *    the thread running it.
+   */
+  void InitRand(const unsigned int seed);
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to the data.
@@ -88,6 +102,35 @@ class DataTransformer {
    */
   void Transform(Blob<Dtype>* input_blob, Blob<Dtype>* transformed_blob);
 
+  /**
+   * @brief Starts transforming one item that is handed over frame by frame
+   *    with TransformFrame(), instead of as a whole Datum. The random crop,
+   *    mirror and mean jitter are drawn here, in the same order as
+   *    Transform(const Datum&, ...) draws them, so both give the same result.
+   *
+   * @param channels, height, width
+   *    The geometry of the whole item, as the Datum holding it would have.
+   * @param transformed_blob
+   *    This is destination blob. It can be part of top blob's data if
+   *    set_cpu_data() is used. See video_data_layer.cpp for an example.
+   * @param roi
+   *    Optional ROIs of the item, adjusted to the crop and mirror.
+   */
+  void BeginTransform(const int channels, const int height, const int width,
+                      Blob<Dtype>* transformed_blob, Blob<Dtype>* roi = NULL);
+
+  /**
+   * @brief Transforms one decoded 8-bit frame of the item started by
+   *    BeginTransform() straight into its destination blob.
+   *
+   * @param frame
+   *    A frame holding the item's channels first_channel to
+   *    first_channel + frame.channels() - 1. It may be of any size, in which
+   *    case it is resized to the item's size along with the crop, in one
+   *    resampling of the cropped region only.
+   */
+  void TransformFrame(const cv::Mat& frame, const int first_channel);
+
   /**
    * @brief Infers the shape of transformed_blob will have when
    *    the transformation is applied to the data.
@@ -135,6 +178,20 @@ class DataTransformer {
   virtual int Rand(int n);
 
   void Transform(const Datum& datum, Dtype* transformed_data, Blob<Dtype> *roi = NULL);
+
+  // The random transformation drawn for one item.
+  struct ItemTransform {
+    int channels, height, width;  // input geometry
+    int crop_height, crop_width;  // window read from the input, 0 if no crop
+    int h_off, w_off;
+    int out_height, out_width;
+    bool do_mirror;
+    bool need_imgproc;  // the window is resized to crop_size
+    vector<int> mean_jitter;  // per channel
+  };
+  void SampleTransform(const int channels, const int height, const int width,
+                       Blob<Dtype>* roi, ItemTransform* item);
+
   // Tranformation parameters
   TransformationParameter param_;
 
@@ -146,6 +203,10 @@ class DataTransformer {
 
   vector<float> custom_scale_ratios_;
   int max_distort_;
+
+  // the item being transformed by TransformFrame()
+  ItemTransform item_;
+  Dtype* item_data_;
 };
 
 }  // namespace caffe
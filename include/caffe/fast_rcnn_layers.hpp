@@ -46,6 +46,10 @@ class ROIPoolingLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  // Max pools over ROI n, whose rois_dim numbers start at bottom_rois + n *
+  // rois_dim; the ROIs are run at once on the threads of Caffe::thread_pool().
+  void Forward_cpu_roi(const Dtype* bottom_data, const Dtype* bottom_rois,
+      int rois_dim, Dtype* top_data, int* argmax_data, int n, int thread_id);
 
   int channels_;
   int height_;
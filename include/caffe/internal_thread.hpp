@@ -27,6 +27,12 @@ class InternalThread {
   /** Will not return until the internal thread has exited. */
   bool WaitForInternalThreadToExit();
 
+  /**
+   * Requests the thread to stop at its next interruption point and waits
+   * for it to exit. Long-running entries should poll must_stop().
+   */
+  bool StopInternalThread();
+
   bool is_started() const;
 
  protected:
@@ -34,6 +40,9 @@ class InternalThread {
       with the code you want your thread to run. */
   virtual void InternalThreadEntry() {}
 
+  /* Should be tested when running loops to exit when requested. */
+  bool must_stop();
+
   shared_ptr<boost::thread> thread_;
 };
 
@@ -274,6 +274,63 @@ class Layer {
     return true;
   }
 
+  /**
+   * @brief Returns true if Forward still computes the right top blobs when
+   *        each of them shares its memory with the bottom blob of the same
+   *        index.
+   *
+   * Net::Init then lets a top reuse the memory of a bottom needed by no later
+   * layer when it plans the memory of a net for inference.
+   */
+  virtual inline bool AllowForwardInPlace() const { return false; }
+
+  /**
+   * @brief Returns true if the top blobs hold the data of the bottom blobs
+   *        (each that of the bottom of the same index, or else of the last
+   *        one) by reference rather than their own copy.
+   */
+  virtual inline bool SharesBottomData() const { return false; }
+  /// @brief Likewise for the diffs of the top blobs.
+  virtual inline bool SharesBottomDiff() const { return SharesBottomData(); }
+
+  /**
+   * @brief Returns true if running Forward again on the same bottom blobs
+   *        gives the same top blobs and changes nothing else, so that Net
+   *        may drop the tops and recompute them for Backward.
+   */
+  virtual inline bool AllowRecomputeForward() const { return true; }
+
+  /**
+   * @brief Returns true if Forward and Backward may run on another thread at
+   *        the same time as those of other layers.
+   *
+   * Net runs the layers returning false one at a time when it executes
+   * independent branches concurrently.
+   */
+  virtual inline bool AllowConcurrentExecution() const { return true; }
+
+  /**
+   * @brief Returns true if the layer carries a state from one Forward to the
+   *        next for each item of its batch, as a recurrent layer does.
+   *
+   * Such a layer implements the three methods below, which let a caller feed
+   * a batch slot from several streams in turn, e.g. one frame of each of many
+   * live videos per Forward.
+   */
+  virtual inline bool HasRecurrentState() const { return false; }
+  /// @brief Copies the state item n of the batch carries to the next Forward
+  ///        into state, reshaping it.
+  virtual void SaveRecurrentState(const int n, Blob<Dtype>* state) const {
+    NOT_IMPLEMENTED;
+  }
+  /// @brief Makes item n of the next Forward continue from state, from
+  ///        SaveRecurrentState.
+  virtual void RestoreRecurrentState(const int n, const Blob<Dtype>& state) {
+    NOT_IMPLEMENTED;
+  }
+  /// @brief Makes item n of the next Forward start from the initial state.
+  virtual void ResetRecurrentState(const int n) { NOT_IMPLEMENTED; }
+
   /**
    * @brief Specifies whether the layer should compute gradients w.r.t. a
    *        parameter at a particular index given by param_id.
@@ -14,6 +14,9 @@
 
 namespace caffe {
 
+template <typename Dtype> class GradientBuckets;
+class WeightPack;
+
 /**
  * @brief Connects Layer%s together into a directed acyclic graph (DAG)
  *        specified by a NetParameter.
@@ -85,6 +88,24 @@ class Net {
   /// @brief Updates the network weights based on the diff values computed.
   void Update();
 
+  /**
+   * @brief Copies the state item n of the batch carries to the next Forward
+   *        in every layer that has one (see Layer::HasRecurrentState), one
+   *        blob per such layer, into state.
+   *
+   * Together with RestoreRecurrentState this makes state a handle on one
+   * stream: a caller serving many streams restores those fed to the batch,
+   * runs Forward on a frame of each, and saves them again.
+   */
+  void SaveRecurrentState(const int n,
+      vector<shared_ptr<Blob<Dtype> > >* state) const;
+  /// @brief Makes item n of the next Forward continue from state, from
+  ///        SaveRecurrentState.
+  void RestoreRecurrentState(const int n,
+      const vector<shared_ptr<Blob<Dtype> > >& state);
+  /// @brief Makes item n of the next Forward start a new stream.
+  void ResetRecurrentState(const int n);
+
   /**
    * @brief For an already initialized net, implicitly copies (i.e., using no
    *        additional memory) the pre-trained layers from another Net.
@@ -97,6 +118,8 @@ class Net {
    *        another Net.
    */
   void CopyTrainedLayersFrom(const NetParameter& param);
+  void CopyTrainedLayersFrom(const WeightPack& pack);
+  /// Reads either a binary NetParameter (.caffemodel) or a weight pack.
   void CopyTrainedLayersFrom(const string trained_filename);
   /// @brief Writes the net to a proto.
   void ToProto(NetParameter* param, bool write_diff = false) const;
@@ -175,6 +198,25 @@ class Net {
   const shared_ptr<Layer<Dtype> > layer_by_name(const string& layer_name) const;
 
   void set_debug_info(const bool value) { debug_info_ = value; }
+  /// @brief Sets how many layers of independent branches may run at once.
+  void set_max_concurrency(int max_concurrency);
+  inline int max_concurrency() const { return max_concurrency_; }
+
+  /// @brief What the layers marked recompute save and cost.
+  struct RecomputeStats {
+    // activation data held at the peak, and without recompute
+    size_t peak_bytes, full_bytes;
+    // layer Forwards run in Forward, and again in Backward
+    int num_forwards, num_recomputed;
+    double forward_seconds, recompute_seconds;
+  };
+  /// @brief Returns true if some layers recompute their tops in Backward.
+  inline bool has_recompute() const { return has_recompute_; }
+  /// @brief Returns the stats since the last reset_recompute_stats().
+  inline const RecomputeStats& recompute_stats() const {
+    return recompute_stats_;
+  }
+  void reset_recompute_stats();
 
   // Helpers for Init.
   /**
@@ -183,6 +225,15 @@ class Net {
    */
   static void FilterNet(const NetParameter& param,
       NetParameter* param_filtered);
+  /**
+   * @brief Removes each BN layer that alone reads the top of a Convolution or
+   *        InnerProduct layer; that layer takes over the top of the BN, and a
+   *        bias if it had none, for the BN to be folded into its parameters.
+   *
+   * folded maps the name of each BN layer removed to that of its layer.
+   */
+  static void FoldBatchNorm(const NetParameter& param,
+      NetParameter* param_folded, map<string, string>* folded);
   /// @brief return whether NetState state meets NetStateRule rule
   static bool StateMeetsRule(const NetState& state, const NetStateRule& rule,
       const string& layer_name);
@@ -194,6 +245,28 @@ class Net {
   return layers_[param_layer_indices_[param_id].first];
  }
 
+#ifdef USE_MPI
+  /**
+   * @brief Packs the gradients smaller than bucket_bytes, as they are
+   *        summed across ranks during Backward, into buckets of that size;
+   *        0 sends each gradient on its own.
+   */
+  void set_gradient_bucket_bytes(size_t bucket_bytes);
+  /// The buckets of set_gradient_bucket_bytes, with the timing of the last
+  /// sync; NULL if it was never called.
+  inline const GradientBuckets<Dtype>* gradient_buckets() const {
+    return gradient_buckets_.get();
+  }
+  /**
+   * @brief Waits for the gradient sums issued during Backward to complete,
+   *        leaving them in the param diffs.
+   */
+  void FinishGradientSync();
+  /// Whether Backward sums the gradients across ranks (the default); local
+  /// SGD turns it off and averages the parameters instead.
+  inline void set_sync_gradients(bool sync) { sync_gradients_ = sync; }
+#endif
+
  protected:
   // Helpers for Init.
   /// @brief Append a new input or top blob to the net.
@@ -207,6 +280,34 @@ class Net {
   /// @brief Append a new parameter blob to the net.
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
+  /// @brief Lets the blobs never needed at the same time share their memory,
+  ///        for nets that only run Forward.
+  void PlanMemory();
+  /// @brief The blobs the trained parameters of a layer of this name go to,
+  ///        or NULL if the net has no such layer, nor folded such a BN layer.
+  vector<shared_ptr<Blob<Dtype> > >* TrainedLayerBlobs(
+      const string& layer_name, const int num_source_blobs);
+  /// @brief Folds the parameters of the BN layers just copied into those of
+  ///        the layers they follow.
+  void FoldTrainedBatchNorm(const set<string>& source_layer_names);
+  /// @brief Finds the blobs the layers marked recompute may drop.
+  void InitRecompute();
+  /// @brief Frees the data of a blob, to be recomputed when needed.
+  void DropBlob(const int blob_id);
+  /// @brief Records that a blob holds its data again.
+  void ProduceBlob(const int blob_id);
+  /// @brief Recomputes the data of a dropped blob, and of the dropped blobs
+  ///        it depends on, running only the layers before end.
+  void RecomputeBlob(const int blob_id, const int end);
+  /// @brief Finds which layers must run before which in Forward and Backward.
+  void InitSchedule();
+  /// @brief Returns true if the layers from start to end may run concurrently.
+  bool UseConcurrency(int start, int end) const;
+  /// @brief Runs the Forward or Backward of the layers from start to end,
+  ///        each once those it depends on are done, on Caffe::thread_pool().
+  void RunConcurrently(int start, int end, bool forward);
+  /// @brief Runs the Forward or Backward of one layer for RunConcurrently.
+  void RunLayer(bool forward, int layer_id);
 
   /// @brief Helper for displaying debug info in Forward about input Blobs.
   void InputDebugInfo(const int layer_id);
@@ -267,6 +368,36 @@ class Net {
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Whether some layers drop their tops, which blobs may be dropped, which
+  /// are, and which to drop after the Forward of each layer.
+  bool has_recompute_;
+  vector<bool> blob_droppable_;
+  vector<bool> blob_dropped_;
+  vector<vector<int> > blobs_to_drop_;
+  /// The layers writing each blob: its producer, then those computing it in
+  /// place.
+  vector<vector<int> > blob_writers_;
+  /// The activation data held by the blobs that are never dropped.
+  size_t kept_bytes_;
+  size_t live_bytes_;
+  RecomputeStats recompute_stats_;
+  /// The BN layers fold_batch_norm removed, by name: the layers they fold
+  /// into, and their parameters once copied.
+  map<string, int> folded_bn_index_;
+  vector<int> folded_bn_layer_ids_;
+  vector<vector<shared_ptr<Blob<Dtype> > > > folded_bn_blobs_;
+  /// The layers each layer must run before, in Forward (all later) and in
+  /// Backward (all earlier), because they share a blob one of them writes.
+  vector<vector<int> > forward_successors_;
+  vector<vector<int> > backward_successors_;
+  int max_concurrency_;
+  /// The loss of each layer run concurrently, summed in order afterwards.
+  vector<Dtype> layer_losses_;
+#ifdef USE_MPI
+  /// Buckets for the gradients summed during Backward.
+  shared_ptr<GradientBuckets<Dtype> > gradient_buckets_;
+  bool sync_gradients_;
+#endif
 
   DISABLE_COPY_AND_ASSIGN(Net);
 };
@@ -31,6 +31,7 @@ class NeuronLayer : public Layer<Dtype> {
 
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool AllowForwardInPlace() const { return true; }
 };
 
 /**
@@ -167,6 +168,10 @@ class DropoutLayer : public NeuronLayer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Dropout"; }
+  // a new mask every time
+  virtual inline bool AllowRecomputeForward() const { return false; }
+  // draws from the shared Caffe::rng_stream()
+  virtual inline bool AllowConcurrentExecution() const { return false; }
 
  protected:
   /**
@@ -8,6 +8,8 @@
 
 namespace caffe {
 
+class SnapshotWriter;
+
 /**
  * @brief An interface for classes that perform optimization on Net%s.
  *
@@ -56,6 +58,18 @@ class Solver {
 #ifdef USE_MPI
     void SyncGradient();
     void SyncData();
+    // Local SGD: averages the parameters, and the history if asked to,
+    // across ranks.
+    void AverageParams();
+    // Averages them between two scheduled averages too, so that the ranks
+    // test, and snapshot, the same parameters.
+    void AverageParamsOffSchedule();
+    // Sums the data of blobs across ranks and divides it by their number.
+    void AverageAcrossRanks(const vector<Blob<Dtype>*>& blobs);
+    // The solver's own state blobs that AverageParams may average.
+    virtual vector<Blob<Dtype>*> HistoryBlobs() {
+      return vector<Blob<Dtype>*>();
+    }
     void SyncOutput(shared_ptr<Net<Dtype> > net);
     Dtype SyncLoss(Dtype loss);
 #endif
@@ -65,6 +79,8 @@ class Solver {
   int current_step_;
   shared_ptr<Net<Dtype> > net_;
   vector<shared_ptr<Net<Dtype> > > test_nets_;
+  // writes the snapshots in the background, NULL if they are synchronous
+  shared_ptr<SnapshotWriter> snapshot_writer_;
 
   DISABLE_COPY_AND_ASSIGN(Solver);
 };
@@ -94,6 +110,9 @@ class SGDSolver : public Solver<Dtype> {
   virtual void ClipGradients();
   virtual void SnapshotSolverState(SolverState * state);
   virtual void RestoreSolverState(const SolverState& state);
+#ifdef USE_MPI
+  virtual vector<Blob<Dtype>*> HistoryBlobs();
+#endif
   // history maintains the historical momentum data.
   // update maintains update related data and is not needed in snapshots.
   // temp maintains other information that might be needed in computation
@@ -0,0 +1,169 @@
+#ifndef CAFFE_UTIL_ALLREDUCE_HPP_
+#define CAFFE_UTIL_ALLREDUCE_HPP_
+
+#ifdef USE_MPI
+
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
+#include "mpi.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief A blocking sum of a float or double buffer over the ranks of a
+ *        communicator: the algorithm MPIComm runs OP_SUM_ALL jobs with when
+ *        it is not left to the MPI library.
+ *
+ * Construction and Allreduce are collective over the communicator.
+ */
+class AllreduceBackend {
+ public:
+  virtual ~AllreduceBackend() {}
+
+  /// Sums count elements of src over all ranks into dst; src == dst sums
+  /// in place. type is MPI_FLOAT or MPI_DOUBLE.
+  virtual void Allreduce(const void* src, void* dst, int count,
+      MPI_Datatype type) = 0;
+  virtual const char* type() const = 0;
+};
+
+/**
+ * @brief Ring allreduce: a reduce-scatter followed by an allgather around
+ *        the ring of ranks, each rank sending only 2 (n - 1) / n of the
+ *        buffer whatever the number of ranks n.
+ *
+ * Each message is at most chunk_bytes, bounding the receive buffer. With
+ * half_precision the values travel as IEEE fp16 and are added up in the
+ * buffer's own precision; the result, identical on all ranks, is then only
+ * as precise as fp16.
+ */
+class RingAllreduce : public AllreduceBackend {
+ public:
+  RingAllreduce(MPI_Comm comm, size_t chunk_bytes,
+      bool half_precision = false);
+  virtual ~RingAllreduce();
+
+  virtual void Allreduce(const void* src, void* dst, int count,
+      MPI_Datatype type);
+  virtual const char* type() const {
+    return half_precision_ ? "fp16 Ring" : "Ring";
+  }
+
+ private:
+  template <typename Dtype>
+  void HalfAllreduce(Dtype* data, int count);
+
+  // a duplicate of the given one, so no other message can match ours
+  MPI_Comm comm_;
+  int rank_, size_;
+  size_t chunk_bytes_;
+  bool half_precision_;
+  vector<char> recv_buffer_;
+  vector<uint16_t> send_half_;
+
+  DISABLE_COPY_AND_ASSIGN(RingAllreduce);
+};
+
+/**
+ * @brief Two-level allreduce: the ranks of a node sum through a
+ *        shared-memory window, one leader per node runs a RingAllreduce
+ *        across the nodes, and the node reads the result back.
+ *
+ * Buffers are processed chunk_bytes at a time, the size of each rank's slot
+ * in the window.
+ */
+class HierarchicalAllreduce : public AllreduceBackend {
+ public:
+  /// half_precision applies to the ring across the nodes.
+  HierarchicalAllreduce(MPI_Comm comm, size_t chunk_bytes,
+      bool half_precision = false);
+  virtual ~HierarchicalAllreduce();
+
+  virtual void Allreduce(const void* src, void* dst, int count,
+      MPI_Datatype type);
+  virtual const char* type() const {
+    return half_precision_ ? "fp16 Hierarchical" : "Hierarchical";
+  }
+
+ private:
+  // makes the writes of every local rank to the window visible to all
+  void LocalBarrier();
+
+  // the ranks sharing memory with this one, and their leaders (rank 0 of
+  // each local_comm_); leader_comm_ is MPI_COMM_NULL on the other ranks
+  MPI_Comm local_comm_, leader_comm_;
+  int local_rank_, local_size_;
+  size_t slot_bytes_;
+  bool half_precision_;
+  MPI_Win window_;
+  // each local rank's slot of the window, mapped in this process
+  vector<char*> slots_;
+  shared_ptr<RingAllreduce> leader_ring_;
+
+  DISABLE_COPY_AND_ASSIGN(HierarchicalAllreduce);
+};
+
+/**
+ * @brief Top-k sparsified allreduce with error feedback: every rank sends
+ *        only the ratio of its values largest in magnitude, as (index,
+ *        value) pairs gathered by all, and keeps the rest to add to the
+ *        next buffer summed at the same address.
+ *
+ * Meant for gradients, which are summed at the same addresses every
+ * iteration; the sum of any single call is only approximate.
+ */
+class TopKAllreduce : public AllreduceBackend {
+ public:
+  TopKAllreduce(MPI_Comm comm, float ratio);
+  virtual ~TopKAllreduce();
+
+  virtual void Allreduce(const void* src, void* dst, int count,
+      MPI_Datatype type);
+  virtual const char* type() const { return "Top-k"; }
+
+ private:
+  template <typename Dtype>
+  void SparseAllreduce(const Dtype* src, Dtype* dst, int count);
+
+  MPI_Comm comm_;
+  int size_;
+  float ratio_;
+  // what is left to send of the buffer summed into each address
+  std::map<void*, vector<char> > residuals_;
+  vector<int> indices_;
+  vector<char> send_buffer_, recv_buffer_;
+
+  DISABLE_COPY_AND_ASSIGN(TopKAllreduce);
+};
+
+/**
+ * @brief Creates the backend of algorithm over MPI_COMM_WORLD, or returns
+ *        NULL for SolverParameter_AllreduceAlgorithm_NATIVE. Collective.
+ */
+AllreduceBackend* CreateAllreduceBackend(
+    SolverParameter_AllreduceAlgorithm algorithm, size_t chunk_bytes);
+
+/**
+ * @brief Creates the backend summing the gradients with compression, or
+ *        returns NULL for SolverParameter_GradientCompression_NONE, when
+ *        they are summed like everything else. Collective.
+ */
+AllreduceBackend* CreateGradientBackend(
+    SolverParameter_AllreduceAlgorithm algorithm, size_t chunk_bytes,
+    SolverParameter_GradientCompression compression, float top_k_ratio);
+
+/// IEEE half precision conversions, rounding to nearest even.
+uint16_t caffe_float_to_half(float value);
+float caffe_half_to_float(uint16_t value);
+
+}  // namespace caffe
+
+#endif  // USE_MPI
+
+#endif  // CAFFE_UTIL_ALLREDUCE_HPP_
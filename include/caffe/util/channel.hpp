@@ -9,8 +9,14 @@
 
 #include <boost/shared_ptr.hpp>
 #include <boost/atomic.hpp>
+#include <boost/function.hpp>
 #include <boost/thread.hpp>
 #include <queue>
+#include <vector>
+
+#include "mpi.h"
+
+#include "caffe/util/allreduce.hpp"
 
 using std::queue;
 using boost::mutex;
@@ -21,7 +27,11 @@ using boost::atomic;
 namespace caffe {
 
 enum OperationType {
-    OP_SUM_ALL, OP_GATHER, OP_SCATTER, OP_BROADCAST
+    OP_SUM_ALL, OP_GATHER, OP_SCATTER, OP_BROADCAST,
+    // a sum that may be compressed, see SetGradientBackend
+    OP_SUM_GRADIENT,
+    // runs MPIJob::call_, see Run
+    OP_CALL
 };
 
 class MPIJob {
@@ -31,8 +41,43 @@ public:
   int count_;
   int dtype_size_;
   OperationType op_;
+  boost::function<void()> call_;
+};
+
+/**
+ * @brief Completion and timing of one job added to MPIComm. All times are
+ *        MPI_Wtime() seconds.
+ */
+class MPIJobStatus {
+  public:
+    MPIJobStatus() : done_(false), queued_time_(0), start_time_(0),
+        finish_time_(0) {}
+
+    inline bool done() const { return done_.load(); }
+    // when the job was added, issued to MPI, and seen completed
+    inline double queued_time() const { return queued_time_; }
+    inline double start_time() const { return start_time_; }
+    inline double finish_time() const { return finish_time_; }
+    // time spent waiting for a free in-flight slot, and on the wire
+    inline double queue_seconds() const { return start_time_ - queued_time_; }
+    inline double comm_seconds() const { return finish_time_ - start_time_; }
+
+  private:
+    friend class MPIComm;
+    atomic<bool> done_;
+    double queued_time_, start_time_, finish_time_;
 };
 
+typedef shared_ptr<MPIJobStatus> MPIJobHandle;
+
+/**
+ * @brief Runs the MPI collectives of the caffe_i* functions on a background
+ *        thread, as non-blocking MPI calls with up to max_in_flight of them
+ *        progressing at once.
+ *
+ * Jobs are issued in the order they are added, so every rank issues the same
+ * sequence of collectives.
+ */
 class MPIComm{
   public:
     ~MPIComm();
@@ -44,28 +89,72 @@ class MPIComm{
       return *singleton_;
     }
 
-    inline static void AddMPIJob(MPIJob job){ Get().AddJob(job);};
+    inline static MPIJobHandle AddMPIJob(MPIJob job){ return Get().AddJob(job);};
     inline static void Syncrhonize(){Get().WaitAll();}
+    // Blocks until the given job is completed.
+    inline static void Wait(const MPIJobHandle& job){Get().WaitJob(job);}
+    inline static void SetMaxInFlight(int max_in_flight){
+      Get().set_max_in_flight(max_in_flight);
+    }
+    // Runs the OP_SUM_ALL jobs with backend rather than MPI_Iallreduce;
+    // NULL goes back to the latter.
+    inline static void SetAllreduceBackend(
+        shared_ptr<AllreduceBackend> backend){
+      Get().set_allreduce_backend(backend);
+    }
+    // Runs the OP_SUM_GRADIENT jobs with backend, typically a lossy one;
+    // NULL sums them like the OP_SUM_ALL jobs.
+    inline static void SetGradientBackend(
+        shared_ptr<AllreduceBackend> backend){
+      Get().set_gradient_backend(backend);
+    }
+    // Runs call on the transmission thread after the jobs added before it,
+    // and blocks until it returns. The MPI library may only be called by one
+    // thread at a time, so other collectives, such as those setting up a
+    // backend, must go through here. call must not wait for other jobs.
+    inline static void Run(const boost::function<void()>& call){
+      Get().RunCall(call);
+    }
 
   private:
     MPIComm();
 
     void ThreadFunc();
-    void DispatchJob(MPIJob& job);
+    void StartJob(const MPIJob& job, MPI_Request* request);
+    // Marks the in-flight jobs whose requests completed as done.
+    void CompleteJobs();
     bool IsRunning();
     bool IsIdle();
     void StartProcessing();
     void EndProcessing();
-    void AddJob(MPIJob new_job);
+    MPIJobHandle AddJob(MPIJob new_job);
     void WaitAll();
-
-    queue<MPIJob> task_queue_;
+    void WaitJob(const MPIJobHandle& job);
+    void set_max_in_flight(int max_in_flight);
+    void set_allreduce_backend(shared_ptr<AllreduceBackend> backend);
+    void set_gradient_backend(shared_ptr<AllreduceBackend> backend);
+    void RunCall(const boost::function<void()>& call);
+    // Runs a job on backend, blocking the transmission thread.
+    void RunBlockingJob(const MPIJob& job, const MPIJobHandle& handle,
+                        AllreduceBackend* backend);
+    // Marks a job run by the transmission thread itself as done.
+    void FinishBlockingJob(const MPIJobHandle& handle);
+
+    queue<std::pair<MPIJob, MPIJobHandle> > task_queue_;
+    // jobs taken from task_queue_ and not completed yet
+    int num_in_flight_;
+    size_t max_in_flight_;
+    shared_ptr<AllreduceBackend> allreduce_backend_, gradient_backend_;
     mutable mutex queue_mutex_;
     atomic<bool> running_, started_;
     shared_ptr<boost::thread> thread_;
     condition_variable cond_work_;
     condition_variable cond_finish_;
 
+    // owned by the transmission thread
+    std::vector<MPI_Request> requests_;
+    std::vector<MPIJobHandle> request_jobs_;
+
     static shared_ptr<MPIComm> singleton_;
 
 };
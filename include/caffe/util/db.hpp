@@ -20,6 +20,11 @@ class Cursor {
   virtual string key() = 0;
   virtual string value() = 0;
   virtual bool valid() = 0;
+  // Positions the cursor exactly on key; returns false if it is absent.
+  virtual bool SeekToKey(const string& key) = 0;
+  // Points data at the current value without copying it; valid until the
+  // cursor moves.
+  virtual void value_data(const char** data, size_t* size) = 0;
 
   DISABLE_COPY_AND_ASSIGN(Cursor);
 };
@@ -21,6 +21,15 @@ class LevelDBCursor : public Cursor {
   virtual string key() { return iter_->key().ToString(); }
   virtual string value() { return iter_->value().ToString(); }
   virtual bool valid() { return iter_->Valid(); }
+  virtual bool SeekToKey(const string& key) {
+    Seek(key);
+    return iter_->Valid() && iter_->key() == leveldb::Slice(key);
+  }
+  virtual void value_data(const char** data, size_t* size) {
+    leveldb::Slice value = iter_->value();
+    *data = value.data();
+    *size = value.size();
+  }
 
  private:
   leveldb::Iterator* iter_;
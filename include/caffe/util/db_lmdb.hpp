@@ -36,6 +36,25 @@ class LMDBCursor : public Cursor {
         mdb_value_.mv_size);
   }
   virtual bool valid() { return valid_; }
+  virtual bool SeekToKey(const string& key) {
+    MDB_val mdb_key;
+    mdb_key.mv_data = const_cast<char*>(key.data());
+    mdb_key.mv_size = key.size();
+    int mdb_status = mdb_cursor_get(mdb_cursor_, &mdb_key, &mdb_value_,
+                                    MDB_SET_KEY);
+    if (mdb_status == MDB_NOTFOUND) {
+      valid_ = false;
+    } else {
+      MDB_CHECK(mdb_status);
+      mdb_key_ = mdb_key;
+      valid_ = true;
+    }
+    return valid_;
+  }
+  virtual void value_data(const char** data, size_t* size) {
+    *data = static_cast<const char*>(mdb_value_.mv_data);
+    *size = mdb_value_.mv_size;
+  }
 
  private:
   void Seek(MDB_cursor_op op) {
@@ -0,0 +1,84 @@
+#ifndef CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+#define CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+
+#include <cstddef>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Keeps the host memory SyncedMemory frees for the next allocation of
+ *        about the same size, so that blobs reshaped over and over, e.g. with
+ *        the input sizes of a net, do not churn and fragment the heap.
+ *
+ * Sizes are rounded up to size classes, four per power of two, and the free
+ * blocks of each class are cached up to cache_limit() bytes in all, the
+ * largest cached blocks making room for the one just freed. Blocks
+ * are kAlignment-byte aligned; with huge pages on, blocks of kHugePageSize
+ * and more are aligned to it and advised to be backed by transparent huge
+ * pages. The methods may be called from several threads at once.
+ */
+class HostAllocator {
+ public:
+  static const size_t kAlignment = 64;
+  static const size_t kHugePageSize = 2 << 20;
+  /// Enough for the scratch of a few reshapes, however many sizes a run
+  /// goes through.
+  static const size_t kDefaultCacheLimit = 256 << 20;
+
+  struct Stats {
+    /// Bytes of the blocks allocated and not freed, by size class.
+    size_t in_use;
+    /// Bytes of the free blocks cached.
+    size_t cached;
+    /// The most bytes in use and cached at once.
+    size_t peak;
+    /// Allocations so far, and those served from the cache.
+    size_t num_allocs;
+    size_t num_cache_hits;
+  };
+
+  HostAllocator();
+  /// Frees the cached blocks; those in use must not be freed afterwards.
+  ~HostAllocator();
+
+  /// Never NULL: fails, after freeing the cache and trying again, if the
+  /// system has no memory left.
+  void* Allocate(size_t size);
+  /// ptr must come from Allocate, or be NULL.
+  void Free(void* ptr);
+  /// Returns the cached blocks to the system.
+  void ReleaseCache();
+
+  Stats stats() const;
+  inline size_t cache_limit() const { return cache_limit_; }
+  /// Frees cached blocks down to the limit; 0 turns caching off.
+  void set_cache_limit(size_t cache_limit);
+  inline bool huge_pages() const { return huge_pages_; }
+  void set_huge_pages(bool huge_pages) { huge_pages_ = huge_pages; }
+
+  /// The size of the blocks Allocate(size) returns.
+  static size_t SizeClass(size_t size);
+
+ protected:
+  /// Frees cached blocks, largest classes first, until at most max_cached
+  /// bytes are left; the lock is held.
+  void TrimCache(size_t max_cached);
+  void* NewBlock(size_t size) const;
+
+  /// Moved out as in ThreadPool, to keep boost/thread.hpp out of headers;
+  /// also holds the blocks.
+  class sync;
+
+  shared_ptr<sync> sync_;
+  Stats stats_;
+  size_t cache_limit_;
+  bool huge_pages_;
+
+  DISABLE_COPY_AND_ASSIGN(HostAllocator);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HOST_ALLOCATOR_HPP_
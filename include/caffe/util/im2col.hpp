@@ -15,6 +15,21 @@ void col2im_cpu(const Dtype* data_col, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, Dtype* data_im);
 
+// Like im2col_cpu and col2im_cpu, but with the rows of data_col col_ld apart,
+// so that the columns of several images can sit side by side. Stride 1, and
+// 1x1 kernels in particular, copy whole runs rather than single elements.
+template <typename Dtype>
+void im2col_ld_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int col_ld, Dtype* data_col);
+
+template <typename Dtype>
+void col2im_ld_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int col_ld, Dtype* data_im);
+
 template <typename Dtype>
 void im2col_gpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
@@ -11,6 +11,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/video_pack.hpp"
 
 #define HDF5_NUM_DIMS 4
 
@@ -95,6 +96,55 @@ bool ReadImageToDatum(const string& filename, const int label,
     const int height, const int width, const bool is_color,
     const std::string & encoding, Datum* datum);
 
+/**
+ * @brief Receives the decoded frames of a video segment read by
+ *        ReadSegmentFrames(), in the channel order of ReadSegment*ToDatum.
+ */
+class SegmentFrameSink {
+ public:
+  virtual ~SegmentFrameSink() {}
+  /// Called once, before the first frame, with the geometry of the segment.
+  virtual void Reshape(const int channels, const int height, const int width) = 0;
+  /// Receives the 8-bit frame holding channels first_channel to
+  /// first_channel + frame.channels() - 1; it is only valid during the call.
+  virtual void AddFrame(const cv::Mat& frame, const int first_channel) = 0;
+  /// If true, frames are handed over as decoded, and the sink resamples them
+  /// to the height and width given to Reshape() itself.
+  virtual bool resizes_frames() const { return false; }
+};
+
+/// Packs the frames it receives into the uint8 data of a Datum.
+class DatumFrameSink : public SegmentFrameSink {
+ public:
+  DatumFrameSink(const int label, Datum* datum)
+      : label_(label), datum_(datum) {}
+  virtual void Reshape(const int channels, const int height, const int width);
+  virtual void AddFrame(const cv::Mat& frame, const int first_channel);
+
+ private:
+  int label_;
+  Datum* datum_;
+};
+
+/**
+ * @brief Reads the rgb_length RGB frames, then the flow_length flow_x/flow_y
+ *        pairs following each of the offsets, resized to height x width if
+ *        both are given, into sink. RGB frames come from
+ *        rgb_folder/image_%04d.jpg and flow ones from flow_folder; a zero
+ *        length skips that modality.
+ */
+bool ReadSegmentFrames(const string& rgb_folder, const string& flow_folder,
+    const vector<int>& offsets, const int height, const int width,
+    const int rgb_length, const int flow_length, const bool is_color,
+    SegmentFrameSink* sink);
+
+/// Same as above, reading from packed videos or a video db; a video may be
+/// NULL when its length is zero.
+bool ReadSegmentFrames(const EncodedVideo* rgb_video,
+    const EncodedVideo* flow_video, const vector<int>& offsets,
+    const int height, const int width, const int rgb_length,
+    const int flow_length, const bool is_color, SegmentFrameSink* sink);
+
 bool ReadSegmentFlowToDatum(const string& filename, const int label,
     const vector<int> offsets, const int height, const int width, const int length, Datum* datum);
 
@@ -104,6 +154,17 @@ bool ReadSegmentRGBToDatum(const string& filename, const int label,
 bool ReadSegmentRGBFlowToDatum(const vector<string>& root_folders, const string& filename, const int label,
     const vector<int> offsets, const int height, const int width, const vector<int> &length, Datum* datum, bool is_color);
 
+// Same as above, reading the encoded frames from packed videos or a video db
+// (see EncodedVideo) instead of one file per frame.
+bool ReadSegmentFlowToDatum(const EncodedVideo& video, const int label,
+    const vector<int> offsets, const int height, const int width, const int length, Datum* datum);
+
+bool ReadSegmentRGBToDatum(const EncodedVideo& video, const int label,
+    const vector<int> offsets, const int height, const int width, const int length, Datum* datum, bool is_color);
+
+bool ReadSegmentRGBFlowToDatum(const EncodedVideo& rgb_video, const EncodedVideo& flow_video, const int label,
+    const vector<int> offsets, const int height, const int width, const vector<int> &length, Datum* datum, bool is_color);
+
 template <typename Dtype>
 bool ReadROI(const string roi_file, Blob<Dtype> &roi, const int id);
 
@@ -5,24 +5,98 @@
 #ifndef CAFFE_MPI_FUNCTIONS_HPP
 #define CAFFE_MPI_FUNCTIONS_HPP
 
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+
 namespace caffe {
+  // Completion and timing of an MPI job, see util/channel.hpp.
+  class MPIJobStatus;
+  typedef shared_ptr<MPIJobStatus> MPIJobHandle;
+
+  // The caffe_i* functions queue a collective and return at once; the
+  // returned handle can be waited on with mpi_wait.
   template <typename Dtype>
-  void caffe_iallreduce(Dtype* data, int count);
+  MPIJobHandle caffe_iallreduce(Dtype* data, int count);
 
   template <typename Dtype>
-  void caffe_iallreduce(Dtype* src_data, Dtype* dst_data, int count);
+  MPIJobHandle caffe_iallreduce(Dtype* src_data, Dtype* dst_data, int count);
 
+  // Sums a gradient in place, with the compression the solver was set up
+  // with, if any.
   template <typename Dtype>
-  void caffe_iallgather(Dtype* src_data, Dtype* dst_data, int count);
+  MPIJobHandle caffe_iallreduce_gradient(Dtype* data, int count);
 
   template <typename Dtype>
-  void caffe_iscatter(Dtype* src_data, Dtype* dst_data, int count);
+  MPIJobHandle caffe_iallgather(Dtype* src_data, Dtype* dst_data, int count);
 
   template <typename Dtype>
-  void caffe_ibcast(Dtype* data, int count);
+  MPIJobHandle caffe_iscatter(Dtype* src_data, Dtype* dst_data, int count);
 
+  template <typename Dtype>
+  MPIJobHandle caffe_ibcast(Dtype* data, int count);
+
+  // Waits for one job.
+  void mpi_wait(const MPIJobHandle& job);
+  // Waits for all the jobs queued so far.
   void mpi_force_synchronize();
 
+  /**
+   * @brief Packs the gradients handed over during the backward pass into
+   *        buckets of a fixed size, so that the many small blobs of a net
+   *        (biases, BN scales and shifts) are summed across ranks by a few
+   *        large allreduces instead of one each.
+   *
+   * A bucket is sent as soon as it is full, so communication still overlaps
+   * the rest of the backward pass. Blobs at least as large as a bucket are
+   * sent on their own, in place.
+   */
+  template <typename Dtype>
+  class GradientBuckets {
+   public:
+    explicit GradientBuckets(size_t bucket_bytes);
+
+    /// Sums diff across ranks: now if it is large, else with its bucket.
+    /// With a bucket_bytes of 0 every blob is summed on its own.
+    /// diff must not change until Finish().
+    void Add(Dtype* diff, int count);
+    /// Sends the partly filled bucket.
+    void Flush();
+    /// Waits for all the sums and copies the bucketed ones back to their
+    /// blobs; the buckets are then reused by the next iteration.
+    void Finish();
+
+    /// Number of sums issued since the last Finish(), bucketed or not.
+    int num_sums() const { return jobs_.size(); }
+    /// Seconds from the start of the first sum to the end of the last one,
+    /// as of the last Finish().
+    double comm_seconds() const { return comm_seconds_; }
+    /// Seconds the last Finish() blocked waiting for them; the rest of
+    /// comm_seconds() was hidden behind the backward pass.
+    double wait_seconds() const { return wait_seconds_; }
+
+   private:
+    struct Bucket {
+      explicit Bucket(int size) : data(size), used(0) {}
+      vector<Dtype> data;
+      // the diff and count of each blob packed in data, in order
+      vector<std::pair<Dtype*, int> > blobs;
+      int used;
+    };
+
+    int bucket_count_;
+    // buckets_[current_] is being filled, those before it were sent
+    vector<shared_ptr<Bucket> > buckets_;
+    int current_;
+    // the sums issued since the last Finish()
+    vector<MPIJobHandle> jobs_;
+    double comm_seconds_, wait_seconds_;
+
+    DISABLE_COPY_AND_ASSIGN(GradientBuckets);
+  };
+
 
 }
 
@@ -0,0 +1,53 @@
+#ifndef CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
+#define CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
+
+#include <string>
+
+#include "google/protobuf/message.h"
+
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+using ::google::protobuf::Message;
+
+/**
+ * @brief Writes snapshots on a background thread, so that training goes on
+ *        while they are serialized and written to disk.
+ *
+ * Files are written in the order given, each under a temporary name renamed
+ * into place once complete, so that an interrupted write never leaves a
+ * truncated snapshot behind.
+ */
+class SnapshotWriter : public InternalThread {
+ public:
+  /// At most max_pending files wait to be written; Write blocks beyond.
+  explicit SnapshotWriter(int max_pending);
+  virtual ~SnapshotWriter();
+
+  /// Writes proto, which must not change any more, to filename.
+  void Write(shared_ptr<Message> proto, const string& filename);
+  /// Blocks until all the files given to Write are in place.
+  void WaitAll();
+
+  struct Job {
+    shared_ptr<Message> proto;
+    string filename;
+  };
+
+ protected:
+  virtual void InternalThreadEntry();
+
+  const int max_pending_;
+  // a token for every free slot
+  BlockingQueue<int> free_;
+  BlockingQueue<Job*> pending_;
+
+  DISABLE_COPY_AND_ASSIGN(SnapshotWriter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
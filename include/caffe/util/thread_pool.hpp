@@ -0,0 +1,55 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_HPP_
+#define CAFFE_UTIL_THREAD_POOL_HPP_
+
+#include <boost/function.hpp>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace boost { class thread; }
+
+namespace caffe {
+
+/**
+ * @brief A fixed group of threads that help whoever calls ParallelFor, kept
+ *        alive between calls so that one costs a wake-up rather than thread
+ *        creation.
+ */
+class ThreadPool {
+ public:
+  /// Up to num_threads threads, the calling one included, work on a call.
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  inline int num_threads() const { return num_threads_; }
+  /**
+   * @brief Calls body(i, slot) for every i in [0, n), and returns once all
+   *        are done.
+   *
+   * The calling thread works through the items along with the threads of
+   * the pool that are idle, each taking the next item not taken yet. slot,
+   * below num_threads(), tells apart the threads working on the same call,
+   * e.g. to give each a buffer of its own; the calling thread is slot 0.
+   * Several threads may call ParallelFor at once, and body may call it too:
+   * the calls share the threads of the pool.
+   */
+  void ParallelFor(int n, const boost::function<void(int, int)>& body);
+
+ protected:
+  void WorkerEntry();
+
+  /// Moved out as in BlockingQueue, to keep boost/thread.hpp out of headers;
+  /// also holds the calls in progress.
+  class sync;
+
+  const int num_threads_;
+  shared_ptr<sync> sync_;
+  vector<shared_ptr<boost::thread> > workers_;
+
+  DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_HPP_
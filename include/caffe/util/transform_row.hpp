@@ -0,0 +1,38 @@
+#ifndef CAFFE_UTIL_TRANSFORM_ROW_HPP_
+#define CAFFE_UTIL_TRANSFORM_ROW_HPP_
+
+#include <stdint.h>
+
+namespace caffe {
+
+// Implementations of caffe_cpu_transform_row<float>; the best one the CPU
+// supports is picked at startup.
+enum TransformRowISA {
+  TRANSFORM_ROW_SCALAR = 0,
+  TRANSFORM_ROW_SSE2 = 1,
+  TRANSFORM_ROW_AVX2 = 2
+};
+
+/**
+ * @brief Converts one row of width 8-bit pixels, read every stride bytes
+ *        from src, to dst[i] = (p - m + offset) * scale, where p is the i-th
+ *        pixel (255 - pixel if invert) and m is mean_row[i], or mean_value if
+ *        mean_row is NULL. With mirror the row is written right to left.
+ *
+ * This is the inner loop of DataTransformer for 8-bit data.
+ */
+template <typename Dtype>
+void caffe_cpu_transform_row(const int width, const uint8_t* src,
+    const int stride, const Dtype* mean_row, const Dtype mean_value,
+    const Dtype offset, const Dtype scale, const bool invert, const bool mirror,
+    Dtype* dst);
+
+TransformRowISA caffe_transform_row_isa();
+// Forces an implementation, e.g. to benchmark them against each other;
+// returns false, leaving the current one, if the CPU does not support it.
+bool caffe_set_transform_row_isa(const TransformRowISA isa);
+const char* caffe_transform_row_isa_name(const TransformRowISA isa);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_TRANSFORM_ROW_HPP_
@@ -0,0 +1,63 @@
+#ifndef CAFFE_UTIL_VIDEO_DB_HPP_
+#define CAFFE_UTIL_VIDEO_DB_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/db.hpp"
+#include "caffe/util/video_pack.hpp"
+
+namespace caffe {
+
+/**
+ * Layout of a video db:
+ *
+ *     "#count"                       number of videos, in decimal
+ *     "v%08d"  video index           serialized VideoRecord
+ *     "f%08d%c%06d"  index, stream, frame_id
+ *                                    encoded frame, stream being 'i' for
+ *                                    images and 'x'/'y' for flow
+ *
+ * Keys sort by video index, so a contiguous range of indices is a contiguous
+ * key range, which is how the data is sharded across MPI ranks.
+ */
+extern const char kVideoCountKey[];
+string VideoRecordKey(int index);
+string VideoFrameKey(int index, EncodedVideo::Stream stream, int frame_id);
+
+/// Reads the number of videos stored in the db; dies if it is not a video db.
+int ReadVideoCount(db::Cursor* cursor);
+/// Stores the number of videos, once they are all written.
+void WriteVideoCount(int count, db::Transaction* txn);
+
+/**
+ * @brief Stores video index: the given encoded frame files, listed per stream
+ *        in frame order, and record with their numbers set. Streams may be
+ *        left empty. Nothing is stored if a file cannot be read.
+ */
+bool WriteVideoToDB(const vector<vector<string> >& frame_files, int index,
+    VideoRecord* record, db::Transaction* txn);
+
+/**
+ * @brief The frames of one video of a video db, read without copy through a
+ *        cursor which must not be shared with other threads.
+ */
+class DBVideo : public EncodedVideo {
+ public:
+  DBVideo(db::Cursor* cursor, int index, const string& name)
+      : cursor_(cursor), index_(index), name_(name) {}
+
+  virtual bool Frame(Stream stream, int frame_id, const char** data,
+      size_t* size) const;
+  virtual string name() const { return name_; }
+
+ private:
+  db::Cursor* cursor_;
+  int index_;
+  string name_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_VIDEO_DB_HPP_
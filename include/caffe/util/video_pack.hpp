@@ -0,0 +1,98 @@
+#ifndef CAFFE_UTIL_VIDEO_PACK_HPP_
+#define CAFFE_UTIL_VIDEO_PACK_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief The encoded frames of one video, numbered from 1 within each stream
+ *        as in the image_%04d.jpg / flow_x_%04d.jpg folders produced by the
+ *        extraction tools.
+ */
+class EncodedVideo {
+ public:
+  enum Stream {
+    IMAGE = 0,
+    FLOW_X = 1,
+    FLOW_Y = 2,
+    NUM_STREAMS = 3
+  };
+
+  EncodedVideo() {}
+  virtual ~EncodedVideo() {}
+
+  /// Points data at the encoded bytes of frame frame_id (1-based); they stay
+  /// valid until the next call.
+  virtual bool Frame(Stream stream, int frame_id, const char** data,
+      size_t* size) const = 0;
+  /// Identifies the video in log messages.
+  virtual string name() const = 0;
+
+  DISABLE_COPY_AND_ASSIGN(EncodedVideo);
+};
+
+/**
+ * @brief Read-only view of a packed video: all the encoded frames of one
+ *        video (RGB images and flow_x/flow_y fields) in a single file.
+ *
+ * The file holds a fixed header, an index and the concatenated encoded
+ * frames, all integers little-endian:
+ *
+ *     char[4]  magic "CVPK"
+ *     uint32   version
+ *     uint32   number of frames of each stream (IMAGE, FLOW_X, FLOW_Y)
+ *     then for every frame of every stream, in stream order:
+ *     uint64   offset of the frame from the start of the file
+ *     uint64   size of the frame in bytes
+ *     then the frames themselves.
+ *
+ * Open() maps the whole file, so reading a segment costs a single open per
+ * video instead of one per frame.
+ */
+class VideoPack : public EncodedVideo {
+ public:
+  VideoPack();
+  virtual ~VideoPack();
+
+  /// Maps the pack at filename; returns false if it is missing or malformed.
+  bool Open(const string& filename);
+  void Close();
+  bool is_open() const { return data_ != NULL; }
+  const string& filename() const { return filename_; }
+
+  int num_frames(Stream stream) const { return num_frames_[stream]; }
+  virtual bool Frame(Stream stream, int frame_id, const char** data,
+      size_t* size) const;
+  virtual string name() const { return filename_; }
+
+  static const char kMagic[4];
+  static const uint32_t kVersion = 1;
+
+ private:
+  string filename_;
+  const char* data_;
+  size_t size_;
+  uint32_t num_frames_[NUM_STREAMS];
+  // index_[stream][frame_id - 1] = (offset, size)
+  vector<vector<std::pair<uint64_t, uint64_t> > > index_;
+
+  DISABLE_COPY_AND_ASSIGN(VideoPack);
+};
+
+/**
+ * @brief Writes a pack holding the given encoded frame files, listed per
+ *        stream in frame order. Streams may be left empty.
+ */
+bool WriteVideoPack(const vector<vector<string> >& frame_files,
+    const string& pack_file);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_VIDEO_PACK_HPP_
@@ -0,0 +1,134 @@
+#ifndef CAFFE_UTIL_VIDEO_PREDICTOR_HPP_
+#define CAFFE_UTIL_VIDEO_PREDICTOR_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/video_pack.hpp"
+
+namespace caffe {
+
+/**
+ * @brief How the input of one net of a VideoPredictor is sampled from a
+ *        video, as in action_python/Video{Spatial,Temporal}Prediction.py.
+ *
+ * num_samples snippets of length RGB frames, or flow_x/flow_y pairs, are
+ * taken over the video and resized to height x width. Each snippet is cut
+ * into the ten crops of the net input size: the four corners and the
+ * center, as with fix_crop, plain and mirrored. A mirrored flow_x field is
+ * inverted, as the VideoData layer does.
+ */
+struct VideoModality {
+  VideoModality()
+      : flow(false), length(1), num_samples(25), height(256), width(340),
+        packed(false), weight(1) {}
+
+  bool flow;
+  int length;
+  int num_samples;
+  int height;
+  int width;
+  /// Holds the frame folder of every video, or its .vpk pack with packed.
+  string root;
+  bool packed;
+  /// Subtracted from each channel of a snippet, one value for all of them
+  /// or one per channel.
+  vector<float> mean_values;
+  /// Or a BlobProto of the snippet channels, of the net input size or of
+  /// height x width, subtracted at the crop.
+  string mean_file;
+  /// The blob of the net holding the class scores.
+  string score_blob;
+  /// The weight of the modality in the fused prediction.
+  float weight;
+};
+
+/**
+ * @brief Predicts the class of videos with one TEST net per modality, e.g.
+ *        the spatial and the temporal nets of a two-stream model.
+ *
+ * The scores of every net are averaged over all the crops of all the
+ * snippets, turned into probabilities by a softmax and averaged over the
+ * modalities by weight. The snippets are decoded as 8-bit frames on an
+ * internal thread, spread over Caffe::thread_pool(), while the nets run on
+ * the videos before; the crops are only cut, and the mean subtracted, into
+ * the input blob of a net, a batch of its input size at a time.
+ */
+template <typename Dtype>
+class VideoPredictor : public InternalThread {
+ public:
+  /// Each net takes a single input, the crops of its modality.
+  VideoPredictor(const vector<VideoModality>& modalities,
+      const vector<shared_ptr<Net<Dtype> > >& nets, int prefetch = 2);
+  virtual ~VideoPredictor();
+
+  /**
+   * @brief Predicts the videos in order; scores[i] gets the fused class
+   *        probabilities of video i, or is left empty if its frames could
+   *        not be read.
+   *
+   * A video is given by its name under the root of every modality and its
+   * number of frames, which is counted from its frames when 0.
+   */
+  void Predict(const vector<std::pair<string, int> >& videos,
+      vector<vector<Dtype> >* scores);
+
+  /// The frame offsets of the snippets of a video of num_frames frames,
+  /// spread as by the Python scripts.
+  static vector<int> SnippetOffsets(const VideoModality& modality,
+      int num_frames);
+
+ protected:
+  /// The snippets of one video, as 8-bit channel planes of height x width.
+  struct DecodedVideo {
+    int index;
+    bool ok;
+    /// frames[m] holds the num_samples snippets of modality m.
+    vector<vector<uint8_t> > frames;
+    // only while decoding
+    vector<vector<int> > offsets;
+    vector<shared_ptr<VideoPack> > packs;
+    vector<int> snippet_ok;
+  };
+
+  virtual void InternalThreadEntry();
+  bool Decode(const std::pair<string, int>& video, DecodedVideo* decoded);
+  /// Decodes snippet job, counted over all the modalities, on the pool.
+  void DecodeSnippet(const string* name, DecodedVideo* decoded, int job,
+      int thread_id);
+  /// Runs the nets on the crops of a decoded video into scores.
+  void ForwardVideo(const DecodedVideo& decoded, vector<Dtype>* scores);
+  /// Cuts crop item, counted from first_item, of modality m into input.
+  void FillCrop(const DecodedVideo* decoded, int m, int first_item,
+      Dtype* input, int item, int thread_id);
+
+  vector<VideoModality> modalities_;
+  vector<shared_ptr<Net<Dtype> > > nets_;
+  /// The channels of a snippet, and the batch size of each net.
+  vector<int> channels_;
+  vector<int> batch_sizes_;
+  /// The crop offsets of the net input in a frame, as (h_off, w_off).
+  vector<vector<pair<int, int> > > crop_offsets_;
+  vector<shared_ptr<Blob<Dtype> > > means_;
+
+  /// The videos of the Predict call in progress.
+  const vector<std::pair<string, int> >* videos_;
+  /// A ring of decoded videos handed between the threads by slot index.
+  vector<DecodedVideo> slots_;
+  BlockingQueue<int> free_;
+  BlockingQueue<int> full_;
+
+  DISABLE_COPY_AND_ASSIGN(VideoPredictor);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_VIDEO_PREDICTOR_HPP_
@@ -0,0 +1,94 @@
+#ifndef CAFFE_UTIL_WEIGHT_PACK_HPP_
+#define CAFFE_UTIL_WEIGHT_PACK_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Read-only view of a weight pack: the parameter blobs of a net, as
+ *        in a .caffemodel, laid out to be mapped and copied from directly.
+ *
+ * The file holds a fixed header, an index and the blob payloads, all
+ * integers little-endian:
+ *
+ *     char[4]  magic "CWPK"
+ *     uint32   version
+ *     uint32   number of layers
+ *     then for every layer:
+ *     uint32   length of the layer name, followed by the name
+ *     uint32   check_shape of the layer (0 or 1)
+ *     uint32   number of blobs
+ *     then for every blob of the layer:
+ *     uint32   1 if the shape comes from the deprecated 4D fields, else 0
+ *     uint32   number of axes, followed by the int32 dimensions
+ *     uint64   offset of the data from the start of the file
+ *     then the data of every blob as float32, each starting at a multiple of
+ *     kAlignment bytes.
+ *
+ * Open() maps the whole file and only parses the index, so loading a net
+ * from a pack is a single copy from the page cache into the blobs, without
+ * the size limits and the parse of the protobuf path.
+ */
+class WeightPack {
+ public:
+  struct BlobEntry {
+    vector<int> shape;
+    // shape is (num, channels, height, width) of a legacy BlobProto
+    bool legacy;
+    int count;
+    // points into the mapping
+    const float* data;
+  };
+  struct LayerEntry {
+    string name;
+    bool check_shape;
+    vector<BlobEntry> blobs;
+  };
+
+  WeightPack();
+  ~WeightPack();
+
+  /// Maps the pack at filename; returns false if it is missing or malformed.
+  bool Open(const string& filename);
+  void Close();
+  bool is_open() const { return data_ != NULL; }
+  const string& filename() const { return filename_; }
+
+  const vector<LayerEntry>& layers() const { return layers_; }
+  /// A BlobProto with the shape of entry but no data, for Blob::ShapeEquals.
+  static BlobProto ShapeProto(const BlobEntry& entry);
+  /// Copies the layers into param->layer(), with only names and blobs set.
+  void ToProto(NetParameter* param) const;
+
+  static const char kMagic[4];
+  static const uint32_t kVersion = 1;
+  static const size_t kAlignment = 64;
+
+ private:
+  string filename_;
+  const char* data_;
+  size_t size_;
+  vector<LayerEntry> layers_;
+
+  DISABLE_COPY_AND_ASSIGN(WeightPack);
+};
+
+/// Returns true if filename starts like a weight pack.
+bool IsWeightPack(const string& filename);
+
+/**
+ * @brief Writes the blobs of the layers of param, typically read from a
+ *        .caffemodel, to a weight pack. Diffs are dropped.
+ */
+bool WriteWeightPack(const NetParameter& param, const string& pack_file);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WEIGHT_PACK_HPP_
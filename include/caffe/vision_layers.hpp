@@ -38,16 +38,21 @@ public:
 
 protected:
 	// Helper functions that abstract away the column buffer and gemm arguments.
-	// The last argument in forward_cpu_gemm is so that we can skip the im2col if
-	// we just called weight_cpu_gemm with the same input.
+	// The skip_im2col argument in forward_cpu_gemm is so that we can skip the
+	// im2col if we just called weight_cpu_gemm with the same input. Calls
+	// running at once on the threads of Caffe::thread_pool() each pass their
+	// slot as thread_id, to get a column buffer of their own.
 	void forward_cpu_gemm(const Dtype* input, const Dtype* weights,
-			Dtype* output, bool skip_im2col = false);
+			Dtype* output, bool skip_im2col = false, int thread_id = 0);
 	void forward_cpu_bias(Dtype* output, const Dtype* bias);
 	void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
-			Dtype* output);
+			Dtype* output, int thread_id = 0);
 	void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
-			weights);
+			weights, int thread_id = 0);
 	void backward_cpu_bias(Dtype* bias, const Dtype* input);
+	// Gives each of the num_threads slots of a pool a column buffer; call it
+	// with the pool a ParallelFor over the images is about to run on.
+	void ReserveColBuffers(const int num_threads);
 
 #ifndef CPU_ONLY
 	void forward_gpu_gemm(const Dtype* col_input, const Dtype* weights,
@@ -109,7 +114,15 @@ private:
 	int col_offset_;
 	int output_offset_;
 
+	// the column buffer of thread 0, and of the GPU
 	Blob<Dtype> col_buffer_;
+	// those of the other threads of Caffe::thread_pool(), sized in Reshape and
+	// grown by ReserveColBuffers() if the pool has grown since
+	vector<shared_ptr<Blob<Dtype> > > thread_col_buffers_;
+	inline Blob<Dtype>* col_buffer(int thread_id) {
+		CHECK_LE(thread_id, thread_col_buffers_.size());
+		return thread_id == 0 ? &col_buffer_ : thread_col_buffers_[thread_id - 1].get();
+	}
 	Blob<Dtype> bias_multiplier_;
 };
 
@@ -157,8 +170,9 @@ public:
 	 *  first group and input channels 3-4 and output channels 5-8 into the second
 	 *  group.
 	 *  - bias_term (\b optional, default true). Whether to have a bias.
-	 *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
-	 *    kernels + stream parallelism) engines.
+	 *  - engine: convolution has CAFFE (matrix multiplication), BATCHED (matrix
+	 *    multiplication over several images at once, on the CPU) and CUDNN
+	 *    (library kernels + stream parallelism) engines.
 	 */
 	explicit ConvolutionLayer(const LayerParameter& param)
 	: BaseConvolutionLayer<Dtype>(param) {}
@@ -176,6 +190,68 @@ protected:
 			const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 	virtual inline bool reverse_dimensions() { return false; }
 	virtual void compute_output_shape();
+
+	// The work on image n, run for all images at once on the threads of
+	// Caffe::thread_pool(). weight_dim is the offset of the weights of one
+	// image with dynamic_conv, and 0 otherwise; the gradients are skipped when
+	// weight_diff or bottom_diff is NULL.
+	void forward_cpu_image(const Dtype* bottom_data, const Dtype* weight,
+			int weight_dim, Dtype* top_data, int n, int thread_id);
+	void backward_cpu_image(const Dtype* top_diff, const Dtype* bottom_data,
+			const Dtype* weight, int weight_dim, Dtype* weight_diff,
+			Dtype* bottom_diff, int n, int thread_id);
+};
+
+/**
+ * @brief CPU ConvolutionLayer that lowers several images into one column
+ *        buffer and convolves them with one GEMM per group.
+ *
+ *   The CAFFE engine makes one GEMM of num_output x kernel_dim x
+ *   (height_out * width_out) per image, which is small and makes poor use of
+ *   the caches for small outputs. This engine lays the columns of as many
+ *   images as fit in convolution_param().batched_buffer_mb side by side, so
+ *   that the GEMMs grow with the batch. The lowering and the scatter of the
+ *   outputs are split over the threads of Caffe::thread_pool(); 1x1 kernels
+ *   and stride 1 copy whole rows. Falls back to ConvolutionLayer on the GPU,
+ *   for dynamic_conv, and when only one image fits.
+ */
+template <typename Dtype>
+class BatchedConvolutionLayer : public ConvolutionLayer<Dtype> {
+public:
+	explicit BatchedConvolutionLayer(const LayerParameter& param)
+	: ConvolutionLayer<Dtype>(param) {}
+	virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+			const vector<Blob<Dtype>*>& top);
+
+protected:
+	virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+			const vector<Blob<Dtype>*>& top);
+	virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+			const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+	// Per image b of a batch of batch_num images, run on the threads of the
+	// pool: lower the bottom into, or add the columns back from, column block
+	// b of col_buff; move the top to or from block b of top_buff. The image
+	// pointers are those of the first image of the batch.
+	void im2col_image(const Dtype* bottom_data, Dtype* col_buff, int batch_num,
+			int b, int thread_id);
+	void col2im_image(const Dtype* col_buff, Dtype* bottom_diff, int batch_num,
+			int b, int thread_id);
+	void scatter_top(const Dtype* top_buff, Dtype* top_data, int batch_num,
+			int b, int thread_id);
+	void gather_top(const Dtype* top_diff, Dtype* top_buff, int batch_num,
+			int b, int thread_id);
+
+	// images convolved at once; batching is off with 1
+	int batch_size_;
+	// the rows of the columns of an image, and its output size
+	int col_height_;
+	int spatial_dim_;
+	// col_height_ x (batch_size_ * spatial_dim_)
+	Blob<Dtype> batch_col_buffer_;
+	// num_output_ x (batch_size_ * spatial_dim_)
+	Blob<Dtype> batch_top_buffer_;
+	Blob<Dtype> batch_bias_multiplier_;
 };
 
 /**
@@ -378,6 +454,13 @@ protected:
 			const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 	virtual void WithinChannelBackward(const vector<Blob<Dtype>*>& top,
 			const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+	// The work on image n across channels, run for all images at once on the
+	// threads of Caffe::thread_pool(); buffer is the scratch of thread_id.
+	void CrossChannelForward_cpu_image(const Dtype* bottom_data,
+			Dtype* scale_data, Dtype* buffer, Dtype* top_data, int n, int thread_id);
+	void CrossChannelBackward_cpu_image(const Dtype* top_diff,
+			const Dtype* top_data, const Dtype* bottom_data, const Dtype* scale_data,
+			Dtype* buffer, Dtype* bottom_diff, int n, int thread_id);
 
 	int size_;
 	int pre_pad_;
@@ -529,6 +612,14 @@ protected:
 	virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
 			const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+	// Pool the plane of one (image, channel); the planes are run at once on
+	// the threads of Caffe::thread_pool(). Only one of mask and top_mask is
+	// used, as in Forward_cpu.
+	void Forward_cpu_plane(const Dtype* bottom_data, Dtype* top_data,
+			int* mask, Dtype* top_mask, int plane, int thread_id);
+	void Backward_cpu_plane(const Dtype* top_diff, const int* mask,
+			const Dtype* top_mask, Dtype* bottom_diff, int plane, int thread_id);
+
 	int kernel_h_, kernel_w_;
 	int stride_h_, stride_w_;
 	int pad_h_, pad_w_;
@@ -36,6 +36,23 @@ const int NPY_DTYPE = NPY_FLOAT32;
 void set_mode_cpu() { Caffe::set_mode(Caffe::CPU); }
 void set_mode_gpu() { Caffe::set_mode(Caffe::GPU); }
 
+// The statistics of Caffe::host_allocator(), by name.
+bp::dict HostMemoryStats() {
+  const HostAllocator::Stats stats = Caffe::host_allocator().stats();
+  bp::dict dict;
+  dict["in_use"] = stats.in_use;
+  dict["cached"] = stats.cached;
+  dict["peak"] = stats.peak;
+  dict["num_allocs"] = stats.num_allocs;
+  dict["num_cache_hits"] = stats.num_cache_hits;
+  return dict;
+}
+
+// The MB of freed host memory Caffe::host_allocator() keeps for reuse.
+void set_host_cache_mb(size_t mb) {
+  Caffe::host_allocator().set_cache_limit(mb << 20);
+}
+
 // For convenience, check that input files can be opened, and raise an
 // exception that boost will send to Python if not (caffe could still crash
 // later if the input files are disturbed before they are actually used, but
@@ -99,6 +116,14 @@ void Net_Save(const Net<Dtype>& net, string filename) {
   WriteProtoToBinaryFile(net_param, filename.c_str());
 }
 
+// The recurrent state of one item of the batch, as a handle on its stream.
+vector<shared_ptr<Blob<Dtype> > > Net_SaveRecurrentState(
+    const Net<Dtype>& net, int n) {
+  vector<shared_ptr<Blob<Dtype> > > state;
+  net.SaveRecurrentState(n, &state);
+  return state;
+}
+
 void Net_SetInputArrays(Net<Dtype>* net, bp::object data_obj,
     bp::object labels_obj) {
   // check that this network has an input MemoryDataLayer
@@ -199,6 +224,9 @@ BOOST_PYTHON_MODULE(_caffe) {
   bp::def("set_mode_cpu", &set_mode_cpu);
   bp::def("set_mode_gpu", &set_mode_gpu);
   bp::def("set_device", &Caffe::SetDevice);
+  bp::def("set_num_threads", &Caffe::set_num_threads);
+  bp::def("host_memory_stats", &HostMemoryStats);
+  bp::def("set_host_cache_mb", &set_host_cache_mb);
 
   bp::class_<Net<Dtype>, shared_ptr<Net<Dtype> >, boost::noncopyable >("Net",
     bp::no_init)
@@ -226,7 +254,10 @@ BOOST_PYTHON_MODULE(_caffe) {
         bp::return_value_policy<bp::copy_const_reference>()))
     .def("_set_input_arrays", &Net_SetInputArrays,
         bp::with_custodian_and_ward<1, 2, bp::with_custodian_and_ward<1, 3> >())
-    .def("save", &Net_Save);
+    .def("save", &Net_Save)
+    .def("save_state", &Net_SaveRecurrentState)
+    .def("restore_state", &Net<Dtype>::RestoreRecurrentState)
+    .def("reset_state", &Net<Dtype>::ResetRecurrentState);
 
   bp::class_<Blob<Dtype>, shared_ptr<Blob<Dtype> >, boost::noncopyable>(
     "Blob", bp::no_init)
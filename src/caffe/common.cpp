@@ -1,9 +1,12 @@
+#include <boost/thread/mutex.hpp>
 #include <glog/logging.h>
 #include <cstdio>
 #include <ctime>
 
 #include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -68,6 +71,37 @@ void GlobalInit(int* pargc, char*** pargv) {
 
 }
 
+// guards the swap of the pool against the threads taking it
+static boost::mutex thread_pool_mutex_;
+
+shared_ptr<ThreadPool> Caffe::thread_pool() {
+  boost::mutex::scoped_lock lock(thread_pool_mutex_);
+  if (!Get().thread_pool_) {
+    Get().thread_pool_.reset(new ThreadPool(1));
+  }
+  return Get().thread_pool_;
+}
+
+int Caffe::num_threads() {
+  return thread_pool()->num_threads();
+}
+
+void Caffe::set_num_threads(const int num_threads) {
+  CHECK_GT(num_threads, 0);
+  shared_ptr<ThreadPool> old_pool;
+  boost::mutex::scoped_lock lock(thread_pool_mutex_);
+  if (!Get().thread_pool_ || num_threads != Get().thread_pool_->num_threads()) {
+    // the calls in progress keep the old pool alive until they return
+    old_pool = Get().thread_pool_;
+    Get().thread_pool_.reset(new ThreadPool(num_threads));
+  }
+}
+
+HostAllocator& Caffe::host_allocator() {
+  static HostAllocator* allocator = new HostAllocator();
+  return *allocator;
+}
+
 void GlobalFinalize(){
   //Add something here
 
@@ -8,13 +8,14 @@
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/transform_row.hpp"
 
 namespace caffe {
 
 template<typename Dtype>
 DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
 		Phase phase)
-		: param_(param), phase_(phase) {
+		: param_(param), phase_(phase), item_data_(NULL) {
 	// check if we want to use mean_file
 	if (param_.has_mean_file()) {
 		CHECK_EQ(param_.mean_value_size(), 0) <<
@@ -104,44 +105,31 @@ void fillCropSize(int input_height, int input_width,
 
 
 template<typename Dtype>
-void DataTransformer<Dtype>::Transform(const Datum& datum, Dtype* transformed_data, Blob<Dtype> *roi) {
-
-
-	const string& data = datum.data();
-	const int datum_channels = datum.channels();
-	const int datum_height = datum.height();
-	const int datum_width = datum.width();
-
+void DataTransformer<Dtype>::SampleTransform(const int channels, const int height,
+		const int width, Blob<Dtype>* roi, ItemTransform* item) {
 	const int crop_size = param_.crop_size();
-	const Dtype scale = param_.scale();
 	const bool do_mirror = param_.mirror() && Rand(2);
-	const bool has_mean_file = param_.has_mean_file();
-	const bool has_uint8 = data.size() > 0;
-	const bool has_mean_values = mean_values_.size() > 0;
 	const bool do_multi_scale = param_.multi_scale();
 	vector<pair<int, int> > offset_pairs;
 	vector<pair<int, int> > crop_size_pairs;
-	cv::Mat multi_scale_bufferM;
 
-	CHECK_GT(datum_channels, 0);
-	CHECK(datum_channels > param_.flow_point()) <<
+	CHECK_GT(channels, 0);
+	CHECK(channels > param_.flow_point()) <<
 			"Flow point should be smaller than the number of channels.";
-	CHECK_GE(datum_height, crop_size);
-	CHECK_GE(datum_width, crop_size);
+	CHECK_GE(height, crop_size);
+	CHECK_GE(width, crop_size);
 
-	Dtype* mean = NULL;
-	if (has_mean_file) {
-		CHECK_EQ(datum_channels, data_mean_.channels());
-		CHECK_EQ(datum_height, data_mean_.height());
-		CHECK_EQ(datum_width, data_mean_.width());
-		mean = data_mean_.mutable_cpu_data();
+	if (param_.has_mean_file()) {
+		CHECK_EQ(channels, data_mean_.channels());
+		CHECK_EQ(height, data_mean_.height());
+		CHECK_EQ(width, data_mean_.width());
 	}
-	if (has_mean_values) {
-		CHECK(mean_values_.size() == 1 || mean_values_.size() == datum_channels) <<
-				"Specify either 1 mean_value or as many as channels: " << datum_channels;
-		if (datum_channels > 1 && mean_values_.size() == 1) {
+	if (mean_values_.size() > 0) {
+		CHECK(mean_values_.size() == 1 || mean_values_.size() == channels) <<
+				"Specify either 1 mean_value or as many as channels: " << channels;
+		if (channels > 1 && mean_values_.size() == 1) {
 			// Replicate the mean_value for simplicity
-			for (int c = 1; c < datum_channels; ++c) {
+			for (int c = 1; c < channels; ++c) {
 				mean_values_.push_back(mean_values_[0]);
 			}
 		}
@@ -151,22 +139,21 @@ void DataTransformer<Dtype>::Transform(const Datum& datum, Dtype* transformed_da
 		LOG(ERROR)<< "Multi scale augmentation is only activated with crop_size set.";
 	}
 
-	int height = datum_height;
-	int width = datum_width;
+	int out_height = height;
+	int out_width = width;
 
 	int h_off = 0;
 	int w_off = 0;
 	int crop_height = 0;
 	int crop_width = 0;
-	bool need_imgproc = false;
 	if (crop_size) {
-		height = crop_size;
-		width = crop_size;
+		out_height = crop_size;
+		out_width = crop_size;
 		// We only do random crop when we do training.
 		if (phase_ == TRAIN) {
 			// If in training and we need multi-scale cropping, reset the crop size params
 			if (do_multi_scale){
-				fillCropSize(datum_height, datum_width, crop_size, crop_size, crop_size_pairs,
+				fillCropSize(height, width, crop_size, crop_size, crop_size_pairs,
 						max_distort_, custom_scale_ratios_);
 				int sel = Rand(crop_size_pairs.size());
 				crop_height = crop_size_pairs[sel].first;
@@ -176,20 +163,20 @@ void DataTransformer<Dtype>::Transform(const Datum& datum, Dtype* transformed_da
 				crop_width = crop_size;
 			}
 			if (param_.fix_crop()){
-				fillFixOffset(datum_height, datum_width, crop_height, crop_width, param_.more_fix_crop(), offset_pairs);
+				fillFixOffset(height, width, crop_height, crop_width, param_.more_fix_crop(), offset_pairs);
 				int sel = Rand(offset_pairs.size());
 				h_off = offset_pairs[sel].first;
 				w_off = offset_pairs[sel].second;
 			}else{
-				h_off = Rand(datum_height - crop_height + 1);
-				w_off = Rand(datum_width - crop_width + 1);
+				h_off = Rand(height - crop_height + 1);
+				w_off = Rand(width - crop_width + 1);
 			}
 
 		} else {
 			crop_height = crop_size;
 			crop_width = crop_size;
-			h_off = (datum_height - crop_size) / 2;
-			w_off = (datum_width - crop_size) / 2;
+			h_off = (height - crop_size) / 2;
+			w_off = (width - crop_size) / 2;
 		}
 	}
 	if (roi) {
@@ -202,8 +189,8 @@ void DataTransformer<Dtype>::Transform(const Datum& datum, Dtype* transformed_da
 			x2 = std::min(crop_width-1.0f, std::max(0.0f, float(roi_data[p+2])-w_off))*ratio_w;
 			y2 = std::min(crop_height-1.0f, std::max(0.0f, float(roi_data[p+3])-h_off))*ratio_h;
 			if (do_mirror) {
-				x1 = width - 1 - x1;
-				x2 = width - 1 - x2;
+				x1 = out_width - 1 - x1;
+				x2 = out_width - 1 - x2;
 				std::swap(x1, x2);
 			}
 			roi_data[p]= x1;
@@ -213,26 +200,74 @@ void DataTransformer<Dtype>::Transform(const Datum& datum, Dtype* transformed_da
 		}
 	}
 
-	need_imgproc = do_multi_scale && crop_size && ((crop_height != crop_size) || (crop_width != crop_size));
+	item->channels = channels;
+	item->height = height;
+	item->width = width;
+	item->crop_height = crop_height;
+	item->crop_width = crop_width;
+	item->h_off = h_off;
+	item->w_off = w_off;
+	item->out_height = out_height;
+	item->out_width = out_width;
+	item->do_mirror = do_mirror;
+	item->need_imgproc = do_multi_scale && crop_size && ((crop_height != crop_size) || (crop_width != crop_size));
+
+	// drawn last, channel after channel, as the per channel loops used to
+	const int mean_jitter_range = param_.mean_jitter();
+	item->mean_jitter.resize(channels);
+	for (int c = 0; c < channels; ++c) {
+		item->mean_jitter[c] = mean_jitter_range ? Rand(2*mean_jitter_range+1) - mean_jitter_range : 0;
+	}
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const Datum& datum, Dtype* transformed_data, Blob<Dtype> *roi) {
+	const string& data = datum.data();
+	const int datum_channels = datum.channels();
+	const int datum_height = datum.height();
+	const int datum_width = datum.width();
+
+	const int crop_size = param_.crop_size();
+	const Dtype scale = param_.scale();
+	const bool has_mean_file = param_.has_mean_file();
+	const bool has_uint8 = data.size() > 0;
+	const bool do_multi_scale = param_.multi_scale();
+	cv::Mat multi_scale_bufferM;
+
+	SampleTransform(datum_channels, datum_height, datum_width, roi, &item_);
+	const bool has_mean_values = mean_values_.size() > 0;
+	const bool do_mirror = item_.do_mirror;
+	const int height = item_.out_height;
+	const int width = item_.out_width;
+	const int h_off = item_.h_off;
+	const int w_off = item_.w_off;
+	const int crop_height = item_.crop_height;
+	const int crop_width = item_.crop_width;
+	const bool need_imgproc = item_.need_imgproc;
+
+	Dtype* mean = NULL;
+	if (has_mean_file) {
+		mean = data_mean_.mutable_cpu_data();
+	}
 
 	Dtype datum_element;
 	int top_index, data_index;
 	bool is_flow;
 	for (int c = 0; c < datum_channels; ++c) {
+		const int mean_jitter = item_.mean_jitter[c];
 		// image resize etc needed
-    	int mean_jitter_range = param_.mean_jitter();
-    	int mean_jitter = mean_jitter_range ? Rand(2*mean_jitter_range+1) - mean_jitter_range : 0;
-        
 		if (need_imgproc){
-			cv::Mat M(datum_height, datum_width, has_uint8?CV_8UC1:CV_32FC1);
-
-			//put the datum content to a cvMat
-			for (int h = 0; h < datum_height; ++h) {
-				for (int w = 0; w < datum_width; ++w) {
-					int data_index = (c * datum_height + h) * datum_width + w;
-					if (has_uint8) {
-						M.at<uchar>(h, w) = static_cast<uint8_t>(data[data_index]);
-					}else{
+			cv::Mat M;
+			if (has_uint8) {
+				// wrap the channel in place, resize does not write to its input
+				M = cv::Mat(datum_height, datum_width, CV_8UC1,
+						const_cast<char*>(data.data()) + c * datum_height * datum_width);
+			} else {
+				//put the datum content to a cvMat
+				M.create(datum_height, datum_width, CV_32FC1);
+				for (int h = 0; h < datum_height; ++h) {
+					for (int w = 0; w < datum_width; ++w) {
+						int data_index = (c * datum_height + h) * datum_width + w;
 						M.at<float>(h, w) = datum.float_data(data_index);
 					}
 				}
@@ -244,6 +279,26 @@ void DataTransformer<Dtype>::Transform(const Datum& datum, Dtype* transformed_da
 		}
 
 		is_flow = param_.is_flow() || (param_.has_flow() && c >= param_.flow_point());
+		const bool invert = is_flow && do_mirror && (c-param_.flow_point()) % 2 == 0;
+		if (has_uint8) {
+			// 8-bit data goes through the vectorized row kernel
+			const Dtype mean_value = has_mean_values ? mean_values_[c] : Dtype(0);
+			const Dtype mean_offset = (has_mean_file || has_mean_values) ? Dtype(mean_jitter) : Dtype(0);
+			for (int h = 0; h < height; ++h) {
+				const uint8_t* src = need_imgproc ? multi_scale_bufferM.ptr<uint8_t>(h) :
+						reinterpret_cast<const uint8_t*>(data.data()) + (c * datum_height + h_off + h) * datum_width + w_off;
+				const Dtype* mean_row = NULL;
+				if (has_mean_file) {
+					//we will use a fixed position of mean map for multi-scale.
+					mean_row = mean + (do_multi_scale ? (c * datum_height + h) * datum_width :
+							(c * datum_height + h_off + h) * datum_width + w_off);
+				}
+				caffe_cpu_transform_row(width, src, 1, mean_row, mean_value, mean_offset, scale,
+						invert, do_mirror, transformed_data + (c * height + h) * width);
+			}
+			continue;
+		}
+
 		for (int h = 0; h < height; ++h) {
 			for (int w = 0; w < width; ++w) {
 				data_index = (c * datum_height + h_off + h) * datum_width + w_off + w;
@@ -253,30 +308,12 @@ void DataTransformer<Dtype>::Transform(const Datum& datum, Dtype* transformed_da
 					top_index = (c * height + h) * width + w;
 				}
 				if (need_imgproc){
-					if (has_uint8){
-						if (is_flow && do_mirror && (c-param_.flow_point()) % 2 == 0)
-							datum_element = 255 - static_cast<Dtype>(multi_scale_bufferM.at<uint8_t>(h, w));
-						else
-							datum_element = static_cast<Dtype>(multi_scale_bufferM.at<uint8_t>(h, w));
-					}else {
-						if (is_flow && do_mirror && (c-param_.flow_point()) % 2 == 0)
-							datum_element = 255 - static_cast<Dtype>(multi_scale_bufferM.at<float>(h, w));
-						else
-							datum_element = static_cast<Dtype>(multi_scale_bufferM.at<float>(h, w));
-					}
+					datum_element = static_cast<Dtype>(multi_scale_bufferM.at<float>(h, w));
 				}else {
-					if (has_uint8) {
-						if (is_flow && do_mirror && (c-param_.flow_point()) % 2 == 0)
-							datum_element = 255 - static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-						else
-							datum_element = static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-					} else {
-						if (is_flow && do_mirror && (c-param_.flow_point()) % 2 == 0)
-							datum_element = 255 - datum.float_data(data_index);
-						else
-							datum_element = datum.float_data(data_index);
-					}
+					datum_element = datum.float_data(data_index);
 				}
+				if (invert)
+					datum_element = 255 - datum_element;
 				if (has_mean_file) {
 					if (do_multi_scale) {
 						int fixed_data_index = (c * datum_height +  h) * datum_width + w;
@@ -350,6 +387,93 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
 	Transform(datum, transformed_data, roi);
 }
 
+template<typename Dtype>
+void DataTransformer<Dtype>::BeginTransform(const int channels, const int height,
+		const int width, Blob<Dtype>* transformed_blob, Blob<Dtype>* roi) {
+	const int crop_size = param_.crop_size();
+
+	// Check dimensions.
+	CHECK_EQ(transformed_blob->channels(), channels);
+	CHECK_GE(transformed_blob->num(), 1);
+	if (crop_size) {
+		CHECK_EQ(crop_size, transformed_blob->height());
+		CHECK_EQ(crop_size, transformed_blob->width());
+	} else {
+		CHECK_EQ(height, transformed_blob->height());
+		CHECK_EQ(width, transformed_blob->width());
+	}
+
+	SampleTransform(channels, height, width, roi, &item_);
+	item_data_ = transformed_blob->mutable_cpu_data();
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::TransformFrame(const cv::Mat& frame, const int first_channel) {
+	const int frame_channels = frame.channels();
+	CHECK(item_data_) << "BeginTransform has to be called before TransformFrame";
+	CHECK_EQ(frame.depth(), CV_8U) << "Frames have to be 8-bit images";
+	CHECK_GE(first_channel, 0);
+	CHECK_LE(first_channel + frame_channels, item_.channels);
+
+	const Dtype scale = param_.scale();
+	const bool has_mean_file = param_.has_mean_file();
+	const bool has_mean_values = mean_values_.size() > 0;
+	const bool do_multi_scale = param_.multi_scale();
+	const bool do_mirror = item_.do_mirror;
+	const int height = item_.out_height;
+	const int width = item_.out_width;
+	const Dtype* mean = has_mean_file ? data_mean_.cpu_data() : NULL;
+
+	// Crop (and resize) all the channels of the frame at once, then read the
+	// window in place: the window is a view into frame when no resize is needed.
+	cv::Mat window = frame;
+	if (frame.rows != item_.height || frame.cols != item_.width) {
+		// The frame is still to be resized to the item's size. Rather than
+		// resizing the whole frame and then the crop, map the output pixels
+		// back through both resizes and resample the crop window of the
+		// frame only, in a single pass.
+		const int crop_height = item_.crop_height ? item_.crop_height : item_.height;
+		const int crop_width = item_.crop_width ? item_.crop_width : item_.width;
+		const double scale_h = static_cast<double>(frame.rows) / item_.height;
+		const double scale_w = static_cast<double>(frame.cols) / item_.width;
+		cv::Mat output_to_frame(2, 3, CV_64FC1, cv::Scalar(0));
+		output_to_frame.at<double>(0, 0) = scale_w * crop_width / width;
+		output_to_frame.at<double>(0, 2) = (item_.w_off + 0.5 * crop_width / width) * scale_w - 0.5;
+		output_to_frame.at<double>(1, 1) = scale_h * crop_height / height;
+		output_to_frame.at<double>(1, 2) = (item_.h_off + 0.5 * crop_height / height) * scale_h - 0.5;
+		cv::Mat resampled;
+		cv::warpAffine(frame, resampled, output_to_frame, cv::Size(width, height),
+				cv::INTER_LINEAR | cv::WARP_INVERSE_MAP, cv::BORDER_REPLICATE);
+		window = resampled;
+	} else {
+		if (item_.crop_height) {
+			window = frame(cv::Rect(item_.w_off, item_.h_off, item_.crop_width, item_.crop_height));
+		}
+		if (item_.need_imgproc) {
+			cv::Mat resized;
+			cv::resize(window, resized, cv::Size(width, height));
+			window = resized;
+		}
+	}
+
+	for (int k = 0; k < frame_channels; ++k) {
+		const int c = first_channel + k;
+		const bool is_flow = param_.is_flow() || (param_.has_flow() && c >= param_.flow_point());
+		const bool invert = is_flow && do_mirror && (c-param_.flow_point()) % 2 == 0;
+		const Dtype mean_value = has_mean_values ? mean_values_[c] : Dtype(0);
+		const Dtype mean_offset = (has_mean_file || has_mean_values) ? Dtype(item_.mean_jitter[c]) : Dtype(0);
+		for (int h = 0; h < height; ++h) {
+			const Dtype* mean_row = NULL;
+			if (has_mean_file) {
+				mean_row = mean + (do_multi_scale ? (c * item_.height + h) * item_.width :
+						(c * item_.height + item_.h_off + h) * item_.width + item_.w_off);
+			}
+			caffe_cpu_transform_row(width, window.ptr<uchar>(h) + k, frame_channels, mean_row,
+					mean_value, mean_offset, scale, invert, do_mirror, item_data_ + (c * height + h) * width);
+		}
+	}
+}
+
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const vector<Datum> & datum_vector,
 		Blob<Dtype>* transformed_blob) {
@@ -494,47 +618,21 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img, Blob<Dtype>* trans
 	CHECK(cv_cropped_img.data);
 
 	Dtype* transformed_data = transformed_blob->mutable_cpu_data();
-	int top_index;
-	for (int h = 0; h < height; ++h) {
-		const uchar* ptr = cv_cropped_img.ptr<uchar>(h);
-		int img_index = 0;
-		for (int w = 0; w < width; ++w) {
-			for (int c = 0; c < img_channels; ++c) {
-				bool is_flow = param_.is_flow() || (param_.has_flow() && c >= param_.flow_point());
-				if (do_mirror) {
-					top_index = (c * height + h) * width + (width - 1 - w);
-				} else {
-					top_index = (c * height + h) * width + w;
-				}
-				// int top_index = (c * height + h) * width + w;
-				Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
-				if (has_mean_file) {
-					//we will use a fixed position of mean map for multi-scale.
-					int mean_index = (do_multi_scale)?
-							(c * img_height  + h) * img_width +  w
-							:(c * img_height + h_off + h) * img_width +  w_off + w;
-					if (is_flow && do_mirror && (c-param_.flow_point()) % 2 == 0)
-						transformed_data[top_index] =
-								(255 - pixel - mean[mean_index]) * scale;
-					else
-						transformed_data[top_index] =
-								(pixel - mean[mean_index]) * scale;
-				} else {
-					if (has_mean_values) {
-						if (is_flow && do_mirror && (c-param_.flow_point()) % 2 == 0)
-							transformed_data[top_index] =
-									(255 - pixel - mean_values_[c]) * scale;
-						else
-							transformed_data[top_index] =
-									(pixel - mean_values_[c]) * scale;
-					} else {
-						if (is_flow && do_mirror && (c-param_.flow_point()) % 2 == 0)
-							transformed_data[top_index] = (255 - pixel) * scale;
-						else
-							transformed_data[top_index] = pixel * scale;
-					}
-				}
+	for (int c = 0; c < img_channels; ++c) {
+		const bool is_flow = param_.is_flow() || (param_.has_flow() && c >= param_.flow_point());
+		const bool invert = is_flow && do_mirror && (c-param_.flow_point()) % 2 == 0;
+		const Dtype mean_value = has_mean_values ? mean_values_[c] : Dtype(0);
+		for (int h = 0; h < height; ++h) {
+			const uchar* ptr = cv_cropped_img.ptr<uchar>(h) + c;
+			const Dtype* mean_row = NULL;
+			if (has_mean_file) {
+				//we will use a fixed position of mean map for multi-scale.
+				mean_row = mean + ((do_multi_scale)?
+						(c * img_height  + h) * img_width
+						:(c * img_height + h_off + h) * img_width +  w_off);
 			}
+			caffe_cpu_transform_row(width, ptr, img_channels, mean_row, mean_value, Dtype(0),
+					scale, invert, do_mirror, transformed_data + (c * height + h) * width);
 		}
 	}
 	cv_cropped_img.release();
@@ -746,6 +844,17 @@ void DataTransformer<Dtype>::InitRand() {
 	}
 }
 
+template <typename Dtype>
+void DataTransformer<Dtype>::InitRand(const unsigned int seed) {
+	const bool needs_rand = param_.mirror() || param_.mean_jitter() ||
+			(phase_ == TRAIN && param_.crop_size());
+	if (needs_rand) {
+		rng_.reset(new Caffe::RNG(seed));
+	} else {
+		rng_.reset();
+	}
+}
+
 template <typename Dtype>
 int DataTransformer<Dtype>::Rand(int n) {
 	CHECK(rng_);
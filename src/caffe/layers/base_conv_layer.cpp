@@ -185,6 +185,13 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 	} else {
 		col_buffer_.Reshape(1, kernel_dim_, height_out_, width_out_);
 	}
+	thread_col_buffers_.resize(Caffe::num_threads() - 1);
+	for (int t = 0; t < thread_col_buffers_.size(); ++t) {
+		if (thread_col_buffers_[t]) {
+			thread_col_buffers_[t]->ReshapeLike(col_buffer_);
+		}
+	}
+	ReserveColBuffers(Caffe::num_threads());
 	// Set up the all ones "bias multiplier" for adding biases by BLAS
 	if (bias_term_) {
 		vector<int> bias_multiplier_shape(1, height_out_ * width_out_);
@@ -194,15 +201,29 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 	}
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::ReserveColBuffers(const int num_threads) {
+	if (thread_col_buffers_.size() < num_threads - 1) {
+		thread_col_buffers_.resize(num_threads - 1);
+	}
+	for (int t = 0; t < thread_col_buffers_.size(); ++t) {
+		if (!thread_col_buffers_[t]) {
+			thread_col_buffers_[t].reset(new Blob<Dtype>());
+			thread_col_buffers_[t]->ReshapeLike(col_buffer_);
+		}
+	}
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
-		const Dtype* weights, Dtype* output, bool skip_im2col) {
+		const Dtype* weights, Dtype* output, bool skip_im2col, int thread_id) {
 	const Dtype* col_buff = input;
 	if (!is_1x1_) {
+		Blob<Dtype>* col_buffer = this->col_buffer(thread_id);
 		if (!skip_im2col) {
-			conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+			conv_im2col_cpu(input, col_buffer->mutable_cpu_data());
 		}
-		col_buff = col_buffer_.cpu_data();
+		col_buff = col_buffer->cpu_data();
 	}
 	for (int g = 0; g < group_; ++g) {
 		caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
@@ -222,10 +243,10 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
-		const Dtype* weights, Dtype* input) {
-	Dtype* col_buff = col_buffer_.mutable_cpu_data();
-	if (is_1x1_) {
-		col_buff = input;
+		const Dtype* weights, Dtype* input, int thread_id) {
+	Dtype* col_buff = input;
+	if (!is_1x1_) {
+		col_buff = col_buffer(thread_id)->mutable_cpu_data();
 	}
 	for (int g = 0; g < group_; ++g) {
 		caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_ / group_,
@@ -240,11 +261,12 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
-		const Dtype* output, Dtype* weights) {
+		const Dtype* output, Dtype* weights, int thread_id) {
 	const Dtype* col_buff = input;
 	if (!is_1x1_) {
-		conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
-		col_buff = col_buffer_.cpu_data();
+		Blob<Dtype>* col_buffer = this->col_buffer(thread_id);
+		conv_im2col_cpu(input, col_buffer->mutable_cpu_data());
+		col_buff = col_buffer->cpu_data();
 	}
 	for (int g = 0; g < group_; ++g) {
 		caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
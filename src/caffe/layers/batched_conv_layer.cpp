@@ -0,0 +1,191 @@
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/im2col.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void BatchedConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+		const vector<Blob<Dtype>*>& top) {
+	ConvolutionLayer<Dtype>::Reshape(bottom, top);
+	const ConvolutionParameter& conv_param = this->layer_param_.convolution_param();
+	col_height_ = this->channels_ * this->kernel_h_ * this->kernel_w_;
+	spatial_dim_ = this->height_out_ * this->width_out_;
+	// as many images as fit in the budget with their columns and outputs
+	const double image_size = static_cast<double>(col_height_ + this->num_output_)
+			* spatial_dim_ * sizeof(Dtype);
+	const double budget = conv_param.batched_buffer_mb() * 1024. * 1024.;
+	batch_size_ = std::max(1, std::min(this->num_,
+			static_cast<int>(budget / image_size)));
+	if (conv_param.dynamic_conv()) {
+		batch_size_ = 1;
+	}
+	if (batch_size_ == 1) {
+		return;
+	}
+	vector<int> shape(2);
+	shape[0] = col_height_;
+	shape[1] = batch_size_ * spatial_dim_;
+	batch_col_buffer_.Reshape(shape);
+	shape[0] = this->num_output_;
+	batch_top_buffer_.Reshape(shape);
+	if (this->bias_term_) {
+		vector<int> bias_multiplier_shape(1, batch_size_ * spatial_dim_);
+		batch_bias_multiplier_.Reshape(bias_multiplier_shape);
+		caffe_set(batch_bias_multiplier_.count(), Dtype(1),
+				batch_bias_multiplier_.mutable_cpu_data());
+	}
+}
+
+template <typename Dtype>
+void BatchedConvolutionLayer<Dtype>::im2col_image(const Dtype* bottom_data,
+		Dtype* col_buff, int batch_num, int b, int thread_id) {
+	im2col_ld_cpu(bottom_data + b * this->channels_ * this->height_ * this->width_,
+			this->channels_, this->height_, this->width_,
+			this->kernel_h_, this->kernel_w_, this->pad_h_, this->pad_w_,
+			this->stride_h_, this->stride_w_, batch_num * spatial_dim_,
+			col_buff + b * spatial_dim_);
+}
+
+template <typename Dtype>
+void BatchedConvolutionLayer<Dtype>::col2im_image(const Dtype* col_buff,
+		Dtype* bottom_diff, int batch_num, int b, int thread_id) {
+	col2im_ld_cpu(col_buff + b * spatial_dim_,
+			this->channels_, this->height_, this->width_,
+			this->kernel_h_, this->kernel_w_, this->pad_h_, this->pad_w_,
+			this->stride_h_, this->stride_w_, batch_num * spatial_dim_,
+			bottom_diff + b * this->channels_ * this->height_ * this->width_);
+}
+
+template <typename Dtype>
+void BatchedConvolutionLayer<Dtype>::scatter_top(const Dtype* top_buff,
+		Dtype* top_data, int batch_num, int b, int thread_id) {
+	top_buff += b * spatial_dim_;
+	top_data += b * this->num_output_ * spatial_dim_;
+	for (int c = 0; c < this->num_output_; ++c) {
+		caffe_copy(spatial_dim_, top_buff + c * batch_num * spatial_dim_,
+				top_data + c * spatial_dim_);
+	}
+}
+
+template <typename Dtype>
+void BatchedConvolutionLayer<Dtype>::gather_top(const Dtype* top_diff,
+		Dtype* top_buff, int batch_num, int b, int thread_id) {
+	top_buff += b * spatial_dim_;
+	top_diff += b * this->num_output_ * spatial_dim_;
+	for (int c = 0; c < this->num_output_; ++c) {
+		caffe_copy(spatial_dim_, top_diff + c * spatial_dim_,
+				top_buff + c * batch_num * spatial_dim_);
+	}
+}
+
+template <typename Dtype>
+void BatchedConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+		const vector<Blob<Dtype>*>& top) {
+	if (batch_size_ == 1) {
+		ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+		return;
+	}
+	shared_ptr<ThreadPool> pool = Caffe::thread_pool();
+	const int group = this->group_;
+	const int out_channels = this->num_output_ / group;
+	const int col_height = col_height_ / group;
+	const Dtype* weight = this->blobs_[0]->cpu_data();
+	Dtype* col_buff = batch_col_buffer_.mutable_cpu_data();
+	Dtype* top_buff = batch_top_buffer_.mutable_cpu_data();
+	for (int i = 0; i < bottom.size(); ++i) {
+		const Dtype* bottom_data = bottom[i]->cpu_data();
+		Dtype* top_data = top[i]->mutable_cpu_data();
+		for (int n0 = 0; n0 < this->num_; n0 += batch_size_) {
+			const int batch_num = std::min(batch_size_, this->num_ - n0);
+			const int cols = batch_num * spatial_dim_;
+			pool->ParallelFor(batch_num, boost::bind(
+					&BatchedConvolutionLayer<Dtype>::im2col_image, this,
+					bottom_data + bottom[i]->offset(n0), col_buff, batch_num, _1, _2));
+			for (int g = 0; g < group; ++g) {
+				caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, out_channels, cols,
+						col_height, (Dtype)1., weight + g * out_channels * col_height,
+						col_buff + g * col_height * cols, (Dtype)0.,
+						top_buff + g * out_channels * cols);
+			}
+			if (this->bias_term_) {
+				caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, this->num_output_,
+						cols, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
+						batch_bias_multiplier_.cpu_data(), (Dtype)1., top_buff);
+			}
+			pool->ParallelFor(batch_num, boost::bind(
+					&BatchedConvolutionLayer<Dtype>::scatter_top, this, top_buff,
+					top_data + top[i]->offset(n0), batch_num, _1, _2));
+		}
+	}
+}
+
+template <typename Dtype>
+void BatchedConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+		const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+	if (batch_size_ == 1) {
+		ConvolutionLayer<Dtype>::Backward_cpu(top, propagate_down, bottom);
+		return;
+	}
+	shared_ptr<ThreadPool> pool = Caffe::thread_pool();
+	const int group = this->group_;
+	const int out_channels = this->num_output_ / group;
+	const int col_height = col_height_ / group;
+	const Dtype* weight = this->blobs_[0]->cpu_data();
+	Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+	Dtype* col_buff = batch_col_buffer_.mutable_cpu_data();
+	Dtype* top_buff = batch_top_buffer_.mutable_cpu_data();
+	for (int i = 0; i < top.size(); ++i) {
+		const Dtype* top_diff = top[i]->cpu_diff();
+		const Dtype* bottom_data = bottom[i]->cpu_data();
+		Dtype* bottom_diff = propagate_down[i] ? bottom[i]->mutable_cpu_diff() : NULL;
+		for (int n0 = 0; n0 < this->num_; n0 += batch_size_) {
+			const int batch_num = std::min(batch_size_, this->num_ - n0);
+			const int cols = batch_num * spatial_dim_;
+			pool->ParallelFor(batch_num, boost::bind(
+					&BatchedConvolutionLayer<Dtype>::gather_top, this,
+					top_diff + top[i]->offset(n0), top_buff, batch_num, _1, _2));
+			// Bias gradient, if necessary.
+			if (this->bias_term_ && this->param_propagate_down_[1]) {
+				caffe_cpu_gemv<Dtype>(CblasNoTrans, this->num_output_, cols, 1.,
+						top_buff, batch_bias_multiplier_.cpu_data(), 1.,
+						this->blobs_[1]->mutable_cpu_diff());
+			}
+			// gradient w.r.t. weight. Note that we will accumulate diffs.
+			if (this->param_propagate_down_[0]) {
+				pool->ParallelFor(batch_num, boost::bind(
+						&BatchedConvolutionLayer<Dtype>::im2col_image, this,
+						bottom_data + bottom[i]->offset(n0), col_buff, batch_num, _1, _2));
+				for (int g = 0; g < group; ++g) {
+					caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, out_channels,
+							col_height, cols, (Dtype)1., top_buff + g * out_channels * cols,
+							col_buff + g * col_height * cols, (Dtype)1.,
+							weight_diff + g * out_channels * col_height);
+				}
+			}
+			// gradient w.r.t. bottom data, if necessary.
+			if (bottom_diff) {
+				for (int g = 0; g < group; ++g) {
+					caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, col_height, cols,
+							out_channels, (Dtype)1., weight + g * out_channels * col_height,
+							top_buff + g * out_channels * cols, (Dtype)0.,
+							col_buff + g * col_height * cols);
+				}
+				pool->ParallelFor(batch_num, boost::bind(
+						&BatchedConvolutionLayer<Dtype>::col2im_image, this, col_buff,
+						bottom_diff + bottom[i]->offset(n0), batch_num, _1, _2));
+			}
+		}
+	}
+}
+
+INSTANTIATE_CLASS(BatchedConvolutionLayer);
+
+}  // namespace caffe
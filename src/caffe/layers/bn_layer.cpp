@@ -1,9 +1,13 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/common_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -69,245 +73,210 @@ void BNLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 }
 
 template <typename Dtype>
-void BNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-  const vector<Blob<Dtype>*>& top) {
-  const Dtype* const_bottom_data = bottom[0]->cpu_data();
-  const Dtype* const_top_data = top[0]->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
+void BNLayer<Dtype>::FrozenForward_cpu_plane(const Dtype* bottom_data,
+    Dtype* top_data, Dtype* x_norm_data, int plane, int thread_id) {
+  // the parameters are already on the CPU, so cpu_data() only reads
+  const int c = plane % channels_;
+  const Dtype mean = this->blobs_[2]->cpu_data()[c];
+  const Dtype inv_std = this->blobs_[3]->cpu_data()[c];
+  const Dtype scale = this->blobs_[0]->cpu_data()[c];
+  const Dtype shift = this->blobs_[1]->cpu_data()[c];
+  const int spatial_dim = height_ * width_;
+  const int offset = plane * spatial_dim;
+  bottom_data += offset;
+  top_data += offset;
+  for (int i = 0; i < spatial_dim; ++i) {
+    top_data[i] = (bottom_data[i] - mean) * inv_std;
+  }
+  if (x_norm_data) {
+    caffe_copy(spatial_dim, top_data, x_norm_data + offset);
+  }
+  for (int i = 0; i < spatial_dim; ++i) {
+    top_data[i] = top_data[i] * scale + shift;
+  }
+}
 
-  const Dtype* scale_data = this->blobs_[0]->cpu_data();
-  const Dtype* shift_data = this->blobs_[1]->cpu_data();
+template <typename Dtype>
+void BNLayer<Dtype>::ChannelStatistics_cpu(const Dtype* bottom_data,
+    Dtype* mean_data, Dtype* inv_std_data, int channel, int thread_id) {
+  const int spatial_dim = height_ * width_;
+  // the count, mean and sum of squared deviations of the planes so far
+  Dtype count = 0;
+  Dtype mean = 0;
+  Dtype m2 = 0;
+  for (int n = 0; n < num_; ++n) {
+    const Dtype* plane_data =
+        bottom_data + (n * channels_ + channel) * spatial_dim;
+    // sum around the first value of the plane, so that the squares do not
+    // cancel out when the values are far from zero
+    const Dtype pivot = plane_data[0];
+    Dtype sum = 0;
+    Dtype sum_sq = 0;
+    for (int i = 0; i < spatial_dim; ++i) {
+      const Dtype diff = plane_data[i] - pivot;
+      sum += diff;
+      sum_sq += diff * diff;
+    }
+    const Dtype plane_mean = sum / spatial_dim;
+    const Dtype plane_m2 = std::max(Dtype(0), sum_sq - sum * plane_mean);
+    // merge with the planes before
+    const Dtype delta = pivot + plane_mean - mean;
+    const Dtype new_count = count + spatial_dim;
+    mean += delta * spatial_dim / new_count;
+    m2 += plane_m2 + delta * delta * count * spatial_dim / new_count;
+    count = new_count;
+  }
+  mean_data[channel] = mean;
+  inv_std_data[channel] = Dtype(1) / std::sqrt(m2 / count + bn_eps_);
+}
 
-  // Mean normalization
-  if (frozen_ || this->phase_ == TEST) {
-    // Use the moving average mean
-    caffe_copy(batch_statistic_.count(), this->blobs_[2]->cpu_data(),
-        batch_statistic_.mutable_cpu_data());
-  } else {
-    // Compute the mean by averaging over spatial and batch dimensions.
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1) / (height_ * width_), const_bottom_data,
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_,
-        Dtype(1) / num_, spatial_statistic_.cpu_data(),
-        batch_sum_multiplier_.cpu_data(), Dtype(0),
-        batch_statistic_.mutable_cpu_data());
-    // Add to the moving average
-    if (!frozen_) {
-      caffe_cpu_axpby(batch_statistic_.count(),
-          Dtype(1) - bn_momentum_, batch_statistic_.cpu_data(),
-          bn_momentum_, this->blobs_[2]->mutable_cpu_data());
+template <typename Dtype>
+void BNLayer<Dtype>::TrainForward_cpu_channel(const Dtype* bottom_data,
+    Dtype* top_data, Dtype* x_norm_data, int channel, int thread_id) {
+  // the statistics and parameters are already on the CPU
+  const Dtype mean = batch_statistic_.cpu_data()[channel];
+  const Dtype inv_std = x_inv_std_.cpu_data()[channel];
+  const Dtype scale = this->blobs_[0]->cpu_data()[channel];
+  const Dtype shift = this->blobs_[1]->cpu_data()[channel];
+  const int spatial_dim = height_ * width_;
+  for (int n = 0; n < num_; ++n) {
+    const int offset = (n * channels_ + channel) * spatial_dim;
+    for (int i = offset; i < offset + spatial_dim; ++i) {
+      const Dtype x_norm = (bottom_data[i] - mean) * inv_std;
+      x_norm_data[i] = x_norm;
+      top_data[i] = x_norm * scale + shift;
     }
   }
-  // Broadcast the mean vector
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(-1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  // Subtract
-  caffe_add(broadcast_buffer_.count(), const_bottom_data,
-      broadcast_buffer_.cpu_data(), top_data);
+}
+
+template <typename Dtype>
+void BNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+  const vector<Blob<Dtype>*>& top) {
+  const Dtype* const_bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  this->blobs_[0]->cpu_data();
+  this->blobs_[1]->cpu_data();
 
-  // Variance normalization
   if (frozen_ || this->phase_ == TEST) {
-    // Use the moving average variance
-    caffe_copy(batch_statistic_.count(), this->blobs_[3]->cpu_data(),
-        batch_statistic_.mutable_cpu_data());
-  } else {
-    caffe_powx(broadcast_buffer_.count(), const_top_data, Dtype(2),
-        broadcast_buffer_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1) / (height_ * width_), broadcast_buffer_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1) / num_,
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(0), batch_statistic_.mutable_cpu_data());
-    // Add eps
-    caffe_add_scalar(batch_statistic_.count(), bn_eps_,
-        batch_statistic_.mutable_cpu_data());
-    // Inverse standard deviation
-    caffe_powx(batch_statistic_.count(), batch_statistic_.cpu_data(),
-        Dtype(-0.5), batch_statistic_.mutable_cpu_data());
-    // Add to the moving average
+    // Every plane is normalized by the moving averages on its own, without
+    // broadcasting them.
+    this->blobs_[2]->cpu_data();
+    this->blobs_[3]->cpu_data();
+    Caffe::thread_pool()->ParallelFor(num_ * channels_, boost::bind(
+        &BNLayer<Dtype>::FrozenForward_cpu_plane, this, const_bottom_data,
+        top_data, frozen_ ? NULL : x_norm_.mutable_cpu_data(), _1, _2));
+    // Save the std for backprop
     if (!frozen_) {
-      caffe_cpu_axpby(batch_statistic_.count(),
-          Dtype(1) - bn_momentum_, batch_statistic_.cpu_data(),
-          bn_momentum_, this->blobs_[3]->mutable_cpu_data());
+      caffe_copy(batch_statistic_.count(), this->blobs_[3]->cpu_data(),
+          x_inv_std_.mutable_cpu_data());
     }
-  }
-  // Broadcast the inverse std
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  // Multiply with the inverse std
-  caffe_mul(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
-
-  // Save the normalized inputs and std for backprop
-  if (!frozen_) {
-    caffe_copy(broadcast_buffer_.count(), const_top_data,
-        x_norm_.mutable_cpu_data());
-    caffe_copy(batch_statistic_.count(), batch_statistic_.cpu_data(),
-        x_inv_std_.mutable_cpu_data());
+    return;
   }
 
-  // Scale
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), scale_data,
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  caffe_mul(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
+  // The mean and inverse std over the spatial and batch dimensions, one
+  // channel per thread; the inverse std is kept for backprop.
+  Caffe::thread_pool()->ParallelFor(channels_, boost::bind(
+      &BNLayer<Dtype>::ChannelStatistics_cpu, this, const_bottom_data,
+      batch_statistic_.mutable_cpu_data(), x_inv_std_.mutable_cpu_data(),
+      _1, _2));
+  // Add to the moving averages
+  caffe_cpu_axpby(batch_statistic_.count(),
+      Dtype(1) - bn_momentum_, batch_statistic_.cpu_data(),
+      bn_momentum_, this->blobs_[2]->mutable_cpu_data());
+  caffe_cpu_axpby(x_inv_std_.count(),
+      Dtype(1) - bn_momentum_, x_inv_std_.cpu_data(),
+      bn_momentum_, this->blobs_[3]->mutable_cpu_data());
 
-  // Shift
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), shift_data,
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  caffe_add(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
+  // Normalize, scale and shift, saving the normalized inputs for backprop
+  Caffe::thread_pool()->ParallelFor(channels_, boost::bind(
+      &BNLayer<Dtype>::TrainForward_cpu_channel, this, const_bottom_data,
+      top_data, x_norm_.mutable_cpu_data(), _1, _2));
 }
 
 template <typename Dtype>
-void BNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
-  const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+void BNLayer<Dtype>::Backward_cpu_channel(const Dtype* top_diff,
+    Dtype* bottom_diff, Dtype* scale_diff, Dtype* shift_diff, int channel,
+    int thread_id) {
+  const Dtype scale = this->blobs_[0]->cpu_data()[channel];
+  const int spatial_dim = height_ * width_;
   if (frozen_) {
-    if (propagate_down[0]) {
-      const Dtype* const_top_diff = top[0]->cpu_diff();
-      Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-      // Use the moving average inverse std
-      caffe_copy(batch_statistic_.count(), this->blobs_[3]->cpu_data(),
-          batch_statistic_.mutable_cpu_data());
-      // Multiple slope with inverse std
-      caffe_mul(batch_statistic_.count(), this->blobs_[0]->cpu_data(),
-          batch_statistic_.cpu_data(), batch_statistic_.mutable_cpu_data());
-      // Broadcast
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-          Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-          Dtype(0), spatial_statistic_.mutable_cpu_data());
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-          height_ * width_, 1, Dtype(1),
-          spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-          Dtype(0), broadcast_buffer_.mutable_cpu_data());
-      // Elementwise multiply top grad with (slope / std)
-      caffe_mul(broadcast_buffer_.count(), const_top_diff,
-          broadcast_buffer_.cpu_data(), bottom_diff);
+    // The statistics are constants: only scale by slope / std.
+    const Dtype factor = scale * this->blobs_[3]->cpu_data()[channel];
+    for (int n = 0; n < num_; ++n) {
+      const int offset = (n * channels_ + channel) * spatial_dim;
+      for (int i = offset; i < offset + spatial_dim; ++i) {
+        bottom_diff[i] = top_diff[i] * factor;
+      }
     }
     return;
   }
 
-  // gradient w.r.t. slope
-  if (this->param_propagate_down_[0]) {
-    const Dtype* const_top_diff = top[0]->cpu_diff();
-    Dtype* scale_diff = this->blobs_[0]->mutable_cpu_diff();
-    caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(), const_top_diff,
-        broadcast_buffer_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), broadcast_buffer_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(1), scale_diff);
+  // sums of the top grad, and of it times x_hat
+  const Dtype* x_norm_data = x_norm_.cpu_data();
+  Dtype sum_diff = 0;
+  Dtype sum_diff_x_norm = 0;
+  for (int n = 0; n < num_; ++n) {
+    const int offset = (n * channels_ + channel) * spatial_dim;
+    for (int i = offset; i < offset + spatial_dim; ++i) {
+      sum_diff += top_diff[i];
+      sum_diff_x_norm += top_diff[i] * x_norm_data[i];
+    }
   }
-
-  // gradient w.r.t. bias
-  if (this->param_propagate_down_[1]) {
-    const Dtype* const_top_diff = top[0]->cpu_diff();
-    Dtype* shift_diff = this->blobs_[1]->mutable_cpu_diff();
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), const_top_diff, spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(1), shift_diff);
+  if (scale_diff) {
+    scale_diff[channel] += sum_diff_x_norm;
+  }
+  if (shift_diff) {
+    shift_diff[channel] += sum_diff;
+  }
+  if (!bottom_diff) {
+    return;
   }
 
-  // gradient w.r.t. normalized inputs
-  if (propagate_down[0]) {
-    const Dtype* const_top_diff = top[0]->cpu_diff();
-    const Dtype* const_bottom_diff = bottom[0]->cpu_diff();
-    Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-    const Dtype* scale_data = this->blobs_[0]->cpu_data();
-
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), scale_data,
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1), spatial_statistic_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        broadcast_buffer_.mutable_cpu_data());
-    caffe_mul(broadcast_buffer_.count(), const_top_diff,
-        broadcast_buffer_.cpu_data(), broadcast_buffer_.mutable_cpu_data());
-
-    // sum of x_hat * (dl / dx_hat)
-    caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(),
-        broadcast_buffer_.cpu_data(), bottom_diff);
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), const_bottom_diff, spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(0), batch_statistic_.mutable_cpu_data());
-
-    // x_hat times the sum
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1),
-        spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), bottom_diff);
-    caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(),
-        const_bottom_diff, bottom_diff);
-
-    // Subtract the average of x_hat times the sum
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), broadcast_buffer_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(0), batch_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1),
-        spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-        Dtype(1), bottom_diff);
-    caffe_cpu_axpby(broadcast_buffer_.count(), Dtype(1),
-        broadcast_buffer_.cpu_data(), Dtype(-1) / (num_ * height_ * width_),
-        bottom_diff);
-
-    // Multiply with the inverse std
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), x_inv_std_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1),
-        spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), broadcast_buffer_.mutable_cpu_data());
-    caffe_mul(broadcast_buffer_.count(), const_bottom_diff,
-        broadcast_buffer_.cpu_data(), bottom_diff);
+  // slope / std * (dl / dy - mean(dl / dy) - x_hat * mean(x_hat * dl / dy)),
+  // written over the top grad when in place
+  const Dtype count = num_ * spatial_dim;
+  const Dtype factor = scale * x_inv_std_.cpu_data()[channel];
+  const Dtype mean_diff = sum_diff / count;
+  const Dtype mean_diff_x_norm = sum_diff_x_norm / count;
+  for (int n = 0; n < num_; ++n) {
+    const int offset = (n * channels_ + channel) * spatial_dim;
+    for (int i = offset; i < offset + spatial_dim; ++i) {
+      bottom_diff[i] = factor *
+          (top_diff[i] - mean_diff - x_norm_data[i] * mean_diff_x_norm);
+    }
   }
 }
 
+template <typename Dtype>
+void BNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+  const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (frozen_ && !propagate_down[0]) {
+    return;
+  }
+  const Dtype* const_top_diff = top[0]->cpu_diff();
+  Dtype* bottom_diff =
+      propagate_down[0] ? bottom[0]->mutable_cpu_diff() : NULL;
+  // The parameters are frozen along with the statistics.
+  Dtype* scale_diff = NULL;
+  Dtype* shift_diff = NULL;
+  this->blobs_[0]->cpu_data();
+  if (frozen_) {
+    this->blobs_[3]->cpu_data();
+  } else {
+    x_norm_.cpu_data();
+    x_inv_std_.cpu_data();
+    if (this->param_propagate_down_[0]) {
+      scale_diff = this->blobs_[0]->mutable_cpu_diff();
+    }
+    if (this->param_propagate_down_[1]) {
+      shift_diff = this->blobs_[1]->mutable_cpu_diff();
+    }
+  }
+  // One channel per thread, each in two passes at most
+  Caffe::thread_pool()->ParallelFor(channels_, boost::bind(
+      &BNLayer<Dtype>::Backward_cpu_channel, this, const_top_diff,
+      bottom_diff, scale_diff, shift_diff, _1, _2));
+}
 
 #ifdef CPU_ONLY
 STUB_GPU(BNLayer);
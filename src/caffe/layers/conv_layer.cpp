@@ -1,9 +1,12 @@
+#include <boost/bind.hpp>
+
 #include <vector>
 
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -16,33 +19,61 @@ void ConvolutionLayer<Dtype>::compute_output_shape() {
     						  / this->stride_w_ + 1;
 }
 
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::forward_cpu_image(const Dtype* bottom_data,
+		const Dtype* weight, int weight_dim, Dtype* top_data, int n, int thread_id) {
+	const int bottom_dim = this->channels_ * this->height_ * this->width_;
+	const int top_dim = this->num_output_ * this->height_out_ * this->width_out_;
+	this->forward_cpu_gemm(bottom_data + n * bottom_dim, weight + n * weight_dim,
+			top_data + n * top_dim, false, thread_id);
+	if (this->bias_term_) {
+		const Dtype* bias = this->blobs_[1]->cpu_data();
+		this->forward_cpu_bias(top_data + n * top_dim, bias);
+	}
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::backward_cpu_image(const Dtype* top_diff,
+		const Dtype* bottom_data, const Dtype* weight, int weight_dim,
+		Dtype* weight_diff, Dtype* bottom_diff, int n, int thread_id) {
+	const int bottom_dim = this->channels_ * this->height_ * this->width_;
+	const int top_dim = this->num_output_ * this->height_out_ * this->width_out_;
+	// gradient w.r.t. weight. Note that we will accumulate diffs.
+	if (weight_diff) {
+		this->weight_cpu_gemm(bottom_data + n * bottom_dim, top_diff + n * top_dim,
+				weight_diff + n * weight_dim, thread_id);
+	}
+	// gradient w.r.t. bottom data, if necessary.
+	if (bottom_diff) {
+		this->backward_cpu_gemm(top_diff + n * top_dim, weight + n * weight_dim,
+				bottom_diff + n * bottom_dim, thread_id);
+	}
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 		const vector<Blob<Dtype>*>& top) {
 	bool dynamic_conv = this->layer_param_.convolution_param().dynamic_conv();
+	// the images are independent, and go to the threads of the pool
+	shared_ptr<ThreadPool> pool = Caffe::thread_pool();
+	this->ReserveColBuffers(pool->num_threads());
 	if (!dynamic_conv) {
 		const Dtype* weight = this->blobs_[0]->cpu_data();
+		if (this->bias_term_) {
+			this->blobs_[1]->cpu_data();
+		}
 		for (int i = 0; i < bottom.size(); ++i) {
-			const Dtype* bottom_data = bottom[i]->cpu_data();
-			Dtype* top_data = top[i]->mutable_cpu_data();
-			for (int n = 0; n < this->num_; ++n) {
-				this->forward_cpu_gemm(bottom_data + bottom[i]->offset(n), weight,
-						top_data + top[i]->offset(n));
-				if (this->bias_term_) {
-					const Dtype* bias = this->blobs_[1]->cpu_data();
-					this->forward_cpu_bias(top_data + top[i]->offset(n), bias);
-				}
-			}
+			pool->ParallelFor(this->num_, boost::bind(
+					&ConvolutionLayer<Dtype>::forward_cpu_image, this,
+					bottom[i]->cpu_data(), weight, 0, top[i]->mutable_cpu_data(), _1, _2));
 		}
 	} else {
 		const Dtype* weight = bottom[0]->cpu_data();
 		for (int i = 1; i < bottom.size(); ++i) {
-			const Dtype* bottom_data = bottom[i]->cpu_data();
-			Dtype* top_data = top[i-1]->mutable_cpu_data();
-			for (int n = 0; n < this->num_; ++n) {
-				this->forward_cpu_gemm(bottom_data + bottom[i]->offset(n), weight + bottom[0]->offset(n),
-						top_data + top[i-1]->offset(n));
-			}
+			pool->ParallelFor(this->num_, boost::bind(
+					&ConvolutionLayer<Dtype>::forward_cpu_image, this,
+					bottom[i]->cpu_data(), weight, bottom[0]->count(1),
+					top[i-1]->mutable_cpu_data(), _1, _2));
 		}
 	}
 }
@@ -51,13 +82,14 @@ template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
 		const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
 	bool dynamic_conv = this->layer_param_.convolution_param().dynamic_conv();
+	shared_ptr<ThreadPool> pool = Caffe::thread_pool();
+	this->ReserveColBuffers(pool->num_threads());
 	if (!dynamic_conv) {
 		const Dtype* weight = this->blobs_[0]->cpu_data();
 		Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
 		for (int i = 0; i < top.size(); ++i) {
 			const Dtype* top_diff = top[i]->cpu_diff();
 			const Dtype* bottom_data = bottom[i]->cpu_data();
-			Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
 			// Bias gradient, if necessary.
 			if (this->bias_term_ && this->param_propagate_down_[1]) {
 				Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
@@ -65,42 +97,34 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
 					this->backward_cpu_bias(bias_diff, top_diff + top[i]->offset(n));
 				}
 			}
-			if (this->param_propagate_down_[0] || propagate_down[i]) {
+			// The weight gradient sums over the images, in order so that it does
+			// not depend on the number of threads.
+			if (this->param_propagate_down_[0]) {
 				for (int n = 0; n < this->num_; ++n) {
-					// gradient w.r.t. weight. Note that we will accumulate diffs.
-					if (this->param_propagate_down_[0]) {
-						this->weight_cpu_gemm(bottom_data + bottom[i]->offset(n),
-								top_diff + top[i]->offset(n), weight_diff);
-					}
-					// gradient w.r.t. bottom data, if necessary.
-					if (propagate_down[i]) {
-						this->backward_cpu_gemm(top_diff + top[i]->offset(n), weight,
-								bottom_diff + bottom[i]->offset(n));
-					}
+					backward_cpu_image(top_diff, bottom_data, weight, 0, weight_diff,
+							NULL, n, 0);
 				}
 			}
+			if (propagate_down[i]) {
+				pool->ParallelFor(this->num_, boost::bind(
+						&ConvolutionLayer<Dtype>::backward_cpu_image, this, top_diff,
+						bottom_data, weight, 0, static_cast<Dtype*>(NULL),
+						bottom[i]->mutable_cpu_diff(), _1, _2));
+			}
 		}
 	} else {
+		// every image has weights of its own
 		const Dtype* weight = bottom[0]->cpu_data();
-		Dtype* weight_diff = bottom[0]->mutable_cpu_diff();
+		Dtype* weight_diff = propagate_down[0] ? bottom[0]->mutable_cpu_diff() : NULL;
 
 		for (int i = 0; i < top.size(); ++i) {
-			const Dtype* top_diff = top[i]->cpu_diff();
 			if (propagate_down[0] || propagate_down[i+1]) {
-				const Dtype* bottom_data = bottom[i+1]->cpu_data();
-				Dtype* bottom_diff = bottom[i+1]->mutable_cpu_diff();
-				for (int n = 0; n < this->num_; ++n) {
-					// gradient w.r.t. weight. Note that we will accumulate diffs.
-					if (propagate_down[0]) {
-						this->weight_cpu_gemm(bottom_data + bottom[i+1]->offset(n),
-								top_diff + top[i]->offset(n), weight_diff+bottom[0]->offset(n));
-					}
-					// gradient w.r.t. bottom data, if necessary.
-					if (propagate_down[i+1]) {
-						this->backward_cpu_gemm(top_diff + top[i]->offset(n), weight + bottom[0]->offset(n),
-								bottom_diff + bottom[i+1]->offset(n));
-					}
-				}
+				pool->ParallelFor(this->num_, boost::bind(
+						&ConvolutionLayer<Dtype>::backward_cpu_image, this,
+						top[i]->cpu_diff(), bottom[i+1]->cpu_data(), weight,
+						bottom[0]->count(1), weight_diff,
+						propagate_down[i+1] ? bottom[i+1]->mutable_cpu_diff() : NULL,
+						_1, _2));
 			}
 		}
 	}
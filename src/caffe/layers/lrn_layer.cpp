@@ -1,7 +1,10 @@
+#include <boost/bind.hpp>
+
 #include <vector>
 
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -105,6 +108,43 @@ void LRNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+void LRNLayer<Dtype>::CrossChannelForward_cpu_image(const Dtype* bottom_data,
+    Dtype* scale_data, Dtype* buffer, Dtype* top_data, int n, int thread_id) {
+  const int image_dim = channels_ * height_ * width_;
+  const int plane_dim = height_ * width_;
+  bottom_data += n * image_dim;
+  scale_data += n * image_dim;
+  top_data += n * image_dim;
+  // the padding channels of buffer stay 0
+  Dtype* padded_square_data = buffer + thread_id *
+      (channels_ + size_ - 1) * plane_dim;
+  Dtype alpha_over_size = alpha_ / size_;
+  // compute the padded square
+  caffe_sqr(image_dim, bottom_data, padded_square_data + pre_pad_ * plane_dim);
+  // Create the first channel scale
+  for (int c = 0; c < size_; ++c) {
+    caffe_axpy<Dtype>(plane_dim, alpha_over_size,
+        padded_square_data + c * plane_dim, scale_data);
+  }
+  for (int c = 1; c < channels_; ++c) {
+    // copy previous scale
+    caffe_copy<Dtype>(plane_dim, scale_data + (c - 1) * plane_dim,
+        scale_data + c * plane_dim);
+    // add head
+    caffe_axpy<Dtype>(plane_dim, alpha_over_size,
+        padded_square_data + (c + size_ - 1) * plane_dim,
+        scale_data + c * plane_dim);
+    // subtract tail
+    caffe_axpy<Dtype>(plane_dim, -alpha_over_size,
+        padded_square_data + (c - 1) * plane_dim,
+        scale_data + c * plane_dim);
+  }
+  // In the end, compute output
+  caffe_powx<Dtype>(image_dim, scale_data, -beta_, top_data);
+  caffe_mul<Dtype>(image_dim, top_data, bottom_data, top_data);
+}
+
 template <typename Dtype>
 void LRNLayer<Dtype>::CrossChannelForward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
@@ -115,41 +155,16 @@ void LRNLayer<Dtype>::CrossChannelForward_cpu(
   for (int i = 0; i < scale_.count(); ++i) {
     scale_data[i] = k_;
   }
-  Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_);
+  // a padded square per thread of the pool
+  shared_ptr<ThreadPool> pool = Caffe::thread_pool();
+  Blob<Dtype> padded_square(pool->num_threads(), channels_ + size_ - 1,
+      height_, width_);
   Dtype* padded_square_data = padded_square.mutable_cpu_data();
   caffe_set(padded_square.count(), Dtype(0), padded_square_data);
-  Dtype alpha_over_size = alpha_ / size_;
   // go through the images
-  for (int n = 0; n < num_; ++n) {
-    // compute the padded square
-    caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
-        padded_square_data + padded_square.offset(0, pre_pad_));
-    // Create the first channel scale
-    for (int c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c),
-          scale_data + scale_.offset(n, 0));
-    }
-    for (int c = 1; c < channels_; ++c) {
-      // copy previous scale
-      caffe_copy<Dtype>(height_ * width_,
-          scale_data + scale_.offset(n, c - 1),
-          scale_data + scale_.offset(n, c));
-      // add head
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
-          scale_data + scale_.offset(n, c));
-      // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
-          padded_square_data + padded_square.offset(0, c - 1),
-          scale_data + scale_.offset(n, c));
-    }
-  }
-
-  // In the end, compute output
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
-  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
+  pool->ParallelFor(num_, boost::bind(
+      &LRNLayer<Dtype>::CrossChannelForward_cpu_image, this, bottom_data,
+      scale_data, padded_square_data, top_data, _1, _2));
 }
 
 template <typename Dtype>
@@ -178,58 +193,67 @@ void LRNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
 }
 
 template <typename Dtype>
-void LRNLayer<Dtype>::CrossChannelBackward_cpu(
-    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
-    const vector<Blob<Dtype>*>& bottom) {
-  const Dtype* top_diff = top[0]->cpu_diff();
-  const Dtype* top_data = top[0]->cpu_data();
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  const Dtype* scale_data = scale_.cpu_data();
-  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Blob<Dtype> padded_ratio(1, channels_ + size_ - 1, height_, width_);
-  Blob<Dtype> accum_ratio(1, 1, height_, width_);
-  Dtype* padded_ratio_data = padded_ratio.mutable_cpu_data();
-  Dtype* accum_ratio_data = accum_ratio.mutable_cpu_data();
-  // We hack a little bit by using the diff() to store an additional result
-  Dtype* accum_ratio_times_bottom = accum_ratio.mutable_cpu_diff();
-  caffe_set(padded_ratio.count(), Dtype(0), padded_ratio_data);
+void LRNLayer<Dtype>::CrossChannelBackward_cpu_image(const Dtype* top_diff,
+    const Dtype* top_data, const Dtype* bottom_data, const Dtype* scale_data,
+    Dtype* buffer, Dtype* bottom_diff, int n, int thread_id) {
+  const int image_dim = channels_ * height_ * width_;
+  const int plane_dim = height_ * width_;
+  top_diff += n * image_dim;
+  top_data += n * image_dim;
+  bottom_data += n * image_dim;
+  scale_data += n * image_dim;
+  bottom_diff += n * image_dim;
+  // the padded ratio, then the accumulated ratio and its product with the
+  // bottom; the padding channels stay 0
+  Dtype* padded_ratio_data = buffer + thread_id *
+      (channels_ + size_ + 1) * plane_dim;
+  Dtype* accum_ratio_data = padded_ratio_data +
+      (channels_ + size_ - 1) * plane_dim;
+  Dtype* accum_ratio_times_bottom = accum_ratio_data + plane_dim;
   Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
+  int inverse_pre_pad = size_ - (size_ + 1) / 2;
 
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, bottom_diff);
-  caffe_mul<Dtype>(scale_.count(), top_diff, bottom_diff, bottom_diff);
+  caffe_powx<Dtype>(image_dim, scale_data, -beta_, bottom_diff);
+  caffe_mul<Dtype>(image_dim, top_diff, bottom_diff, bottom_diff);
+  // first, compute diff_i * y_i / s_i
+  caffe_mul<Dtype>(image_dim, top_diff, top_data,
+      padded_ratio_data + inverse_pre_pad * plane_dim);
+  caffe_div<Dtype>(image_dim, padded_ratio_data + inverse_pre_pad * plane_dim,
+      scale_data, padded_ratio_data + inverse_pre_pad * plane_dim);
+  // Now, compute the accumulated ratios and the bottom diff
+  caffe_set(plane_dim, Dtype(0), accum_ratio_data);
+  for (int c = 0; c < size_ - 1; ++c) {
+    caffe_axpy<Dtype>(plane_dim, 1., padded_ratio_data + c * plane_dim,
+        accum_ratio_data);
+  }
+  for (int c = 0; c < channels_; ++c) {
+    caffe_axpy<Dtype>(plane_dim, 1.,
+        padded_ratio_data + (c + size_ - 1) * plane_dim, accum_ratio_data);
+    // compute bottom diff
+    caffe_mul<Dtype>(plane_dim, bottom_data + c * plane_dim,
+        accum_ratio_data, accum_ratio_times_bottom);
+    caffe_axpy<Dtype>(plane_dim, -cache_ratio_value,
+        accum_ratio_times_bottom, bottom_diff + c * plane_dim);
+    caffe_axpy<Dtype>(plane_dim, -1., padded_ratio_data + c * plane_dim,
+        accum_ratio_data);
+  }
+}
 
+template <typename Dtype>
+void LRNLayer<Dtype>::CrossChannelBackward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  // the scratch of each thread: the padded ratio, and two more channels
+  shared_ptr<ThreadPool> pool = Caffe::thread_pool();
+  Blob<Dtype> buffer(pool->num_threads(), channels_ + size_ + 1,
+      height_, width_);
+  caffe_set(buffer.count(), Dtype(0), buffer.mutable_cpu_data());
   // go through individual data
-  int inverse_pre_pad = size_ - (size_ + 1) / 2;
-  for (int n = 0; n < num_; ++n) {
-    int block_offset = scale_.offset(n);
-    // first, compute diff_i * y_i / s_i
-    caffe_mul<Dtype>(channels_ * height_ * width_,
-        top_diff + block_offset, top_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    caffe_div<Dtype>(channels_ * height_ * width_,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad),
-        scale_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    // Now, compute the accumulated ratios and the bottom diff
-    caffe_set(accum_ratio.count(), Dtype(0), accum_ratio_data);
-    for (int c = 0; c < size_ - 1; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
-    }
-    for (int c = 0; c < channels_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c + size_ - 1),
-          accum_ratio_data);
-      // compute bottom diff
-      caffe_mul<Dtype>(height_ * width_,
-          bottom_data + top[0]->offset(n, c),
-          accum_ratio_data, accum_ratio_times_bottom);
-      caffe_axpy<Dtype>(height_ * width_, -cache_ratio_value,
-          accum_ratio_times_bottom, bottom_diff + top[0]->offset(n, c));
-      caffe_axpy<Dtype>(height_ * width_, -1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
-    }
-  }
+  pool->ParallelFor(num_, boost::bind(
+      &LRNLayer<Dtype>::CrossChannelBackward_cpu_image, this,
+      top[0]->cpu_diff(), top[0]->cpu_data(), bottom[0]->cpu_data(),
+      scale_.cpu_data(), buffer.mutable_cpu_data(),
+      bottom[0]->mutable_cpu_diff(), _1, _2));
 }
 
 template <typename Dtype>
@@ -1,3 +1,8 @@
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -5,15 +10,144 @@
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+namespace {
+
+template <typename Dtype>
+inline Dtype sigmoid(Dtype x) {
+  return Dtype(1) / (Dtype(1) + std::exp(-x));
+}
+
+// The buffers of one time step, at its first sequence; rows of gates are
+// 4 * H long ([i f o g]), the others H.
+template <typename Dtype>
+struct LstmStep {
+  int H;
+  // per sequence of the step, or NULL without clipping
+  const Dtype* clip;
+  const Dtype* c_prev;
+  // forward
+  const Dtype* pre_gate;
+  Dtype* gate;
+  Dtype* cell;
+  Dtype* tanh_cell;
+  Dtype* top;
+  // backward; f_next and dc_next are NULL at the last step
+  const Dtype* gate_data;
+  const Dtype* tanh_cell_data;
+  const Dtype* top_diff;
+  const Dtype* f_next;
+  const Dtype* dc_next;
+  Dtype* cell_diff;
+  Dtype* pre_gate_diff;
+  Dtype clipping_threshold;
+};
+
+// The gates, cell and output of sequence n. Its rows, 4 * H + 3 * H long, stay
+// in cache from the gates to the output; each sweep below is a plain loop over
+// contiguous memory, which the compiler vectorizes better than one loop doing
+// all of the cell math.
+template <typename Dtype>
+void LstmForwardCell(const LstmStep<Dtype>& step, int n, int thread_id) {
+  const int H = step.H;
+  const Dtype* pre_gate = step.pre_gate + n * 4 * H;
+  const Dtype* c_prev = step.c_prev + n * H;
+  Dtype* gate = step.gate + n * 4 * H;
+  Dtype* cell = step.cell + n * H;
+  Dtype* tanh_cell = step.tanh_cell + n * H;
+  Dtype* top = step.top + n * H;
+  const Dtype* i = gate;
+  const Dtype* f = gate + H;
+  const Dtype* o = gate + 2 * H;
+  const Dtype* g = gate + 3 * H;
+  for (int j = 0; j < 3 * H; ++j) {
+    gate[j] = sigmoid(pre_gate[j]);
+  }
+  for (int j = 3 * H; j < 4 * H; ++j) {
+    gate[j] = std::tanh(pre_gate[j]);
+  }
+  // c(t) = f(t)*c(t-1) + i(t)*g(t); a clipped sequence starts anew,
+  // forgetting the previous cell
+  if (step.clip && step.clip[n] == 0) {
+    caffe_set(H, Dtype(0), gate + H);
+    for (int j = 0; j < H; ++j) {
+      cell[j] = i[j] * g[j];
+    }
+  } else {
+    for (int j = 0; j < H; ++j) {
+      cell[j] = f[j] * c_prev[j] + i[j] * g[j];
+    }
+  }
+  for (int j = 0; j < H; ++j) {
+    tanh_cell[j] = std::tanh(cell[j]);
+  }
+  for (int j = 0; j < H; ++j) {
+    top[j] = o[j] * tanh_cell[j];
+  }
+}
+
+// The cell diff and the gate diffs before the nonlinearities of sequence n,
+// swept over its rows as in LstmForwardCell.
+template <typename Dtype>
+void LstmBackwardCell(const LstmStep<Dtype>& step, int n, int thread_id) {
+  const int H = step.H;
+  const Dtype* i = step.gate_data + n * 4 * H;
+  const Dtype* f = i + H;
+  const Dtype* o = i + 2 * H;
+  const Dtype* g = i + 3 * H;
+  const Dtype* tanh_cell = step.tanh_cell_data + n * H;
+  const Dtype* c_prev = step.c_prev + n * H;
+  const Dtype* dh = step.top_diff + n * H;
+  Dtype* dc = step.cell_diff + n * H;
+  Dtype* pre_diff = step.pre_gate_diff + n * 4 * H;
+  const Dtype mask = step.clip ? step.clip[n] : Dtype(1);
+  // Cell state : o(t) * tanh'(c(t)) * h_diff(t) + f(t+1) * c_diff(t+1)
+  for (int j = 0; j < H; ++j) {
+    dc[j] = o[j] * dh[j] * (Dtype(1) - tanh_cell[j] * tanh_cell[j]);
+  }
+  if (step.f_next) {
+    const Dtype* f_next = step.f_next + n * 4 * H;
+    const Dtype* dc_next = step.dc_next + n * H;
+    for (int j = 0; j < H; ++j) {
+      dc[j] += f_next[j] * dc_next[j];
+    }
+  }
+  // Derivatives before nonlinearity of the input gate, g(t) * c_diff(t); the
+  // forget gate, c(t-1) * c_diff(t); the output gate, tanh(c(t)) * h_diff(t);
+  // and the input modulation gate, i(t) * c_diff(t)
+  for (int j = 0; j < H; ++j) {
+    pre_diff[j] = g[j] * dc[j] * i[j] * (Dtype(1) - i[j]);
+  }
+  for (int j = 0; j < H; ++j) {
+    pre_diff[H + j] = mask * c_prev[j] * dc[j] * f[j] * (Dtype(1) - f[j]);
+  }
+  for (int j = 0; j < H; ++j) {
+    pre_diff[2 * H + j] = tanh_cell[j] * dh[j] * o[j] * (Dtype(1) - o[j]);
+  }
+  for (int j = 0; j < H; ++j) {
+    pre_diff[3 * H + j] = i[j] * dc[j] * (Dtype(1) - g[j] * g[j]);
+  }
+  // Clip deriviates before nonlinearity
+  const Dtype bound = step.clipping_threshold;
+  if (bound > 0) {
+    for (int j = 0; j < 4 * H; ++j) {
+      pre_diff[j] = std::min(std::max(pre_diff[j], -bound), bound);
+    }
+  }
+}
+
+}  // namespace
+
 template <typename Dtype>
 void LstmLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const int num_output = this->layer_param_.lstm_param().num_output();
   clipping_threshold_ = this->layer_param_.lstm_param().clipping_threshold();
+  stream_ = this->layer_param_.lstm_param().stream();
 
   N_ = this->layer_param_.lstm_param().batch_size();
   I_ = bottom[0]->count() / bottom[0]->num(); // input dimension
@@ -129,7 +263,6 @@ void LstmLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   Dtype* gate_data = gate_.mutable_cpu_data();
   Dtype* cell_data = cell_.mutable_cpu_data();
   Dtype* tanh_cell_data = tanh_cell_.mutable_cpu_data();
-  Dtype* ig = ig_.mutable_cpu_data();
   Dtype* mask = clip_mask_.mutable_cpu_data();
 
   // Initialize previous state
@@ -140,6 +273,10 @@ void LstmLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     caffe_mul(c_0_.count(), c_T_.cpu_data(), mask, c_0_.mutable_cpu_data());
     caffe_mul(h_0_.count(), h_T_.cpu_data(), mask, h_0_.mutable_cpu_data());
   }
+  else if (stream_) {
+    caffe_copy(c_0_.count(), c_T_.cpu_data(), c_0_.mutable_cpu_data());
+    caffe_copy(h_0_.count(), h_T_.cpu_data(), h_0_.mutable_cpu_data());
+  }
   else {
     caffe_set(c_0_.count(), (Dtype)0., c_0_.mutable_cpu_data());
     caffe_set(h_0_.count(), (Dtype)0., h_0_.mutable_cpu_data());
@@ -154,63 +291,74 @@ void LstmLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       bias_multiplier_.cpu_data(), bias, (Dtype)1., pre_gate_data);
 
   // Compute recurrent forward propagation
+  shared_ptr<ThreadPool> pool = Caffe::thread_pool();
+  LstmStep<Dtype> step;
+  step.H = H_;
   for (int t = 0; t < T_; ++t) {
     Dtype* h_t = top_data + top_.offset(t);
     Dtype* c_t = cell_data + cell_.offset(t);
-    Dtype* tanh_c_t = tanh_cell_data + tanh_cell_.offset(t);
-    Dtype* i_t = gate_data + gate_.offset(t);
-    Dtype* f_t = gate_data + gate_.offset(t, 0, 1);
-    Dtype* o_t = gate_data + gate_.offset(t, 0, 2);
-    Dtype* g_t = gate_data + gate_.offset(t, 0, 3);
-    Dtype* pre_i_t = pre_gate_data + pre_gate_.offset(t);
-    Dtype* pre_g_t = pre_gate_data + pre_gate_.offset(t, 0, 3);
-    Dtype* mask_t = mask + clip_mask_.offset(t);
     const Dtype* h_t_1 = t > 0 ? (h_t - top_.offset(1)) : h_0_.cpu_data();
     const Dtype* c_t_1 = t > 0 ? (c_t - cell_.offset(1)) : c_0_.cpu_data();
 
     // Hidden-to-hidden propagation
     if (clip) {
-      caffe_mul(N_*H_, h_t_1, mask_t, clipped_.mutable_cpu_data());
+      caffe_mul(N_*H_, h_t_1, mask + clip_mask_.offset(t),
+          clipped_.mutable_cpu_data());
       h_t_1 = clipped_.cpu_data();
     }
     caffe_cpu_gemm(CblasNoTrans, CblasTrans, N_, 4*H_, H_, (Dtype)1.,
         h_t_1, weight_h, (Dtype)1., pre_gate_data + pre_gate_.offset(t));
 
-    for (int n = 0; n < N_; ++n) {
-      // Apply nonlinearity
-      caffe_sigmoid(3*H_, pre_i_t, i_t);
-      caffe_tanh(H_, pre_g_t, g_t);
-      if (clip && mask_t[0] == 0) {
-        caffe_set(H_, (Dtype)0., f_t);
-      }
-
-      // Compute cell : c(t) = f(t)*c(t-1) + i(t)*g(t)
-      caffe_mul(H_, f_t, c_t_1, c_t);
-      caffe_mul(H_, i_t, g_t, ig);
-      caffe_add(H_, c_t, ig, c_t);
-
-      // Compute output
-      caffe_tanh(H_, c_t, tanh_c_t);
-      caffe_mul(H_, o_t, tanh_c_t, h_t);
-
-      h_t += H_;
-      c_t += H_;
-      tanh_c_t += H_;
-      c_t_1 += H_;
-      i_t += 4*H_;
-      f_t += 4*H_;
-      o_t += 4*H_;
-      g_t += 4*H_;
-      pre_i_t += 4*H_;
-      pre_g_t += 4*H_;
-      mask_t += H_;
-    }
+    // Apply the nonlinearities, and compute the cell and output, of every
+    // sequence on the threads of the pool
+    step.clip = clip ? clip + t * N_ : NULL;
+    step.c_prev = c_t_1;
+    step.pre_gate = pre_gate_data + pre_gate_.offset(t);
+    step.gate = gate_data + gate_.offset(t);
+    step.cell = c_t;
+    step.tanh_cell = tanh_cell_data + tanh_cell_.offset(t);
+    step.top = h_t;
+    pool->ParallelFor(N_, boost::bind(&LstmForwardCell<Dtype>,
+        boost::cref(step), _1, _2));
   }
   // Preserve cell state and output value for truncated BPTT
   caffe_copy(N_*H_, cell_data + cell_.offset(T_-1), c_T_.mutable_cpu_data());
   caffe_copy(N_*H_, top_data + top_.offset(T_-1), h_T_.mutable_cpu_data());
 }
 
+template <typename Dtype>
+void LstmLayer<Dtype>::SaveRecurrentState(const int n,
+    Blob<Dtype>* state) const {
+  CHECK_GE(n, 0);
+  CHECK_LT(n, N_);
+  vector<int> state_shape;
+  state_shape.push_back(2);
+  state_shape.push_back(H_);
+  state->Reshape(state_shape);
+  Dtype* state_data = state->mutable_cpu_data();
+  caffe_copy(H_, h_T_.cpu_data() + h_T_.offset(n), state_data);
+  caffe_copy(H_, c_T_.cpu_data() + c_T_.offset(n), state_data + H_);
+}
+
+template <typename Dtype>
+void LstmLayer<Dtype>::RestoreRecurrentState(const int n,
+    const Blob<Dtype>& state) {
+  CHECK_GE(n, 0);
+  CHECK_LT(n, N_);
+  CHECK_EQ(state.count(), 2 * H_) << "State of another layer";
+  const Dtype* state_data = state.cpu_data();
+  caffe_copy(H_, state_data, h_T_.mutable_cpu_data() + h_T_.offset(n));
+  caffe_copy(H_, state_data + H_, c_T_.mutable_cpu_data() + c_T_.offset(n));
+}
+
+template <typename Dtype>
+void LstmLayer<Dtype>::ResetRecurrentState(const int n) {
+  CHECK_GE(n, 0);
+  CHECK_LT(n, N_);
+  caffe_set(H_, Dtype(0), h_T_.mutable_cpu_data() + h_T_.offset(n));
+  caffe_set(H_, Dtype(0), c_T_.mutable_cpu_data() + c_T_.offset(n));
+}
+
 template <typename Dtype>
 void LstmLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
@@ -231,78 +379,25 @@ void LstmLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
 
   Dtype* top_diff = top_.mutable_cpu_diff();
   Dtype* pre_gate_diff = pre_gate_.mutable_cpu_diff();
-  Dtype* gate_diff = gate_.mutable_cpu_diff();
   Dtype* cell_diff = cell_.mutable_cpu_diff();
 
+  shared_ptr<ThreadPool> pool = Caffe::thread_pool();
+  LstmStep<Dtype> step;
+  step.H = H_;
+  step.clipping_threshold = clipping_threshold_;
   for (int t = T_-1; t >= 0; --t) {
-    Dtype* dh_t = top_diff + top_.offset(t);
-    const Dtype* c_t = cell_data + cell_.offset(t);
-    Dtype* dc_t = cell_diff + cell_.offset(t);
-    const Dtype* tanh_c_t = tanh_cell_data + tanh_cell_.offset(t);
-    const Dtype* i_t = gate_data + gate_.offset(t);
-    const Dtype* f_t = gate_data + gate_.offset(t, 0, 1);
-    const Dtype* o_t = gate_data + gate_.offset(t, 0, 2);
-    const Dtype* g_t = gate_data + gate_.offset(t, 0, 3);
-    Dtype* di_t = gate_diff + gate_.offset(t);
-    Dtype* df_t = gate_diff + gate_.offset(t, 0, 1);
-    Dtype* do_t = gate_diff + gate_.offset(t, 0, 2);
-    Dtype* dg_t = gate_diff + gate_.offset(t, 0, 3);
-    Dtype* pre_di_t = pre_gate_diff + pre_gate_.offset(t);
-    Dtype* pre_dg_t = pre_gate_diff + pre_gate_.offset(t, 0, 3);
-    Dtype* fdc = fdc_.mutable_cpu_data();
-    const Dtype* mask_t = mask + clip_mask_.offset(t);
-
-    for (int n = 0; n < N_; ++n) {
-      // Output gate : tanh(c(t)) * h_diff(t)
-      caffe_mul(H_, tanh_c_t, dh_t, do_t);
-
-      // Cell state : o(t) * tanh'(c(t)) * h_diff(t) + f(t+1) * c_diff(t+1)
-      caffe_mul(H_, o_t, dh_t, dc_t);
-      caffe_tanh_diff(H_, tanh_c_t, dc_t, dc_t);
-      if (t < T_-1) {
-        caffe_mul(H_, f_t + gate_.offset(1), dc_t + cell_.offset(1), fdc);
-        caffe_add(H_, fdc, dc_t, dc_t);
-      }
-
-      // Forget gate : c(t-1) * c_diff(t)
-      const Dtype* c_t_1 = t > 0 ? (c_t - cell_.offset(1)) : c_0_.cpu_data();
-      if (clip) {
-        caffe_mul(H_, c_t_1, mask_t, clipped_.mutable_cpu_data());
-        c_t_1 = clipped_.cpu_data();
-      }
-      caffe_mul(H_, c_t_1, dc_t, df_t);
-
-      // Input gate : g(t) * c_diff(t)
-      caffe_mul(H_, g_t, dc_t, di_t);
-      // Input modulation gate : i(t) * c_diff(t)
-      caffe_mul(H_, i_t, dc_t, dg_t);
-
-      // Compute derivate before nonlinearity
-      caffe_sigmoid_diff(3*H_, i_t, di_t, pre_di_t);
-      caffe_tanh_diff(H_, g_t, dg_t, pre_dg_t);
-
-      // Clip deriviates before nonlinearity
-      if (clipping_threshold_ > 0.0f) {
-        caffe_bound(4*H_, pre_di_t, -clipping_threshold_,
-            clipping_threshold_, pre_di_t);
-      }
-
-      dh_t += H_;
-      c_t += H_;
-      dc_t += H_;
-      tanh_c_t += H_;
-      mask_t += H_;
-      di_t += 4*H_;
-      df_t += 4*H_;
-      do_t += 4*H_;
-      dg_t += 4*H_;
-      i_t += 4*H_;
-      f_t += 4*H_;
-      o_t += 4*H_;
-      g_t += 4*H_;
-      pre_di_t += 4*H_;
-      pre_dg_t += 4*H_;
-    }
+    // The gate and cell diffs of every sequence, on the threads of the pool
+    step.clip = clip ? clip + t * N_ : NULL;
+    step.c_prev = t > 0 ? cell_data + cell_.offset(t-1) : c_0_.cpu_data();
+    step.gate_data = gate_data + gate_.offset(t);
+    step.tanh_cell_data = tanh_cell_data + tanh_cell_.offset(t);
+    step.top_diff = top_diff + top_.offset(t);
+    step.f_next = t < T_-1 ? gate_data + gate_.offset(t+1, 0, 1) : NULL;
+    step.dc_next = t < T_-1 ? cell_diff + cell_.offset(t+1) : NULL;
+    step.cell_diff = cell_diff + cell_.offset(t);
+    step.pre_gate_diff = pre_gate_diff + pre_gate_.offset(t);
+    pool->ParallelFor(N_, boost::bind(&LstmBackwardCell<Dtype>,
+        boost::cref(step), _1, _2));
 
     if (t > 0) {
       Dtype* dh_t_1 = top_diff + top_.offset(t-1);
@@ -38,6 +38,10 @@ void LstmLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     caffe_gpu_mul(c_0_.count(), c_T_.gpu_data(), mask, c_0_.mutable_gpu_data());
     caffe_gpu_mul(h_0_.count(), h_T_.gpu_data(), mask, h_0_.mutable_gpu_data());
   }
+  else if (stream_) {
+    caffe_copy(c_0_.count(), c_T_.gpu_data(), c_0_.mutable_gpu_data());
+    caffe_copy(h_0_.count(), h_T_.gpu_data(), h_0_.mutable_gpu_data());
+  }
   else {
     caffe_gpu_set(c_0_.count(), (Dtype)0., c_0_.mutable_gpu_data());
     caffe_gpu_set(h_0_.count(), (Dtype)0., h_0_.mutable_gpu_data());
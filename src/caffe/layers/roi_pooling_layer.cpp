@@ -5,9 +5,12 @@
 // Written by Ross Girshick
 // ------------------------------------------------------------------
 
+#include <boost/bind.hpp>
+
 #include <cfloat>
 
 #include "caffe/fast_rcnn_layers.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 using std::max;
 using std::min;
@@ -42,6 +45,77 @@ void ROIPoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       pooled_width_);
 }
 
+template <typename Dtype>
+void ROIPoolingLayer<Dtype>::Forward_cpu_roi(const Dtype* bottom_data,
+      const Dtype* bottom_rois, int rois_dim, Dtype* top_data,
+      int* argmax_data, int n, int thread_id) {
+  const int plane_dim = height_ * width_;
+  const int pooled_dim = pooled_height_ * pooled_width_;
+  bottom_rois += n * rois_dim;
+  top_data += n * channels_ * pooled_dim;
+  argmax_data += n * channels_ * pooled_dim;
+
+  int roi_batch_ind = bottom_rois[0];
+  int roi_start_w = round(bottom_rois[1] * spatial_scale_);
+  int roi_start_h = round(bottom_rois[2] * spatial_scale_);
+  int roi_end_w = round(bottom_rois[3] * spatial_scale_);
+  int roi_end_h = round(bottom_rois[4] * spatial_scale_);
+
+  int roi_height = max(roi_end_h - roi_start_h + 1, 1);
+  int roi_width = max(roi_end_w - roi_start_w + 1, 1);
+  const Dtype bin_size_h = static_cast<Dtype>(roi_height)
+                           / static_cast<Dtype>(pooled_height_);
+  const Dtype bin_size_w = static_cast<Dtype>(roi_width)
+                           / static_cast<Dtype>(pooled_width_);
+
+  const Dtype* batch_data = bottom_data + roi_batch_ind * channels_ * plane_dim;
+
+  for (int c = 0; c < channels_; ++c) {
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        // Compute pooling region for this output unit:
+        //  start (included) = floor(ph * roi_height / pooled_height_)
+        //  end (excluded) = ceil((ph + 1) * roi_height / pooled_height_)
+        int hstart = static_cast<int>(floor(static_cast<Dtype>(ph)
+                                            * bin_size_h));
+        int wstart = static_cast<int>(floor(static_cast<Dtype>(pw)
+                                            * bin_size_w));
+        int hend = static_cast<int>(ceil(static_cast<Dtype>(ph + 1)
+                                         * bin_size_h));
+        int wend = static_cast<int>(ceil(static_cast<Dtype>(pw + 1)
+                                         * bin_size_w));
+
+        hstart = min(max(hstart + roi_start_h, 0), height_);
+        hend = min(max(hend + roi_start_h, 0), height_);
+        wstart = min(max(wstart + roi_start_w, 0), width_);
+        wend = min(max(wend + roi_start_w, 0), width_);
+
+        bool is_empty = (hend <= hstart) || (wend <= wstart);
+
+        const int pool_index = ph * pooled_width_ + pw;
+        if (is_empty) {
+          top_data[pool_index] = 0;
+          argmax_data[pool_index] = -1;
+        }
+
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            const int index = h * width_ + w;
+            if (batch_data[index] > top_data[pool_index]) {
+              top_data[pool_index] = batch_data[index];
+              argmax_data[pool_index] = index;
+            }
+          }
+        }
+      }
+    }
+    // Increment all data pointers by one channel
+    batch_data += plane_dim;
+    top_data += pooled_dim;
+    argmax_data += pooled_dim;
+  }
+}
+
 template <typename Dtype>
 void ROIPoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -56,72 +130,15 @@ void ROIPoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   int* argmax_data = max_idx_.mutable_cpu_data();
   caffe_set(top_count, -1, argmax_data);
 
-  // For each ROI R = [batch_index x1 y1 x2 y2]: max pool over R
   for (int n = 0; n < num_rois; ++n) {
-    int roi_batch_ind = bottom_rois[0];
-    int roi_start_w = round(bottom_rois[1] * spatial_scale_);
-    int roi_start_h = round(bottom_rois[2] * spatial_scale_);
-    int roi_end_w = round(bottom_rois[3] * spatial_scale_);
-    int roi_end_h = round(bottom_rois[4] * spatial_scale_);
+    int roi_batch_ind = bottom_rois[bottom[1]->offset(n)];
     CHECK_GE(roi_batch_ind, 0);
     CHECK_LT(roi_batch_ind, batch_size);
-
-    int roi_height = max(roi_end_h - roi_start_h + 1, 1);
-    int roi_width = max(roi_end_w - roi_start_w + 1, 1);
-    const Dtype bin_size_h = static_cast<Dtype>(roi_height)
-                             / static_cast<Dtype>(pooled_height_);
-    const Dtype bin_size_w = static_cast<Dtype>(roi_width)
-                             / static_cast<Dtype>(pooled_width_);
-
-    const Dtype* batch_data = bottom_data + bottom[0]->offset(roi_batch_ind);
-
-    for (int c = 0; c < channels_; ++c) {
-      for (int ph = 0; ph < pooled_height_; ++ph) {
-        for (int pw = 0; pw < pooled_width_; ++pw) {
-          // Compute pooling region for this output unit:
-          //  start (included) = floor(ph * roi_height / pooled_height_)
-          //  end (excluded) = ceil((ph + 1) * roi_height / pooled_height_)
-          int hstart = static_cast<int>(floor(static_cast<Dtype>(ph)
-                                              * bin_size_h));
-          int wstart = static_cast<int>(floor(static_cast<Dtype>(pw)
-                                              * bin_size_w));
-          int hend = static_cast<int>(ceil(static_cast<Dtype>(ph + 1)
-                                           * bin_size_h));
-          int wend = static_cast<int>(ceil(static_cast<Dtype>(pw + 1)
-                                           * bin_size_w));
-
-          hstart = min(max(hstart + roi_start_h, 0), height_);
-          hend = min(max(hend + roi_start_h, 0), height_);
-          wstart = min(max(wstart + roi_start_w, 0), width_);
-          wend = min(max(wend + roi_start_w, 0), width_);
-
-          bool is_empty = (hend <= hstart) || (wend <= wstart);
-
-          const int pool_index = ph * pooled_width_ + pw;
-          if (is_empty) {
-            top_data[pool_index] = 0;
-            argmax_data[pool_index] = -1;
-          }
-
-          for (int h = hstart; h < hend; ++h) {
-            for (int w = wstart; w < wend; ++w) {
-              const int index = h * width_ + w;
-              if (batch_data[index] > top_data[pool_index]) {
-                top_data[pool_index] = batch_data[index];
-                argmax_data[pool_index] = index;
-              }
-            }
-          }
-        }
-      }
-      // Increment all data pointers by one channel
-      batch_data += bottom[0]->offset(0, 1);
-      top_data += top[0]->offset(0, 1);
-      argmax_data += max_idx_.offset(0, 1);
-    }
-    // Increment ROI data pointer
-    bottom_rois += bottom[1]->offset(1);
   }
+  // For each ROI R = [batch_index x1 y1 x2 y2]: max pool over R
+  Caffe::thread_pool()->ParallelFor(num_rois, boost::bind(
+      &ROIPoolingLayer<Dtype>::Forward_cpu_roi, this, bottom_data, bottom_rois,
+      bottom[1]->offset(1), top_data, argmax_data, _1, _2));
 }
 
 template <typename Dtype>
@@ -1,5 +1,6 @@
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
@@ -10,14 +11,46 @@
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
+#include "caffe/util/video_db.hpp"
+#include "caffe/util/video_pack.hpp"
 
 #ifdef USE_MPI
 #include "mpi.h"
 #endif
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
 using namespace boost::filesystem;
 
 namespace caffe{
+
+namespace {
+
+// Transforms the frames of a video straight into its slot of the batch.
+template <typename Dtype>
+class TransformFrameSink : public SegmentFrameSink {
+public:
+	TransformFrameSink(DataTransformer<Dtype>* transformer, Blob<Dtype>* transformed_blob, Blob<Dtype>* roi)
+		: transformer_(transformer), transformed_blob_(transformed_blob), roi_(roi) {}
+
+	virtual void Reshape(const int channels, const int height, const int width) {
+		transformer_->BeginTransform(channels, height, width, transformed_blob_, roi_);
+	}
+	virtual void AddFrame(const cv::Mat& frame, const int first_channel) {
+		transformer_->TransformFrame(frame, first_channel);
+	}
+	// the resize to new_height x new_width is fused with the crop
+	virtual bool resizes_frames() const { return true; }
+
+private:
+	DataTransformer<Dtype>* transformer_;
+	Blob<Dtype>* transformed_blob_;
+	Blob<Dtype>* roi_;
+};
+
+}  // namespace
+
 template <typename Dtype>
 VideoDataLayer<Dtype>:: ~VideoDataLayer<Dtype>(){
 	this->JoinPrefetchThread();
@@ -37,7 +70,9 @@ void VideoDataLayer<Dtype>:: DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     root_folders_.clear();
 	std::copy(video_data_param.root_folder().begin(), video_data_param.root_folder().end(),
 			std::back_inserter(root_folders_));
-	if (video_data_param.modality() == VideoDataParameter_Modality_BOTH)
+	if (video_data_param.has_backend())
+		CHECK_EQ(root_folders_.size(), 0) << "root_folder is not used when reading from a db.";
+	else if (video_data_param.modality() == VideoDataParameter_Modality_BOTH)
 		CHECK_EQ(root_folders_.size(), 2) << "Two root folders should be specified for modality BOTH.";
 	else
 		CHECK_EQ(root_folders_.size(), 1) << "One root folder should be specified for modality FLOW or RGB.";
@@ -47,17 +82,31 @@ void VideoDataLayer<Dtype>:: DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
 	
     num_labels_ = video_data_param.num_labels();
 	LOG(INFO) << "number of labels: " << num_labels_;
+	// with 0, the items are decoded by the threads of the Caffe-wide pool
+	const int num_decode_threads = video_data_param.num_decode_threads() > 0 ?
+			video_data_param.num_decode_threads() : Caffe::num_threads();
+	LOG(INFO) << "Decoding with " << num_decode_threads << " thread(s).";
+	decode_transformers_.clear();
+	for (int t = 0; t < num_decode_threads; ++t) {
+		decode_transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+				new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+	}
+
 	const string& source = video_data_param.source();
-    LOG(INFO) << "Opening file: " << source;
-	std:: ifstream infile(source.c_str());
-	string filename;
-	vector<int> label(num_labels_);
-	int length;
-	while (infile >> filename >> length){
-		for (int i = 0; i < num_labels_; ++i)
-			infile >> label[i];
-		lines_.push_back(std::make_pair(filename,label));
-		lines_duration_.push_back(length-interval);
+	if (video_data_param.has_backend()) {
+		LoadVideosFromDB(source, interval);
+	} else {
+		LOG(INFO) << "Opening file: " << source;
+		std:: ifstream infile(source.c_str());
+		string filename;
+		vector<int> label(num_labels_);
+		int length;
+		while (infile >> filename >> length){
+			for (int i = 0; i < num_labels_; ++i)
+				infile >> label[i];
+			lines_.push_back(std::make_pair(filename,label));
+			lines_duration_.push_back(length-interval);
+		}
 	}
 	if (video_data_param.shuffle()){
 		const unsigned int prefectch_rng_seed = caffe_rng_rand();
@@ -68,8 +117,6 @@ void VideoDataLayer<Dtype>:: DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
 	LOG(INFO) << "A total of " << lines_.size() << " videos.";
 	lines_id_ = 0;
 
-	const int new_height  = video_data_param.new_height();
-	const int new_width  = video_data_param.new_width();
 	const int num_segments = video_data_param.num_segments();
 	int max_length = *std::max_element(new_length_.begin(), new_length_.end());
 	Datum datum;
@@ -82,25 +129,22 @@ void VideoDataLayer<Dtype>:: DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
 		int offset = (*frame_rng)() % (average_duration - max_length + 1);
 		offsets.push_back(offset+i*average_duration);
 	}
-	if (this->layer_param_.video_data_param().modality() == VideoDataParameter_Modality_FLOW)
-		CHECK(ReadSegmentFlowToDatum(root_folders_[0]+lines_[lines_id_].first, (lines_[lines_id_].second)[0], offsets, new_height, new_width, new_length_[0], &datum));
-	else if (this->layer_param_.video_data_param().modality() == VideoDataParameter_Modality_RGB)
-		CHECK(ReadSegmentRGBToDatum(root_folders_[0]+lines_[lines_id_].first, (lines_[lines_id_].second)[0], offsets, new_height, new_width, new_length_[0], &datum, true));
-	else
-		CHECK(ReadSegmentRGBFlowToDatum(root_folders_, lines_[lines_id_].first, (lines_[lines_id_].second)[0], offsets, new_height, new_width, new_length_, &datum, true));
+	DatumFrameSink datum_sink((lines_[lines_id_].second)[0], &datum);
+	CHECK(ReadVideoFrames(0, lines_[lines_id_].first, offsets, &datum_sink));
 	const int crop_size = this->layer_param_.transform_param().crop_size();
 	const int batch_size = this->layer_param_.video_data_param().batch_size();
 	if (crop_size > 0){
 		top[0]->Reshape(batch_size, datum.channels(), crop_size, crop_size);
-		this->prefetch_data_.Reshape(batch_size, datum.channels(), crop_size, crop_size);
 	} else {
 		top[0]->Reshape(batch_size, datum.channels(), datum.height(), datum.width());
-		this->prefetch_data_.Reshape(batch_size, datum.channels(), datum.height(), datum.width());
 	}
+	for (int i = 0; i < this->prefetch_.size(); ++i)
+		this->prefetch_[i]->data_.ReshapeLike(*top[0]);
 	LOG(INFO) << "output data size: " << top[0]->num() << "," << top[0]->channels() << "," << top[0]->height() << "," << top[0]->width();
 
 	top[1]->Reshape(batch_size, num_labels_, 1, 1);
-	this->prefetch_label_.Reshape(batch_size, num_labels_, 1, 1);
+	for (int i = 0; i < this->prefetch_.size(); ++i)
+		this->prefetch_[i]->label_.ReshapeLike(*top[1]);
 
 	this->num_rois_ = this->layer_param_.video_data_param().num_rois();
     if (this->num_rois_) {
@@ -110,7 +154,8 @@ void VideoDataLayer<Dtype>:: DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
         shape[0] = batch_size*this->num_rois_;
         shape[1] = 5;
         top[2]->Reshape(shape);
-        this->prefetch_roi_.Reshape(shape);
+        for (int i = 0; i < this->prefetch_.size(); ++i)
+            this->prefetch_[i]->roi_.Reshape(shape);
     }
     else {
     	CHECK_EQ(top.size(), 2) << "There should be 2 tops.";
@@ -120,6 +165,45 @@ void VideoDataLayer<Dtype>:: DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
 	this->transformed_data_.Reshape(top_shape);
 }
 
+template <typename Dtype>
+void VideoDataLayer<Dtype>::LoadVideosFromDB(const string& source, const int interval){
+	db_.reset(db::GetDB(this->layer_param_.video_data_param().backend()));
+	db_->Open(source, db::READ);
+	// cursors are not thread-safe, every decode thread gets its own
+	decode_cursors_.clear();
+	for (int t = 0; t < decode_transformers_.size(); ++t)
+		decode_cursors_.push_back(shared_ptr<db::Cursor>(db_->NewCursor()));
+	db::Cursor* cursor = decode_cursors_[0].get();
+
+	const int num_videos = ReadVideoCount(cursor);
+	int begin = 0, end = num_videos;
+#ifdef USE_MPI
+	// Each rank reads its own contiguous range of videos, i.e. of keys,
+	// instead of skipping over the batches of the other ranks.
+	if (Caffe::parallel_mode() == Caffe::MPI) {
+		begin = static_cast<int64_t>(num_videos) * Caffe::MPI_my_rank() / Caffe::MPI_all_rank();
+		end = static_cast<int64_t>(num_videos) * (Caffe::MPI_my_rank() + 1) / Caffe::MPI_all_rank();
+		LOG(INFO) << "Rank " << Caffe::MPI_my_rank() << " reads videos [" << begin << ", " << end << ")";
+	}
+#endif
+	CHECK_LT(begin, end) << "No video to read from " << source;
+
+	VideoRecord record;
+	vector<int> label(num_labels_);
+	for (int index = begin; index < end; ++index) {
+		CHECK(cursor->SeekToKey(VideoRecordKey(index))) << "Missing video " << index << " in " << source;
+		const char* data;
+		size_t size;
+		cursor->value_data(&data, &size);
+		CHECK(record.ParseFromArray(data, size)) << "Corrupted record of video " << index;
+		CHECK_GE(record.label_size(), num_labels_) << "Not enough labels for " << record.name();
+		std::copy(record.label().begin(), record.label().begin() + num_labels_, label.begin());
+		lines_.push_back(std::make_pair(record.name(), label));
+		lines_duration_.push_back(record.length() - interval);
+		db_index_[record.name()] = index;
+	}
+}
+
 template <typename Dtype>
 void VideoDataLayer<Dtype>::ShuffleVideos(){
 	caffe::rng_t* prefetch_rng1 = static_cast<caffe::rng_t*>(prefetch_rng_1_->generator());
@@ -129,19 +213,167 @@ void VideoDataLayer<Dtype>::ShuffleVideos(){
 }
 
 template <typename Dtype>
-void VideoDataLayer<Dtype>::InternalThreadEntry(){
+bool VideoDataLayer<Dtype>::ReadVideoFrames(const int thread_id, const string& filename,
+		const vector<int>& offsets, SegmentFrameSink* sink){
 	const VideoDataParameter& video_data_param = this->layer_param_.video_data_param();
-	const int batch_size = video_data_param.batch_size();
 	const int new_height = video_data_param.new_height();
 	const int new_width = video_data_param.new_width();
+	const VideoDataParameter_Modality modality = video_data_param.modality();
+	int rgb_length = 0, flow_length = 0;
+	if (modality == VideoDataParameter_Modality_FLOW) {
+		flow_length = new_length_[0];
+	} else if (modality == VideoDataParameter_Modality_RGB) {
+		rgb_length = new_length_[0];
+	} else {
+		rgb_length = new_length_[0];
+		flow_length = new_length_[1];
+	}
+
+	if (db_) {
+		std::map<string, int>::const_iterator it = db_index_.find(filename);
+		CHECK(it != db_index_.end()) << "Unknown video " << filename;
+		DBVideo video(decode_cursors_[thread_id].get(), it->second, filename);
+		return ReadSegmentFrames(&video, &video, offsets, new_height, new_width,
+				rgb_length, flow_length, true, sink);
+	}
+
+	if (video_data_param.packed()) {
+		// one mapped file per modality instead of one file per frame
+		VideoPack pack, flow_pack;
+		if (!pack.Open(root_folders_[0] + filename + ".vpk"))
+			return false;
+		if (modality != VideoDataParameter_Modality_BOTH || root_folders_[1] == root_folders_[0])
+			return ReadSegmentFrames(&pack, &pack, offsets, new_height, new_width,
+					rgb_length, flow_length, true, sink);
+		if (!flow_pack.Open(root_folders_[1] + filename + ".vpk"))
+			return false;
+		return ReadSegmentFrames(&pack, &flow_pack, offsets, new_height, new_width,
+				rgb_length, flow_length, true, sink);
+	}
+
+	const string& flow_folder = root_folders_[root_folders_.size() - 1];
+	return ReadSegmentFrames(root_folders_[0] + filename, flow_folder + filename, offsets,
+			new_height, new_width, rgb_length, flow_length, true, sink);
+}
+
+template <typename Dtype>
+void VideoDataLayer<Dtype>::NextDecodeJob(DecodeJob* job){
+	const VideoDataParameter& video_data_param = this->layer_param_.video_data_param();
 	const int num_segments = video_data_param.num_segments();
-	string roi_folder = this->layer_param_.video_data_param().roi_folder();
+	const int max_length = *std::max_element(new_length_.begin(), new_length_.end());
+	const int lines_size = lines_.size();
+	CHECK_GT(lines_size, lines_id_);
+
+	caffe::rng_t* frame_rng = static_cast<caffe::rng_t*>(frame_prefetch_rng_->generator());
+	job->filename = lines_[lines_id_].first;
+	job->labels = lines_[lines_id_].second;
+	job->offsets.clear();
+	int average_duration = (int) lines_duration_[lines_id_] / num_segments;
+	for (int i = 0; i < num_segments; ++i) {
+		if (this->phase_==TRAIN){
+			int offset = (*frame_rng)() % (average_duration - max_length + 1);
+			job->offsets.push_back(offset+i*average_duration);
+		} else{
+			job->offsets.push_back(int((average_duration-max_length+1)/2 + i*average_duration));
+		}
+	}
+	// the seed of the item's transformation stream is drawn in list order,
+	// which keeps the batch independent of how items are spread over threads
+	job->seed = (*frame_rng)();
+	job->ok = false;
+
+	//next iteration
+	lines_id_++;
+	if (lines_id_ >= lines_size) {
+		DLOG(INFO) << "Restarting data prefetching from start.";
+		lines_id_ = 0;
+		if(video_data_param.shuffle()){
+			ShuffleVideos();
+		}
+	}
+}
+
+template <typename Dtype>
+bool VideoDataLayer<Dtype>::DecodeItem(const int item_id, const DecodeJob& job,
+		const int thread_id, Batch<Dtype>* batch){
+	DataTransformer<Dtype>* transformer = decode_transformers_[thread_id].get();
+	const VideoDataParameter& video_data_param = this->layer_param_.video_data_param();
+	const string& filename = job.filename;
+	const vector<int>& labels = job.labels;
+
+	Blob<Dtype> transformed_data(this->transformed_data_.shape());
+	transformed_data.set_cpu_data(batch->data_.mutable_cpu_data() + batch->data_.offset(item_id));
+	transformer->InitRand(job.seed);
+	Blob<Dtype> rois;
+	if (this->num_rois_) {
+		boost::filesystem::path roi_path(filename);
+		string roi_file = video_data_param.roi_folder() + roi_path.stem().string() + ".mat";
+		if (!ReadROI(roi_file, rois, job.offsets[0])) {
+			LOG(ERROR) << "Error reading ROI file " << roi_file
+					<< "at index " << job.offsets[0];
+			return false;
+		}
+	}
+	// frames are transformed into the batch as they are decoded
+	TransformFrameSink<Dtype> sink(transformer, &transformed_data, this->num_rois_ ? &rois : NULL);
+	if (!ReadVideoFrames(thread_id, filename, job.offsets, &sink))
+		return false;
+
+	if (this->num_rois_) {
+		const int roi_dim = batch->roi_.shape(1);
+		Dtype *roi_top = batch->roi_.mutable_cpu_data() + batch->roi_.offset(item_id*this->num_rois_);
+		const Dtype *roi_data = rois.cpu_data();
+		int n = 0;
+		for (int p = 0; p < rois.count() && n < this->num_rois_-1; p+=rois.shape(1)) {
+			int x1 = roi_data[p], y1 = roi_data[p+1], x2 = roi_data[p+2], y2 = roi_data[p+3];
+			if (std::min(x2-x1, y2-y1) >= 50) {
+				int c = roi_dim * n;
+				roi_top[c] = item_id;
+				for (int i = 0; i < 4; ++i)
+					roi_top[c+i+1] = roi_data[p+i];
+				n++;
+			}
+		}
+		for (; n < this->num_rois_; ++n) {
+			int c = roi_dim * n;
+			roi_top[c] = item_id;
+			roi_top[c+1] = 0;
+			roi_top[c+2] = 0;
+			roi_top[c+3] = transformed_data.shape(3)-1;
+			roi_top[c+4] = transformed_data.shape(2)-1;
+		}
+	}
+
+	Dtype* top_label = batch->label_.mutable_cpu_data();
+	for (int l = 0; l < num_labels_; ++l) {
+		top_label[item_id*num_labels_+l] = labels[l];
+	}
+	return true;
+}
+
+template <typename Dtype>
+void VideoDataLayer<Dtype>::DecodeThreadEntry(const int thread_id, Batch<Dtype>* batch){
+	const int num_threads = decode_transformers_.size();
+	for (int item_id = thread_id; item_id < decode_jobs_.size(); item_id += num_threads) {
+		decode_jobs_[item_id].ok = DecodeItem(item_id, decode_jobs_[item_id], thread_id, batch);
+	}
+}
+
+template <typename Dtype>
+void VideoDataLayer<Dtype>::DecodePoolItem(Batch<Dtype>* batch, const int item_id, const int thread_id){
+	decode_jobs_[item_id].ok = DecodeItem(item_id, decode_jobs_[item_id], thread_id, batch);
+}
+
+template <typename Dtype>
+void VideoDataLayer<Dtype>::load_batch(Batch<Dtype>* batch){
+	const VideoDataParameter& video_data_param = this->layer_param_.video_data_param();
+	const int batch_size = video_data_param.batch_size();
 	num_labels_ = video_data_param.num_labels();
 
-	Datum datum;
-	CHECK(this->prefetch_data_.count());
-	Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
-	Dtype* top_label = this->prefetch_label_.mutable_cpu_data();
+	CHECK(batch->data_.count());
+	// touch the buffers once here so the decode threads only read pointers
+	batch->data_.mutable_cpu_data();
+	batch->label_.mutable_cpu_data();
 
 	new_length_.clear();
 	std::copy(video_data_param.new_length().begin(), video_data_param.new_length().end(), std::back_inserter(new_length_));
@@ -154,90 +386,56 @@ void VideoDataLayer<Dtype>::InternalThreadEntry(){
 	std::copy(video_data_param.root_folder().begin(), video_data_param.root_folder().end(),
 			std::back_inserter(root_folders_));
 
-	Blob<Dtype> rois;
-	const int max_length = *std::max_element(new_length_.begin(), new_length_.end());
-	const int lines_size = lines_.size();
 	if (this->num_rois_) {
 		vector<int> shape(2);
 		shape[0] = batch_size * this->num_rois_;
 		shape[1] = 5;
-		this->prefetch_roi_.Reshape(shape);
-	}
-	for (int item_id = 0; item_id < batch_size; ++item_id){
-		CHECK_GT(lines_size, lines_id_);
-		vector<int> offsets;
-		int average_duration = (int) lines_duration_[lines_id_] / num_segments;
-		for (int i = 0; i < num_segments; ++i) {
-			if (this->phase_==TRAIN){
-				caffe::rng_t* frame_rng = static_cast<caffe::rng_t*>(frame_prefetch_rng_->generator());
-				int offset = (*frame_rng)() % (average_duration - max_length + 1);
-				offsets.push_back(offset+i*average_duration);
-			} else{
-				offsets.push_back(int((average_duration-max_length+1)/2 + i*average_duration));
+		batch->roi_.Reshape(shape);
+		batch->roi_.mutable_cpu_data();
+	}
+
+	// Sample the videos, offsets and seeds of the whole batch up front, then
+	// let the worker threads decode the items into their slots.
+	decode_jobs_.resize(batch_size);
+	for (int item_id = 0; item_id < batch_size; ++item_id) {
+		NextDecodeJob(&decode_jobs_[item_id]);
+	}
+	const int num_threads = decode_transformers_.size();
+	if (video_data_param.num_decode_threads() == 0) {
+		shared_ptr<ThreadPool> pool = Caffe::thread_pool();
+		// the pool may have grown since setup; its new slots get a transformer
+		// and db cursor of their own, as the ones there were then
+		while (decode_transformers_.size() < pool->num_threads()) {
+			decode_transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+					new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+			if (db_) {
+				decode_cursors_.push_back(shared_ptr<db::Cursor>(db_->NewCursor()));
 			}
 		}
-		if (this->layer_param_.video_data_param().modality() == VideoDataParameter_Modality_FLOW){
-			if(!ReadSegmentFlowToDatum(root_folders_[0]+lines_[lines_id_].first, (lines_[lines_id_].second)[0], offsets, new_height, new_width, new_length_[0], &datum)) {
-				continue;
-			}
-		} else if (this->layer_param_.video_data_param().modality() == VideoDataParameter_Modality_RGB){
-			if(!ReadSegmentRGBToDatum(root_folders_[0]+lines_[lines_id_].first, (lines_[lines_id_].second)[0], offsets, new_height, new_width, new_length_[0], &datum, true)) {
-				continue;
-			}
-		} else {
-			if(!ReadSegmentRGBFlowToDatum(root_folders_, lines_[lines_id_].first, (lines_[lines_id_].second)[0], offsets, new_height, new_width, new_length_, &datum, true))
-				continue;
-		}
-
-		for (int l = 0; l < num_labels_; ++l) {
-			top_label[item_id*num_labels_+l] = (lines_[lines_id_].second)[l];
+		pool->ParallelFor(batch_size, boost::bind(&VideoDataLayer<Dtype>::DecodePoolItem,
+				this, batch, _1, _2));
+	} else if (num_threads > 1) {
+		// the workers write into the batch, so a stop request must not cut
+		// the join short; it is honoured once the batch is complete
+		boost::this_thread::disable_interruption no_interruption;
+		boost::thread_group decode_threads;
+		for (int t = 0; t < num_threads; ++t) {
+			decode_threads.create_thread(boost::bind(&VideoDataLayer<Dtype>::DecodeThreadEntry,
+					this, t, batch));
 		}
+		decode_threads.join_all();
+	} else {
+		DecodeThreadEntry(0, batch);
+	}
 
-		this->transformed_data_.set_cpu_data(top_data + this->prefetch_data_.offset(item_id));
-        if (this->num_rois_) {
-        	boost::filesystem::path roi_path(lines_[lines_id_].first);
-            string roi_file = roi_folder + roi_path.stem().string() + ".mat";
-            if (!ReadROI(roi_file, rois, offsets[0])) {
-                LOG(ERROR) << "Error reading ROI file " << roi_file
-            		       << "at index " << offsets[0];
-                item_id--;
-            } else {
-                this->data_transformer_->Transform(datum, &(this->transformed_data_), &rois);
-
-                Dtype *roi_top = this->prefetch_roi_.mutable_cpu_data() + this->prefetch_roi_.offset(item_id*this->num_rois_);
-                const Dtype *roi_data = rois.cpu_data();
-                int n = 0;
-                for (int p = 0; p < rois.count() && n < this->num_rois_-1; p+=rois.shape(1)) {
-                	int x1 = roi_data[p], y1 = roi_data[p+1], x2 = roi_data[p+2], y2 = roi_data[p+3];
-	    			if (std::min(x2-x1, y2-y1) >= 50) {
-		    			int c = this->prefetch_roi_.shape(1) * n;
-			    		roi_top[c] = item_id;
-				    	for (int i = 0; i < 4; ++i)
-					    	roi_top[c+i+1] = roi_data[p+i];
-    					n++;
-	    			}
-                }
-                for (; n < this->num_rois_; ++n) {
-            	    int c = this->prefetch_roi_.shape(1) * n;
-                	roi_top[c] = item_id;
-	    			roi_top[c+1] = 0;
-		    		roi_top[c+2] = 0;
-			    	roi_top[c+3] = this->transformed_data_.shape(3)-1;
-				    roi_top[c+4] = this->transformed_data_.shape(2)-1;
-                }
-            }
-        } else {
-        	this->data_transformer_->Transform(datum, &(this->transformed_data_), NULL);
-        }
-
-     	//next iteration
-		lines_id_++;
-		if (lines_id_ >= lines_size) {
-			DLOG(INFO) << "Restarting data prefetching from start.";
-			lines_id_ = 0;
-			if(this->layer_param_.video_data_param().shuffle()){
-				ShuffleVideos();
-			}
+	// Items that failed to load are replaced by the next videos in the list.
+	const int lines_size = lines_.size();
+	for (int item_id = 0; item_id < batch_size; ++item_id) {
+		int num_retries = 0;
+		while (!decode_jobs_[item_id].ok) {
+			CHECK_LT(num_retries++, lines_size) << "Could not load any video for item " << item_id;
+			NextDecodeJob(&decode_jobs_[item_id]);
+			decode_jobs_[item_id].ok = DecodeItem(item_id, decode_jobs_[item_id], 0, batch);
 		}
 	}
 }
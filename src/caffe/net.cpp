@@ -1,5 +1,12 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 #include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <functional>
 #include <map>
+#include <queue>
 #include <set>
 #include <string>
 #include <utility>
@@ -9,10 +16,13 @@
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/util/upgrade_proto.hpp"
+#include "caffe/util/weight_pack.hpp"
 
 #include "caffe/util/channel.hpp"
 #include "caffe/util/mpi_functions.hpp"
@@ -43,6 +53,15 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   // the current NetState.
   NetParameter filtered_param;
   FilterNet(in_param, &filtered_param);
+  map<string, string> folded_bn;
+  if (in_param.fold_batch_norm()) {
+    if (phase_ == TEST) {
+      const NetParameter unfolded_param(filtered_param);
+      FoldBatchNorm(unfolded_param, &filtered_param, &folded_bn);
+    } else {
+      LOG(WARNING) << "Ignoring fold_batch_norm outside the TEST phase";
+    }
+  }
   LOG(INFO) << "Initializing net from parameters: " << std::endl
             << filtered_param.DebugString();
   // Create a copy of filtered_param with splits added where necessary.
@@ -306,12 +325,617 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   for (size_t layer_id = 0; layer_id < layer_names_.size(); ++layer_id) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
+  for (map<string, string>::const_iterator bn = folded_bn.begin();
+      bn != folded_bn.end(); ++bn) {
+    LOG(INFO) << "Folding " << bn->first << " into " << bn->second;
+    const int layer_id = layer_names_index_[bn->second];
+    folded_bn_index_[bn->first] = folded_bn_layer_ids_.size();
+    folded_bn_layer_ids_.push_back(layer_id);
+    // the slope, bias, moving mean and moving inverse std of each channel,
+    // shaped as in BNLayer
+    vector<int> shape;
+    shape.push_back(1);
+    shape.push_back(layers_[layer_id]->blobs()[1]->count());
+    vector<shared_ptr<Blob<Dtype> > > bn_blobs;
+    for (int i = 0; i < 4; ++i) {
+      bn_blobs.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(shape)));
+    }
+    folded_bn_blobs_.push_back(bn_blobs);
+  }
   GetLearningRateAndWeightDecay();
   debug_info_ = param.debug_info();
+  if (param.optimize_memory()) {
+    if (phase_ == TEST) {
+      PlanMemory();
+    } else {
+      LOG(WARNING) << "Ignoring optimize_memory outside the TEST phase";
+    }
+  }
+  InitRecompute();
+  InitSchedule();
+  max_concurrency_ = 1;
+  set_max_concurrency(param.max_concurrency());
+#ifdef USE_MPI
+  sync_gradients_ = true;
+#endif
   LOG(INFO) << "Network initialization done.";
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
 }
 
+template <typename Dtype>
+void Net<Dtype>::PlanMemory() {
+  // Blobs sharing their data (splits, flattens, in-place layers) form one
+  // group, live from the first layer writing any of them to the last one
+  // reading any of them.
+  vector<int> group_of_blob(blobs_.size(), -1);
+  map<SyncedMemory*, int> blob_of_memory;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (blobs_[blob_id]->count() == 0) {
+      continue;
+    }
+    SyncedMemory* memory = blobs_[blob_id]->data().get();
+    if (blob_of_memory.find(memory) == blob_of_memory.end()) {
+      blob_of_memory[memory] = blob_id;
+    }
+    group_of_blob[blob_id] = blob_of_memory[memory];
+  }
+  // Layers sharing by reference in Forward only are not seen above.
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    if (!layers_[layer_id]->SharesBottomData() || bottom_ids.empty()) {
+      continue;
+    }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int bottom_id = bottom_ids[std::min<int>(i, bottom_ids.size() - 1)];
+      int from = group_of_blob[top_id_vecs_[layer_id][i]];
+      int to = group_of_blob[bottom_id];
+      if (from < 0 || to < 0) { continue; }
+      while (group_of_blob[from] != from) { from = group_of_blob[from]; }
+      while (group_of_blob[to] != to) { to = group_of_blob[to]; }
+      group_of_blob[from] = to;
+    }
+  }
+  // Number the groups.
+  vector<int> group_begin, group_end;
+  vector<size_t> group_bytes;
+  vector<bool> group_pinned;
+  map<int, int> group_of_root;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    int root = group_of_blob[blob_id];
+    if (root < 0) { continue; }
+    while (group_of_blob[root] != root) { root = group_of_blob[root]; }
+    if (group_of_root.find(root) == group_of_root.end()) {
+      group_of_root[root] = group_begin.size();
+      group_begin.push_back(INT_MAX);
+      group_end.push_back(-1);
+      group_bytes.push_back(0);
+      group_pinned.push_back(false);
+    }
+  }
+  vector<int> root_of_blob(group_of_blob);
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    int root = root_of_blob[blob_id];
+    if (root < 0) { continue; }
+    while (root_of_blob[root] != root) { root = root_of_blob[root]; }
+    const int group = group_of_root[root];
+    group_of_blob[blob_id] = group;
+    group_bytes[group] = std::max(group_bytes[group],
+        blobs_[blob_id]->data()->size());
+  }
+  const int num_groups = group_begin.size();
+  // The inputs and outputs of the net keep their own memory, and so do the
+  // tops of the layers without bottoms: data layers swap in their batches.
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    const int group = group_of_blob[net_input_blob_indices_[i]];
+    if (group >= 0) { group_pinned[group] = true; }
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    const int group = group_of_blob[net_output_blob_indices_[i]];
+    if (group >= 0) { group_pinned[group] = true; }
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int group = group_of_blob[top_id_vecs_[layer_id][i]];
+      if (group < 0) { continue; }
+      group_begin[group] = std::min(group_begin[group], layer_id);
+      group_end[group] = std::max(group_end[group], layer_id);
+      if (bottom_id_vecs_[layer_id].empty()) {
+        group_pinned[group] = true;
+      }
+    }
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      const int group = group_of_blob[bottom_id_vecs_[layer_id][i]];
+      if (group < 0) { continue; }
+      group_end[group] = std::max(group_end[group], layer_id);
+    }
+  }
+
+  // Walk the layers in order, giving each group a buffer when it is first
+  // written and putting the buffer back once its last reader is done.
+  vector<size_t> buffer_bytes;
+  vector<int> free_buffers;
+  vector<int> group_buffer(num_groups, -1);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    vector<int> in_place_buffers;
+    for (int i = 0; i < top_ids.size(); ++i) {
+      const int group = group_of_blob[top_ids[i]];
+      if (group < 0 || group_pinned[group] || group_begin[group] != layer_id
+          || group_buffer[group] >= 0) {
+        continue;
+      }
+      // Take over the buffer of the bottom of the same index, if this layer
+      // may compute in place and nothing reads the bottom afterwards.
+      if (layers_[layer_id]->AllowForwardInPlace() && i < bottom_ids.size()) {
+        const int bottom_group = group_of_blob[bottom_ids[i]];
+        if (bottom_group >= 0 && group_buffer[bottom_group] >= 0
+            && group_end[bottom_group] == layer_id
+            && std::find(in_place_buffers.begin(), in_place_buffers.end(),
+                group_buffer[bottom_group]) == in_place_buffers.end()) {
+          group_buffer[group] = group_buffer[bottom_group];
+          in_place_buffers.push_back(group_buffer[group]);
+          buffer_bytes[group_buffer[group]] = std::max(
+              buffer_bytes[group_buffer[group]], group_bytes[group]);
+          continue;
+        }
+      }
+      // Otherwise the smallest free buffer large enough, or else the largest
+      // one, grown, or else a new one.
+      int best = -1;
+      for (int j = 0; j < free_buffers.size(); ++j) {
+        const size_t bytes = buffer_bytes[free_buffers[j]];
+        if (best < 0) {
+          best = j;
+          continue;
+        }
+        const size_t best_bytes = buffer_bytes[free_buffers[best]];
+        if (bytes >= group_bytes[group] ? (best_bytes < group_bytes[group]
+            || bytes < best_bytes) : bytes > best_bytes) {
+          best = j;
+        }
+      }
+      if (best >= 0) {
+        group_buffer[group] = free_buffers[best];
+        free_buffers.erase(free_buffers.begin() + best);
+      } else {
+        group_buffer[group] = buffer_bytes.size();
+        buffer_bytes.push_back(0);
+      }
+      buffer_bytes[group_buffer[group]] = std::max(
+          buffer_bytes[group_buffer[group]], group_bytes[group]);
+    }
+    // Free the buffers of the groups read or written for the last time.
+    vector<int> last_groups;
+    for (int i = 0; i < bottom_ids.size(); ++i) {
+      last_groups.push_back(group_of_blob[bottom_ids[i]]);
+    }
+    for (int i = 0; i < top_ids.size(); ++i) {
+      last_groups.push_back(group_of_blob[top_ids[i]]);
+    }
+    for (int i = 0; i < last_groups.size(); ++i) {
+      const int group = last_groups[i];
+      if (group < 0 || group_end[group] != layer_id
+          || group_buffer[group] < 0) {
+        continue;
+      }
+      const int buffer = group_buffer[group];
+      // unless passed on in place
+      bool passed_on = false;
+      for (int j = 0; j < top_ids.size(); ++j) {
+        const int top_group = group_of_blob[top_ids[j]];
+        passed_on |= top_group != group && top_group >= 0
+            && group_buffer[top_group] == buffer;
+      }
+      if (!passed_on && std::find(free_buffers.begin(), free_buffers.end(),
+          buffer) == free_buffers.end()) {
+        free_buffers.push_back(buffer);
+      }
+    }
+  }
+
+  vector<shared_ptr<SyncedMemory> > buffers(buffer_bytes.size());
+  for (int i = 0; i < buffers.size(); ++i) {
+    buffers[i].reset(new SyncedMemory(buffer_bytes[i]));
+  }
+  int num_shared_blobs = 0;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const int group = group_of_blob[blob_id];
+    if (group >= 0 && group_buffer[group] >= 0) {
+      blobs_[blob_id]->set_data(buffers[group_buffer[group]]);
+      ++num_shared_blobs;
+    }
+  }
+  size_t bytes_before = 0, bytes_after = 0;
+  for (int group = 0; group < num_groups; ++group) {
+    bytes_before += group_bytes[group];
+    if (group_buffer[group] < 0) {
+      bytes_after += group_bytes[group];
+    }
+  }
+  for (int i = 0; i < buffer_bytes.size(); ++i) {
+    bytes_after += buffer_bytes[i];
+  }
+  LOG(INFO) << "Memory planning: " << num_shared_blobs << " blobs share "
+      << buffers.size() << " buffers; memory required for data: "
+      << bytes_after << " instead of " << bytes_before;
+}
+
+template <typename Dtype>
+void Net<Dtype>::InitRecompute() {
+  has_recompute_ = false;
+  kept_bytes_ = live_bytes_ = 0;
+  vector<bool> layer_recompute(layers_.size(), false);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (!layers_[layer_id]->layer_param().recompute() || phase_ != TRAIN) {
+      continue;
+    }
+    const string& name = layer_names_[layer_id];
+    CHECK(layers_[layer_id]->AllowRecomputeForward()) << "Layer " << name
+        << " of type " << layers_[layer_id]->type()
+        << " cannot recompute its Forward";
+    CHECK(!bottom_id_vecs_[layer_id].empty()) << "Layer " << name
+        << " has no bottoms to recompute its tops from";
+    layer_recompute[layer_id] = true;
+    has_recompute_ = true;
+  }
+  if (!has_recompute_) {
+    blob_droppable_.clear();
+    blob_dropped_.clear();
+    blobs_to_drop_.clear();
+    blob_writers_.clear();
+    return;
+  }
+
+  // A blob may be dropped if the layer producing it is marked recompute, and
+  // it is neither an input nor an output of the net.
+  blob_writers_.assign(blobs_.size(), vector<int>());
+  vector<bool> pinned(blobs_.size(), false);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      blob_writers_[top_id_vecs_[layer_id][i]].push_back(layer_id);
+    }
+  }
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    pinned[net_input_blob_indices_[i]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    pinned[net_output_blob_indices_[i]] = true;
+  }
+  blob_droppable_.assign(blobs_.size(), false);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    // Splits and the like only pass their bottoms on by reference, and are
+    // recomputed along with them.
+    if (!layer_recompute[layer_id] && layers_[layer_id]->SharesBottomData()
+        && !bottom_ids.empty()) {
+      bool all_droppable = true;
+      for (int i = 0; i < bottom_ids.size(); ++i) {
+        all_droppable &= blob_droppable_[bottom_ids[i]];
+      }
+      layer_recompute[layer_id] = all_droppable;
+    }
+    if (!layer_recompute[layer_id]) {
+      continue;
+    }
+    for (int i = 0; i < top_ids.size(); ++i) {
+      const int top_id = top_ids[i];
+      if (std::find(bottom_ids.begin(), bottom_ids.end(), top_id)
+          != bottom_ids.end()) {
+        // computed in place, and recomputed along with the producer
+        continue;
+      }
+      // The layers after this one computing the top in place, such as a ReLU
+      // after a convolution, are recomputed with it. The top is kept if one
+      // of them cannot recompute its Forward.
+      const vector<int>& writers = blob_writers_[top_id];
+      bool droppable = !pinned[top_id];
+      for (int j = 1; j < writers.size(); ++j) {
+        const vector<int>& writer_bottoms = bottom_id_vecs_[writers[j]];
+        droppable &= std::find(writer_bottoms.begin(), writer_bottoms.end(),
+            top_id) != writer_bottoms.end()
+            && layers_[writers[j]]->AllowRecomputeForward();
+      }
+      blob_droppable_[top_id] = droppable;
+      for (int j = 1; droppable && j < writers.size(); ++j) {
+        layer_recompute[writers[j]] = true;
+      }
+    }
+  }
+
+  // Drop each blob after the last layer reading it in Forward, or reading a
+  // blob sharing its data.
+  vector<int> last_use(blobs_.size(), -1);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      last_use[bottom_id_vecs_[layer_id][i]] = layer_id;
+    }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      last_use[top_id_vecs_[layer_id][i]] = std::max(
+          last_use[top_id_vecs_[layer_id][i]], layer_id);
+    }
+  }
+  for (int layer_id = layers_.size() - 1; layer_id >= 0; --layer_id) {
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    if (!layers_[layer_id]->SharesBottomData() || bottom_ids.empty()) {
+      continue;
+    }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int bottom_id = bottom_ids[std::min<int>(i, bottom_ids.size() - 1)];
+      last_use[bottom_id] = std::max(last_use[bottom_id],
+          last_use[top_id_vecs_[layer_id][i]]);
+    }
+  }
+  blobs_to_drop_.assign(layers_.size(), vector<int>());
+  blob_dropped_.assign(blobs_.size(), true);
+  size_t droppable_bytes = 0;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const int layer_id = top_layer_indices_[blob_id].first;
+    const size_t bytes = (layer_id >= 0 && layers_[layer_id]->SharesBottomData())
+        ? 0 : blobs_[blob_id]->count() * sizeof(Dtype);
+    if (blob_droppable_[blob_id]) {
+      blobs_to_drop_[last_use[blob_id]].push_back(blob_id);
+      droppable_bytes += bytes;
+    } else {
+      blob_dropped_[blob_id] = false;
+      kept_bytes_ += bytes;
+    }
+  }
+  live_bytes_ = kept_bytes_;
+  reset_recompute_stats();
+  recompute_stats_.full_bytes = kept_bytes_ + droppable_bytes;
+  LOG(INFO) << "Recompute may drop " << droppable_bytes << " of the "
+      << recompute_stats_.full_bytes << " bytes of data";
+}
+
+template <typename Dtype>
+void Net<Dtype>::reset_recompute_stats() {
+  recompute_stats_.peak_bytes = live_bytes_;
+  recompute_stats_.num_forwards = recompute_stats_.num_recomputed = 0;
+  recompute_stats_.forward_seconds = recompute_stats_.recompute_seconds = 0;
+}
+
+template <typename Dtype>
+void Net<Dtype>::DropBlob(const int blob_id) {
+  if (!blob_droppable_[blob_id] || blob_dropped_[blob_id]) {
+    return;
+  }
+  // the old memory goes once no blob shares it any more
+  Blob<Dtype>* blob = blobs_[blob_id].get();
+  blob->set_data(shared_ptr<SyncedMemory>(
+      new SyncedMemory(blob->data()->size())));
+  blob_dropped_[blob_id] = true;
+  const int layer_id = top_layer_indices_[blob_id].first;
+  if (!layers_[layer_id]->SharesBottomData()) {
+    live_bytes_ -= blob->count() * sizeof(Dtype);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ProduceBlob(const int blob_id) {
+  if (!blob_droppable_[blob_id] || !blob_dropped_[blob_id]) {
+    return;
+  }
+  blob_dropped_[blob_id] = false;
+  const int layer_id = top_layer_indices_[blob_id].first;
+  if (!layers_[layer_id]->SharesBottomData()) {
+    live_bytes_ += blobs_[blob_id]->count() * sizeof(Dtype);
+    recompute_stats_.peak_bytes = std::max(recompute_stats_.peak_bytes,
+        live_bytes_);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::RecomputeBlob(const int blob_id, const int end) {
+  if (!blob_droppable_[blob_id] || !blob_dropped_[blob_id]) {
+    return;
+  }
+  // the producer, then the layers computing the blob in place after it
+  const vector<int>& writers = blob_writers_[blob_id];
+  for (int w = 0; w < writers.size() && writers[w] < end; ++w) {
+    const int layer_id = writers[w];
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      if (bottom_id_vecs_[layer_id][i] != blob_id) {
+        RecomputeBlob(bottom_id_vecs_[layer_id][i], layer_id);
+      }
+    }
+    layers_[layer_id]->Forward(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+    ++recompute_stats_.num_recomputed;
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      ProduceBlob(top_id_vecs_[layer_id][i]);
+    }
+  }
+}
+
+namespace {
+
+int FindRoot(vector<int>* parent, int i) {
+  while ((*parent)[i] != i) {
+    i = (*parent)[i] = (*parent)[(*parent)[i]];
+  }
+  return i;
+}
+
+// Makes every layer, taken in order, a successor of the layers before it
+// that last wrote what it reads or writes, and of those that read what it
+// writes since then.
+void AddDependencies(const vector<int>& order,
+    const vector<vector<int> >& reads, const vector<vector<int> >& writes,
+    vector<vector<int> >* successors) {
+  map<int, int> last_writer;
+  map<int, vector<int> > readers;
+  for (int i = 0; i < order.size(); ++i) {
+    const int layer_id = order[i];
+    set<int> before;
+    for (int j = 0; j < reads[layer_id].size(); ++j) {
+      const int resource = reads[layer_id][j];
+      if (last_writer.count(resource)) {
+        before.insert(last_writer[resource]);
+      }
+    }
+    for (int j = 0; j < writes[layer_id].size(); ++j) {
+      const int resource = writes[layer_id][j];
+      if (last_writer.count(resource)) {
+        before.insert(last_writer[resource]);
+      }
+      const vector<int>& resource_readers = readers[resource];
+      before.insert(resource_readers.begin(), resource_readers.end());
+    }
+    before.erase(layer_id);
+    for (set<int>::iterator it = before.begin(); it != before.end(); ++it) {
+      (*successors)[*it].push_back(layer_id);
+    }
+    for (int j = 0; j < reads[layer_id].size(); ++j) {
+      readers[reads[layer_id][j]].push_back(layer_id);
+    }
+    for (int j = 0; j < writes[layer_id].size(); ++j) {
+      last_writer[writes[layer_id][j]] = layer_id;
+      readers[writes[layer_id][j]].clear();
+    }
+  }
+}
+
+// Hands the layers of one Forward or Backward to the threads of a pool, each
+// once all those it depends on are done, earliest in the order first.
+class LayerScheduler {
+ public:
+  LayerScheduler(const vector<int>& layer_ids,
+      const vector<vector<int> >& successors, const vector<int>& num_deps,
+      const vector<bool>& exclusive, const boost::function<void(int)>& run)
+      : layer_ids_(layer_ids), successors_(successors), num_deps_(num_deps),
+        exclusive_(exclusive), run_(run), remaining_(layer_ids.size()) {
+    for (int i = 0; i < num_deps_.size(); ++i) {
+      if (num_deps_[i] == 0) { ready_.push(i); }
+    }
+  }
+
+  void Work(int thread_id) {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (true) {
+      while (ready_.empty() && remaining_ > 0) {
+        condition_.wait(lock);
+      }
+      if (ready_.empty()) {
+        return;
+      }
+      const int i = ready_.top();
+      ready_.pop();
+      lock.unlock();
+      if (exclusive_[i]) {
+        boost::mutex::scoped_lock exclusive_lock(exclusive_mutex_);
+        run_(layer_ids_[i]);
+      } else {
+        run_(layer_ids_[i]);
+      }
+      lock.lock();
+      for (int j = 0; j < successors_[i].size(); ++j) {
+        if (--num_deps_[successors_[i][j]] == 0) {
+          ready_.push(successors_[i][j]);
+          condition_.notify_one();
+        }
+      }
+      if (--remaining_ == 0) {
+        condition_.notify_all();
+      }
+    }
+  }
+
+ private:
+  // indexed by the position of the layers in the order
+  const vector<int>& layer_ids_;
+  const vector<vector<int> >& successors_;
+  vector<int> num_deps_;
+  const vector<bool>& exclusive_;
+  boost::function<void(int)> run_;
+  int remaining_;
+  std::priority_queue<int, vector<int>, std::greater<int> > ready_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+  boost::mutex exclusive_mutex_;
+};
+
+}  // namespace
+
+template <typename Dtype>
+void Net<Dtype>::InitSchedule() {
+  // Blobs sharing their data or their diff conflict as a whole: the data of
+  // blob i is resource i and its diff resource num_blobs + i.
+  const int num_blobs = blobs_.size();
+  vector<int> parent(2 * num_blobs);
+  for (int i = 0; i < parent.size(); ++i) {
+    parent[i] = i;
+  }
+  map<SyncedMemory*, int> resource_of_memory;
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    if (blobs_[blob_id]->count() == 0) {
+      continue;
+    }
+    SyncedMemory* memory[2] = {
+        blobs_[blob_id]->data().get(), blobs_[blob_id]->diff().get()};
+    for (int k = 0; k < 2; ++k) {
+      const int resource = k * num_blobs + blob_id;
+      if (resource_of_memory.count(memory[k])) {
+        parent[FindRoot(&parent, resource)] =
+            FindRoot(&parent, resource_of_memory[memory[k]]);
+      } else {
+        resource_of_memory[memory[k]] = resource;
+      }
+    }
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    if (bottom_ids.empty()) { continue; }
+    const bool shares[2] = {layers_[layer_id]->SharesBottomData(),
+        layers_[layer_id]->SharesBottomDiff()};
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int bottom_id = bottom_ids[std::min<int>(i, bottom_ids.size() - 1)];
+      for (int k = 0; k < 2; ++k) {
+        if (!shares[k]) { continue; }
+        parent[FindRoot(&parent, k * num_blobs + top_id_vecs_[layer_id][i])] =
+            FindRoot(&parent, k * num_blobs + bottom_id);
+      }
+    }
+  }
+
+  // Forward reads the data of the bottoms and writes that of the tops.
+  // Backward reads the tops and the data of the bottoms and writes the diffs
+  // of the bottoms; the param diffs are each layer's own.
+  const int num_layers = layers_.size();
+  vector<vector<int> > forward_reads(num_layers), forward_writes(num_layers);
+  vector<vector<int> > backward_reads(num_layers), backward_writes(num_layers);
+  vector<int> forward_order(num_layers), backward_order(num_layers);
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    forward_order[layer_id] = layer_id;
+    backward_order[layer_id] = num_layers - 1 - layer_id;
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      const int bottom_id = bottom_id_vecs_[layer_id][i];
+      forward_reads[layer_id].push_back(FindRoot(&parent, bottom_id));
+      if (layer_need_backward_[layer_id]) {
+        backward_reads[layer_id].push_back(FindRoot(&parent, bottom_id));
+        backward_writes[layer_id].push_back(
+            FindRoot(&parent, num_blobs + bottom_id));
+      }
+    }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int top_id = top_id_vecs_[layer_id][i];
+      forward_writes[layer_id].push_back(FindRoot(&parent, top_id));
+      if (layer_need_backward_[layer_id]) {
+        backward_reads[layer_id].push_back(FindRoot(&parent, top_id));
+        backward_reads[layer_id].push_back(
+            FindRoot(&parent, num_blobs + top_id));
+      }
+    }
+  }
+  forward_successors_.assign(num_layers, vector<int>());
+  backward_successors_.assign(num_layers, vector<int>());
+  AddDependencies(forward_order, forward_reads, forward_writes,
+      &forward_successors_);
+  AddDependencies(backward_order, backward_reads, backward_writes,
+      &backward_successors_);
+  layer_losses_.resize(num_layers);
+}
+
 template <typename Dtype>
 void Net<Dtype>::FilterNet(const NetParameter& param,
     NetParameter* param_filtered) {
@@ -342,6 +966,79 @@ void Net<Dtype>::FilterNet(const NetParameter& param,
   }
 }
 
+// Whether the bottoms or tops of a layer include a blob.
+static bool HasBlob(const google::protobuf::RepeatedPtrField<string>& blobs,
+    const string& blob_name) {
+  return std::find(blobs.begin(), blobs.end(), blob_name) != blobs.end();
+}
+
+template <typename Dtype>
+void Net<Dtype>::FoldBatchNorm(const NetParameter& param,
+    NetParameter* param_folded, map<string, string>* folded) {
+  folded->clear();
+  vector<LayerParameter> layers(param.layer().begin(), param.layer().end());
+  vector<bool> removed(layers.size(), false);
+  for (int bn_id = 0; bn_id < layers.size(); ++bn_id) {
+    const LayerParameter& bn_param = layers[bn_id];
+    if (bn_param.type() != "BN" || bn_param.bottom_size() != 1 ||
+        bn_param.top_size() != 1) {
+      continue;
+    }
+    const string& blob_name = bn_param.bottom(0);
+    // the layer writing the bottom of the BN
+    int layer_id = bn_id - 1;
+    while (layer_id >= 0 && !HasBlob(layers[layer_id].top(), blob_name)) {
+      --layer_id;
+    }
+    if (layer_id < 0) {
+      continue;
+    }
+    LayerParameter* layer_param = &layers[layer_id];
+    if ((layer_param->type() != "Convolution" &&
+        layer_param->type() != "InnerProduct") ||
+        layer_param->bottom_size() != 1 || layer_param->top_size() != 1) {
+      continue;
+    }
+    // weights shared with another layer would be folded for both
+    bool shared = false;
+    for (int i = 0; i < layer_param->param_size(); ++i) {
+      shared |= layer_param->param(i).has_name();
+    }
+    // the BN must be the only reader of the blob, up to its next writer
+    bool read_elsewhere = false;
+    for (int i = layer_id + 1; i < layers.size() && !read_elsewhere; ++i) {
+      if (i == bn_id) {
+        if (bn_param.top(0) == blob_name) {
+          break;
+        }
+        continue;
+      }
+      read_elsewhere = HasBlob(layers[i].bottom(), blob_name);
+      if (HasBlob(layers[i].top(), blob_name)) {
+        break;
+      }
+    }
+    if (shared || read_elsewhere) {
+      continue;
+    }
+    layer_param->set_top(0, bn_param.top(0));
+    if (layer_param->type() == "Convolution") {
+      layer_param->mutable_convolution_param()->set_bias_term(true);
+    } else {
+      layer_param->mutable_inner_product_param()->set_bias_term(true);
+    }
+    removed[bn_id] = true;
+    (*folded)[bn_param.name()] = layer_param->name();
+  }
+  param_folded->CopyFrom(param);
+  param_folded->clear_layer();
+  for (int i = 0; i < layers.size(); ++i) {
+    if (!removed[i]) {
+      param_folded->add_layer()->CopyFrom(layers[i]);
+    }
+  }
+}
+
 template <typename Dtype>
 bool Net<Dtype>::StateMeetsRule(const NetState& state,
     const NetStateRule& rule, const string& layer_name) {
@@ -559,21 +1256,127 @@ void Net<Dtype>::GetLearningRateAndWeightDecay() {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::set_max_concurrency(int max_concurrency) {
+  CHECK_GT(max_concurrency, 0);
+  if (max_concurrency == max_concurrency_) {
+    return;
+  }
+  max_concurrency_ = max_concurrency;
+  if (max_concurrency_ > 1) {
+    LOG(INFO) << "Running up to " << max_concurrency_
+              << " independent layers at once, on Caffe::thread_pool()";
+  }
+}
+
+template <typename Dtype>
+bool Net<Dtype>::UseConcurrency(int start, int end) const {
+#ifdef USE_MPI
+  // Every rank must issue the collectives of the gradient sum and of the
+  // Gather/Scatter layers in the same order, that of the layers.
+  if (Caffe::parallel_mode() == Caffe::MPI) {
+    return false;
+  }
+#endif
+  // Debug info is printed, and dropped blobs are recomputed, in layer order.
+  return max_concurrency_ > 1 && start < end && !debug_info_ &&
+      !has_recompute_ && Caffe::mode() == Caffe::CPU &&
+      Caffe::num_threads() > 1;
+}
+
+template <typename Dtype>
+void Net<Dtype>::RunConcurrently(int start, int end, bool forward) {
+  const vector<vector<int> >& layer_successors =
+      forward ? forward_successors_ : backward_successors_;
+  const int num_layers = std::abs(end - start) + 1;
+  const int step = forward ? 1 : -1;
+  vector<int> layer_ids(num_layers);
+  vector<bool> exclusive(num_layers);
+  for (int i = 0; i < num_layers; ++i) {
+    layer_ids[i] = start + step * i;
+    exclusive[i] = !layers_[layer_ids[i]]->AllowConcurrentExecution();
+  }
+  // by position in the order, leaving out layers beyond end
+  vector<vector<int> > successors(num_layers);
+  vector<int> num_deps(num_layers, 0);
+  for (int i = 0; i < num_layers; ++i) {
+    const vector<int>& after = layer_successors[layer_ids[i]];
+    for (int j = 0; j < after.size(); ++j) {
+      const int position = (after[j] - start) * step;
+      if (position < num_layers) {
+        successors[i].push_back(position);
+        ++num_deps[position];
+      }
+    }
+  }
+  LayerScheduler scheduler(layer_ids, successors, num_deps, exclusive,
+      boost::bind(&Net<Dtype>::RunLayer, this, forward, _1));
+  // every thread taking part runs layers until all are done; the layers
+  // split their own work over the same pool
+  shared_ptr<ThreadPool> pool = Caffe::thread_pool();
+  pool->ParallelFor(std::min(max_concurrency_, pool->num_threads()),
+      boost::bind(&LayerScheduler::Work, &scheduler, _2));
+}
+
+template <typename Dtype>
+void Net<Dtype>::RunLayer(bool forward, int layer_id) {
+  if (forward) {
+    layer_losses_[layer_id] =
+        layers_[layer_id]->Forward(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+  } else if (layer_need_backward_[layer_id]) {
+    layers_[layer_id]->Backward(top_vecs_[layer_id],
+        bottom_need_backward_[layer_id], bottom_vecs_[layer_id]);
+  }
+}
+
 template <typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
   CHECK_LT(end, layers_.size());
   Dtype loss = 0;
+  if (UseConcurrency(start, end)) {
+    RunConcurrently(start, end, true);
+    // summed in the same order as below
+    for (int i = start; i <= end; ++i) {
+      loss += layer_losses_[i];
+    }
+    return loss;
+  }
   if (debug_info_) {
     for (int i = 0; i < net_input_blobs_.size(); ++i) {
       InputDebugInfo(i);
     }
   }
+  Timer timer;
+  if (has_recompute_) { timer.Start(); }
+  if (has_recompute_ && start > 0) {
+    // what the layers before start computed may be dropped since
+    for (int i = start; i <= end; ++i) {
+      for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+        const int blob_id = bottom_id_vecs_[i][j];
+        if (top_layer_indices_[blob_id].first < start) {
+          RecomputeBlob(blob_id, start);
+        }
+      }
+    }
+  }
   for (int i = start; i <= end; ++i) {
     // LOG(ERROR) << "Forwarding " << layer_names_[i];
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
     loss += layer_loss;
     if (debug_info_) { ForwardDebugInfo(i); }
+    if (has_recompute_) {
+      for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+        ProduceBlob(top_id_vecs_[i][j]);
+      }
+      for (int j = 0; j < blobs_to_drop_[i].size(); ++j) {
+        DropBlob(blobs_to_drop_[i][j]);
+      }
+    }
+  }
+  if (has_recompute_) {
+    recompute_stats_.num_forwards += end - start + 1;
+    recompute_stats_.forward_seconds += timer.Seconds();
   }
 
 #ifdef USE_CUDNN
@@ -637,15 +1440,31 @@ template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  if (UseConcurrency(end, start)) {
+    RunConcurrently(start, end, false);
+    return;
+  }
 
   for (int i = start; i >= end; --i) {
     if (layer_need_backward_[i]) {
+      if (has_recompute_) {
+        Timer timer;
+        timer.Start();
+        for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+          RecomputeBlob(bottom_id_vecs_[i][j], layers_.size());
+        }
+        for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+          RecomputeBlob(top_id_vecs_[i][j], layers_.size());
+        }
+        recompute_stats_.recompute_seconds += timer.Seconds();
+      }
       layers_[i]->Backward(
           top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
       if (debug_info_) { BackwardDebugInfo(i); }
 
 #ifdef USE_MPI
-      if ((Caffe::parallel_mode() == Caffe::MPI) && (Caffe::remaining_sub_iter() == 0)) {
+      if ((Caffe::parallel_mode() == Caffe::MPI) && sync_gradients_ &&
+          (Caffe::remaining_sub_iter() == 0)) {
         for (int n = 0; n < param_layer_indices_.size(); ++n) {
           bool ready_for_sync = false;
 
@@ -669,19 +1488,59 @@ void Net<Dtype>::BackwardFromTo(int start, int end) {
             }
           }
           //sync gradient
-          if (ready_for_sync && layers_[i]->need_sync())
-            caffe_iallreduce(
-                this->params_[n]->mutable_cpu_diff(),
-                this->params_[n]->count()
-            );
+          if (ready_for_sync && layers_[i]->need_sync()) {
+            if (gradient_buckets_) {
+              gradient_buckets_->Add(this->params_[n]->mutable_cpu_diff(),
+                                     this->params_[n]->count());
+            } else {
+              caffe_iallreduce_gradient(
+                  this->params_[n]->mutable_cpu_diff(),
+                  this->params_[n]->count()
+              );
+            }
+          }
         }
       }
 #endif //USE_MPI
 
     }
+    if (has_recompute_) {
+      // The tops of this layer are needed by no Backward still to come. Those
+      // it computes in place are dropped after the Backward of their producer.
+      const vector<int>& bottom_ids = bottom_id_vecs_[i];
+      for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+        if (std::find(bottom_ids.begin(), bottom_ids.end(),
+            top_id_vecs_[i][j]) == bottom_ids.end()) {
+          DropBlob(top_id_vecs_[i][j]);
+        }
+      }
+    }
   }
+#ifdef USE_MPI
+  // the last bucket is not full, send it rather than wait for Finish
+  if (gradient_buckets_ && (Caffe::parallel_mode() == Caffe::MPI) &&
+      sync_gradients_ && (Caffe::remaining_sub_iter() == 0)) {
+    gradient_buckets_->Flush();
+  }
+#endif
 }
 
+#ifdef USE_MPI
+template <typename Dtype>
+void Net<Dtype>::set_gradient_bucket_bytes(size_t bucket_bytes) {
+  gradient_buckets_.reset(new GradientBuckets<Dtype>(bucket_bytes));
+}
+
+template <typename Dtype>
+void Net<Dtype>::FinishGradientSync() {
+  if (gradient_buckets_) {
+    gradient_buckets_->Finish();
+  } else {
+    mpi_force_synchronize();
+  }
+}
+#endif
+
 template <typename Dtype>
 void Net<Dtype>::InputDebugInfo(const int input_id) {
   const Blob<Dtype>& blob = *net_input_blobs_[input_id];
@@ -759,8 +1618,49 @@ void Net<Dtype>::UpdateDebugInfo(const int param_id) {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::SaveRecurrentState(const int n,
+    vector<shared_ptr<Blob<Dtype> > >* state) const {
+  int num_states = 0;
+  for (int i = 0; i < layers_.size(); ++i) {
+    if (!layers_[i]->HasRecurrentState()) {
+      continue;
+    }
+    if (num_states == state->size()) {
+      state->push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    }
+    layers_[i]->SaveRecurrentState(n, (*state)[num_states++].get());
+  }
+  state->resize(num_states);
+}
+
+template <typename Dtype>
+void Net<Dtype>::RestoreRecurrentState(const int n,
+    const vector<shared_ptr<Blob<Dtype> > >& state) {
+  int num_states = 0;
+  for (int i = 0; i < layers_.size(); ++i) {
+    if (!layers_[i]->HasRecurrentState()) {
+      continue;
+    }
+    CHECK_LT(num_states, state.size()) << "State of another net";
+    layers_[i]->RestoreRecurrentState(n, *state[num_states++]);
+  }
+  CHECK_EQ(num_states, state.size()) << "State of another net";
+}
+
+template <typename Dtype>
+void Net<Dtype>::ResetRecurrentState(const int n) {
+  for (int i = 0; i < layers_.size(); ++i) {
+    if (layers_[i]->HasRecurrentState()) {
+      layers_[i]->ResetRecurrentState(n);
+    }
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::ShareTrainedLayersWith(const Net* other) {
+  CHECK(folded_bn_index_.empty())
+      << "A net folding BN layers must copy its parameters, not share them";
   int num_source_layers = other->layers().size();
   for (int i = 0; i < num_source_layers; ++i) {
     Layer<Dtype>* source_layer = other->layers()[i].get();
@@ -831,32 +1731,132 @@ void Net<Dtype>::Reshape() {
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
   int num_source_layers = param.layer_size();
+  set<string> source_layer_names;
   for (int i = 0; i < num_source_layers; ++i) {
     const LayerParameter& source_layer = param.layer(i);
     const string& source_layer_name = source_layer.name();
-    int target_layer_id = 0;
-    while (target_layer_id != layer_names_.size() &&
-        layer_names_[target_layer_id] != source_layer_name) {
-      ++target_layer_id;
-    }
-    if (target_layer_id == layer_names_.size()) {
+    vector<shared_ptr<Blob<Dtype> > >* target_blobs =
+        TrainedLayerBlobs(source_layer_name, source_layer.blobs_size());
+    if (!target_blobs) {
       DLOG(INFO) << "Ignoring source layer " << source_layer_name;
       continue;
     }
     DLOG(INFO) << "Copying source layer " << source_layer_name;
-    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
-        layers_[target_layer_id]->blobs();
-    CHECK_EQ(target_blobs.size(), source_layer.blobs_size())
-        << "Incompatible number of blobs for layer " << source_layer_name;
-    for (int j = 0; j < target_blobs.size(); ++j) {
+    source_layer_names.insert(source_layer_name);
+    for (int j = 0; j < source_layer.blobs_size(); ++j) {
       const bool kReshape = source_layer.check_shape();
-      target_blobs[j]->FromProto(source_layer.blobs(j), !kReshape);
+      (*target_blobs)[j]->FromProto(source_layer.blobs(j), !kReshape);
+    }
+  }
+  FoldTrainedBatchNorm(source_layer_names);
+}
+
+template <typename Dtype>
+void Net<Dtype>::CopyTrainedLayersFrom(const WeightPack& pack) {
+  const vector<WeightPack::LayerEntry>& source_layers = pack.layers();
+  set<string> source_layer_names;
+  for (int i = 0; i < source_layers.size(); ++i) {
+    const WeightPack::LayerEntry& source_layer = source_layers[i];
+    vector<shared_ptr<Blob<Dtype> > >* target =
+        TrainedLayerBlobs(source_layer.name, source_layer.blobs.size());
+    if (!target) {
+      DLOG(INFO) << "Ignoring source layer " << source_layer.name;
+      continue;
+    }
+    DLOG(INFO) << "Copying source layer " << source_layer.name;
+    source_layer_names.insert(source_layer.name);
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs = *target;
+    for (int j = 0; j < source_layer.blobs.size(); ++j) {
+      const WeightPack::BlobEntry& source_blob = source_layer.blobs[j];
+      if (source_layer.check_shape) {
+        CHECK(target_blobs[j]->ShapeEquals(
+            WeightPack::ShapeProto(source_blob)))
+            << "shape mismatch (reshape not set)";
+      } else {
+        target_blobs[j]->Reshape(source_blob.shape);
+      }
+      // straight from the mapping into the blob
+      std::copy(source_blob.data, source_blob.data + source_blob.count,
+          target_blobs[j]->mutable_cpu_data());
+    }
+  }
+  FoldTrainedBatchNorm(source_layer_names);
+}
+
+template <typename Dtype>
+vector<shared_ptr<Blob<Dtype> > >* Net<Dtype>::TrainedLayerBlobs(
+    const string& layer_name, const int num_source_blobs) {
+  map<string, int>::const_iterator folded_bn =
+      folded_bn_index_.find(layer_name);
+  if (folded_bn != folded_bn_index_.end()) {
+    CHECK_EQ(4, num_source_blobs)
+        << "Incompatible number of blobs for layer " << layer_name;
+    return &folded_bn_blobs_[folded_bn->second];
+  }
+  map<string, int>::const_iterator layer = layer_names_index_.find(layer_name);
+  if (layer == layer_names_index_.end()) {
+    return NULL;
+  }
+  vector<shared_ptr<Blob<Dtype> > >& blobs = layers_[layer->second]->blobs();
+  if (num_source_blobs + 1 == blobs.size() &&
+      std::find(folded_bn_layer_ids_.begin(), folded_bn_layer_ids_.end(),
+      layer->second) != folded_bn_layer_ids_.end()) {
+    // the bias the layer gained for its BN starts from 0
+    caffe_set(blobs[1]->count(), Dtype(0), blobs[1]->mutable_cpu_data());
+  } else {
+    CHECK_EQ(blobs.size(), num_source_blobs)
+        << "Incompatible number of blobs for layer " << layer_name;
+  }
+  return &blobs;
+}
+
+template <typename Dtype>
+void Net<Dtype>::FoldTrainedBatchNorm(const set<string>& source_layer_names) {
+  for (map<string, int>::const_iterator bn = folded_bn_index_.begin();
+      bn != folded_bn_index_.end(); ++bn) {
+    const int layer_id = folded_bn_layer_ids_[bn->second];
+    const bool has_bn = source_layer_names.count(bn->first);
+    const bool has_layer = source_layer_names.count(layer_names_[layer_id]);
+    if (!has_bn && !has_layer) {
+      continue;
+    }
+    // folding again into parameters folded before would be wrong
+    CHECK(has_bn && has_layer) << "Folding " << bn->first << " into "
+        << layer_names_[layer_id] << " needs the parameters of both copied "
+        << "together";
+    // y = (x - mean) * inv_std * slope + bias, per output channel; the rows
+    // of the weights of both Convolution and InnerProduct are those channels
+    const vector<shared_ptr<Blob<Dtype> > >& bn_blobs =
+        folded_bn_blobs_[bn->second];
+    const Dtype* slope = bn_blobs[0]->cpu_data();
+    const Dtype* shift = bn_blobs[1]->cpu_data();
+    const Dtype* mean = bn_blobs[2]->cpu_data();
+    const Dtype* inv_std = bn_blobs[3]->cpu_data();
+    Blob<Dtype>* weight = layers_[layer_id]->blobs()[0].get();
+    Blob<Dtype>* bias = layers_[layer_id]->blobs()[1].get();
+    const int channels = bias->count();
+    CHECK_EQ(channels, bn_blobs[0]->count()) << "Channels of " << bn->first
+        << " do not match the outputs of " << layer_names_[layer_id];
+    const int dim = weight->count() / channels;
+    Dtype* weight_data = weight->mutable_cpu_data();
+    Dtype* bias_data = bias->mutable_cpu_data();
+    for (int c = 0; c < channels; ++c) {
+      const Dtype scale = slope[c] * inv_std[c];
+      caffe_scal(dim, scale, weight_data + c * dim);
+      bias_data[c] = (bias_data[c] - mean[c]) * scale + shift[c];
     }
   }
 }
 
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const string trained_filename) {
+  if (IsWeightPack(trained_filename)) {
+    WeightPack pack;
+    CHECK(pack.Open(trained_filename))
+        << "Failed to read weight pack " << trained_filename;
+    CopyTrainedLayersFrom(pack);
+    return;
+  }
   NetParameter param;
   ReadNetParamsFromBinaryFileOrDie(trained_filename, &param);
   CopyTrainedLayersFrom(param);
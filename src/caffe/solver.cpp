@@ -4,17 +4,39 @@
 #include <string>
 #include <vector>
 
+#include <boost/bind.hpp>
+
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/snapshot_writer.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 #include "caffe/util/mpi_functions.hpp"
 #include "caffe/util/channel.hpp"
 
 namespace caffe {
 
+#ifdef USE_MPI
+namespace {
+
+// Creating a backend takes collectives, so this runs on the transmission
+// thread of MPIComm.
+void SetUpAllreduceBackends(const SolverParameter& param) {
+  MPIComm::SetAllreduceBackend(shared_ptr<AllreduceBackend>(
+      CreateAllreduceBackend(param.mpi_allreduce(),
+                             param.mpi_allreduce_chunk_bytes())));
+  MPIComm::SetGradientBackend(shared_ptr<AllreduceBackend>(
+      CreateGradientBackend(param.mpi_allreduce(),
+                            param.mpi_allreduce_chunk_bytes(),
+                            param.mpi_gradient_compression(),
+                            param.mpi_top_k_ratio())));
+}
+
+}  // namespace
+#endif
+
 template <typename Dtype>
 Solver<Dtype>::Solver(const SolverParameter& param)
     : net_() {
@@ -41,6 +63,9 @@ void Solver<Dtype>::Init(const SolverParameter& param) {
 #ifdef USE_CUDNN
   Caffe::set_cudnn_mem_richness(param_.richness());
 #endif
+  if (param_.snapshot_max_pending() > 0) {
+    snapshot_writer_.reset(new SnapshotWriter(param_.snapshot_max_pending()));
+  }
   // Scaffolding code
   InitTrainNet();
   InitTestNets();
@@ -85,6 +110,15 @@ void Solver<Dtype>::InitTrainNet() {
   net_state.MergeFrom(param_.train_state());
   net_param.mutable_state()->CopyFrom(net_state);
   net_.reset(new Net<Dtype>(net_param));
+#ifdef USE_MPI
+  net_->set_gradient_bucket_bytes(param_.mpi_bucket_bytes());
+  CHECK_GE(param_.mpi_local_steps(), 1);
+  net_->set_sync_gradients(param_.mpi_local_steps() == 1);
+  if (Caffe::parallel_mode() == Caffe::MPI) {
+    MPIComm::SetMaxInFlight(param_.mpi_max_in_flight());
+    MPIComm::Run(boost::bind(&SetUpAllreduceBackends, boost::cref(param_)));
+  }
+#endif
 }
 
 template <typename Dtype>
@@ -196,7 +230,13 @@ void Solver<Dtype>::Step(int iters) {
         && (iter_ > 0 || param_.test_initialization())) {
 #ifdef USE_MPI
       if (Caffe::parallel_mode()==Caffe::MPI){
+        // local SGD ranks are only in step right after an average, and a
+        // broadcast of rank 0 would drop the updates of the others
+        if (param_.mpi_local_steps() > 1) {
+          AverageParamsOffSchedule();
+        } else {
           SyncData();
+        }
       }
 #endif
       TestAll();
@@ -217,7 +257,9 @@ void Solver<Dtype>::Step(int iters) {
     if (Caffe::parallel_mode() == Caffe::MPI) {
       DLOG(INFO)<<"Communication";
 
-      SyncGradient();
+      if (param_.mpi_local_steps() == 1) {
+        SyncGradient();
+      }
 
       SyncOutput(this->net_);
 
@@ -257,6 +299,16 @@ void Solver<Dtype>::Step(int iters) {
               << result_vec[k] << loss_msg_stream.str();
         }
       }
+      if (net_->has_recompute()) {
+        const typename Net<Dtype>::RecomputeStats& stats =
+            net_->recompute_stats();
+        LOG(INFO) << "    Recompute: peak data " << stats.peak_bytes / 1048576.
+            << " MB instead of " << stats.full_bytes / 1048576. << " MB, "
+            << stats.num_recomputed << " layer forwards recomputed for "
+            << stats.num_forwards << " (" << stats.recompute_seconds
+            << " s for " << stats.forward_seconds << " s of Forward)";
+        net_->reset_recompute_stats();
+      }
     }
     ApplyUpdate();
 
@@ -264,9 +316,25 @@ void Solver<Dtype>::Step(int iters) {
     // the number of times the weights have been updated.
     ++iter_;
 
+#ifdef USE_MPI
+    if (Caffe::parallel_mode() == Caffe::MPI &&
+        param_.mpi_local_steps() > 1 &&
+        iter_ % param_.mpi_local_steps() == 0) {
+      AverageParams();
+    }
+#endif
+
     // Save a snapshot if needed.
     if (param_.snapshot() && iter_ % param_.snapshot() == 0) {
+#ifdef USE_MPI
+      AverageParamsOffSchedule();
+      // the ranks share the snapshot files, the first one writes them
+      if (Caffe::MPI_my_rank() == 0) {
+        Snapshot();
+      }
+#else
       Snapshot();
+#endif
     }
   }
 }
@@ -281,7 +349,7 @@ void Solver<Dtype>::SyncGradient(){
   double t1, t2;
   t1 = MPI_Wtime();
 
-  mpi_force_synchronize();
+  this->net_->FinishGradientSync();
   for (int param_id = 0; param_id < net_params.size(); ++param_id) {
     int param_owner = param_owners[param_id];
 
@@ -310,6 +378,78 @@ void Solver<Dtype>::SyncGradient(){
   }
   t2 = MPI_Wtime();
   DLOG(INFO)<<"Communication time "<<t2-t1<<" second";
+  const GradientBuckets<Dtype>* buckets = this->net_->gradient_buckets();
+  if (buckets) {
+    DLOG(INFO)<<"Gradient allreduce time "<<buckets->comm_seconds()
+              <<" second, "<<std::max(buckets->comm_seconds()
+                                      - buckets->wait_seconds(), 0.)
+              <<" second of it hidden behind backward";
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::AverageAcrossRanks(const vector<Blob<Dtype>*>& blobs){
+  for (int i = 0; i < blobs.size(); ++i) {
+    caffe_iallreduce(blobs[i]->mutable_cpu_data(), blobs[i]->count());
+  }
+  mpi_force_synchronize();
+  for (int i = 0; i < blobs.size(); ++i) {
+#ifndef CPU_ONLY
+    caffe_gpu_scal(blobs[i]->count(),
+                   Dtype(1.)/Dtype(Caffe::MPI_all_rank()),
+                   blobs[i]->mutable_gpu_data());
+#else
+    caffe_scal(blobs[i]->count(),
+               Dtype(1.)/Dtype(Caffe::MPI_all_rank()),
+               blobs[i]->mutable_cpu_data());
+#endif
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::AverageParams(){
+  const vector<int>& param_owners = this->net_->param_owners();
+  const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
+  vector<Blob<Dtype>*> blobs;
+  size_t param_count = 0;
+  for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    // shared params are averaged through their owner
+    if (param_owners[param_id] == -1 &&
+        this->net_->layer_by_param(param_id)->need_sync()) {
+      blobs.push_back(net_params[param_id].get());
+      param_count += net_params[param_id]->count();
+    }
+  }
+  if (param_.mpi_average_history()) {
+    const vector<Blob<Dtype>*> history = HistoryBlobs();
+    blobs.insert(blobs.end(), history.begin(), history.end());
+  }
+  size_t count = 0;
+  for (int i = 0; i < blobs.size(); ++i) {
+    count += blobs[i]->count();
+  }
+  double t1, t2;
+  t1 = MPI_Wtime();
+  AverageAcrossRanks(blobs);
+  t2 = MPI_Wtime();
+  // compared with summing the gradients every iteration
+  const int local_steps = param_.mpi_local_steps();
+  const double mb = count * sizeof(Dtype) / 1048576.;
+  const double gradient_mb =
+      local_steps * param_count * sizeof(Dtype) / 1048576.;
+  if (param_.display() && iter_ % param_.display() < local_steps) {
+    LOG(INFO)<<"Averaged parameters across ranks after "<<local_steps
+             <<" local steps: "<<mb<<" MB in "<<t2-t1<<" second, instead of "
+             <<gradient_mb<<" MB of gradients";
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::AverageParamsOffSchedule(){
+  if (Caffe::parallel_mode() == Caffe::MPI && param_.mpi_local_steps() > 1 &&
+      iter_ % param_.mpi_local_steps() != 0) {
+    AverageParams();
+  }
 }
 
 template <typename Dtype>
@@ -385,17 +525,23 @@ void Solver<Dtype>::Solve(const char* resume_file) {
     #ifndef USE_MPI
     Snapshot();
     #else
+    AverageParamsOffSchedule();
     if (Caffe::MPI_my_rank() == 0){
       Snapshot();
     }
-    if (Caffe::parallel_mode() == Caffe::MPI){
-      //Stop the world to wait for the master process to finish snapshot
-      //TODO: Send this to queue in blocking mode
-      MPIComm::Syncrhonize();
-      MPI_Barrier(MPI_COMM_WORLD);
-    }
     #endif
   }
+  // the snapshots must all be on disk when training is over
+  if (snapshot_writer_) {
+    snapshot_writer_->WaitAll();
+  }
+  #ifdef USE_MPI
+  if (Caffe::parallel_mode() == Caffe::MPI){
+    //Stop the world to wait for the master process to finish snapshot
+    MPIComm::Syncrhonize();
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+  #endif
 
 
   // After the optimization is done, run an additional train and test pass to
@@ -489,9 +635,11 @@ void Solver<Dtype>::Test(const int test_net_id) {
 
 template <typename Dtype>
 void Solver<Dtype>::Snapshot() {
-  NetParameter net_param;
+  // The protos are copies of the blobs, so they can be written while
+  // training goes on.
+  shared_ptr<NetParameter> net_param(new NetParameter());
   // For intermediate results, we will also dump the gradient values.
-  net_->ToProto(&net_param, param_.snapshot_diff());
+  net_->ToProto(net_param.get(), param_.snapshot_diff());
   string filename(param_.snapshot_prefix());
   string model_filename, snapshot_filename;
   const int kBufferSize = 20;
@@ -499,16 +647,24 @@ void Solver<Dtype>::Snapshot() {
   snprintf(iter_str_buffer, kBufferSize, "_iter_%d", iter_);
   filename += iter_str_buffer;
   model_filename = filename + ".caffemodel";
-  LOG(INFO) << "Snapshotting to " << model_filename;
-  WriteProtoToBinaryFile(net_param, model_filename.c_str());
-  SolverState state;
-  SnapshotSolverState(&state);
-  state.set_iter(iter_);
-  state.set_learned_net(model_filename);
-  state.set_current_step(current_step_);
+  shared_ptr<SolverState> state(new SolverState());
+  SnapshotSolverState(state.get());
+  state->set_iter(iter_);
+  state->set_learned_net(model_filename);
+  state->set_current_step(current_step_);
   snapshot_filename = filename + ".solverstate";
-  LOG(INFO) << "Snapshotting solver state to " << snapshot_filename;
-  WriteProtoToBinaryFile(state, snapshot_filename.c_str());
+  if (snapshot_writer_) {
+    LOG(INFO) << "Snapshotting to " << model_filename << " in the background";
+    snapshot_writer_->Write(net_param, model_filename);
+    LOG(INFO) << "Snapshotting solver state to " << snapshot_filename
+              << " in the background";
+    snapshot_writer_->Write(state, snapshot_filename);
+  } else {
+    LOG(INFO) << "Snapshotting to " << model_filename;
+    WriteProtoToBinaryFile(*net_param, model_filename.c_str());
+    LOG(INFO) << "Snapshotting solver state to " << snapshot_filename;
+    WriteProtoToBinaryFile(*state, snapshot_filename.c_str());
+  }
 }
 
 template <typename Dtype>
@@ -772,6 +928,17 @@ void SGDSolver<Dtype>::SnapshotSolverState(SolverState* state) {
   }
 }
 
+#ifdef USE_MPI
+template <typename Dtype>
+vector<Blob<Dtype>*> SGDSolver<Dtype>::HistoryBlobs() {
+  vector<Blob<Dtype>*> blobs;
+  for (int i = 0; i < history_.size(); ++i) {
+    blobs.push_back(history_[i].get());
+  }
+  return blobs;
+}
+#endif
+
 template <typename Dtype>
 void SGDSolver<Dtype>::RestoreSolverState(const SolverState& state) {
   CHECK_EQ(state.history_size(), history_.size())
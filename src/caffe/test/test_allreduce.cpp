@@ -0,0 +1,356 @@
+#ifdef USE_MPI
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/solver.hpp"
+#include "caffe/util/allreduce.hpp"
+#include "caffe/util/channel.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/mpi_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Run with mpirun -np N to test across ranks; with one process every backend
+// is a copy.
+template <typename Dtype>
+class AllreduceTest : public ::testing::Test {
+ protected:
+  AllreduceTest() {
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank_);
+  }
+
+  MPI_Datatype type() const {
+    return sizeof(Dtype) == sizeof(float) ? MPI_FLOAT : MPI_DOUBLE;
+  }
+
+  void CheckMatchesMPI(AllreduceBackend* backend, const int count,
+      const bool in_place) {
+    // small integers, so the sum is exact in any order
+    vector<Dtype> src(count);
+    for (int i = 0; i < count; ++i) {
+      src[i] = (i * 7 + rank_ * 13) % 101;
+    }
+    vector<Dtype> expected(count);
+    MPI_Allreduce(&src[0], &expected[0], count, type(), MPI_SUM,
+        MPI_COMM_WORLD);
+    vector<Dtype> dst(src);
+    if (in_place) {
+      backend->Allreduce(&dst[0], &dst[0], count, type());
+    } else {
+      backend->Allreduce(&src[0], &dst[0], count, type());
+    }
+    for (int i = 0; i < count; ++i) {
+      ASSERT_EQ(expected[i], dst[i]) << backend->type() << " count " << count
+          << " index " << i;
+    }
+  }
+
+  void CheckAlgorithm(SolverParameter_AllreduceAlgorithm algorithm) {
+    // counts smaller than, and not divisible by, the number of ranks
+    const int counts[] = {1, 2, 3, 5, 17, 1000, 100003};
+    // tiny chunks split every segment into many messages
+    const size_t chunk_bytes[] = {8, 256, 1048576};
+    for (int c = 0; c < 3; ++c) {
+      shared_ptr<AllreduceBackend> backend(
+          CreateAllreduceBackend(algorithm, chunk_bytes[c]));
+      ASSERT_TRUE(backend.get() != NULL);
+      for (int i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        this->CheckMatchesMPI(backend.get(), counts[i], false);
+        this->CheckMatchesMPI(backend.get(), counts[i], true);
+      }
+    }
+  }
+
+  // Trains a linear regression by SGD, the gradients summed across ranks
+  // with backend, or exactly if NULL, and averaged; returns the final loss
+  // and sets the initial one.
+  Dtype Train(AllreduceBackend* backend, const int iters, Dtype* init_loss) {
+    const string proto =
+        "name: 'CompressionTest' "
+        "input: 'data' "
+        "input_shape { dim: 16 dim: 8 } "
+        "input: 'target' "
+        "input_shape { dim: 16 dim: 1 } "
+        "layer { "
+        "  name: 'ip' type: 'InnerProduct' bottom: 'data' top: 'ip' "
+        "  inner_product_param { "
+        "    num_output: 1 "
+        "    weight_filler { type: 'constant' value: 0 } "
+        "    bias_filler { type: 'constant' value: 0 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'loss' type: 'EuclideanLoss' bottom: 'ip' bottom: 'target' "
+        "  top: 'loss' "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    Net<Dtype> net(param);
+    Blob<Dtype>* data = net.input_blobs()[0];
+    Blob<Dtype>* target = net.input_blobs()[1];
+    const int num = data->num();
+    const int dim = data->count() / num;
+    for (int i = 0; i < data->count(); ++i) {
+      data->mutable_cpu_data()[i] = std::sin(i * 0.7);
+    }
+    for (int n = 0; n < num; ++n) {
+      Dtype t = 0.5;
+      for (int d = 0; d < dim; ++d) {
+        t += data->cpu_data()[n * dim + d] * (d % 3 - 1) * 0.8;
+      }
+      target->mutable_cpu_data()[n] = t;
+    }
+    int num_ranks;
+    MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+    const Dtype lr = 0.1;
+    const vector<Blob<Dtype>*> bottom;
+    Dtype loss = net.ForwardBackward(bottom);
+    *init_loss = loss;
+    for (int iter = 0; iter < iters; ++iter) {
+      for (int i = 0; i < net.params().size(); ++i) {
+        Blob<Dtype>* blob = net.params()[i].get();
+        Dtype* diff = blob->mutable_cpu_diff();
+        if (backend) {
+          backend->Allreduce(diff, diff, blob->count(), type());
+        } else {
+          MPI_Allreduce(MPI_IN_PLACE, diff, blob->count(), type(), MPI_SUM,
+              MPI_COMM_WORLD);
+        }
+        caffe_scal(blob->count(), lr / num_ranks, diff);
+      }
+      net.Update();
+      loss = net.ForwardBackward(bottom);
+    }
+    return loss;
+  }
+
+  void CheckConvergence(AllreduceBackend* backend) {
+    const int iters = 100;
+    Dtype init_loss;
+    const Dtype exact_loss = Train(NULL, iters, &init_loss);
+    const Dtype loss = Train(backend, iters, &init_loss);
+    EXPECT_LT(exact_loss, 1e-3 * init_loss);
+    EXPECT_NEAR(exact_loss, loss, 1e-3 * init_loss) << backend->type();
+  }
+
+  int rank_;
+};
+
+TYPED_TEST_CASE(AllreduceTest, TestDtypes);
+
+TYPED_TEST(AllreduceTest, TestNativeIsNull) {
+  EXPECT_TRUE(CreateAllreduceBackend(SolverParameter_AllreduceAlgorithm_NATIVE,
+      1024) == NULL);
+}
+
+TYPED_TEST(AllreduceTest, TestRing) {
+  this->CheckAlgorithm(SolverParameter_AllreduceAlgorithm_RING);
+}
+
+TYPED_TEST(AllreduceTest, TestRingChunkSmallerThanElement) {
+  // one element per message, received whole however few bytes were asked
+  RingAllreduce backend(MPI_COMM_WORLD, 1);
+  this->CheckMatchesMPI(&backend, 17, false);
+  this->CheckMatchesMPI(&backend, 17, true);
+}
+
+TYPED_TEST(AllreduceTest, TestHierarchical) {
+  this->CheckAlgorithm(SolverParameter_AllreduceAlgorithm_HIERARCHICAL);
+}
+
+TYPED_TEST(AllreduceTest, TestFp16Converges) {
+  shared_ptr<AllreduceBackend> backend(CreateGradientBackend(
+      SolverParameter_AllreduceAlgorithm_RING, 1024,
+      SolverParameter_GradientCompression_FP16, 0));
+  this->CheckConvergence(backend.get());
+}
+
+TYPED_TEST(AllreduceTest, TestHierarchicalFp16Converges) {
+  shared_ptr<AllreduceBackend> backend(CreateGradientBackend(
+      SolverParameter_AllreduceAlgorithm_HIERARCHICAL, 1024,
+      SolverParameter_GradientCompression_FP16, 0));
+  this->CheckConvergence(backend.get());
+}
+
+TYPED_TEST(AllreduceTest, TestTopKConverges) {
+  shared_ptr<AllreduceBackend> backend(CreateGradientBackend(
+      SolverParameter_AllreduceAlgorithm_NATIVE, 1024,
+      SolverParameter_GradientCompression_TOP_K, 0.25));
+  this->CheckConvergence(backend.get());
+}
+
+TYPED_TEST(AllreduceTest, TestTopKAllIsExact) {
+  shared_ptr<AllreduceBackend> backend(CreateGradientBackend(
+      SolverParameter_AllreduceAlgorithm_NATIVE, 1024,
+      SolverParameter_GradientCompression_TOP_K, 1));
+  this->CheckMatchesMPI(backend.get(), 1000, false);
+  this->CheckMatchesMPI(backend.get(), 1000, true);
+}
+
+void RecordThread(boost::thread::id* id) {
+  *id = boost::this_thread::get_id();
+}
+
+TYPED_TEST(AllreduceTest, TestRunOnTransmissionThread) {
+  typedef TypeParam Dtype;
+  int size;
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  vector<Dtype> data(1000, 1);
+  MPIJobHandle job = caffe_iallreduce(&data[0], data.size());
+  // issued after the sum, by the thread issuing it
+  boost::thread::id id;
+  MPIComm::Run(boost::bind(&RecordThread, &id));
+  EXPECT_TRUE(id != boost::thread::id());
+  EXPECT_TRUE(id != boost::this_thread::get_id());
+  mpi_wait(job);
+  for (int i = 0; i < data.size(); ++i) {
+    EXPECT_EQ(size, data[i]);
+  }
+}
+
+TYPED_TEST(AllreduceTest, TestLocalStepsSnapshotAverages) {
+  typedef TypeParam Dtype;
+  // every rank fits a target of its own, so the local steps drift apart
+  char proto[1000];
+  snprintf(proto, sizeof(proto),
+      "base_lr: 0.1 lr_policy: 'fixed' momentum: 0.9 "
+      "mpi_local_steps: 4 snapshot: 3 snapshot_after_train: false "
+      "net_param { "
+      "  name: 'LocalStepsTest' "
+      "  layer { "
+      "    name: 'data' type: 'DummyData' top: 'data' top: 'target' "
+      "    dummy_data_param { "
+      "      shape { dim: 16 dim: 8 } shape { dim: 16 dim: 1 } "
+      "      data_filler { type: 'gaussian' } "
+      "      data_filler { type: 'constant' value: %d } "
+      "    } "
+      "  } "
+      "  layer { "
+      "    name: 'ip' type: 'InnerProduct' bottom: 'data' top: 'ip' "
+      "    inner_product_param { "
+      "      num_output: 1 weight_filler { type: 'constant' value: 0 } "
+      "    } "
+      "  } "
+      "  layer { "
+      "    name: 'loss' type: 'EuclideanLoss' bottom: 'ip' bottom: 'target' "
+      "    top: 'loss' "
+      "  } "
+      "} ", this->rank_ + 1);
+  SolverParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  string folder;
+  MakeTempDir(&folder);
+  param.set_snapshot_prefix(folder + "/local");
+  SGDSolver<Dtype> solver(param);
+  // the snapshot at iteration 3 comes before the average at 4, and must
+  // hold, like every rank, the average parameters
+  solver.Step(3);
+  const vector<shared_ptr<Blob<Dtype> > >& params = solver.net()->params();
+  for (int i = 0; i < params.size(); ++i) {
+    const int count = params[i]->count();
+    vector<Dtype> lowest(params[i]->cpu_data(), params[i]->cpu_data() + count);
+    vector<Dtype> highest(lowest);
+    MPI_Allreduce(MPI_IN_PLACE, &lowest[0], count, this->type(), MPI_MIN,
+        MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &highest[0], count, this->type(), MPI_MAX,
+        MPI_COMM_WORLD);
+    for (int j = 0; j < count; ++j) {
+      EXPECT_EQ(lowest[j], highest[j]) << "param " << i << " index " << j;
+    }
+  }
+}
+
+TYPED_TEST(AllreduceTest, TestGradientBuckets) {
+  typedef TypeParam Dtype;
+  // the params of three InnerProduct layers in the order Backward hands
+  // them over: last layer first, its weights before its bias
+  const int counts[] = {2, 1, 4, 2, 6, 2};
+  // a bucket holds 4 values: blobs of 4 or more are summed on their own,
+  // a blob which does not fit sends the bucket ahead of it, and a full
+  // bucket is sent at once
+  const int num_sums[] = {0, 0, 1, 2, 3, 4};
+  const int num_blobs = sizeof(counts) / sizeof(counts[0]);
+  GradientBuckets<Dtype> buckets(4 * sizeof(Dtype));
+  // the buckets are reused by the next iteration
+  for (int iter = 0; iter < 2; ++iter) {
+    vector<vector<Dtype> > diffs(num_blobs), expected(num_blobs);
+    for (int b = 0; b < num_blobs; ++b) {
+      for (int i = 0; i < counts[b]; ++i) {
+        diffs[b].push_back(b * 10 + i + this->rank_ * 3 + iter);
+      }
+      expected[b] = diffs[b];
+      MPI_Allreduce(MPI_IN_PLACE, &expected[b][0], counts[b], this->type(),
+          MPI_SUM, MPI_COMM_WORLD);
+    }
+    for (int b = 0; b < num_blobs; ++b) {
+      buckets.Add(&diffs[b][0], counts[b]);
+      EXPECT_EQ(num_sums[b], buckets.num_sums()) << "blob " << b;
+    }
+    buckets.Finish();
+    EXPECT_EQ(0, buckets.num_sums());
+    for (int b = 0; b < num_blobs; ++b) {
+      for (int i = 0; i < counts[b]; ++i) {
+        EXPECT_EQ(expected[b][i], diffs[b][i]) << "blob " << b << " index "
+            << i;
+      }
+    }
+  }
+}
+
+TYPED_TEST(AllreduceTest, TestGradientBucketsFlush) {
+  typedef TypeParam Dtype;
+  int size;
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  GradientBuckets<Dtype> buckets(4 * sizeof(Dtype));
+  vector<Dtype> diff(3, this->rank_ + 1);
+  buckets.Add(&diff[0], diff.size());
+  EXPECT_EQ(0, buckets.num_sums());
+  buckets.Flush();
+  EXPECT_EQ(1, buckets.num_sums());
+  // nothing is left to send
+  buckets.Flush();
+  EXPECT_EQ(1, buckets.num_sums());
+  buckets.Finish();
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(size * (size + 1) / 2, diff[i]);
+  }
+
+  // without room for a single value every blob is summed on its own
+  GradientBuckets<Dtype> unbucketed(0);
+  Dtype value = 1;
+  unbucketed.Add(&value, 1);
+  EXPECT_EQ(1, unbucketed.num_sums());
+  unbucketed.Finish();
+  EXPECT_EQ(size, value);
+}
+
+TYPED_TEST(AllreduceTest, TestHalfConversion) {
+  // exactly representable values, round to nearest even, subnormals,
+  // overflow
+  EXPECT_EQ(0x3c00, caffe_float_to_half(1));
+  EXPECT_EQ(0xc000, caffe_float_to_half(-2));
+  EXPECT_EQ(0x3c00, caffe_float_to_half(1 + 1. / 4096));
+  EXPECT_EQ(0x3c02, caffe_float_to_half(1 + 3. / 2048));
+  EXPECT_EQ(0x0001, caffe_float_to_half(std::pow(2., -24)));
+  EXPECT_EQ(0x7c00, caffe_float_to_half(70000));
+  for (int h = 0; h < 0x7c00; ++h) {
+    EXPECT_EQ(h, caffe_float_to_half(caffe_half_to_float(h)));
+  }
+}
+
+}  // namespace caffe
+
+#endif  // USE_MPI
@@ -0,0 +1,208 @@
+#include <cmath>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/common_layers.hpp"
+#include "caffe/filler.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class BNLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+ protected:
+  BNLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 4, 5)),
+        blob_top_(new Blob<Dtype>()) {
+    // fill the values
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    layer_param_.mutable_bn_param()->mutable_slope_filler()->set_type(
+        "gaussian");
+    layer_param_.mutable_bn_param()->mutable_bias_filler()->set_type(
+        "gaussian");
+  }
+  virtual ~BNLayerTest() { delete blob_bottom_; delete blob_top_; }
+
+  // Checks that the top is the bottom normalized by mean and inv_std, and
+  // then scaled and shifted by the parameters of the layer.
+  void CheckTop(BNLayer<Dtype>* layer, const Dtype* mean,
+      const Dtype* inv_std) {
+    const vector<shared_ptr<Blob<Dtype> > >& blobs = layer->blobs();
+    for (int i = 0; i < blob_bottom_->num(); ++i) {
+      for (int j = 0; j < blob_bottom_->channels(); ++j) {
+        for (int k = 0; k < blob_bottom_->height(); ++k) {
+          for (int l = 0; l < blob_bottom_->width(); ++l) {
+            const Dtype expected = (blob_bottom_->data_at(i, j, k, l) -
+                mean[j]) * inv_std[j] * blobs[0]->cpu_data()[j] +
+                blobs[1]->cpu_data()[j];
+            EXPECT_NEAR(expected, blob_top_->data_at(i, j, k, l), 1e-4);
+          }
+        }
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  LayerParameter layer_param_;
+};
+
+TYPED_TEST_CASE(BNLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(BNLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  // far from zero, where the sum of squares alone loses the variance
+  caffe_add_scalar(this->blob_bottom_->count(), Dtype(100),
+      this->blob_bottom_->mutable_cpu_data());
+  BNLayer<Dtype> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int num = this->blob_bottom_->num();
+  const int channels = this->blob_bottom_->channels();
+  const int spatial_dim = this->blob_bottom_->height() *
+      this->blob_bottom_->width();
+  vector<Dtype> mean(channels, 0), inv_std(channels, 0);
+  for (int j = 0; j < channels; ++j) {
+    Dtype var = 0;
+    for (int i = 0; i < num; ++i) {
+      const Dtype* data = this->blob_bottom_->cpu_data() +
+          this->blob_bottom_->offset(i, j);
+      for (int k = 0; k < spatial_dim; ++k) {
+        mean[j] += data[k] / (num * spatial_dim);
+      }
+    }
+    for (int i = 0; i < num; ++i) {
+      const Dtype* data = this->blob_bottom_->cpu_data() +
+          this->blob_bottom_->offset(i, j);
+      for (int k = 0; k < spatial_dim; ++k) {
+        var += (data[k] - mean[j]) * (data[k] - mean[j]) /
+            (num * spatial_dim);
+      }
+    }
+    inv_std[j] = 1 / std::sqrt(var + Dtype(1e-5));
+  }
+  this->CheckTop(&layer, &mean[0], &inv_std[0]);
+  // the batch statistics are added to the moving averages, of which the
+  // mean starts at 0 and the inverse std at 1
+  for (int j = 0; j < channels; ++j) {
+    EXPECT_NEAR(Dtype(0.1) * mean[j], layer.blobs()[2]->cpu_data()[j],
+        1e-3);
+    EXPECT_NEAR(Dtype(0.1) * inv_std[j] + Dtype(0.9),
+        layer.blobs()[3]->cpu_data()[j], 1e-4);
+  }
+}
+
+TYPED_TEST(BNLayerTest, TestForwardTest) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->layer_param_.set_phase(TEST);
+  BNLayer<Dtype> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int channels = this->blob_bottom_->channels();
+  for (int j = 0; j < channels; ++j) {
+    layer.blobs()[2]->mutable_cpu_data()[j] = Dtype(0.1) * j;
+    layer.blobs()[3]->mutable_cpu_data()[j] = Dtype(0.5) + j;
+  }
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // testing uses the moving averages, and leaves them as they are
+  this->CheckTop(&layer, layer.blobs()[2]->cpu_data(),
+      layer.blobs()[3]->cpu_data());
+  for (int j = 0; j < channels; ++j) {
+    EXPECT_EQ(Dtype(0.1) * j, layer.blobs()[2]->cpu_data()[j]);
+  }
+}
+
+TYPED_TEST(BNLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  BNLayer<Dtype> layer(this->layer_param_);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(BNLayerTest, TestBackwardFrozen) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->layer_param_.mutable_bn_param()->set_frozen(true);
+  BNLayer<Dtype> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int channels = this->blob_bottom_->channels();
+  for (int j = 0; j < channels; ++j) {
+    layer.blobs()[2]->mutable_cpu_data()[j] = Dtype(0.1) * j;
+    layer.blobs()[3]->mutable_cpu_data()[j] = Dtype(0.5) + j;
+  }
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  this->CheckTop(&layer, layer.blobs()[2]->cpu_data(),
+      layer.blobs()[3]->cpu_data());
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_top_);
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, vector<bool>(1, true),
+      this->blob_bottom_vec_);
+  // the statistics are constants, and the parameters get no gradient
+  const vector<shared_ptr<Blob<Dtype> > >& blobs = layer.blobs();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    const int j = i / (this->blob_bottom_->height() *
+        this->blob_bottom_->width()) % channels;
+    EXPECT_NEAR(this->blob_top_->cpu_diff()[i] * blobs[0]->cpu_data()[j] *
+        blobs[3]->cpu_data()[j], this->blob_bottom_->cpu_diff()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(BNLayerTest, TestFrozenThreaded) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int channels = this->blob_bottom_->channels();
+  Blob<Dtype> top_diff(this->blob_bottom_->shape());
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&top_diff);
+  // frozen, and testing: the planes are split over the threads of the pool
+  // on the CPU, each normalized as by a single thread
+  for (int test = 0; test < 2; ++test) {
+    LayerParameter layer_param(this->layer_param_);
+    if (test) {
+      layer_param.set_phase(TEST);
+    } else {
+      layer_param.mutable_bn_param()->set_frozen(true);
+    }
+    BNLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int j = 0; j < channels; ++j) {
+      layer.blobs()[2]->mutable_cpu_data()[j] = Dtype(0.1) * j;
+      layer.blobs()[3]->mutable_cpu_data()[j] = Dtype(0.5) + j;
+    }
+    Blob<Dtype> top[2], bottom[2];
+    for (int i = 0; i < 2; ++i) {
+      Caffe::set_num_threads(i == 0 ? 1 : 3);
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      top[i].CopyFrom(*this->blob_top_, false, true);
+      if (!test) {
+        caffe_copy(top_diff.count(), top_diff.cpu_data(),
+            this->blob_top_->mutable_cpu_diff());
+        layer.Backward(this->blob_top_vec_, vector<bool>(1, true),
+            this->blob_bottom_vec_);
+        bottom[i].CopyFrom(*this->blob_bottom_, true, true);
+      }
+    }
+    Caffe::set_num_threads(1);
+    for (int i = 0; i < top[0].count(); ++i) {
+      EXPECT_EQ(top[0].cpu_data()[i], top[1].cpu_data()[i]);
+    }
+    for (int i = 0; i < bottom[0].count(); ++i) {
+      EXPECT_EQ(bottom[0].cpu_diff()[i], bottom[1].cpu_diff()[i]);
+    }
+  }
+}
+
+}  // namespace caffe
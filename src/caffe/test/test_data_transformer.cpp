@@ -1,3 +1,6 @@
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
 #include <string>
 #include <vector>
 
@@ -9,6 +12,7 @@
 #include "caffe/data_transformer.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -352,4 +356,207 @@ TYPED_TEST(DataTransformTest, TestMeanFile) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestSeededCropMirrorTrain) {
+  TransformationParameter transform_param;
+  const bool unique_pixels = true;
+  const int label = 0;
+  const int channels = 3;
+  const int height = 4;
+  const int width = 5;
+  const int crop_size = 2;
+
+  transform_param.set_crop_size(crop_size);
+  transform_param.set_mirror(true);
+  Datum datum;
+  FillDatum(label, channels, height, width, unique_pixels, &datum);
+  Blob<TypeParam> blob_a(1, channels, crop_size, crop_size);
+  Blob<TypeParam> blob_b(1, channels, crop_size, crop_size);
+  DataTransformer<TypeParam> transformer_a(transform_param, TRAIN);
+  DataTransformer<TypeParam> transformer_b(transform_param, TRAIN);
+  // Two transformers seeded alike produce the same crops and flips,
+  // whatever the global Caffe seed is.
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    Caffe::set_random_seed(this->seed_ + iter);
+    transformer_a.InitRand(this->seed_ * iter);
+    transformer_a.Transform(datum, &blob_a);
+    Caffe::set_random_seed(this->seed_ - iter);
+    transformer_b.InitRand(this->seed_ * iter);
+    transformer_b.Transform(datum, &blob_b);
+    for (int j = 0; j < blob_a.count(); ++j) {
+      EXPECT_EQ(blob_a.cpu_data()[j], blob_b.cpu_data()[j]);
+    }
+  }
+}
+
+// An RGB frame then a flow_x/flow_y pair, as the video data layer reads them.
+static void FillFrames(const int height, const int width, vector<cv::Mat>* frames,
+    vector<int>* first_channels) {
+  frames->clear();
+  first_channels->clear();
+  frames->push_back(cv::Mat(height, width, CV_8UC3));
+  first_channels->push_back(0);
+  for (int i = 0; i < 2; ++i) {
+    frames->push_back(cv::Mat(height, width, CV_8UC1));
+    first_channels->push_back(3 + i);
+  }
+  for (int i = 0; i < frames->size(); ++i) {
+    cv::Mat& frame = (*frames)[i];
+    for (int h = 0; h < height; ++h) {
+      uchar* ptr = frame.ptr<uchar>(h);
+      for (int j = 0; j < width * frame.channels(); ++j) {
+        ptr[j] = static_cast<uchar>((h * 37 + j * 11 + i * 101) % 256);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+static void CheckFramesMatchDatum(const TransformationParameter& transform_param,
+    const int num_iter, const Dtype tolerance) {
+  const int channels = 5;
+  const int height = 16;
+  const int width = 20;
+  const int crop_size = transform_param.crop_size();
+  vector<cv::Mat> frames;
+  vector<int> first_channels;
+  FillFrames(height, width, &frames, &first_channels);
+  Datum datum;
+  DatumFrameSink sink(0, &datum);
+  sink.Reshape(channels, height, width);
+  for (int i = 0; i < frames.size(); ++i) {
+    sink.AddFrame(frames[i], first_channels[i]);
+  }
+
+  Blob<Dtype> from_datum(1, channels, crop_size, crop_size);
+  Blob<Dtype> from_frames(1, channels, crop_size, crop_size);
+  DataTransformer<Dtype> transformer_a(transform_param, TRAIN);
+  DataTransformer<Dtype> transformer_b(transform_param, TRAIN);
+  for (int iter = 0; iter < num_iter; ++iter) {
+    transformer_a.InitRand(iter);
+    transformer_a.Transform(datum, &from_datum);
+    transformer_b.InitRand(iter);
+    transformer_b.BeginTransform(channels, height, width, &from_frames);
+    for (int i = frames.size() - 1; i >= 0; --i) {
+      transformer_b.TransformFrame(frames[i], first_channels[i]);
+    }
+    for (int j = 0; j < from_datum.count(); ++j) {
+      EXPECT_NEAR(from_datum.cpu_data()[j], from_frames.cpu_data()[j],
+          tolerance);
+    }
+  }
+}
+
+TYPED_TEST(DataTransformTest, TestFramesMatchDatum) {
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(8);
+  transform_param.set_mirror(true);
+  transform_param.set_has_flow(true);
+  transform_param.set_flow_point(3);
+  transform_param.set_mean_jitter(4);
+  transform_param.set_scale(0.5);
+  for (int c = 0; c < 5; ++c) {
+    transform_param.add_mean_value(100 + c);
+  }
+  CheckFramesMatchDatum<TypeParam>(transform_param, this->num_iter_, 0);
+}
+
+TYPED_TEST(DataTransformTest, TestFramesMatchDatumMultiScale) {
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(8);
+  transform_param.set_mirror(true);
+  transform_param.set_multi_scale(true);
+  transform_param.set_fix_crop(true);
+  transform_param.set_has_flow(true);
+  transform_param.set_flow_point(3);
+  transform_param.add_mean_value(128);
+  // the RGB frame is resized as one 3-channel image rather than channel
+  // by channel, which may round differently
+  CheckFramesMatchDatum<TypeParam>(transform_param, this->num_iter_,
+      TypeParam(1));
+}
+
+// A smooth frame, so that resampling it once or twice gives close results.
+static cv::Mat RampFrame(const int height, const int width, const int channels) {
+  cv::Mat frame(height, width, CV_8UC(channels));
+  for (int h = 0; h < height; ++h) {
+    uchar* ptr = frame.ptr<uchar>(h);
+    for (int w = 0; w < width; ++w) {
+      for (int c = 0; c < channels; ++c) {
+        ptr[w * channels + c] = static_cast<uchar>(
+            (h * 250 / height + w * 250 / width) / 2 + c);
+      }
+    }
+  }
+  return frame;
+}
+
+TYPED_TEST(DataTransformTest, TestFusedResizeMatchesTwoPass) {
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(24);
+  transform_param.set_mirror(true);
+  transform_param.set_multi_scale(true);
+  const int height = 48;
+  const int width = 60;
+  const cv::Mat frame = RampFrame(70, 90, 3);
+  cv::Mat resized;
+  cv::resize(frame, resized, cv::Size(width, height));
+
+  Blob<TypeParam> two_pass(1, 3, 24, 24);
+  Blob<TypeParam> fused(1, 3, 24, 24);
+  DataTransformer<TypeParam> transformer(transform_param, TRAIN);
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    transformer.InitRand(iter);
+    transformer.BeginTransform(3, height, width, &two_pass);
+    transformer.TransformFrame(resized, 0);
+    transformer.InitRand(iter);
+    transformer.BeginTransform(3, height, width, &fused);
+    transformer.TransformFrame(frame, 0);
+    for (int j = 0; j < fused.count(); ++j) {
+      EXPECT_NEAR(two_pass.cpu_data()[j], fused.cpu_data()[j], 2);
+    }
+  }
+}
+
+TYPED_TEST(DataTransformTest, TestFusedResizeBenchmark) {
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(224);
+  transform_param.set_mirror(true);
+  transform_param.set_multi_scale(true);
+  transform_param.add_mean_value(128);
+  const int height = 256;
+  const int width = 340;
+  const int num_frames = 50;
+  const cv::Mat frame = RampFrame(360, 480, 3);
+  Blob<TypeParam> blob(1, 3, 224, 224);
+  DataTransformer<TypeParam> transformer(transform_param, TRAIN);
+  CPUTimer timer;
+
+  // resize the whole frame to height x width, then crop and resize again
+  transformer.InitRand(1701);
+  timer.Start();
+  for (int i = 0; i < num_frames; ++i) {
+    cv::Mat resized;
+    cv::resize(frame, resized, cv::Size(width, height));
+    transformer.BeginTransform(3, height, width, &blob);
+    transformer.TransformFrame(resized, 0);
+  }
+  timer.Stop();
+  const float two_pass_ms = timer.MilliSeconds();
+
+  // resample only the crop window, straight from the decoded frame
+  transformer.InitRand(1701);
+  timer.Start();
+  for (int i = 0; i < num_frames; ++i) {
+    transformer.BeginTransform(3, height, width, &blob);
+    transformer.TransformFrame(frame, 0);
+  }
+  timer.Stop();
+  const float fused_ms = timer.MilliSeconds();
+
+  LOG(INFO) << "Two-pass resize and crop: "
+      << num_frames * 1000. / two_pass_ms << " frames/s";
+  LOG(INFO) << "Fused resize and crop: "
+      << num_frames * 1000. / fused_ms << " frames/s";
+}
+
 }  // namespace caffe
@@ -116,6 +116,25 @@ TYPED_TEST(DBTest, TestKeyValue) {
   EXPECT_FALSE(cursor->valid());
 }
 
+TYPED_TEST(DBTest, TestSeekToKey) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  EXPECT_TRUE(cursor->SeekToKey("fish-bike.jpg"));
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(cursor->key(), "fish-bike.jpg");
+  const char* data;
+  size_t size;
+  cursor->value_data(&data, &size);
+  EXPECT_EQ(cursor->value(), string(data, size));
+  Datum datum;
+  datum.ParseFromArray(data, size);
+  EXPECT_EQ(datum.height(), 323);
+  EXPECT_TRUE(cursor->SeekToKey("cat.jpg"));
+  EXPECT_EQ(cursor->key(), "cat.jpg");
+  EXPECT_FALSE(cursor->SeekToKey("dog.jpg"));
+}
+
 TYPED_TEST(DBTest, TestWrite) {
   scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
   db->Open(this->source_, db::WRITE);
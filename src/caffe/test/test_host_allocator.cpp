@@ -0,0 +1,147 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <cstring>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/host_allocator.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class HostAllocatorTest : public ::testing::Test {
+ public:
+  // allocates, fills and frees blocks of many sizes
+  void Churn(int seed) {
+    for (int i = 0; i < 200; ++i) {
+      const size_t size = 1 + (seed * 7919 + i * 104729) % 100000;
+      char* ptr = static_cast<char*>(allocator_.Allocate(size));
+      memset(ptr, i, size);
+      allocator_.Free(ptr);
+    }
+  }
+
+ protected:
+  HostAllocator allocator_;
+};
+
+TEST_F(HostAllocatorTest, TestSizeClass) {
+  EXPECT_EQ(64, HostAllocator::SizeClass(0));
+  EXPECT_EQ(64, HostAllocator::SizeClass(64));
+  EXPECT_EQ(128, HostAllocator::SizeClass(65));
+  EXPECT_EQ(512, HostAllocator::SizeClass(512));
+  EXPECT_EQ(1024, HostAllocator::SizeClass(1000));
+  EXPECT_EQ(1280, HostAllocator::SizeClass(1100));
+  for (size_t size = 1; size < (1 << 22); size = size * 3 / 2 + 1) {
+    const size_t class_size = HostAllocator::SizeClass(size);
+    EXPECT_GE(class_size, size);
+    EXPECT_LT(class_size - size, class_size / 5 + 64);
+    EXPECT_EQ(class_size, HostAllocator::SizeClass(class_size));
+  }
+}
+
+TEST_F(HostAllocatorTest, TestReuse) {
+  void* ptr = allocator_.Allocate(1000);
+  EXPECT_EQ(0, reinterpret_cast<size_t>(ptr) % HostAllocator::kAlignment);
+  HostAllocator::Stats stats = allocator_.stats();
+  EXPECT_EQ(1024, stats.in_use);
+  EXPECT_EQ(0, stats.cached);
+  allocator_.Free(ptr);
+  stats = allocator_.stats();
+  EXPECT_EQ(0, stats.in_use);
+  EXPECT_EQ(1024, stats.cached);
+  // the same class comes from the cache, another does not
+  EXPECT_EQ(ptr, allocator_.Allocate(1020));
+  void* other_ptr = allocator_.Allocate(2000);
+  stats = allocator_.stats();
+  EXPECT_EQ(1024 + 2048, stats.in_use);
+  EXPECT_EQ(0, stats.cached);
+  EXPECT_EQ(1024 + 2048, stats.peak);
+  EXPECT_EQ(3, stats.num_allocs);
+  EXPECT_EQ(1, stats.num_cache_hits);
+  allocator_.Free(ptr);
+  allocator_.Free(other_ptr);
+  allocator_.Free(NULL);
+  allocator_.ReleaseCache();
+  stats = allocator_.stats();
+  EXPECT_EQ(0, stats.in_use);
+  EXPECT_EQ(0, stats.cached);
+  EXPECT_EQ(1024 + 2048, stats.peak);
+}
+
+TEST_F(HostAllocatorTest, TestCacheLimit) {
+  void* ptr = allocator_.Allocate(1024);
+  void* other_ptr = allocator_.Allocate(4096);
+  allocator_.set_cache_limit(3000);
+  // the larger block is over the limit, and so freed at once
+  allocator_.Free(other_ptr);
+  allocator_.Free(ptr);
+  EXPECT_EQ(1024, allocator_.stats().cached);
+  allocator_.set_cache_limit(0);
+  EXPECT_EQ(0, allocator_.stats().cached);
+  allocator_.Free(allocator_.Allocate(1024));
+  EXPECT_EQ(0, allocator_.stats().cached);
+}
+
+TEST_F(HostAllocatorTest, TestCacheLimitCyclingSizes) {
+  EXPECT_EQ(HostAllocator::kDefaultCacheLimit, allocator_.cache_limit());
+  const size_t limit = 100000;
+  allocator_.set_cache_limit(limit);
+  // shapes changing all the time, as with the ROIs of each image
+  for (int i = 0; i < 200; ++i) {
+    void* ptr = allocator_.Allocate(1000 * (1 + i % 37));
+    void* other_ptr = allocator_.Allocate(3000 * (1 + i % 11));
+    allocator_.Free(ptr);
+    allocator_.Free(other_ptr);
+    EXPECT_LE(allocator_.stats().cached, limit);
+  }
+  // the block just freed is kept, the larger ones before it making room
+  void* ptr = allocator_.Allocate(90000);
+  allocator_.Free(ptr);
+  EXPECT_GE(allocator_.stats().cached, HostAllocator::SizeClass(90000));
+  EXPECT_LE(allocator_.stats().cached, limit);
+  EXPECT_EQ(ptr, allocator_.Allocate(90000));
+  allocator_.Free(ptr);
+}
+
+TEST_F(HostAllocatorTest, TestHugePages) {
+  allocator_.set_huge_pages(true);
+  void* ptr = allocator_.Allocate(3 * HostAllocator::kHugePageSize);
+  EXPECT_EQ(0, reinterpret_cast<size_t>(ptr) % HostAllocator::kHugePageSize);
+  memset(ptr, 1, 3 * HostAllocator::kHugePageSize);
+  allocator_.Free(ptr);
+}
+
+TEST_F(HostAllocatorTest, TestConcurrentChurn) {
+  vector<shared_ptr<boost::thread> > threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.push_back(shared_ptr<boost::thread>(new boost::thread(
+        boost::bind(&HostAllocatorTest::Churn, this, i))));
+  }
+  for (int i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+  }
+  const HostAllocator::Stats stats = allocator_.stats();
+  EXPECT_EQ(0, stats.in_use);
+  EXPECT_EQ(800, stats.num_allocs);
+  EXPECT_GE(stats.peak, stats.cached);
+}
+
+TEST_F(HostAllocatorTest, TestSyncedMemory) {
+  // SyncedMemory takes its memory from the Caffe-wide allocator
+  const size_t in_use = Caffe::host_allocator().stats().in_use;
+  {
+    SyncedMemory mem(12345);
+    mem.cpu_data();
+    EXPECT_EQ(in_use + HostAllocator::SizeClass(12345),
+        Caffe::host_allocator().stats().in_use);
+  }
+  EXPECT_EQ(in_use, Caffe::host_allocator().stats().in_use);
+}
+
+}  // namespace caffe
@@ -19,5 +19,26 @@ TEST_F(InternalThreadTest, TestStartAndExit) {
   EXPECT_FALSE(thread.is_started());
 }
 
+class LoopingThread : public InternalThread {
+ public:
+  LoopingThread() : iterations_(0) {}
+  int iterations_;
+
+ protected:
+  virtual void InternalThreadEntry() {
+    while (!must_stop()) {
+      ++iterations_;
+    }
+  }
+};
+
+TEST_F(InternalThreadTest, TestStopLoopingThread) {
+  LoopingThread thread;
+  EXPECT_TRUE(thread.StartInternalThread());
+  EXPECT_TRUE(thread.is_started());
+  EXPECT_TRUE(thread.StopInternalThread());
+  EXPECT_FALSE(thread.is_started());
+}
+
 }  // namespace caffe
 
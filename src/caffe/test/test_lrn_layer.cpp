@@ -197,6 +197,38 @@ TYPED_TEST(LRNLayerTest, TestGradientAcrossChannelsLargeRegion) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(LRNLayerTest, TestForwardBackwardThreaded) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  LRNLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> top_diff;
+  top_diff.ReshapeLike(*this->blob_top_);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&top_diff);
+  // the images are split over the threads of the pool on the CPU, each
+  // with a scratch of its own
+  Blob<Dtype> top[2], bottom[2];
+  for (int i = 0; i < 2; ++i) {
+    Caffe::set_num_threads(i == 0 ? 1 : 3);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, vector<bool>(1, true),
+        this->blob_bottom_vec_);
+    top[i].CopyFrom(*this->blob_top_, false, true);
+    bottom[i].CopyFrom(*this->blob_bottom_, true, true);
+  }
+  Caffe::set_num_threads(1);
+  for (int i = 0; i < top[0].count(); ++i) {
+    EXPECT_EQ(top[0].cpu_data()[i], top[1].cpu_data()[i]);
+  }
+  for (int i = 0; i < bottom[0].count(); ++i) {
+    EXPECT_EQ(bottom[0].cpu_diff()[i], bottom[1].cpu_diff()[i]);
+  }
+}
+
 TYPED_TEST(LRNLayerTest, TestSetupWithinChannel) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -193,4 +193,119 @@ TYPED_TEST(LstmLayerTest, TestGradientBatchClipMask) {
     LOG(ERROR) << "Skipping test due to old architecture.";
   }
 }
+
+TYPED_TEST(LstmLayerTest, TestThreadedBatchClipMask) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  LSTMParameter* lstm_param =
+      layer_param.mutable_lstm_param();
+  lstm_param->set_num_output(5);
+  lstm_param->set_batch_size(3);
+  lstm_param->mutable_weight_filler()->set_type("uniform");
+  lstm_param->mutable_weight_filler()->set_min(-0.1);
+  lstm_param->mutable_weight_filler()->set_max(0.1);
+  lstm_param->mutable_bias_filler()->set_type("constant");
+  lstm_param->mutable_bias_filler()->set_value(0.1);
+  // sequences restart at t = 0 and 2
+  for (int i = 3; i < 12; ++i) {
+    this->blob_bottom2_->mutable_cpu_data()[i] = (i == 7) ? 0 : 1;
+  }
+  this->blob_bottom_vec_.clear();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  this->blob_bottom_vec_.push_back(this->blob_bottom2_);
+  vector<bool> propagate_down(2, true);
+  propagate_down[1] = false;
+
+  // the sequences of the batch are split over the threads of the pool on
+  // the CPU, which must not change the results
+  LstmLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> top_diff;
+  top_diff.ReshapeLike(*this->blob_top_);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&top_diff);
+  caffe_copy(top_diff.count(), top_diff.cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  Blob<Dtype> top, bottom_diff, weight_h_diff;
+  top.CopyFrom(*this->blob_top_, false, true);
+  bottom_diff.CopyFrom(*this->blob_bottom_, true, true);
+  weight_h_diff.CopyFrom(*layer.blobs()[1], true, true);
+
+  Caffe::set_num_threads(3);
+  LstmLayer<Dtype> threaded_layer(layer_param);
+  threaded_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    threaded_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  threaded_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_copy(top_diff.count(), top_diff.cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  threaded_layer.Backward(this->blob_top_vec_, propagate_down,
+      this->blob_bottom_vec_);
+  Caffe::set_num_threads(1);
+  for (int i = 0; i < top.count(); ++i) {
+    EXPECT_EQ(top.cpu_data()[i], this->blob_top_->cpu_data()[i]);
+  }
+  for (int i = 0; i < bottom_diff.count(); ++i) {
+    EXPECT_EQ(bottom_diff.cpu_diff()[i], this->blob_bottom_->cpu_diff()[i]);
+  }
+  for (int i = 0; i < weight_h_diff.count(); ++i) {
+    EXPECT_EQ(weight_h_diff.cpu_diff()[i],
+        threaded_layer.blobs()[1]->cpu_diff()[i]);
+  }
+}
+TYPED_TEST(LstmLayerTest, TestStreamState) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  LSTMParameter* lstm_param =
+      layer_param.mutable_lstm_param();
+  lstm_param->set_num_output(5);
+  lstm_param->set_batch_size(2);
+  lstm_param->mutable_weight_filler()->set_type("uniform");
+  lstm_param->mutable_weight_filler()->set_min(-0.1);
+  lstm_param->mutable_weight_filler()->set_max(0.1);
+  lstm_param->mutable_bias_filler()->set_type("constant");
+  lstm_param->mutable_bias_filler()->set_value(0.1);
+  this->blob_bottom_vec_.clear();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  LstmLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+  // both sequences of 6 steps one frame at a time, through one batch slot
+  lstm_param->set_batch_size(1);
+  lstm_param->set_stream(true);
+  LstmLayer<Dtype> stream_layer(layer_param);
+  Blob<Dtype> frame(1, 10, 2, 3);
+  Blob<Dtype> frame_top;
+  vector<Blob<Dtype>*> frame_bottom_vec(1, &frame);
+  vector<Blob<Dtype>*> frame_top_vec(1, &frame_top);
+  stream_layer.SetUp(frame_bottom_vec, frame_top_vec);
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    stream_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  Blob<Dtype> state[2];
+  for (int t = 0; t < 6; ++t) {
+    for (int n = 0; n < 2; ++n) {
+      if (t == 0) {
+        stream_layer.ResetRecurrentState(0);
+      } else {
+        stream_layer.RestoreRecurrentState(0, state[n]);
+      }
+      caffe_copy(frame.count(), this->blob_bottom_->cpu_data() +
+          this->blob_bottom_->offset(t * 2 + n), frame.mutable_cpu_data());
+      stream_layer.Forward(frame_bottom_vec, frame_top_vec);
+      stream_layer.SaveRecurrentState(0, &state[n]);
+      const Dtype* top_data =
+          this->blob_top_->cpu_data() + this->blob_top_->offset(t * 2 + n);
+      for (int i = 0; i < 5; ++i) {
+        EXPECT_NEAR(top_data[i], frame_top.cpu_data()[i], 1e-6);
+      }
+    }
+  }
+}
+
 }  // namespace caffe
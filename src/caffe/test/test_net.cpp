@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cmath>
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
@@ -10,6 +13,9 @@
 #include "caffe/filler.hpp"
 #include "caffe/net.hpp"
 #include "caffe/util/math_functions.hpp"
+#ifdef USE_MPI
+#include "caffe/util/mpi_functions.hpp"
+#endif
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -2372,4 +2378,600 @@ TYPED_TEST(NetTest, TestSkipPropagateDown) {
   }
 }
 
+TYPED_TEST(NetTest, TestOptimizeMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  string proto =
+      "name: 'OptimizeMemoryNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 5 } "
+      "state { phase: TEST } ";
+  // a chain of InnerProduct and ReLU, the second ReLU also summed at the end
+  for (int i = 1; i <= 4; ++i) {
+    std::ostringstream layers;
+    layers << "layer { name: 'ip" << i << "' type: 'InnerProduct' bottom: '";
+    if (i == 1) {
+      layers << "data";
+    } else {
+      layers << "relu" << i - 1;
+    }
+    layers << "' top: 'ip" << i << "' "
+        << "inner_product_param { num_output: 6 "
+        << "weight_filler { type: 'gaussian' std: 1 } "
+        << "bias_filler { type: 'gaussian' std: 1 } } } "
+        << "layer { name: 'relu" << i << "' type: 'ReLU' "
+        << "bottom: 'ip" << i << "' top: 'relu" << i << "' } ";
+    proto += layers.str();
+  }
+  proto +=
+      "layer { name: 'sum' type: 'Eltwise' bottom: 'relu2' bottom: 'relu4' "
+      "  top: 'sum' } ";
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  shared_ptr<Net<Dtype> > net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto + "optimize_memory: true ");
+  shared_ptr<Net<Dtype> > planned_net = this->net_;
+
+  // ip1 and relu1 share in place, ip3 reuses the memory of relu1
+  EXPECT_EQ(planned_net->blob_by_name("ip1")->data(),
+      planned_net->blob_by_name("relu1")->data());
+  EXPECT_EQ(planned_net->blob_by_name("ip1")->data(),
+      planned_net->blob_by_name("ip3")->data());
+  EXPECT_NE(planned_net->blob_by_name("ip3")->data(),
+      planned_net->blob_by_name("relu2")->data());
+  EXPECT_NE(planned_net->blob_by_name("ip4")->data(),
+      planned_net->blob_by_name("relu2")->data());
+  EXPECT_NE(planned_net->blob_by_name("sum")->data(),
+      planned_net->blob_by_name("relu4")->data());
+  EXPECT_NE(planned_net->blob_by_name("data")->data(),
+      planned_net->blob_by_name("ip1")->data());
+
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(net->input_blobs()[0]);
+  planned_net->input_blobs()[0]->CopyFrom(*net->input_blobs()[0]);
+  for (int iter = 0; iter < 2; ++iter) {
+    net->ForwardPrefilled();
+    planned_net->ForwardPrefilled();
+    const Blob<Dtype>* output = net->output_blobs()[0];
+    const Blob<Dtype>* planned_output = planned_net->output_blobs()[0];
+    ASSERT_EQ(output->count(), planned_output->count());
+    for (int i = 0; i < output->count(); ++i) {
+      EXPECT_EQ(output->cpu_data()[i], planned_output->cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestRecompute) {
+  typedef typename TypeParam::Dtype Dtype;
+  // conv1, relu1 (through a split) and relu2 drop their tops, the kept
+  // conv2 and sum being checkpoints
+  const string proto =
+      "name: 'RecomputeNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 6 dim: 6 } "
+      "input: 'target' "
+      "input_shape { dim: 2 dim: 2 } "
+      "state { phase: TRAIN } "
+      "force_backward: true "
+      "layer { name: 'conv1' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv1' RECOMPUTE "
+      "  convolution_param { num_output: 4 kernel_size: 3 pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'relu1' "
+      "  RECOMPUTE } "
+      "layer { name: 'conv2' type: 'Convolution' bottom: 'relu1' "
+      "  top: 'conv2' "
+      "  convolution_param { num_output: 4 kernel_size: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'sum' type: 'Eltwise' bottom: 'relu1' bottom: 'conv2' "
+      "  top: 'sum' } "
+      "layer { name: 'relu2' type: 'ReLU' bottom: 'sum' top: 'relu2' "
+      "  RECOMPUTE } "
+      "layer { name: 'ip' type: 'InnerProduct' bottom: 'relu2' top: 'ip' "
+      "  inner_product_param { num_output: 2 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'loss' type: 'EuclideanLoss' bottom: 'ip' "
+      "  bottom: 'target' top: 'loss' } ";
+  string plain_proto(proto), recompute_proto(proto);
+  for (size_t pos = 0;
+       (pos = plain_proto.find("RECOMPUTE", pos)) != string::npos; ) {
+    plain_proto.erase(pos, 9);
+  }
+  for (size_t pos = 0;
+       (pos = recompute_proto.find("RECOMPUTE", pos)) != string::npos; ) {
+    recompute_proto.replace(pos, 9, "recompute: true");
+  }
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(plain_proto);
+  shared_ptr<Net<Dtype> > net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(recompute_proto);
+  shared_ptr<Net<Dtype> > recompute_net = this->net_;
+  EXPECT_FALSE(net->has_recompute());
+  ASSERT_TRUE(recompute_net->has_recompute());
+
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int i = 0; i < 2; ++i) {
+    filler.Fill(net->input_blobs()[i]);
+    recompute_net->input_blobs()[i]->CopyFrom(*net->input_blobs()[i]);
+  }
+  // twice, the second time from blobs dropped in the first Backward
+  const vector<Blob<Dtype>*> bottom;
+  for (int iter = 0; iter < 2; ++iter) {
+    EXPECT_EQ(net->ForwardBackward(bottom),
+        recompute_net->ForwardBackward(bottom));
+    for (int i = 0; i < net->params().size(); ++i) {
+      const Blob<Dtype>* param = net->params()[i].get();
+      const Blob<Dtype>* recompute_param = recompute_net->params()[i].get();
+      for (int j = 0; j < param->count(); ++j) {
+        EXPECT_EQ(param->cpu_diff()[j], recompute_param->cpu_diff()[j]);
+      }
+    }
+    const Blob<Dtype>* data = net->input_blobs()[0];
+    const Blob<Dtype>* recompute_data = recompute_net->input_blobs()[0];
+    for (int j = 0; j < data->count(); ++j) {
+      EXPECT_EQ(data->cpu_diff()[j], recompute_data->cpu_diff()[j]);
+    }
+  }
+  const typename Net<Dtype>::RecomputeStats& stats =
+      recompute_net->recompute_stats();
+  EXPECT_EQ(2 * recompute_net->layers().size(), stats.num_forwards);
+  // relu2 for ip, and for sum the split of relu1, relu1 and conv1
+  EXPECT_EQ(8, stats.num_recomputed);
+  // conv1 and relu2 are never held at the same time
+  EXPECT_EQ(stats.full_bytes - 2 * 4 * 6 * 6 * sizeof(Dtype),
+      stats.peak_bytes);
+
+  // a Forward from conv2 reads relu1, which the last Backward dropped
+  const vector<string>& layer_names = recompute_net->layer_names();
+  const int conv2 = std::find(layer_names.begin(), layer_names.end(),
+      "conv2") - layer_names.begin();
+  ASSERT_LT(conv2, layer_names.size());
+  EXPECT_EQ(net->ForwardFrom(conv2), recompute_net->ForwardFrom(conv2));
+  const Blob<Dtype>* ip = net->blob_by_name("ip").get();
+  const Blob<Dtype>* recompute_ip = recompute_net->blob_by_name("ip").get();
+  for (int j = 0; j < ip->count(); ++j) {
+    EXPECT_EQ(ip->cpu_data()[j], recompute_ip->cpu_data()[j]);
+  }
+}
+
+TYPED_TEST(NetTest, TestRecomputeInPlace) {
+  typedef typename TypeParam::Dtype Dtype;
+  // conv1 drops its top, which relu1 computes in place; the leaky ReLU
+  // would not give the same data if run twice, or not at all
+  const string proto =
+      "name: 'RecomputeInPlaceNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 6 dim: 6 } "
+      "input: 'target' "
+      "input_shape { dim: 2 dim: 2 } "
+      "state { phase: TRAIN } "
+      "force_backward: true "
+      "layer { name: 'conv1' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv1' RECOMPUTE "
+      "  convolution_param { num_output: 4 kernel_size: 3 pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'conv1' "
+      "  relu_param { negative_slope: 0.5 } } "
+      "layer { name: 'conv2' type: 'Convolution' bottom: 'conv1' "
+      "  top: 'conv2' "
+      "  convolution_param { num_output: 4 kernel_size: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'relu2' type: 'ReLU' bottom: 'conv2' top: 'conv2' } "
+      "layer { name: 'ip' type: 'InnerProduct' bottom: 'conv2' top: 'ip' "
+      "  inner_product_param { num_output: 2 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'loss' type: 'EuclideanLoss' bottom: 'ip' "
+      "  bottom: 'target' top: 'loss' } ";
+  string plain_proto(proto), recompute_proto(proto);
+  const size_t pos = proto.find("RECOMPUTE");
+  plain_proto.erase(pos, 9);
+  recompute_proto.replace(pos, 9, "recompute: true");
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(plain_proto);
+  shared_ptr<Net<Dtype> > net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(recompute_proto);
+  shared_ptr<Net<Dtype> > recompute_net = this->net_;
+  ASSERT_TRUE(recompute_net->has_recompute());
+
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int i = 0; i < 2; ++i) {
+    filler.Fill(net->input_blobs()[i]);
+    recompute_net->input_blobs()[i]->CopyFrom(*net->input_blobs()[i]);
+  }
+  const vector<Blob<Dtype>*> bottom;
+  for (int iter = 0; iter < 2; ++iter) {
+    EXPECT_EQ(net->ForwardBackward(bottom),
+        recompute_net->ForwardBackward(bottom));
+    for (int i = 0; i < net->params().size(); ++i) {
+      const Blob<Dtype>* param = net->params()[i].get();
+      const Blob<Dtype>* recompute_param = recompute_net->params()[i].get();
+      for (int j = 0; j < param->count(); ++j) {
+        EXPECT_EQ(param->cpu_diff()[j], recompute_param->cpu_diff()[j]);
+      }
+    }
+  }
+  const typename Net<Dtype>::RecomputeStats& stats =
+      recompute_net->recompute_stats();
+  // conv1 and relu1 once an iteration, for the Backward of conv2
+  EXPECT_EQ(4, stats.num_recomputed);
+
+  // a Forward from conv2 reads conv1 as relu1 left it
+  const vector<string>& layer_names = recompute_net->layer_names();
+  const int conv2 = std::find(layer_names.begin(), layer_names.end(),
+      "conv2") - layer_names.begin();
+  ASSERT_LT(conv2, layer_names.size());
+  EXPECT_EQ(net->ForwardFrom(conv2), recompute_net->ForwardFrom(conv2));
+  EXPECT_EQ(6, stats.num_recomputed);
+  const Blob<Dtype>* ip = net->blob_by_name("ip").get();
+  const Blob<Dtype>* recompute_ip = recompute_net->blob_by_name("ip").get();
+  for (int j = 0; j < ip->count(); ++j) {
+    EXPECT_EQ(ip->cpu_data()[j], recompute_ip->cpu_data()[j]);
+  }
+}
+
+TYPED_TEST(NetTest, TestConcurrentExecution) {
+  typedef typename TypeParam::Dtype Dtype;
+  // three branches over a split of data, with in-place ReLUs and a split of
+  // their own
+  const string proto =
+      "name: 'ConcurrentNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 5 dim: 5 } "
+      "input: 'target' "
+      "input_shape { dim: 2 dim: 2 } "
+      "force_backward: true "
+      "layer { name: 'conv_a' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv_a' "
+      "  convolution_param { num_output: 3 kernel_size: 3 pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'relu_a' type: 'ReLU' bottom: 'conv_a' top: 'conv_a' } "
+      "layer { name: 'conv_b' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv_b' "
+      "  convolution_param { num_output: 3 kernel_size: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'relu_b' type: 'ReLU' bottom: 'conv_b' top: 'conv_b' } "
+      "layer { name: 'sum' type: 'Eltwise' bottom: 'conv_b' bottom: 'data' "
+      "  top: 'sum' } "
+      "layer { name: 'pool_c' type: 'Pooling' bottom: 'data' top: 'pool_c' "
+      "  pooling_param { pool: AVE kernel_size: 3 pad: 1 stride: 1 } } "
+      "layer { name: 'concat' type: 'Concat' bottom: 'conv_a' "
+      "  bottom: 'conv_b' bottom: 'sum' bottom: 'pool_c' top: 'concat' } "
+      "layer { name: 'ip' type: 'InnerProduct' bottom: 'concat' top: 'ip' "
+      "  inner_product_param { num_output: 2 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'loss' type: 'EuclideanLoss' bottom: 'ip' "
+      "  bottom: 'target' top: 'loss' } ";
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  shared_ptr<Net<Dtype> > net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  shared_ptr<Net<Dtype> > concurrent_net = this->net_;
+  concurrent_net->set_max_concurrency(4);
+  EXPECT_EQ(1, net->max_concurrency());
+  EXPECT_EQ(4, concurrent_net->max_concurrency());
+  // the branches run on the threads of Caffe::thread_pool()
+  Caffe::set_num_threads(4);
+
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  const vector<Blob<Dtype>*> bottom;
+  for (int iter = 0; iter < 3; ++iter) {
+    for (int i = 0; i < 2; ++i) {
+      filler.Fill(net->input_blobs()[i]);
+      concurrent_net->input_blobs()[i]->CopyFrom(*net->input_blobs()[i]);
+    }
+    EXPECT_EQ(net->ForwardBackward(bottom),
+        concurrent_net->ForwardBackward(bottom));
+    const Blob<Dtype>* concat = net->blob_by_name("concat").get();
+    const Blob<Dtype>* concurrent_concat =
+        concurrent_net->blob_by_name("concat").get();
+    for (int j = 0; j < concat->count(); ++j) {
+      EXPECT_EQ(concat->cpu_data()[j], concurrent_concat->cpu_data()[j]);
+    }
+    for (int i = 0; i < net->params().size(); ++i) {
+      const Blob<Dtype>* param = net->params()[i].get();
+      const Blob<Dtype>* concurrent_param = concurrent_net->params()[i].get();
+      for (int j = 0; j < param->count(); ++j) {
+        EXPECT_EQ(param->cpu_diff()[j], concurrent_param->cpu_diff()[j]);
+      }
+    }
+    const Blob<Dtype>* data = net->input_blobs()[0];
+    const Blob<Dtype>* concurrent_data = concurrent_net->input_blobs()[0];
+    for (int j = 0; j < data->count(); ++j) {
+      EXPECT_EQ(data->cpu_diff()[j], concurrent_data->cpu_diff()[j]);
+    }
+  }
+  Caffe::set_num_threads(1);
+}
+
+#ifdef USE_MPI
+TYPED_TEST(NetTest, TestOptimizeMemoryGather) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'GatherMemoryNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 5 } "
+      "state { phase: TEST } "
+      "layer { name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+      "  inner_product_param { num_output: 6 "
+      "    weight_filler { type: 'gaussian' std: 1 } } } "
+      "layer { name: 'gather' type: 'Gather' bottom: 'ip1' top: 'gather' } "
+      "layer { name: 'ip2' type: 'InnerProduct' bottom: 'gather' top: 'ip2' "
+      "  inner_product_param { num_output: 6 "
+      "    weight_filler { type: 'gaussian' std: 1 } } } "
+      "layer { name: 'ip3' type: 'InnerProduct' bottom: 'ip2' top: 'ip3' "
+      "  inner_product_param { num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 1 } } } ";
+  const Caffe::PARALLEL_MODE parallel_mode = Caffe::parallel_mode();
+  Caffe::set_parallel_mode(Caffe::MPI);
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  shared_ptr<Net<Dtype> > net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto + "optimize_memory: true ");
+  shared_ptr<Net<Dtype> > planned_net = this->net_;
+
+  // the gather reads ip1 while it writes its own top
+  EXPECT_NE(planned_net->blob_by_name("ip1")->data(),
+      planned_net->blob_by_name("gather")->data());
+
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(net->input_blobs()[0]);
+  planned_net->input_blobs()[0]->CopyFrom(*net->input_blobs()[0]);
+  net->ForwardPrefilled();
+  planned_net->ForwardPrefilled();
+  const Blob<Dtype>* output = net->output_blobs()[0];
+  const Blob<Dtype>* planned_output = planned_net->output_blobs()[0];
+  ASSERT_EQ(output->count(), planned_output->count());
+  for (int i = 0; i < output->count(); ++i) {
+    EXPECT_EQ(output->cpu_data()[i], planned_output->cpu_data()[i]);
+  }
+  Caffe::set_parallel_mode(parallel_mode);
+}
+
+// Tells whether the layers of a net may run concurrently.
+template <typename Dtype>
+class ScheduleNet : public Net<Dtype> {
+ public:
+  explicit ScheduleNet(const NetParameter& param) : Net<Dtype>(param) {}
+  bool UseConcurrency() const {
+    return Net<Dtype>::UseConcurrency(0, this->layers().size() - 1);
+  }
+};
+
+TYPED_TEST(NetTest, TestGatherRunsSeriallyUnderMPI) {
+  typedef typename TypeParam::Dtype Dtype;
+  // two branches, each gathering across the ranks
+  const string proto =
+      "name: 'GatherNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 } "
+      "max_concurrency: 4 "
+      "layer { name: 'ip_a' type: 'InnerProduct' bottom: 'data' top: 'ip_a' "
+      "  inner_product_param { num_output: 2 "
+      "    weight_filler { type: 'constant' value: 1 } } } "
+      "layer { name: 'gather_a' type: 'Gather' bottom: 'ip_a' "
+      "  top: 'gather_a' } "
+      "layer { name: 'ip_b' type: 'InnerProduct' bottom: 'data' top: 'ip_b' "
+      "  inner_product_param { num_output: 2 "
+      "    weight_filler { type: 'constant' value: 2 } } } "
+      "layer { name: 'gather_b' type: 'Gather' bottom: 'ip_b' "
+      "  top: 'gather_b' } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  const Caffe::PARALLEL_MODE parallel_mode = Caffe::parallel_mode();
+  Caffe::set_num_threads(4);
+  Caffe::set_parallel_mode(Caffe::NO);
+  EXPECT_EQ(Caffe::mode() == Caffe::CPU,
+      ScheduleNet<Dtype>(param).UseConcurrency());
+  // the ranks would issue the collectives of the branches in any order
+  Caffe::set_parallel_mode(Caffe::MPI);
+  ScheduleNet<Dtype> net(param);
+  EXPECT_FALSE(net.UseConcurrency());
+  Caffe::set_parallel_mode(parallel_mode);
+  Caffe::set_num_threads(1);
+}
+
+TYPED_TEST(NetTest, TestBackwardSendsLastBucket) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'BucketNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 } "
+      "input: 'target' "
+      "input_shape { dim: 2 dim: 1 } "
+      "layer { name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+      "  inner_product_param { num_output: 2 "
+      "    weight_filler { type: 'gaussian' std: 1 } "
+      "    bias_filler { type: 'gaussian' std: 1 } } } "
+      "layer { name: 'ip2' type: 'InnerProduct' bottom: 'ip1' top: 'ip2' "
+      "  inner_product_param { num_output: 1 "
+      "    weight_filler { type: 'gaussian' std: 1 } "
+      "    bias_filler { type: 'gaussian' std: 1 } } } "
+      "layer { name: 'loss' type: 'EuclideanLoss' bottom: 'ip2' "
+      "  bottom: 'target' top: 'loss' } ";
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  shared_ptr<Net<Dtype> > net = this->net_;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(net->input_blobs()[0]);
+  filler.Fill(net->input_blobs()[1]);
+  const vector<shared_ptr<Blob<Dtype> > >& params = net->params();
+  const Caffe::PARALLEL_MODE parallel_mode = Caffe::parallel_mode();
+
+  // the gradients of this rank alone
+  Caffe::set_parallel_mode(Caffe::NO);
+  for (int i = 0; i < params.size(); ++i) {
+    caffe_set(params[i]->count(), Dtype(0), params[i]->mutable_cpu_diff());
+  }
+  net->ForwardPrefilled();
+  net->Backward();
+  vector<shared_ptr<Blob<Dtype> > > local_params;
+  this->CopyNetParams(true, &local_params);
+
+  // every param fits in one bucket, which Backward sends once the first
+  // layer is done rather than leave it to FinishGradientSync
+  Caffe::set_parallel_mode(Caffe::MPI);
+  net->set_gradient_bucket_bytes(1024 * sizeof(Dtype));
+  for (int i = 0; i < params.size(); ++i) {
+    caffe_set(params[i]->count(), Dtype(0), params[i]->mutable_cpu_diff());
+  }
+  net->ForwardPrefilled();
+  net->Backward();
+  EXPECT_EQ(1, net->gradient_buckets()->num_sums());
+  net->FinishGradientSync();
+  Caffe::set_parallel_mode(parallel_mode);
+
+  // all the ranks ran the same net on the same data
+  int size;
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      const Dtype expected = size * local_params[i]->cpu_diff()[j];
+      EXPECT_NEAR(expected, params[i]->cpu_diff()[j],
+          1e-5 * std::max(Dtype(1), std::fabs(expected)))
+          << "param " << i << " index " << j;
+    }
+  }
+}
+#endif
+
+TYPED_TEST(NetTest, TestRecurrentState) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'StreamNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 4 } "
+      "layer { name: 'lstm1' type: 'Lstm' bottom: 'data' top: 'lstm1' "
+      "  lstm_param { num_output: 3 batch_size: 2 stream: true "
+      "    weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'lstm2' type: 'Lstm' bottom: 'lstm1' top: 'lstm2' "
+      "  lstm_param { num_output: 2 batch_size: 2 stream: true "
+      "    weight_filler { type: 'gaussian' std: 0.5 } } } ";
+  this->InitNetFromProtoString(proto);
+  Blob<Dtype>* data = this->net_->input_blobs()[0];
+  const Blob<Dtype>* output = this->net_->output_blobs()[0];
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> first_data, first_output, second_output;
+  filler.Fill(data);
+  first_data.CopyFrom(*data, false, true);
+  this->net_->ForwardPrefilled();
+  first_output.CopyFrom(*output, false, true);
+  vector<shared_ptr<Blob<Dtype> > > state[2];
+  for (int n = 0; n < 2; ++n) {
+    this->net_->SaveRecurrentState(n, &state[n]);
+    EXPECT_EQ(2, state[n].size());
+  }
+  filler.Fill(data);
+  this->net_->ForwardPrefilled();
+  second_output.CopyFrom(*output, false, true);
+
+  // the two streams swapped between the items of the batch
+  this->net_->RestoreRecurrentState(0, state[1]);
+  this->net_->RestoreRecurrentState(1, state[0]);
+  for (int i = 0; i < 4; ++i) {
+    std::swap(data->mutable_cpu_data()[i], data->mutable_cpu_data()[4 + i]);
+  }
+  this->net_->ForwardPrefilled();
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ(second_output.cpu_data()[i], output->cpu_data()[2 + i]);
+    EXPECT_EQ(second_output.cpu_data()[2 + i], output->cpu_data()[i]);
+  }
+
+  // and started anew
+  this->net_->ResetRecurrentState(0);
+  this->net_->ResetRecurrentState(1);
+  data->CopyFrom(first_data);
+  this->net_->ForwardPrefilled();
+  for (int i = 0; i < output->count(); ++i) {
+    EXPECT_EQ(first_output.cpu_data()[i], output->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestFoldBatchNorm) {
+  typedef typename TypeParam::Dtype Dtype;
+  // bn1 and bn2 follow a Convolution and an InnerProduct, bn3 an input
+  const string proto =
+      "name: 'FoldBatchNormNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 5 dim: 5 } "
+      "state { phase: TEST } "
+      "layer { name: 'conv1' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv1' "
+      "  convolution_param { num_output: 4 kernel_size: 3 bias_term: false "
+      "    weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'bn1' type: 'BN' bottom: 'conv1' top: 'bn1' } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'bn1' top: 'bn1' } "
+      "layer { name: 'ip1' type: 'InnerProduct' bottom: 'bn1' top: 'ip1' "
+      "  inner_product_param { num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'bn2' type: 'BN' bottom: 'ip1' top: 'ip1' } "
+      "layer { name: 'bn3' type: 'BN' bottom: 'data' top: 'bn3' } ";
+  this->InitNetFromProtoString(proto);
+  shared_ptr<Net<Dtype> > net = this->net_;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler_param.set_min(0.5);
+  filler_param.set_max(2);
+  UniformFiller<Dtype> inv_std_filler(filler_param);
+  const char* bn_names[] = {"bn1", "bn2", "bn3"};
+  for (int i = 0; i < 3; ++i) {
+    const vector<shared_ptr<Blob<Dtype> > >& bn_blobs =
+        net->layer_by_name(bn_names[i])->blobs();
+    for (int j = 0; j < 3; ++j) {
+      filler.Fill(bn_blobs[j].get());
+    }
+    inv_std_filler.Fill(bn_blobs[3].get());
+  }
+  NetParameter weights;
+  net->ToProto(&weights, false);
+  filler.Fill(net->input_blobs()[0]);
+  net->ForwardPrefilled();
+
+  this->InitNetFromProtoString(proto + "fold_batch_norm: true ");
+  shared_ptr<Net<Dtype> > folded_net = this->net_;
+  EXPECT_FALSE(folded_net->has_layer("bn1"));
+  EXPECT_FALSE(folded_net->has_layer("bn2"));
+  EXPECT_TRUE(folded_net->has_layer("bn3"));
+  EXPECT_EQ(2, folded_net->layer_by_name("conv1")->blobs().size());
+  folded_net->CopyTrainedLayersFrom(weights);
+  folded_net->input_blobs()[0]->CopyFrom(*net->input_blobs()[0]);
+  folded_net->ForwardPrefilled();
+  const char* output_names[] = {"bn1", "ip1", "bn3"};
+  for (int i = 0; i < 3; ++i) {
+    const Blob<Dtype>* output = net->blob_by_name(output_names[i]).get();
+    const Blob<Dtype>* folded_output =
+        folded_net->blob_by_name(output_names[i]).get();
+    ASSERT_EQ(output->count(), folded_output->count());
+    for (int j = 0; j < output->count(); ++j) {
+      EXPECT_NEAR(output->cpu_data()[j], folded_output->cpu_data()[j],
+          1e-4 * std::max(Dtype(1), std::abs(output->cpu_data()[j])));
+    }
+  }
+}
+
 }  // namespace caffe
@@ -472,6 +472,43 @@ TYPED_TEST(PoolingLayerTest, TestGradientMax) {
   }
 }
 
+TYPED_TEST(PoolingLayerTest, TestForwardBackwardThreaded) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_pad(1);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  PoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> top_diff;
+  top_diff.ReshapeLike(*this->blob_top_);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&top_diff);
+  // the planes are split over the threads of the pool on the CPU, each
+  // computed as by a single thread
+  Blob<Dtype> top[2], bottom[2];
+  for (int i = 0; i < 2; ++i) {
+    Caffe::set_num_threads(i == 0 ? 1 : 3);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, vector<bool>(1, true),
+        this->blob_bottom_vec_);
+    top[i].CopyFrom(*this->blob_top_, false, true);
+    bottom[i].CopyFrom(*this->blob_bottom_, true, true);
+  }
+  Caffe::set_num_threads(1);
+  for (int i = 0; i < top[0].count(); ++i) {
+    EXPECT_EQ(top[0].cpu_data()[i], top[1].cpu_data()[i]);
+  }
+  for (int i = 0; i < bottom[0].count(); ++i) {
+    EXPECT_EQ(bottom[0].cpu_diff()[i], bottom[1].cpu_diff()[i]);
+  }
+}
+
 TYPED_TEST(PoolingLayerTest, TestForwardMaxPadded) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -25,8 +25,6 @@ using boost::scoped_ptr;
 
 namespace caffe {
 
-typedef ::testing::Types< GPUDevice<float>, GPUDevice<double> > TestDtypesGPU;
-
 template <typename TypeParam>
 class ROIPoolingLayerTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -85,6 +83,9 @@ class ROIPoolingLayerTest : public MultiDeviceTest<TypeParam> {
   vector<Blob<Dtype>*> blob_top_vec_;
 };
 
+#ifndef CPU_ONLY
+typedef ::testing::Types< GPUDevice<float>, GPUDevice<double> > TestDtypesGPU;
+
 TYPED_TEST_CASE(ROIPoolingLayerTest, TestDtypesGPU);
 
 TYPED_TEST(ROIPoolingLayerTest, TestGradient) {
@@ -99,5 +100,35 @@ TYPED_TEST(ROIPoolingLayerTest, TestGradient) {
   checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
       this->blob_top_vec_, 0);
 }
+#endif
+
+// The CPU layer only has a Forward, which splits the ROIs over the threads
+// of the pool.
+template <typename Dtype>
+class ROIPoolingLayerCPUTest : public ROIPoolingLayerTest<CPUDevice<Dtype> > {
+};
+
+TYPED_TEST_CASE(ROIPoolingLayerCPUTest, TestDtypes);
+
+TYPED_TEST(ROIPoolingLayerCPUTest, TestForwardThreaded) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  ROIPoolingParameter* roi_pooling_param =
+      layer_param.mutable_roi_pooling_param();
+  roi_pooling_param->set_pooled_h(3);
+  roi_pooling_param->set_pooled_w(2);
+  ROIPoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> top[2];
+  for (int i = 0; i < 2; ++i) {
+    Caffe::set_num_threads(i == 0 ? 1 : 3);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    top[i].CopyFrom(*this->blob_top_data_, false, true);
+  }
+  Caffe::set_num_threads(1);
+  for (int i = 0; i < top[0].count(); ++i) {
+    EXPECT_EQ(top[0].cpu_data()[i], top[1].cpu_data()[i]);
+  }
+}
 
 }  // namespace caffe
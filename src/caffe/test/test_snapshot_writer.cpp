@@ -0,0 +1,71 @@
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/snapshot_writer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class SnapshotWriterTest : public ::testing::Test {
+ protected:
+  SnapshotWriterTest() {
+    MakeTempDir(&dirname_);
+  }
+
+  virtual ~SnapshotWriterTest() {
+    boost::filesystem::remove_all(dirname_);
+  }
+
+  shared_ptr<BlobProto> MakeBlob(const int count, const float value) {
+    shared_ptr<BlobProto> blob(new BlobProto());
+    for (int i = 0; i < count; ++i) {
+      blob->add_data(value + i);
+    }
+    return blob;
+  }
+
+  void CheckBlob(const string& filename, const int count, const float value) {
+    BlobProto blob;
+    ASSERT_TRUE(ReadProtoFromBinaryFile(filename, &blob)) << filename;
+    ASSERT_EQ(count, blob.data_size());
+    for (int i = 0; i < count; ++i) {
+      EXPECT_EQ(value + i, blob.data(i));
+    }
+    EXPECT_FALSE(boost::filesystem::exists(filename + ".tmp"));
+  }
+
+  string dirname_;
+};
+
+TEST_F(SnapshotWriterTest, TestWriteAll) {
+  const int num_files = 10;
+  const int count = 100000;
+  vector<string> filenames;
+  {
+    // fewer slots than files, so Write has to wait for the thread
+    SnapshotWriter writer(2);
+    for (int i = 0; i < num_files; ++i) {
+      std::ostringstream filename;
+      filename << dirname_ << "/snapshot_" << i;
+      filenames.push_back(filename.str());
+      shared_ptr<BlobProto> blob = MakeBlob(count, i);
+      writer.Write(blob, filenames.back());
+    }
+    writer.WaitAll();
+    for (int i = 0; i < num_files; ++i) {
+      CheckBlob(filenames[i], count, i);
+    }
+    // the writer keeps working after WaitAll
+    writer.Write(MakeBlob(count, -1), filenames[0]);
+  }
+  // and finishes its files when destroyed
+  CheckBlob(filenames[0], count, -1);
+}
+
+}  // namespace caffe
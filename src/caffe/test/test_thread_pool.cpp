@@ -0,0 +1,114 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ThreadPoolTest : public ::testing::Test {
+ public:
+  ThreadPoolTest() : pool_(4) {}
+
+  void Count(int i, int slot) {
+    EXPECT_GE(slot, 0);
+    EXPECT_LT(slot, pool_.num_threads());
+    boost::mutex::scoped_lock lock(mutex_);
+    ++counts_[i];
+  }
+
+  void CountOffset(int offset, int i, int slot) {
+    Count(offset + i, slot);
+  }
+
+  // each item runs a ParallelFor of its own
+  void CountNested(int n, int i, int slot) {
+    pool_.ParallelFor(n, boost::bind(&ThreadPoolTest::CountOffset, this,
+        i * n, _1, _2));
+  }
+
+  void CountMany(int n, int repeats) {
+    for (int r = 0; r < repeats; ++r) {
+      pool_.ParallelFor(n, boost::bind(&ThreadPoolTest::Count, this, _1, _2));
+    }
+  }
+
+  // swaps the Caffe pool while the call on the old one is running
+  void CountAndSwap(int i, int slot) {
+    Caffe::set_num_threads(2 + i % 3);
+    boost::mutex::scoped_lock lock(mutex_);
+    ++counts_[i];
+  }
+
+  void ExpectCounts(int n, int count) {
+    ASSERT_EQ(n, counts_.size());
+    for (int i = 0; i < n; ++i) {
+      EXPECT_EQ(count, counts_[i]) << "item " << i;
+    }
+  }
+
+ protected:
+  ThreadPool pool_;
+  boost::mutex mutex_;
+  vector<int> counts_;
+};
+
+TEST_F(ThreadPoolTest, TestParallelFor) {
+  const int n = 1000;
+  counts_.resize(n, 0);
+  for (int r = 0; r < 10; ++r) {
+    pool_.ParallelFor(n, boost::bind(&ThreadPoolTest::Count, this, _1, _2));
+  }
+  ExpectCounts(n, 10);
+  // nothing to do
+  pool_.ParallelFor(0, boost::bind(&ThreadPoolTest::Count, this, _1, _2));
+  ExpectCounts(n, 10);
+}
+
+TEST_F(ThreadPoolTest, TestNested) {
+  const int n = 20;
+  counts_.resize(n * n, 0);
+  pool_.ParallelFor(n, boost::bind(&ThreadPoolTest::CountNested, this, n,
+      _1, _2));
+  ExpectCounts(n * n, 1);
+}
+
+TEST_F(ThreadPoolTest, TestConcurrentCallers) {
+  const int n = 100;
+  counts_.resize(n, 0);
+  boost::thread_group callers;
+  for (int t = 0; t < 3; ++t) {
+    callers.create_thread(boost::bind(&ThreadPoolTest::CountMany, this, n, 50));
+  }
+  callers.join_all();
+  ExpectCounts(n, 150);
+}
+
+TEST_F(ThreadPoolTest, TestCaffeThreadPool) {
+  EXPECT_EQ(1, Caffe::num_threads());
+  Caffe::set_num_threads(3);
+  EXPECT_EQ(3, Caffe::num_threads());
+  EXPECT_EQ(3, Caffe::thread_pool()->num_threads());
+  Caffe::set_num_threads(1);
+  EXPECT_EQ(1, Caffe::num_threads());
+}
+
+TEST_F(ThreadPoolTest, TestCaffeThreadPoolSwap) {
+  const int n = 100;
+  counts_.resize(n, 0);
+  Caffe::set_num_threads(4);
+  // the call holds on to the pool it started on
+  Caffe::thread_pool()->ParallelFor(n, boost::bind(
+      &ThreadPoolTest::CountAndSwap, this, _1, _2));
+  ExpectCounts(n, 1);
+  EXPECT_EQ(2 + (n - 1) % 3, Caffe::num_threads());
+  Caffe::set_num_threads(1);
+}
+
+}  // namespace caffe
@@ -0,0 +1,128 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/transform_row.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class TransformRowTest : public ::testing::Test {
+ protected:
+  TransformRowTest() : isa_(caffe_transform_row_isa()) {}
+  virtual ~TransformRowTest() { caffe_set_transform_row_isa(isa_); }
+
+  // The implementations this CPU supports.
+  vector<TransformRowISA> SupportedISAs() {
+    vector<TransformRowISA> isas;
+    const TransformRowISA all[] = {TRANSFORM_ROW_SCALAR, TRANSFORM_ROW_SSE2,
+        TRANSFORM_ROW_AVX2};
+    for (int i = 0; i < 3; ++i) {
+      if (caffe_set_transform_row_isa(all[i])) {
+        isas.push_back(all[i]);
+      }
+    }
+    caffe_set_transform_row_isa(isa_);
+    return isas;
+  }
+
+  void CheckRow(const int width, const int stride, const bool use_mean_row,
+      const bool invert, const bool mirror) {
+    vector<uint8_t> src(width * stride);
+    vector<Dtype> mean_row(width);
+    for (int i = 0; i < src.size(); ++i) {
+      src[i] = caffe_rng_rand() % 256;
+    }
+    for (int i = 0; i < width; ++i) {
+      mean_row[i] = (caffe_rng_rand() % 2560) / Dtype(10);
+    }
+    const Dtype mean_value = 104;
+    const Dtype offset = -3;
+    const Dtype scale = 0.017;
+    vector<Dtype> dst(width);
+    caffe_cpu_transform_row(width, &src[0], stride,
+        use_mean_row ? &mean_row[0] : NULL, mean_value, offset, scale,
+        invert, mirror, &dst[0]);
+    for (int i = 0; i < width; ++i) {
+      const uint8_t raw = src[i * stride];
+      const Dtype pixel = invert ? 255 - raw : raw;
+      const Dtype mean = use_mean_row ? mean_row[i] : mean_value;
+      // all implementations compute exactly this
+      EXPECT_EQ((pixel - mean + offset) * scale,
+          dst[mirror ? width - 1 - i : i]);
+    }
+  }
+
+  TransformRowISA isa_;
+};
+
+TYPED_TEST_CASE(TransformRowTest, TestDtypes);
+
+TYPED_TEST(TransformRowTest, TestMatchesReference) {
+  // widths around the vector sizes and past the gather chunk
+  const int widths[] = {1, 7, 8, 9, 15, 16, 17, 224, 300};
+  vector<TransformRowISA> isas = this->SupportedISAs();
+  for (int i = 0; i < isas.size(); ++i) {
+    ASSERT_TRUE(caffe_set_transform_row_isa(isas[i]));
+    for (int w = 0; w < sizeof(widths) / sizeof(widths[0]); ++w) {
+      for (int stride = 1; stride <= 3; stride += 2) {
+        for (int flags = 0; flags < 8; ++flags) {
+          this->CheckRow(widths[w], stride, flags & 1, flags & 2, flags & 4);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(TransformRowTest, TestBenchmark) {
+  const int height = 224;
+  const int width = 224;
+  const int rgb_channels = 3;
+  const int flow_channels = 20;
+  const int num_iter = 20;
+  // an interleaved RGB frame as decoded by OpenCV, and a planar flow stack
+  // as stored in a Datum
+  vector<uint8_t> rgb(height * width * rgb_channels, 128);
+  vector<uint8_t> flow(flow_channels * height * width, 128);
+  vector<TypeParam> dst(flow_channels * height * width);
+  vector<TransformRowISA> isas = this->SupportedISAs();
+  CPUTimer timer;
+  for (int i = 0; i < isas.size(); ++i) {
+    ASSERT_TRUE(caffe_set_transform_row_isa(isas[i]));
+    timer.Start();
+    for (int iter = 0; iter < num_iter; ++iter) {
+      for (int c = 0; c < rgb_channels; ++c) {
+        for (int h = 0; h < height; ++h) {
+          caffe_cpu_transform_row<TypeParam>(width,
+              &rgb[h * width * rgb_channels + c], rgb_channels, NULL, 104, 0,
+              1, false, iter % 2, &dst[(c * height + h) * width]);
+        }
+      }
+    }
+    timer.Stop();
+    LOG(INFO) << caffe_transform_row_isa_name(isas[i]) << " RGB: "
+        << num_iter * rgb_channels * height * width
+            / timer.MicroSeconds() << " Mpixels/s";
+    timer.Start();
+    for (int iter = 0; iter < num_iter; ++iter) {
+      for (int c = 0; c < flow_channels; ++c) {
+        for (int h = 0; h < height; ++h) {
+          caffe_cpu_transform_row<TypeParam>(width,
+              &flow[(c * height + h) * width], 1, NULL, 128, 0, 1,
+              iter % 2 && c % 2 == 0, iter % 2, &dst[(c * height + h) * width]);
+        }
+      }
+    }
+    timer.Stop();
+    LOG(INFO) << caffe_transform_row_isa_name(isas[i]) << " flow: "
+        << num_iter * flow_channels * height * width
+            / timer.MicroSeconds() << " Mpixels/s";
+  }
+}
+
+}  // namespace caffe
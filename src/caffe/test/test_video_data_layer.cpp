@@ -0,0 +1,259 @@
+#include <cstdio>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "boost/scoped_ptr.hpp"
+#include "gtest/gtest.h"
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/video_db.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+using boost::scoped_ptr;
+
+template <typename TypeParam>
+class VideoDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  VideoDataLayerTest()
+      : seed_(1701), num_videos_(4), num_frames_(6),
+        blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()) {}
+
+  virtual void SetUp() {
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+    // Every video gets its own folder of distinct, losslessly encoded
+    // image_%04d.jpg and flow_{x,y}_%04d.jpg frames; video i has label i.
+    MakeTempDir(&folder_);
+    source_ = folder_ + "/list.txt";
+    std::ofstream list(source_.c_str(), std::ofstream::out);
+    for (int v = 0; v < num_videos_; ++v) {
+      const string video = VideoName(v);
+      boost::filesystem::create_directory(folder_ + "/" + video);
+      for (int f = 1; f <= num_frames_; ++f) {
+        WriteFrame(FrameFile(video, "image_%04d.jpg", f), v, f, CV_8UC3);
+        WriteFrame(FrameFile(video, "flow_x_%04d.jpg", f), v, f, CV_8UC1);
+        WriteFrame(FrameFile(video, "flow_y_%04d.jpg", f), v, f + 50, CV_8UC1);
+      }
+      list << video << " " << num_frames_ << " " << v << "\n";
+    }
+    list.close();
+  }
+
+  virtual ~VideoDataLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_label_;
+  }
+
+  string VideoName(int v) {
+    char name[16];
+    snprintf(name, sizeof(name), "video%d", v);
+    return name;
+  }
+
+  string FrameFile(const string& video, const char* pattern, int frame_id) {
+    char tmp[30];
+    snprintf(tmp, sizeof(tmp), pattern, frame_id);
+    return folder_ + "/" + video + "/" + tmp;
+  }
+
+  void WriteFrame(const string& filename, int v, int f, int type) {
+    cv::Mat frame(8, 10, type);
+    const int channels = frame.channels();
+    for (int h = 0; h < frame.rows; ++h) {
+      uchar* ptr = frame.ptr<uchar>(h);
+      for (int w = 0; w < frame.cols * channels; ++w) {
+        ptr[w] = static_cast<uchar>((v * 61 + f * 17 + h * 23 + w * 3) % 256);
+      }
+    }
+    vector<uchar> buffer;
+    ASSERT_TRUE(cv::imencode(".png", frame, buffer));
+    std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&buffer[0]), buffer.size());
+  }
+
+  // Stores the same videos in a db, as tools/convert_videoset_db does.
+  string MakeDB() {
+    const string db_name = folder_ + "/db";
+    scoped_ptr<db::DB> db(db::GetDB("lmdb"));
+    db->Open(db_name, db::NEW);
+    scoped_ptr<db::Transaction> txn(db->NewTransaction());
+    const char* const kPatterns[EncodedVideo::NUM_STREAMS] = {
+        "image_%04d.jpg", "flow_x_%04d.jpg", "flow_y_%04d.jpg"};
+    for (int v = 0; v < num_videos_; ++v) {
+      vector<vector<string> > frames(EncodedVideo::NUM_STREAMS);
+      for (int s = 0; s < EncodedVideo::NUM_STREAMS; ++s) {
+        for (int f = 1; f <= num_frames_; ++f) {
+          frames[s].push_back(FrameFile(VideoName(v), kPatterns[s], f));
+        }
+      }
+      VideoRecord record;
+      record.set_name(VideoName(v));
+      record.set_length(num_frames_);
+      record.add_label(v);
+      CHECK(WriteVideoToDB(frames, v, &record, txn.get()));
+    }
+    WriteVideoCount(num_videos_, txn.get());
+    txn->Commit();
+    db->Close();
+    return db_name;
+  }
+
+  // RGB and flow of one segment, read from the frame folders.
+  void FillParameter(LayerParameter* param, int batch_size) {
+    VideoDataParameter* video_data_param = param->mutable_video_data_param();
+    video_data_param->set_source(source_);
+    video_data_param->set_batch_size(batch_size);
+    video_data_param->set_modality(VideoDataParameter_Modality_BOTH);
+    video_data_param->add_root_folder(folder_ + "/");
+    video_data_param->add_root_folder(folder_ + "/");
+    video_data_param->add_new_length(2);
+    video_data_param->add_new_length(1);
+    video_data_param->set_interval(1);
+    video_data_param->set_shuffle(false);
+  }
+
+  // Runs num_batches batches through a fresh layer, all of them appended.
+  void ReadBatches(const LayerParameter& param, int num_batches,
+      vector<Dtype>* data, vector<Dtype>* labels) {
+    Caffe::set_random_seed(seed_);
+    VideoDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    data->clear();
+    labels->clear();
+    for (int iter = 0; iter < num_batches; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      data->insert(data->end(), blob_top_data_->cpu_data(),
+          blob_top_data_->cpu_data() + blob_top_data_->count());
+      labels->insert(labels->end(), blob_top_label_->cpu_data(),
+          blob_top_label_->cpu_data() + blob_top_label_->count());
+    }
+  }
+
+  int seed_;
+  int num_videos_;
+  int num_frames_;
+  string folder_;
+  string source_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(VideoDataLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(VideoDataLayerTest, TestRead) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.set_phase(TEST);
+  this->FillParameter(&param, 3);
+  VideoDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(3, this->blob_top_data_->num());
+  EXPECT_EQ(3 * 2 + 2, this->blob_top_data_->channels());
+  EXPECT_EQ(8, this->blob_top_data_->height());
+  EXPECT_EQ(10, this->blob_top_data_->width());
+  EXPECT_EQ(3, this->blob_top_label_->num());
+  EXPECT_EQ(1, this->blob_top_label_->channels());
+  // Go through the videos more than once, in list order.
+  for (int iter = 0; iter < 3; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < 3; ++i) {
+      EXPECT_EQ((iter * 3 + i) % this->num_videos_,
+          this->blob_top_label_->cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(VideoDataLayerTest, TestReadFromDB) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.set_phase(TEST);
+  this->FillParameter(&param, 3);
+  vector<Dtype> data, labels;
+  this->ReadBatches(param, 3, &data, &labels);
+
+  VideoDataParameter* video_data_param = param.mutable_video_data_param();
+  video_data_param->set_source(this->MakeDB());
+  video_data_param->clear_root_folder();
+  video_data_param->set_backend(DataParameter_DB_LMDB);
+  vector<Dtype> db_data, db_labels;
+  this->ReadBatches(param, 3, &db_data, &db_labels);
+  ASSERT_EQ(data.size(), db_data.size());
+  for (size_t i = 0; i < data.size(); ++i) {
+    EXPECT_EQ(data[i], db_data[i]);
+  }
+  EXPECT_TRUE(labels == db_labels);
+}
+
+TYPED_TEST(VideoDataLayerTest, TestDecodeThreadsMatch) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.set_phase(TRAIN);
+  this->FillParameter(&param, 4);
+  param.mutable_transform_param()->set_crop_size(5);
+  param.mutable_transform_param()->set_mirror(true);
+  param.mutable_video_data_param()->set_num_decode_threads(1);
+  vector<Dtype> data, labels;
+  this->ReadBatches(param, 3, &data, &labels);
+
+  // Random offsets, crops and mirrors are drawn per item in list order, so
+  // neither the number of decode threads nor the Caffe pool change a batch.
+  const int kNumDecodeThreads[] = {3, 0};
+  for (int t = 0; t < 2; ++t) {
+    Caffe::set_num_threads(3);
+    param.mutable_video_data_param()->set_num_decode_threads(
+        kNumDecodeThreads[t]);
+    vector<Dtype> threaded_data, threaded_labels;
+    this->ReadBatches(param, 3, &threaded_data, &threaded_labels);
+    Caffe::set_num_threads(1);
+    ASSERT_EQ(data.size(), threaded_data.size());
+    for (size_t i = 0; i < data.size(); ++i) {
+      EXPECT_EQ(data[i], threaded_data[i]);
+    }
+    EXPECT_TRUE(labels == threaded_labels);
+  }
+}
+
+TYPED_TEST(VideoDataLayerTest, TestPrefetchRing) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.set_phase(TRAIN);
+  this->FillParameter(&param, 3);
+  param.mutable_transform_param()->set_crop_size(5);
+  param.mutable_transform_param()->set_mirror(true);
+  param.mutable_data_param()->set_prefetch(1);
+  vector<Dtype> data, labels;
+  this->ReadBatches(param, 5, &data, &labels);
+
+  // A deeper ring lets the loader run ahead of Forward, which must still
+  // return every batch whole and in the order it was sampled.
+  param.mutable_data_param()->set_prefetch(3);
+  vector<Dtype> ring_data, ring_labels;
+  this->ReadBatches(param, 5, &ring_data, &ring_labels);
+  ASSERT_EQ(data.size(), ring_data.size());
+  for (size_t i = 0; i < data.size(); ++i) {
+    EXPECT_EQ(data[i], ring_data[i]);
+  }
+  ASSERT_EQ(5 * 3, static_cast<int>(ring_labels.size()));
+  for (int i = 0; i < 5 * 3; ++i) {
+    EXPECT_EQ(i % this->num_videos_, ring_labels[i]);
+  }
+}
+
+}  // namespace caffe
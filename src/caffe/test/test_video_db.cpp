@@ -0,0 +1,113 @@
+#include <cstdio>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "boost/scoped_ptr.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/video_db.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+using boost::scoped_ptr;
+
+class VideoDBTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempDir(&folder_);
+    source_ = folder_ + "/db";
+  }
+
+  string FrameFile(const char* pattern, int frame_id) {
+    char tmp[30];
+    snprintf(tmp, sizeof(tmp), pattern, frame_id);
+    return folder_ + "/" + tmp;
+  }
+
+  void WriteFile(const string& filename, const string& contents) {
+    std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+    out << contents;
+  }
+
+  string folder_;
+  string source_;
+};
+
+TEST_F(VideoDBTest, TestWriteRead) {
+  vector<vector<string> > frames(EncodedVideo::NUM_STREAMS);
+  const string contents[] = {"first", "", "third frame"};
+  for (int i = 0; i < 3; ++i) {
+    frames[EncodedVideo::IMAGE].push_back(FrameFile("image_%04d.jpg", i + 1));
+    WriteFile(frames[EncodedVideo::IMAGE][i], contents[i]);
+  }
+  frames[EncodedVideo::FLOW_Y].push_back(frames[EncodedVideo::IMAGE][2]);
+  scoped_ptr<db::DB> db(db::GetDB("lmdb"));
+  db->Open(source_, db::NEW);
+  scoped_ptr<db::Transaction> txn(db->NewTransaction());
+  VideoRecord record;
+  record.set_name("video");
+  record.set_length(3);
+  record.add_label(7);
+  ASSERT_TRUE(WriteVideoToDB(frames, 0, &record, txn.get()));
+  WriteVideoCount(1, txn.get());
+  txn->Commit();
+  db->Close();
+
+  db->Open(source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  EXPECT_EQ(1, ReadVideoCount(cursor.get()));
+  ASSERT_TRUE(cursor->SeekToKey(VideoRecordKey(0)));
+  VideoRecord stored;
+  ASSERT_TRUE(stored.ParseFromString(cursor->value()));
+  EXPECT_EQ("video", stored.name());
+  EXPECT_EQ(3, stored.length());
+  ASSERT_EQ(1, stored.label_size());
+  EXPECT_EQ(7, stored.label(0));
+  ASSERT_EQ(EncodedVideo::NUM_STREAMS, stored.num_frames_size());
+  EXPECT_EQ(3, stored.num_frames(EncodedVideo::IMAGE));
+  EXPECT_EQ(0, stored.num_frames(EncodedVideo::FLOW_X));
+  EXPECT_EQ(1, stored.num_frames(EncodedVideo::FLOW_Y));
+
+  DBVideo video(cursor.get(), 0, "video");
+  const char* data;
+  size_t size;
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(video.Frame(EncodedVideo::IMAGE, i + 1, &data, &size));
+    EXPECT_EQ(contents[i], string(data, size));
+  }
+  ASSERT_TRUE(video.Frame(EncodedVideo::FLOW_Y, 1, &data, &size));
+  EXPECT_EQ(contents[2], string(data, size));
+  EXPECT_FALSE(video.Frame(EncodedVideo::IMAGE, 0, &data, &size));
+  EXPECT_FALSE(video.Frame(EncodedVideo::IMAGE, 4, &data, &size));
+  EXPECT_FALSE(video.Frame(EncodedVideo::FLOW_X, 1, &data, &size));
+}
+
+TEST_F(VideoDBTest, TestUnreadableFrameStoresNothing) {
+  vector<vector<string> > frames(EncodedVideo::NUM_STREAMS);
+  frames[EncodedVideo::IMAGE].push_back(FrameFile("image_%04d.jpg", 1));
+  WriteFile(frames[EncodedVideo::IMAGE][0], "first");
+  // the flow stream is read after the image one has been fully read
+  frames[EncodedVideo::FLOW_X].push_back(FrameFile("flow_x_%04d.jpg", 1));
+  scoped_ptr<db::DB> db(db::GetDB("lmdb"));
+  db->Open(source_, db::NEW);
+  scoped_ptr<db::Transaction> txn(db->NewTransaction());
+  VideoRecord record;
+  record.set_name("video");
+  EXPECT_FALSE(WriteVideoToDB(frames, 0, &record, txn.get()));
+  txn->Commit();
+  db->Close();
+
+  db->Open(source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  cursor->SeekToFirst();
+  EXPECT_FALSE(cursor->valid());
+}
+
+}  // namespace caffe
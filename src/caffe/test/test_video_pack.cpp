@@ -0,0 +1,119 @@
+#include <cstdio>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/video_pack.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class VideoPackTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempDir(&folder_);
+  }
+
+  string FrameFile(const char* pattern, int frame_id) {
+    char tmp[30];
+    snprintf(tmp, sizeof(tmp), pattern, frame_id);
+    return folder_ + "/" + tmp;
+  }
+
+  void WriteFile(const string& filename, const string& contents) {
+    std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+    out << contents;
+  }
+
+  void CopyFile(const string& from, const string& to) {
+    std::ifstream in(from.c_str(), std::ios::in | std::ios::binary);
+    std::ofstream out(to.c_str(), std::ios::out | std::ios::binary);
+    out << in.rdbuf();
+  }
+
+  string folder_;
+};
+
+TEST_F(VideoPackTest, TestWriteRead) {
+  vector<vector<string> > frames(VideoPack::NUM_STREAMS);
+  const string contents[] = {"first", "", "third frame"};
+  for (int i = 0; i < 3; ++i) {
+    frames[VideoPack::IMAGE].push_back(FrameFile("image_%04d.jpg", i + 1));
+    WriteFile(frames[VideoPack::IMAGE][i], contents[i]);
+  }
+  frames[VideoPack::FLOW_Y].push_back(frames[VideoPack::IMAGE][2]);
+  const string pack_file = folder_ + "/video.vpk";
+  ASSERT_TRUE(WriteVideoPack(frames, pack_file));
+
+  VideoPack pack;
+  ASSERT_TRUE(pack.Open(pack_file));
+  EXPECT_EQ(3, pack.num_frames(VideoPack::IMAGE));
+  EXPECT_EQ(0, pack.num_frames(VideoPack::FLOW_X));
+  EXPECT_EQ(1, pack.num_frames(VideoPack::FLOW_Y));
+  const char* data;
+  size_t size;
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(pack.Frame(VideoPack::IMAGE, i + 1, &data, &size));
+    EXPECT_EQ(contents[i], string(data, size));
+  }
+  ASSERT_TRUE(pack.Frame(VideoPack::FLOW_Y, 1, &data, &size));
+  EXPECT_EQ(contents[2], string(data, size));
+  EXPECT_FALSE(pack.Frame(VideoPack::IMAGE, 0, &data, &size));
+  EXPECT_FALSE(pack.Frame(VideoPack::IMAGE, 4, &data, &size));
+  EXPECT_FALSE(pack.Frame(VideoPack::FLOW_X, 1, &data, &size));
+}
+
+TEST_F(VideoPackTest, TestOpenInvalid) {
+  VideoPack pack;
+  EXPECT_FALSE(pack.Open(folder_ + "/missing.vpk"));
+  const string bad_file = folder_ + "/bad.vpk";
+  WriteFile(bad_file, "this is not a video pack at all");
+  EXPECT_FALSE(pack.Open(bad_file));
+  EXPECT_FALSE(pack.is_open());
+}
+
+TEST_F(VideoPackTest, TestReadSegmentMatchesFolder) {
+  const string cat = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  vector<vector<string> > frames(VideoPack::NUM_STREAMS);
+  for (int i = 1; i <= 3; ++i) {
+    frames[VideoPack::IMAGE].push_back(FrameFile("image_%04d.jpg", i));
+    frames[VideoPack::FLOW_X].push_back(FrameFile("flow_x_%04d.jpg", i));
+    frames[VideoPack::FLOW_Y].push_back(FrameFile("flow_y_%04d.jpg", i));
+    for (int s = 0; s < VideoPack::NUM_STREAMS; ++s) {
+      CopyFile(cat, frames[s].back());
+    }
+  }
+  const string pack_file = folder_ + "/video.vpk";
+  ASSERT_TRUE(WriteVideoPack(frames, pack_file));
+  VideoPack pack;
+  ASSERT_TRUE(pack.Open(pack_file));
+
+  vector<int> offsets(1, 1);
+  Datum from_folder, from_pack;
+  ASSERT_TRUE(ReadSegmentRGBToDatum(folder_, 0, offsets, 32, 48, 2,
+      &from_folder, true));
+  ASSERT_TRUE(ReadSegmentRGBToDatum(pack, 0, offsets, 32, 48, 2,
+      &from_pack, true));
+  EXPECT_EQ(from_folder.channels(), from_pack.channels());
+  EXPECT_EQ(from_folder.data(), from_pack.data());
+
+  ASSERT_TRUE(ReadSegmentFlowToDatum(folder_, 0, offsets, 32, 48, 2,
+      &from_folder));
+  ASSERT_TRUE(ReadSegmentFlowToDatum(pack, 0, offsets, 32, 48, 2,
+      &from_pack));
+  EXPECT_EQ(from_folder.channels(), from_pack.channels());
+  EXPECT_EQ(from_folder.data(), from_pack.data());
+
+  // frames past the end of the pack fail like missing files do
+  offsets[0] = 2;
+  EXPECT_FALSE(ReadSegmentRGBToDatum(pack, 0, offsets, 32, 48, 2,
+      &from_pack, true));
+}
+
+}  // namespace caffe
@@ -0,0 +1,264 @@
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <sys/stat.h>
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/video_pack.hpp"
+#include "caffe/util/video_predictor.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Exposes the crops VideoPredictor cuts into the input of its net.
+template <typename Dtype>
+class CropVideoPredictor : public VideoPredictor<Dtype> {
+ public:
+  CropVideoPredictor(const vector<VideoModality>& modalities,
+      const vector<shared_ptr<Net<Dtype> > >& nets)
+      : VideoPredictor<Dtype>(modalities, nets) {}
+
+  void Crop(const vector<uint8_t>& frames, int num_items, Dtype* input) {
+    typename VideoPredictor<Dtype>::DecodedVideo decoded;
+    decoded.frames.push_back(frames);
+    for (int i = 0; i < num_items; ++i) {
+      this->FillCrop(&decoded, 0, 0, input, i, 0);
+    }
+  }
+};
+
+template <typename Dtype>
+class VideoPredictorTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    Caffe::set_mode(Caffe::CPU);
+    MakeTempDir(&folder_);
+  }
+
+  // A net averaging each channel of its batch_size x channels x 4 x 8 input.
+  shared_ptr<Net<Dtype> > AverageNet(int batch_size, int channels) {
+    char proto[300];
+    snprintf(proto, sizeof(proto),
+        "name: 'average' input: 'data' "
+        "input_shape { dim: %d dim: %d dim: 4 dim: 8 } "
+        "layer { name: 'pool' type: 'Pooling' bottom: 'data' top: 'score' "
+        "  pooling_param { pool: AVE global_pooling: true } } ",
+        batch_size, channels);
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    param.mutable_state()->set_phase(TEST);
+    return shared_ptr<Net<Dtype> >(new Net<Dtype>(param));
+  }
+
+  VideoModality Modality(bool flow, const float* mean_values) {
+    VideoModality modality;
+    modality.flow = flow;
+    modality.num_samples = 2;
+    modality.height = 8;
+    modality.width = 12;
+    modality.root = folder_ + "/";
+    modality.mean_values.assign(mean_values, mean_values + (flow ? 2 : 3));
+    modality.score_blob = "score";
+    return modality;
+  }
+
+  // Writes frames 1 to 3 of a stream, all of color value, losslessly.
+  void WriteFrames(const char* pattern, const cv::Scalar& value, int type,
+      vector<string>* files) {
+    const cv::Mat frame(8, 12, type, value);
+    vector<uchar> encoded;
+    ASSERT_TRUE(cv::imencode(".png", frame, encoded));
+    for (int i = 1; i <= 3; ++i) {
+      char tmp[30];
+      snprintf(tmp, sizeof(tmp), pattern, i);
+      files->push_back(folder_ + "/video/" + tmp);
+      std::ofstream out(files->back().c_str(),
+          std::ios::out | std::ios::binary);
+      out.write(reinterpret_cast<const char*>(&encoded[0]), encoded.size());
+    }
+  }
+
+  void WriteVideo() {
+    ASSERT_EQ(0, mkdir((folder_ + "/video").c_str(), 0755));
+    vector<vector<string> > frames(EncodedVideo::NUM_STREAMS);
+    WriteFrames("image_%04d.jpg", cv::Scalar(10, 100, 200), CV_8UC3,
+        &frames[EncodedVideo::IMAGE]);
+    WriteFrames("flow_x_%04d.jpg", cv::Scalar(100), CV_8UC1,
+        &frames[EncodedVideo::FLOW_X]);
+    WriteFrames("flow_y_%04d.jpg", cv::Scalar(50), CV_8UC1,
+        &frames[EncodedVideo::FLOW_Y]);
+    ASSERT_TRUE(WriteVideoPack(frames, folder_ + "/video.vpk"));
+  }
+
+  // The softmax of the given scores.
+  vector<Dtype> Softmax(const Dtype* scores, int num) {
+    vector<Dtype> probabilities(num);
+    Dtype sum = 0;
+    for (int i = 0; i < num; ++i) {
+      probabilities[i] = std::exp(scores[i]);
+      sum += probabilities[i];
+    }
+    for (int i = 0; i < num; ++i) {
+      probabilities[i] /= sum;
+    }
+    return probabilities;
+  }
+
+  string folder_;
+};
+
+TYPED_TEST_CASE(VideoPredictorTest, TestDtypes);
+
+TYPED_TEST(VideoPredictorTest, TestSnippetOffsets) {
+  VideoModality modality;
+  // RGB snippets go from the first frame to the last
+  vector<int> offsets =
+      VideoPredictor<TypeParam>::SnippetOffsets(modality, 101);
+  ASSERT_EQ(25, offsets.size());
+  EXPECT_EQ(0, offsets[0]);
+  EXPECT_EQ(4, offsets[1]);
+  EXPECT_EQ(96, offsets[24]);
+  // flow ones are (frames - length + 1) / num_samples apart
+  modality.flow = true;
+  modality.length = 10;
+  offsets = VideoPredictor<TypeParam>::SnippetOffsets(modality, 100);
+  EXPECT_EQ(3, offsets[1]);
+  EXPECT_LE(offsets[24] + modality.length, 100);
+  // too short a video samples its first frames over and over
+  modality.flow = false;
+  modality.length = 1;
+  offsets = VideoPredictor<TypeParam>::SnippetOffsets(modality, 10);
+  EXPECT_EQ(0, offsets[24]);
+}
+
+TYPED_TEST(VideoPredictorTest, TestCrops) {
+  // flow snippets of one flow_x/flow_y pair, with a value per pixel
+  const float mean_values[] = {1, 2};
+  vector<VideoModality> modalities(1, this->Modality(true, mean_values));
+  vector<shared_ptr<Net<TypeParam> > > nets(1, this->AverageNet(20, 2));
+  CropVideoPredictor<TypeParam> predictor(modalities, nets);
+  vector<uint8_t> frames(2 * 2 * 8 * 12);
+  for (int i = 0; i < frames.size(); ++i) {
+    const int s = i / (2 * 8 * 12), c = i / (8 * 12) % 2;
+    const int h = i / 12 % 8, w = i % 12;
+    frames[i] = s * 100 + c * 50 + h * 5 + w;
+  }
+  vector<TypeParam> input(20 * 2 * 4 * 8);
+  predictor.Crop(frames, 20, &input[0]);
+  // the corners and the center, then the same mirrored, of every snippet
+  const int offsets[5][2] = {{0, 0}, {0, 4}, {4, 0}, {4, 4}, {2, 2}};
+  for (int i = 0; i < 20; ++i) {
+    const int s = i % 2, crop = i / 2;
+    const bool mirror = crop >= 5;
+    const int h_off = offsets[crop % 5][0], w_off = offsets[crop % 5][1];
+    for (int c = 0; c < 2; ++c) {
+      for (int h = 0; h < 4; ++h) {
+        for (int w = 0; w < 8; ++w) {
+          const int w_in = mirror ? 7 - w : w;
+          int value = s * 100 + c * 50 + (h_off + h) * 5 + w_off + w_in;
+          // a mirrored flow_x field points the other way
+          if (mirror && c == 0) {
+            value = 255 - value;
+          }
+          EXPECT_EQ(value - mean_values[c],
+              input[((i * 2 + c) * 4 + h) * 8 + w]);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(VideoPredictorTest, TestPredict) {
+  this->WriteVideo();
+  // the net averages each channel over all the crops of the video
+  const float rgb_mean[] = {10, 99, 198};
+  vector<VideoModality> modalities(1, this->Modality(false, rgb_mean));
+  // a batch size which the crops of a video are not a multiple of
+  vector<shared_ptr<Net<TypeParam> > > nets(1, this->AverageNet(7, 3));
+  vector<std::pair<string, int> > videos;
+  videos.push_back(std::make_pair(string("video"), 0));
+  videos.push_back(std::make_pair(string("missing"), 0));
+  videos.push_back(std::make_pair(string("video"), 3));
+  const TypeParam rgb_scores[] = {0, 1, 2};
+  const vector<TypeParam> expected = this->Softmax(rgb_scores, 3);
+
+  vector<vector<TypeParam> > scores;
+  {
+    VideoPredictor<TypeParam> predictor(modalities, nets);
+    predictor.Predict(videos, &scores);
+  }
+  ASSERT_EQ(3, scores.size());
+  EXPECT_TRUE(scores[1].empty());
+  for (int i = 0; i < 3; i += 2) {
+    ASSERT_EQ(3, scores[i].size());
+    for (int k = 0; k < 3; ++k) {
+      EXPECT_NEAR(expected[k], scores[i][k], 1e-5);
+    }
+  }
+
+  // the same from the pack of the video
+  modalities[0].packed = true;
+  {
+    VideoPredictor<TypeParam> predictor(modalities, nets);
+    predictor.Predict(videos, &scores);
+  }
+  EXPECT_TRUE(scores[1].empty());
+  for (int k = 0; k < 3; ++k) {
+    EXPECT_NEAR(expected[k], scores[0][k], 1e-5);
+  }
+
+  // flow_x averages (100 + 155) / 2 over the plain and mirrored crops
+  const float flow_mean[] = {126.5, 50};
+  modalities[0] = this->Modality(true, flow_mean);
+  nets[0] = this->AverageNet(20, 2);
+  {
+    VideoPredictor<TypeParam> predictor(modalities, nets);
+    predictor.Predict(videos, &scores);
+  }
+  const TypeParam flow_scores[] = {1, 0};
+  const vector<TypeParam> flow_expected = this->Softmax(flow_scores, 2);
+  ASSERT_EQ(2, scores[0].size());
+  for (int k = 0; k < 2; ++k) {
+    EXPECT_NEAR(flow_expected[k], scores[0][k], 1e-5);
+  }
+}
+
+TYPED_TEST(VideoPredictorTest, TestFuse) {
+  this->WriteVideo();
+  const float rgb_mean[] = {10, 99, 198};
+  const float uniform_mean[] = {10, 100, 200};
+  vector<VideoModality> modalities;
+  modalities.push_back(this->Modality(false, rgb_mean));
+  modalities.push_back(this->Modality(false, uniform_mean));
+  modalities[1].packed = true;
+  modalities[1].weight = 3;
+  vector<shared_ptr<Net<TypeParam> > > nets;
+  nets.push_back(this->AverageNet(20, 3));
+  nets.push_back(this->AverageNet(20, 3));
+  VideoPredictor<TypeParam> predictor(modalities, nets);
+  vector<std::pair<string, int> > videos(1, std::make_pair("video", 0));
+  vector<vector<TypeParam> > scores;
+  predictor.Predict(videos, &scores);
+  // the probabilities of the modalities, averaged by weight
+  const TypeParam rgb_scores[] = {0, 1, 2};
+  const vector<TypeParam> expected = this->Softmax(rgb_scores, 3);
+  ASSERT_EQ(3, scores[0].size());
+  for (int k = 0; k < 3; ++k) {
+    EXPECT_NEAR((expected[k] + 3 * TypeParam(1) / 3) / 4, scores[0][k], 1e-5);
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,180 @@
+#include <fstream>  // NOLINT(readability/streams)
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/weight_pack.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class WeightPackTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempDir(&folder_);
+  }
+
+  string folder_;
+};
+
+TEST_F(WeightPackTest, TestWriteRead) {
+  NetParameter param;
+  LayerParameter* conv = param.add_layer();
+  conv->set_name("conv");
+  BlobProto* weights = conv->add_blobs();
+  for (int i = 0; i < 3; ++i) {
+    weights->mutable_shape()->add_dim(i + 2);
+  }
+  for (int i = 0; i < 24; ++i) {
+    weights->add_data(i * 0.5 - 3);
+  }
+  // a legacy 4D bias
+  BlobProto* bias = conv->add_blobs();
+  bias->set_num(1);
+  bias->set_channels(1);
+  bias->set_height(1);
+  bias->set_width(2);
+  bias->add_data(7);
+  bias->add_data(-1);
+  param.add_layer()->set_name("relu");
+  const string pack_file = folder_ + "/weights.wpk";
+  ASSERT_TRUE(WriteWeightPack(param, pack_file));
+  EXPECT_TRUE(IsWeightPack(pack_file));
+
+  WeightPack pack;
+  ASSERT_TRUE(pack.Open(pack_file));
+  const vector<WeightPack::LayerEntry>& layers = pack.layers();
+  ASSERT_EQ(2, layers.size());
+  EXPECT_EQ("conv", layers[0].name);
+  EXPECT_TRUE(layers[0].check_shape);
+  ASSERT_EQ(2, layers[0].blobs.size());
+  const WeightPack::BlobEntry& entry = layers[0].blobs[0];
+  EXPECT_FALSE(entry.legacy);
+  ASSERT_EQ(3, entry.shape.size());
+  EXPECT_EQ(4, entry.shape[2]);
+  ASSERT_EQ(24, entry.count);
+  EXPECT_EQ(0, reinterpret_cast<size_t>(entry.data) % WeightPack::kAlignment);
+  for (int i = 0; i < 24; ++i) {
+    EXPECT_EQ(weights->data(i), entry.data[i]);
+  }
+  EXPECT_TRUE(layers[0].blobs[1].legacy);
+  EXPECT_EQ(0, reinterpret_cast<size_t>(layers[0].blobs[1].data)
+      % WeightPack::kAlignment);
+  EXPECT_EQ("relu", layers[1].name);
+  EXPECT_EQ(0, layers[1].blobs.size());
+
+  // and back to the proto
+  NetParameter round_trip;
+  pack.ToProto(&round_trip);
+  EXPECT_EQ(param.DebugString(), round_trip.DebugString());
+}
+
+TEST_F(WeightPackTest, TestOpenInvalid) {
+  WeightPack pack;
+  EXPECT_FALSE(pack.Open(folder_ + "/missing.wpk"));
+  const string bad_file = folder_ + "/bad.wpk";
+  {
+    std::ofstream out(bad_file.c_str(), std::ios::out | std::ios::binary);
+    out << "this is not a weight pack at all";
+  }
+  EXPECT_FALSE(IsWeightPack(bad_file));
+  EXPECT_FALSE(pack.Open(bad_file));
+
+  // a pack cut short within its payload
+  NetParameter param;
+  BlobProto* blob = param.add_layer()->add_blobs();
+  blob->mutable_shape()->add_dim(100);
+  for (int i = 0; i < 100; ++i) {
+    blob->add_data(i);
+  }
+  const string pack_file = folder_ + "/weights.wpk";
+  ASSERT_TRUE(WriteWeightPack(param, pack_file));
+  string contents;
+  {
+    std::ifstream in(pack_file.c_str(), std::ios::in | std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(in),
+        std::istreambuf_iterator<char>());
+  }
+  {
+    std::ofstream out(bad_file.c_str(), std::ios::out | std::ios::binary);
+    out << contents.substr(0, contents.size() - 4);
+  }
+  EXPECT_TRUE(IsWeightPack(bad_file));
+  EXPECT_FALSE(pack.Open(bad_file));
+  EXPECT_FALSE(pack.is_open());
+}
+
+template <typename Dtype>
+class WeightPackNetTest : public ::testing::Test {
+ protected:
+  WeightPackNetTest() {
+    MakeTempDir(&folder_);
+  }
+
+  shared_ptr<Net<Dtype> > MakeNet() {
+    const string proto =
+        "name: 'WeightPackTest' "
+        "input: 'data' "
+        "input_shape { dim: 2 dim: 3 dim: 5 dim: 5 } "
+        "layer { "
+        "  name: 'conv' type: 'Convolution' bottom: 'data' top: 'conv' "
+        "  convolution_param { "
+        "    num_output: 4 kernel_size: 3 "
+        "    weight_filler { type: 'gaussian' std: 1 } "
+        "    bias_filler { type: 'gaussian' std: 1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'ip' type: 'InnerProduct' bottom: 'conv' top: 'ip' "
+        "  inner_product_param { "
+        "    num_output: 3 "
+        "    weight_filler { type: 'gaussian' std: 1 } "
+        "    bias_filler { type: 'gaussian' std: 1 } "
+        "  } "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    return shared_ptr<Net<Dtype> >(new Net<Dtype>(param));
+  }
+
+  string folder_;
+};
+
+TYPED_TEST_CASE(WeightPackNetTest, TestDtypes);
+
+TYPED_TEST(WeightPackNetTest, TestCopyTrainedLayersFrom) {
+  shared_ptr<Net<TypeParam> > trained = this->MakeNet();
+  NetParameter trained_param;
+  trained->ToProto(&trained_param);
+  const string model_file = this->folder_ + "/trained.caffemodel";
+  const string pack_file = this->folder_ + "/trained.wpk";
+  WriteProtoToBinaryFile(trained_param, model_file);
+  ASSERT_TRUE(WriteWeightPack(trained_param, pack_file));
+
+  // different random weights until copied over
+  shared_ptr<Net<TypeParam> > from_model = this->MakeNet();
+  shared_ptr<Net<TypeParam> > from_pack = this->MakeNet();
+  from_model->CopyTrainedLayersFrom(model_file);
+  from_pack->CopyTrainedLayersFrom(pack_file);
+  const vector<shared_ptr<Blob<TypeParam> > >& params = from_model->params();
+  ASSERT_EQ(4, params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    const Blob<TypeParam>& expected = *trained->params()[i];
+    const Blob<TypeParam>& from_pack_param = *from_pack->params()[i];
+    for (int j = 0; j < expected.count(); ++j) {
+      // both went through float
+      EXPECT_EQ(params[i]->cpu_data()[j], from_pack_param.cpu_data()[j]);
+      EXPECT_FLOAT_EQ(expected.cpu_data()[j], from_pack_param.cpu_data()[j]);
+    }
+  }
+}
+
+}  // namespace caffe
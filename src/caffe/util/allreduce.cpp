@@ -0,0 +1,463 @@
+#ifdef USE_MPI
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "caffe/util/allreduce.hpp"
+
+namespace caffe {
+
+namespace {
+
+template <typename Dtype>
+void Accumulate(const void* src, void* dst, const int count) {
+  const Dtype* x = static_cast<const Dtype*>(src);
+  Dtype* y = static_cast<Dtype*>(dst);
+  for (int i = 0; i < count; ++i) {
+    y[i] += x[i];
+  }
+}
+
+// dst += src, for count elements of type
+void Accumulate(const void* src, void* dst, const int count,
+    MPI_Datatype type) {
+  if (type == MPI_FLOAT) {
+    Accumulate<float>(src, dst, count);
+  } else {
+    CHECK(type == MPI_DOUBLE) << "Only float and double can be summed";
+    Accumulate<double>(src, dst, count);
+  }
+}
+
+int TypeSize(MPI_Datatype type) {
+  int size;
+  MPI_CHECK(MPI_Type_size(type, &size));
+  return size;
+}
+
+// Splits count elements into the size segments of a ring, segment i being
+// [(*offsets)[i], (*offsets)[i + 1]); returns the longest.
+int RingSegments(const int count, const int size, vector<int>* offsets) {
+  offsets->resize(size + 1);
+  int max_segment = 0;
+  for (int i = 0; i <= size; ++i) {
+    (*offsets)[i] = static_cast<int64_t>(count) * i / size;
+    if (i > 0) {
+      max_segment = std::max(max_segment, (*offsets)[i] - (*offsets)[i - 1]);
+    }
+  }
+  return max_segment;
+}
+
+template <typename Dtype>
+inline Dtype RoundToHalf(const Dtype value) {
+  return caffe_half_to_float(caffe_float_to_half(value));
+}
+
+// Orders indices by decreasing magnitude of the values they point to.
+template <typename Dtype>
+struct AbsGreater {
+  explicit AbsGreater(const Dtype* values) : values(values) {}
+  bool operator()(const int a, const int b) const {
+    return std::fabs(values[a]) > std::fabs(values[b]);
+  }
+  const Dtype* values;
+};
+
+// Whether MPI is still up: the backends may be destroyed at exit, after
+// MPI_Finalize.
+bool MPIActive() {
+  int finalized;
+  MPI_Finalized(&finalized);
+  return !finalized;
+}
+
+}  // namespace
+
+uint16_t caffe_float_to_half(float value) {
+  uint32_t x;
+  memcpy(&x, &value, sizeof(x));
+  const uint16_t sign = (x >> 16) & 0x8000;
+  const int exponent = (x >> 23) & 0xff;
+  uint32_t mantissa = x & 0x7fffff;
+  if (exponent == 0xff) {
+    // inf, or a quiet nan
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  const int half_exponent = exponent - 127 + 15;
+  if (half_exponent >= 31) {
+    return sign | 0x7c00;
+  }
+  if (half_exponent <= 0) {
+    // a subnormal half, or zero
+    if (half_exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    const int shift = 14 - half_exponent;
+    uint32_t half = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) {
+      ++half;
+    }
+    return sign | half;
+  }
+  uint32_t half = (half_exponent << 10) | (mantissa >> 13);
+  const uint32_t rest = mantissa & 0x1fff;
+  // a carry out of the mantissa rightly bumps the exponent, up to inf
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return sign | half;
+}
+
+float caffe_half_to_float(uint16_t value) {
+  const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+  int exponent = (value >> 10) & 0x1f;
+  uint32_t mantissa = value & 0x3ff;
+  uint32_t x;
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      x = sign;
+    } else {
+      // normalize the subnormal
+      exponent = 1;
+      while (!(mantissa & 0x400)) {
+        mantissa <<= 1;
+        --exponent;
+      }
+      x = sign | ((exponent + 112) << 23) | ((mantissa & 0x3ff) << 13);
+    }
+  } else if (exponent == 31) {
+    x = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float result;
+  memcpy(&result, &x, sizeof(result));
+  return result;
+}
+
+RingAllreduce::RingAllreduce(MPI_Comm comm, size_t chunk_bytes,
+    bool half_precision)
+    : chunk_bytes_(chunk_bytes), half_precision_(half_precision) {
+  CHECK_GT(chunk_bytes, 0);
+  MPI_CHECK(MPI_Comm_dup(comm, &comm_));
+  MPI_CHECK(MPI_Comm_rank(comm_, &rank_));
+  MPI_CHECK(MPI_Comm_size(comm_, &size_));
+  // room for at least one element however small the chunks
+  recv_buffer_.resize(std::max(chunk_bytes_, sizeof(double)));
+}
+
+RingAllreduce::~RingAllreduce() {
+  if (MPIActive()) {
+    MPI_Comm_free(&comm_);
+  }
+}
+
+void RingAllreduce::Allreduce(const void* src, void* dst, int count,
+    MPI_Datatype type) {
+  const int type_size = TypeSize(type);
+  char* data = static_cast<char*>(dst);
+  if (src != dst) {
+    memcpy(data, src, static_cast<size_t>(count) * type_size);
+  }
+  if (half_precision_) {
+    if (type == MPI_FLOAT) {
+      HalfAllreduce(static_cast<float*>(dst), count);
+    } else {
+      CHECK(type == MPI_DOUBLE) << "Only float and double can be summed";
+      HalfAllreduce(static_cast<double*>(dst), count);
+    }
+    return;
+  }
+  if (size_ == 1) {
+    return;
+  }
+  const int chunk = std::max<int>(chunk_bytes_ / type_size, 1);
+  const int right = (rank_ + 1) % size_;
+  const int left = (rank_ + size_ - 1) % size_;
+  vector<int> offsets;
+  const int max_segment = RingSegments(count, size_, &offsets);
+  // Step s sends segment (rank - s) and receives segment (rank - s - 1),
+  // adding it in the first phase and copying it in the second. After the
+  // first phase each rank holds the full sum of segment (rank + 1).
+  for (int phase = 0; phase < 2; ++phase) {
+    for (int step = 0; step < size_ - 1; ++step) {
+      const int send_seg = (rank_ - step + phase + 2 * size_) % size_;
+      const int recv_seg = (send_seg + size_ - 1) % size_;
+      const int send_count = offsets[send_seg + 1] - offsets[send_seg];
+      const int recv_count = offsets[recv_seg + 1] - offsets[recv_seg];
+      // the same number of exchanges on every rank, some of them empty
+      for (int done = 0; done < max_segment; done += chunk) {
+        const int n_send = std::max(std::min(chunk, send_count - done), 0);
+        const int n_recv = std::max(std::min(chunk, recv_count - done), 0);
+        char* send_ptr = data
+            + static_cast<size_t>(offsets[send_seg] + done) * type_size;
+        char* recv_ptr = data
+            + static_cast<size_t>(offsets[recv_seg] + done) * type_size;
+        MPI_CHECK(MPI_Sendrecv(send_ptr, n_send, type, right, step,
+            phase == 0 ? &recv_buffer_[0] : recv_ptr, n_recv, type, left,
+            step, comm_, MPI_STATUS_IGNORE));
+        if (phase == 0) {
+          Accumulate(&recv_buffer_[0], recv_ptr, n_recv, type);
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void RingAllreduce::HalfAllreduce(Dtype* data, int count) {
+  if (size_ == 1) {
+    // the result is as precise as on more ranks
+    for (int i = 0; i < count; ++i) {
+      data[i] = RoundToHalf(data[i]);
+    }
+    return;
+  }
+  const int chunk = std::max<int>(chunk_bytes_ / sizeof(uint16_t), 1);
+  uint16_t* recv_half = reinterpret_cast<uint16_t*>(&recv_buffer_[0]);
+  send_half_.resize(chunk);
+  const int right = (rank_ + 1) % size_;
+  const int left = (rank_ + size_ - 1) % size_;
+  vector<int> offsets;
+  const int max_segment = RingSegments(count, size_, &offsets);
+  // the same schedule as the full precision ring
+  for (int phase = 0; phase < 2; ++phase) {
+    if (phase == 1) {
+      // round the segment this rank completed like the copies the others
+      // receive of it
+      const int own_seg = (rank_ + 1) % size_;
+      for (int i = offsets[own_seg]; i < offsets[own_seg + 1]; ++i) {
+        data[i] = RoundToHalf(data[i]);
+      }
+    }
+    for (int step = 0; step < size_ - 1; ++step) {
+      const int send_seg = (rank_ - step + phase + 2 * size_) % size_;
+      const int recv_seg = (send_seg + size_ - 1) % size_;
+      const int send_count = offsets[send_seg + 1] - offsets[send_seg];
+      const int recv_count = offsets[recv_seg + 1] - offsets[recv_seg];
+      for (int done = 0; done < max_segment; done += chunk) {
+        const int n_send = std::max(std::min(chunk, send_count - done), 0);
+        const int n_recv = std::max(std::min(chunk, recv_count - done), 0);
+        const Dtype* send_ptr = data + offsets[send_seg] + done;
+        Dtype* recv_ptr = data + offsets[recv_seg] + done;
+        for (int i = 0; i < n_send; ++i) {
+          send_half_[i] = caffe_float_to_half(send_ptr[i]);
+        }
+        MPI_CHECK(MPI_Sendrecv(&send_half_[0], n_send, MPI_UINT16_T, right,
+            step, recv_half, n_recv, MPI_UINT16_T, left, step, comm_,
+            MPI_STATUS_IGNORE));
+        if (phase == 0) {
+          for (int i = 0; i < n_recv; ++i) {
+            recv_ptr[i] += caffe_half_to_float(recv_half[i]);
+          }
+        } else {
+          for (int i = 0; i < n_recv; ++i) {
+            recv_ptr[i] = caffe_half_to_float(recv_half[i]);
+          }
+        }
+      }
+    }
+  }
+}
+
+HierarchicalAllreduce::HierarchicalAllreduce(MPI_Comm comm,
+    size_t chunk_bytes, bool half_precision)
+    : leader_comm_(MPI_COMM_NULL), slot_bytes_(chunk_bytes),
+      half_precision_(half_precision) {
+  CHECK_GT(chunk_bytes, 0);
+  int rank;
+  MPI_CHECK(MPI_Comm_rank(comm, &rank));
+  MPI_CHECK(MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank,
+      MPI_INFO_NULL, &local_comm_));
+  MPI_CHECK(MPI_Comm_rank(local_comm_, &local_rank_));
+  MPI_CHECK(MPI_Comm_size(local_comm_, &local_size_));
+  MPI_CHECK(MPI_Comm_split(comm, local_rank_ == 0 ? 0 : MPI_UNDEFINED, rank,
+      &leader_comm_));
+  if (leader_comm_ != MPI_COMM_NULL) {
+    leader_ring_.reset(new RingAllreduce(leader_comm_, chunk_bytes,
+        half_precision));
+  }
+
+  char* base;
+  MPI_CHECK(MPI_Win_allocate_shared(slot_bytes_, 1, MPI_INFO_NULL,
+      local_comm_, &base, &window_));
+  slots_.resize(local_size_);
+  for (int i = 0; i < local_size_; ++i) {
+    MPI_Aint size;
+    int disp_unit;
+    MPI_CHECK(MPI_Win_shared_query(window_, i, &size, &disp_unit,
+        &slots_[i]));
+  }
+  // the window is only accessed by loads and stores, ordered by
+  // LocalBarrier
+  MPI_CHECK(MPI_Win_lock_all(MPI_MODE_NOCHECK, window_));
+}
+
+HierarchicalAllreduce::~HierarchicalAllreduce() {
+  if (MPIActive()) {
+    MPI_Win_unlock_all(window_);
+    MPI_Win_free(&window_);
+    leader_ring_.reset();
+    if (leader_comm_ != MPI_COMM_NULL) {
+      MPI_Comm_free(&leader_comm_);
+    }
+    MPI_Comm_free(&local_comm_);
+  }
+}
+
+void HierarchicalAllreduce::LocalBarrier() {
+  MPI_CHECK(MPI_Win_sync(window_));
+  MPI_CHECK(MPI_Barrier(local_comm_));
+  MPI_CHECK(MPI_Win_sync(window_));
+}
+
+void HierarchicalAllreduce::Allreduce(const void* src, void* dst, int count,
+    MPI_Datatype type) {
+  const int type_size = TypeSize(type);
+  const int chunk = std::max<int>(slot_bytes_ / type_size, 1);
+  CHECK_LE(static_cast<size_t>(chunk) * type_size, slot_bytes_)
+      << "chunk_bytes must hold at least one element";
+  const char* src_data = static_cast<const char*>(src);
+  char* dst_data = static_cast<char*>(dst);
+  char* sum = slots_[0];
+  for (int start = 0; start < count; start += chunk) {
+    const int n = std::min(chunk, count - start);
+    const size_t offset = static_cast<size_t>(start) * type_size;
+    memcpy(slots_[local_rank_], src_data + offset,
+        static_cast<size_t>(n) * type_size);
+    LocalBarrier();
+    // every local rank adds up its share of the chunk into slot 0
+    const int begin = static_cast<int64_t>(n) * local_rank_ / local_size_;
+    const int end = static_cast<int64_t>(n) * (local_rank_ + 1) / local_size_;
+    for (int i = 1; i < local_size_; ++i) {
+      Accumulate(slots_[i] + static_cast<size_t>(begin) * type_size,
+          sum + static_cast<size_t>(begin) * type_size, end - begin, type);
+    }
+    LocalBarrier();
+    if (leader_ring_) {
+      leader_ring_->Allreduce(sum, sum, n, type);
+    }
+    LocalBarrier();
+    memcpy(dst_data + offset, sum, static_cast<size_t>(n) * type_size);
+    // slot 0 is overwritten by the next chunk
+    LocalBarrier();
+  }
+}
+
+TopKAllreduce::TopKAllreduce(MPI_Comm comm, float ratio) : ratio_(ratio) {
+  CHECK_GT(ratio, 0);
+  CHECK_LE(ratio, 1);
+  MPI_CHECK(MPI_Comm_dup(comm, &comm_));
+  MPI_CHECK(MPI_Comm_size(comm_, &size_));
+}
+
+TopKAllreduce::~TopKAllreduce() {
+  if (MPIActive()) {
+    MPI_Comm_free(&comm_);
+  }
+}
+
+void TopKAllreduce::Allreduce(const void* src, void* dst, int count,
+    MPI_Datatype type) {
+  if (type == MPI_FLOAT) {
+    SparseAllreduce(static_cast<const float*>(src), static_cast<float*>(dst),
+        count);
+  } else {
+    CHECK(type == MPI_DOUBLE) << "Only float and double can be summed";
+    SparseAllreduce(static_cast<const double*>(src),
+        static_cast<double*>(dst), count);
+  }
+}
+
+template <typename Dtype>
+void TopKAllreduce::SparseAllreduce(const Dtype* src, Dtype* dst,
+    int count) {
+  vector<char>& residual_bytes = residuals_[dst];
+  if (residual_bytes.size() != count * sizeof(Dtype)) {
+    residual_bytes.assign(count * sizeof(Dtype), 0);
+  }
+  Dtype* residual = reinterpret_cast<Dtype*>(&residual_bytes[0]);
+  // error feedback: what was left out before is sent along with src
+  for (int i = 0; i < count; ++i) {
+    residual[i] += src[i];
+  }
+  const int k = std::min(count,
+      std::max(1, static_cast<int>(std::ceil(ratio_ * count))));
+  indices_.resize(count);
+  for (int i = 0; i < count; ++i) {
+    indices_[i] = i;
+  }
+  if (k < count) {
+    std::nth_element(indices_.begin(), indices_.begin() + k, indices_.end(),
+        AbsGreater<Dtype>(residual));
+  }
+  // (index, value) pairs; the values sent are taken out of the residual
+  const size_t pair_bytes = sizeof(int) + sizeof(Dtype);
+  send_buffer_.resize(k * pair_bytes);
+  char* pair = &send_buffer_[0];
+  for (int i = 0; i < k; ++i, pair += pair_bytes) {
+    const int index = indices_[i];
+    memcpy(pair, &index, sizeof(int));
+    memcpy(pair + sizeof(int), &residual[index], sizeof(Dtype));
+    residual[index] = 0;
+  }
+  recv_buffer_.resize(size_ * send_buffer_.size());
+  MPI_CHECK(MPI_Allgather(&send_buffer_[0], send_buffer_.size(), MPI_BYTE,
+      &recv_buffer_[0], send_buffer_.size(), MPI_BYTE, comm_));
+  // added up in rank order, so the sum is the same on every rank
+  std::fill(dst, dst + count, Dtype(0));
+  pair = &recv_buffer_[0];
+  for (int i = 0; i < size_ * k; ++i, pair += pair_bytes) {
+    int index;
+    Dtype value;
+    memcpy(&index, pair, sizeof(int));
+    memcpy(&value, pair + sizeof(int), sizeof(Dtype));
+    dst[index] += value;
+  }
+}
+
+AllreduceBackend* CreateAllreduceBackend(
+    SolverParameter_AllreduceAlgorithm algorithm, size_t chunk_bytes) {
+  switch (algorithm) {
+  case SolverParameter_AllreduceAlgorithm_NATIVE:
+    return NULL;
+  case SolverParameter_AllreduceAlgorithm_RING:
+    return new RingAllreduce(MPI_COMM_WORLD, chunk_bytes);
+  case SolverParameter_AllreduceAlgorithm_HIERARCHICAL:
+    return new HierarchicalAllreduce(MPI_COMM_WORLD, chunk_bytes);
+  default:
+    LOG(FATAL) << "Unknown allreduce algorithm: " << algorithm;
+  }
+  return NULL;
+}
+
+AllreduceBackend* CreateGradientBackend(
+    SolverParameter_AllreduceAlgorithm algorithm, size_t chunk_bytes,
+    SolverParameter_GradientCompression compression, float top_k_ratio) {
+  switch (compression) {
+  case SolverParameter_GradientCompression_NONE:
+    return NULL;
+  case SolverParameter_GradientCompression_FP16:
+    if (algorithm == SolverParameter_AllreduceAlgorithm_HIERARCHICAL) {
+      return new HierarchicalAllreduce(MPI_COMM_WORLD, chunk_bytes, true);
+    }
+    // the MPI library cannot send floats as halves, a ring does it instead
+    return new RingAllreduce(MPI_COMM_WORLD, chunk_bytes, true);
+  case SolverParameter_GradientCompression_TOP_K:
+    return new TopKAllreduce(MPI_COMM_WORLD, top_k_ratio);
+  default:
+    LOG(FATAL) << "Unknown gradient compression: " << compression;
+  }
+  return NULL;
+}
+
+}  // namespace caffe
+
+#endif  // USE_MPI
@@ -7,6 +7,8 @@
 #include <boost/thread.hpp>
 #include <boost/atomic.hpp>
 #include <boost/lockfree/queue.hpp>
+#include <utility>
+#include <vector>
 
 
 #include "caffe/util/channel.hpp"
@@ -19,7 +21,14 @@ namespace caffe {
 
 shared_ptr<MPIComm> MPIComm::singleton_;
 
+// Default bound on the collectives progressing at once.
+static const int kDefaultMaxInFlight = 4;
+// How long the transmission thread sleeps between polls of the in-flight
+// jobs when it has nothing new to issue.
+static const int kPollMicroseconds = 50;
+
 MPIComm::MPIComm() :
+    num_in_flight_(0), max_in_flight_(kDefaultMaxInFlight),
     running_(false), started_(false){}
 
 MPIComm::~MPIComm() {
@@ -34,19 +43,57 @@ bool MPIComm::IsRunning(){
 
 bool MPIComm::IsIdle(){
   mutex::scoped_lock lock(queue_mutex_);
-  return task_queue_.empty();
+  return task_queue_.empty() && num_in_flight_ == 0;
 }
 
 void MPIComm::WaitAll() {
 
   mutex::scoped_lock lock(queue_mutex_);
-  while (task_queue_.size()){
-    DLOG(INFO)<<"Waiting for tasks to finish, task size "<<task_queue_.size()<<"\n";
+  while (task_queue_.size() || num_in_flight_){
+    DLOG(INFO)<<"Waiting for tasks to finish, task size "<<task_queue_.size()
+              <<", in flight "<<num_in_flight_<<"\n";
     cond_finish_.wait(lock);
   }
   DLOG(INFO)<<"all task done on "<<Caffe::MPI_my_rank()<<"\n";
 }
 
+void MPIComm::WaitJob(const MPIJobHandle& job) {
+  mutex::scoped_lock lock(queue_mutex_);
+  while (!job->done()){
+    cond_finish_.wait(lock);
+  }
+}
+
+void MPIComm::set_max_in_flight(int max_in_flight) {
+  CHECK_GT(max_in_flight, 0);
+  mutex::scoped_lock lock(queue_mutex_);
+  max_in_flight_ = max_in_flight;
+}
+
+void MPIComm::set_allreduce_backend(shared_ptr<AllreduceBackend> backend) {
+  mutex::scoped_lock lock(queue_mutex_);
+  allreduce_backend_ = backend;
+  if (backend) {
+    LOG(INFO)<<"Summing across ranks with the "<<backend->type()
+             <<" allreduce";
+  }
+}
+
+void MPIComm::set_gradient_backend(shared_ptr<AllreduceBackend> backend) {
+  mutex::scoped_lock lock(queue_mutex_);
+  gradient_backend_ = backend;
+  if (backend) {
+    LOG(INFO)<<"Summing gradients across ranks with the "<<backend->type()
+             <<" allreduce";
+  }
+}
+
+void MPIComm::RunCall(const boost::function<void()>& call) {
+  MPIJob job = {NULL, NULL, 0, 0, OP_CALL};
+  job.call_ = call;
+  WaitJob(AddJob(job));
+}
+
 void MPIComm::StartProcessing() {
 
   running_.store(true);
@@ -62,8 +109,12 @@ void MPIComm::StartProcessing() {
 void MPIComm::EndProcessing(){
   if (IsRunning()) {
     try {
+      {
+        //notify the transmission thread to finish and shutdown
+        mutex::scoped_lock lock(queue_mutex_);
+        running_.store(false);
+      }
       cond_work_.notify_one();
-      running_.store(false); //notify the transmission thread to finish and shutdown
       thread_->join();
     } catch (...) {
       LOG(FATAL)<<"Cannot destroy MPI comminication thread";
@@ -71,48 +122,52 @@ void MPIComm::EndProcessing(){
   }
 }
 
-void MPIComm::AddJob(MPIJob new_job) {
+MPIJobHandle MPIComm::AddJob(MPIJob new_job) {
+  MPIJobHandle handle(new MPIJobStatus());
   if (IsRunning()) {
     while(!started_.load());
+    handle->queued_time_ = MPI_Wtime();
     mutex::scoped_lock lock(queue_mutex_);
     DLOG(INFO) << "adding job on " << Caffe::MPI_my_rank() << " task queue size " << task_queue_.size() << " \n";
-    task_queue_.push(new_job);
+    task_queue_.push(std::make_pair(new_job, handle));
     lock.unlock();
     cond_work_.notify_one();
   }else{
     LOG(FATAL)<<"Cannot push job while MPI Comm is shutting down";
   }
+  return handle;
 }
 
-void MPIComm::DispatchJob(MPIJob &job) {
+void MPIComm::StartJob(const MPIJob& job, MPI_Request* request) {
   MPI_Datatype data_type = (job.dtype_size_ == 4) ? MPI_FLOAT : MPI_DOUBLE;
 
   // call MPI APIs for real works
   switch (job.op_) {
-    case OP_SUM_ALL: {
+    case OP_SUM_ALL:
+    case OP_SUM_GRADIENT: {
       DLOG(INFO)<<"Running all reduce\n";
-      MPI_CHECK(MPI_Allreduce((job.src_ptr_ == job.dst_ptr_) ? MPI_IN_PLACE : job.src_ptr_,
-                              job.dst_ptr_, job.count_, data_type,
-                              MPI_SUM, MPI_COMM_WORLD
+      MPI_CHECK(MPI_Iallreduce((job.src_ptr_ == job.dst_ptr_) ? MPI_IN_PLACE : job.src_ptr_,
+                               job.dst_ptr_, job.count_, data_type,
+                               MPI_SUM, MPI_COMM_WORLD, request
       ));
       break;
     }
     case OP_GATHER: {
-      MPI_CHECK(MPI_Allgather(job.src_ptr_, job.count_, data_type,
-                              job.dst_ptr_, job.count_, data_type,
-                              MPI_COMM_WORLD));
+      MPI_CHECK(MPI_Iallgather(job.src_ptr_, job.count_, data_type,
+                               job.dst_ptr_, job.count_, data_type,
+                               MPI_COMM_WORLD, request));
       break;
     }
     case OP_SCATTER: {
-      MPI_CHECK(MPI_Scatter(job.src_ptr_, job.count_, data_type,
-                            job.dst_ptr_, job.count_, data_type,
-                            0, MPI_COMM_WORLD));
+      MPI_CHECK(MPI_Iscatter(job.src_ptr_, job.count_, data_type,
+                             job.dst_ptr_, job.count_, data_type,
+                             0, MPI_COMM_WORLD, request));
       break;
     }
     case OP_BROADCAST: {
       CHECK_EQ(job.src_ptr_, job.dst_ptr_);
-      MPI_CHECK(MPI_Bcast(job.src_ptr_, job.count_, data_type,
-                          0, MPI_COMM_WORLD));
+      MPI_CHECK(MPI_Ibcast(job.src_ptr_, job.count_, data_type,
+                           0, MPI_COMM_WORLD, request));
       break;
     }
     default: {
@@ -120,42 +175,134 @@ void MPIComm::DispatchJob(MPIJob &job) {
     }
   }
 }
+
+void MPIComm::RunBlockingJob(const MPIJob& job, const MPIJobHandle& handle,
+                             AllreduceBackend* backend) {
+  CHECK(job.op_ == OP_SUM_ALL || job.op_ == OP_SUM_GRADIENT);
+  MPI_Datatype data_type = (job.dtype_size_ == 4) ? MPI_FLOAT : MPI_DOUBLE;
+  handle->start_time_ = MPI_Wtime();
+  backend->Allreduce(job.src_ptr_, job.dst_ptr_, job.count_, data_type);
+  FinishBlockingJob(handle);
+}
+
+void MPIComm::FinishBlockingJob(const MPIJobHandle& handle) {
+  const double now = MPI_Wtime();
+  mutex::scoped_lock lock(queue_mutex_);
+  handle->finish_time_ = now;
+  handle->done_.store(true);
+  --num_in_flight_;
+  lock.unlock();
+  cond_finish_.notify_all();
+}
+
+void MPIComm::CompleteJobs() {
+  if (requests_.empty()) {
+    return;
+  }
+  // with every slot taken nothing new can be issued, so block; otherwise
+  // only poll, to keep issuing the jobs being added
+  int num_done = 0;
+  std::vector<int> indices(requests_.size());
+  if (requests_.size() >= max_in_flight_) {
+    MPI_CHECK(MPI_Waitsome(requests_.size(), &requests_[0], &num_done,
+                           &indices[0], MPI_STATUSES_IGNORE));
+  } else {
+    MPI_CHECK(MPI_Testsome(requests_.size(), &requests_[0], &num_done,
+                           &indices[0], MPI_STATUSES_IGNORE));
+  }
+  if (num_done <= 0) {
+    return;
+  }
+  const double now = MPI_Wtime();
+  mutex::scoped_lock lock(queue_mutex_);
+  // completed requests were set to MPI_REQUEST_NULL
+  int kept = 0;
+  for (size_t i = 0; i < requests_.size(); ++i) {
+    if (requests_[i] == MPI_REQUEST_NULL) {
+      request_jobs_[i]->finish_time_ = now;
+      request_jobs_[i]->done_.store(true);
+      --num_in_flight_;
+    } else {
+      requests_[kept] = requests_[i];
+      request_jobs_[kept] = request_jobs_[i];
+      ++kept;
+    }
+  }
+  requests_.resize(kept);
+  request_jobs_.resize(kept);
+  lock.unlock();
+  cond_finish_.notify_all();
+}
+
 void MPIComm::ThreadFunc(){
 #ifndef CPU_ONLY
   CUDA_CHECK(cudaSetDevice(Caffe::device_id()));
 #endif
   started_.store(true);
-  MPIJob job;
+  std::vector<std::pair<MPIJob, MPIJobHandle> > to_start;
   while (true){
     mutex::scoped_lock lock(queue_mutex_);
-    while( task_queue_.empty() && IsRunning()){
+    while (task_queue_.empty() && requests_.empty() && IsRunning()){
       DLOG(INFO)<<"no job running, waiting on cond";
       cond_work_.wait(lock);
     }
-    lock.unlock();
-
-    DLOG(INFO)<<"Cond fulfilled, dispatching job";
-    if (IsRunning()){
-      job = task_queue_.front();
-      DLOG(INFO)<<task_queue_.size();
-      DispatchJob(job);
-      mutex::scoped_lock pop_lock(queue_mutex_);
-      task_queue_.pop();
-      pop_lock.unlock();
-      cond_finish_.notify_one();
-      DLOG(INFO)<<"job finished, poped taskqueue";
-    }else{
+    // when shutting down, finish the remaining jobs first
+    if (task_queue_.empty() && requests_.empty()){
       break;
     }
+    if (task_queue_.empty() || requests_.size() >= max_in_flight_){
+      if (task_queue_.empty()){
+        // the jobs in flight still need polling for MPI to progress them
+        cond_work_.timed_wait(lock,
+            boost::posix_time::microseconds(kPollMicroseconds));
+      }
+      lock.unlock();
+      CompleteJobs();
+      continue;
+    }
+    // keep the backends alive while their jobs run, even if replaced
+    shared_ptr<AllreduceBackend> backend = allreduce_backend_;
+    shared_ptr<AllreduceBackend> gradient_backend =
+        gradient_backend_ ? gradient_backend_ : allreduce_backend_;
+    to_start.clear();
+    while (!task_queue_.empty() &&
+           requests_.size() + to_start.size() < max_in_flight_){
+      to_start.push_back(task_queue_.front());
+      task_queue_.pop();
+      ++num_in_flight_;
+    }
+    lock.unlock();
 
-  }
-
-  // finish remaining jobs
-  while (!task_queue_.empty()){
-    boost::lock_guard<mutex> lock(queue_mutex_);
-    job = task_queue_.front();
-    task_queue_.pop();
-    DispatchJob(job);
+    DLOG(INFO)<<"Cond fulfilled, starting "<<to_start.size()<<" job(s)";
+    for (size_t i = 0; i < to_start.size(); ++i){
+      if (to_start[i].first.op_ == OP_CALL){
+        to_start[i].second->start_time_ = MPI_Wtime();
+        to_start[i].first.call_();
+        FinishBlockingJob(to_start[i].second);
+        // the call may have set the backends of the jobs after it
+        lock.lock();
+        backend = allreduce_backend_;
+        gradient_backend =
+            gradient_backend_ ? gradient_backend_ : allreduce_backend_;
+        lock.unlock();
+        continue;
+      }
+      if (backend && to_start[i].first.op_ == OP_SUM_ALL){
+        RunBlockingJob(to_start[i].first, to_start[i].second, backend.get());
+        continue;
+      }
+      if (gradient_backend && to_start[i].first.op_ == OP_SUM_GRADIENT){
+        RunBlockingJob(to_start[i].first, to_start[i].second,
+                       gradient_backend.get());
+        continue;
+      }
+      MPI_Request request;
+      to_start[i].second->start_time_ = MPI_Wtime();
+      StartJob(to_start[i].first, &request);
+      requests_.push_back(request);
+      request_jobs_.push_back(to_start[i].second);
+    }
+    CompleteJobs();
   }
 }
 
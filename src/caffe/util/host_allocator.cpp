@@ -0,0 +1,157 @@
+#include <boost/thread.hpp>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include "caffe/util/host_allocator.hpp"
+
+namespace caffe {
+
+const size_t HostAllocator::kAlignment;
+const size_t HostAllocator::kHugePageSize;
+const size_t HostAllocator::kDefaultCacheLimit;
+
+class HostAllocator::sync {
+ public:
+  mutable boost::mutex mutex_;
+  // the cached blocks of each size class
+  std::map<size_t, std::vector<void*> > free_;
+  // the size class of each block in use
+  std::map<void*, size_t> in_use_;
+};
+
+HostAllocator::HostAllocator()
+    : sync_(new sync()), cache_limit_(kDefaultCacheLimit),
+      huge_pages_(false) {
+  stats_.in_use = 0;
+  stats_.cached = 0;
+  stats_.peak = 0;
+  stats_.num_allocs = 0;
+  stats_.num_cache_hits = 0;
+}
+
+HostAllocator::~HostAllocator() {
+  ReleaseCache();
+}
+
+size_t HostAllocator::SizeClass(size_t size) {
+  if (size <= kAlignment) {
+    return kAlignment;
+  }
+  // a quarter of the largest power of two not above size, so that at most
+  // a fifth of a block is lost to rounding; the pages of that last fifth
+  // which SyncedMemory never touches are not backed by memory anyway
+  size_t step = kAlignment;
+  while (step * 8 <= size) {
+    step *= 2;
+  }
+  return (size + step - 1) / step * step;
+}
+
+void* HostAllocator::NewBlock(size_t size) const {
+  size_t alignment = kAlignment;
+  if (huge_pages_ && size >= kHugePageSize) {
+    alignment = kHugePageSize;
+  }
+  void* ptr = NULL;
+  if (posix_memalign(&ptr, alignment, size) != 0) {
+    return NULL;
+  }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (alignment == kHugePageSize) {
+    // only a hint: fine to fail where transparent huge pages are off
+    madvise(ptr, size / kHugePageSize * kHugePageSize, MADV_HUGEPAGE);
+  }
+#endif
+  return ptr;
+}
+
+void* HostAllocator::Allocate(size_t size) {
+  const size_t class_size = SizeClass(size);
+  void* ptr = NULL;
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    ++stats_.num_allocs;
+    std::map<size_t, std::vector<void*> >::iterator blocks =
+        sync_->free_.find(class_size);
+    if (blocks != sync_->free_.end() && !blocks->second.empty()) {
+      ptr = blocks->second.back();
+      blocks->second.pop_back();
+      stats_.cached -= class_size;
+      ++stats_.num_cache_hits;
+    }
+  }
+  if (!ptr) {
+    ptr = NewBlock(class_size);
+    if (!ptr) {
+      // the cached blocks of other classes may be what is missing
+      ReleaseCache();
+      ptr = NewBlock(class_size);
+    }
+    CHECK(ptr) << "host allocation of size " << size << " failed";
+  }
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  sync_->in_use_[ptr] = class_size;
+  stats_.in_use += class_size;
+  stats_.peak = std::max(stats_.peak, stats_.in_use + stats_.cached);
+  return ptr;
+}
+
+void HostAllocator::Free(void* ptr) {
+  if (!ptr) {
+    return;
+  }
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  std::map<void*, size_t>::iterator block = sync_->in_use_.find(ptr);
+  CHECK(block != sync_->in_use_.end())
+      << "freeing host memory that was not allocated here";
+  const size_t class_size = block->second;
+  sync_->in_use_.erase(block);
+  stats_.in_use -= class_size;
+  if (class_size <= cache_limit_) {
+    // the blocks of the sizes in use now are the likeliest to be reused
+    TrimCache(cache_limit_ - class_size);
+    sync_->free_[class_size].push_back(ptr);
+    stats_.cached += class_size;
+  } else {
+    lock.unlock();
+    free(ptr);
+  }
+}
+
+void HostAllocator::TrimCache(size_t max_cached) {
+  while (stats_.cached > max_cached) {
+    std::vector<void*>& blocks = sync_->free_.rbegin()->second;
+    if (blocks.empty()) {
+      sync_->free_.erase(sync_->free_.rbegin()->first);
+      continue;
+    }
+    free(blocks.back());
+    blocks.pop_back();
+    stats_.cached -= sync_->free_.rbegin()->first;
+  }
+}
+
+void HostAllocator::ReleaseCache() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  TrimCache(0);
+  sync_->free_.clear();
+}
+
+HostAllocator::Stats HostAllocator::stats() const {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  return stats_;
+}
+
+void HostAllocator::set_cache_limit(size_t cache_limit) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  cache_limit_ = cache_limit;
+  TrimCache(cache_limit_);
+}
+
+}  // namespace caffe
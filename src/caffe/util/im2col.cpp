@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
@@ -80,4 +81,130 @@ template void col2im_cpu<double>(const double* data_col, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, double* data_im);
 
+template <typename Dtype>
+void im2col_ld_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int col_ld, Dtype* data_col) {
+  int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  int channels_col = channels * kernel_h * kernel_w;
+  if (kernel_h == 1 && kernel_w == 1 && pad_h == 0 && pad_w == 0 &&
+      stride_h == 1 && stride_w == 1) {
+    // 1x1: every row is a channel of the image
+    for (int c = 0; c < channels; ++c) {
+      caffe_copy(height * width, data_im + c * height * width,
+          data_col + c * col_ld);
+    }
+    return;
+  }
+  for (int c = 0; c < channels_col; ++c) {
+    int w_offset = c % kernel_w;
+    int h_offset = (c / kernel_w) % kernel_h;
+    int c_im = c / kernel_h / kernel_w;
+    Dtype* row = data_col + c * col_ld;
+    if (stride_w == 1) {
+      // the inside of every output row is a run of an input row; only the
+      // padding at its ends is set apart
+      const int w_begin = std::min(std::max(pad_w - w_offset, 0), width_col);
+      const int w_end = std::max(std::min(width + pad_w - w_offset, width_col),
+          w_begin);
+      for (int h = 0; h < height_col; ++h) {
+        int h_pad = h * stride_h - pad_h + h_offset;
+        Dtype* out = row + h * width_col;
+        if (h_pad < 0 || h_pad >= height) {
+          caffe_set(width_col, Dtype(0), out);
+          continue;
+        }
+        caffe_set(w_begin, Dtype(0), out);
+        caffe_copy(w_end - w_begin, data_im + (c_im * height + h_pad) * width
+            + w_begin - pad_w + w_offset, out + w_begin);
+        caffe_set(width_col - w_end, Dtype(0), out + w_end);
+      }
+      continue;
+    }
+    for (int h = 0; h < height_col; ++h) {
+      for (int w = 0; w < width_col; ++w) {
+        int h_pad = h * stride_h - pad_h + h_offset;
+        int w_pad = w * stride_w - pad_w + w_offset;
+        if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
+          row[h * width_col + w] =
+            data_im[(c_im * height + h_pad) * width + w_pad];
+        else
+          row[h * width_col + w] = 0;
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void im2col_ld_cpu<float>(const float* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int col_ld, float* data_col);
+template void im2col_ld_cpu<double>(const double* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int col_ld, double* data_col);
+
+template <typename Dtype>
+void col2im_ld_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int col_ld, Dtype* data_im) {
+  int height_col = (height + 2 * pad_h - patch_h) / stride_h + 1;
+  int width_col = (width + 2 * pad_w - patch_w) / stride_w + 1;
+  int channels_col = channels * patch_h * patch_w;
+  if (patch_h == 1 && patch_w == 1 && pad_h == 0 && pad_w == 0 &&
+      stride_h == 1 && stride_w == 1) {
+    for (int c = 0; c < channels; ++c) {
+      caffe_copy(height * width, data_col + c * col_ld,
+          data_im + c * height * width);
+    }
+    return;
+  }
+  caffe_set(height * width * channels, Dtype(0), data_im);
+  for (int c = 0; c < channels_col; ++c) {
+    int w_offset = c % patch_w;
+    int h_offset = (c / patch_w) % patch_h;
+    int c_im = c / patch_h / patch_w;
+    const Dtype* row = data_col + c * col_ld;
+    if (stride_w == 1) {
+      const int w_begin = std::min(std::max(pad_w - w_offset, 0), width_col);
+      const int w_end = std::max(std::min(width + pad_w - w_offset, width_col),
+          w_begin);
+      for (int h = 0; h < height_col; ++h) {
+        int h_pad = h * stride_h - pad_h + h_offset;
+        if (h_pad >= 0 && h_pad < height) {
+          caffe_axpy(w_end - w_begin, Dtype(1), row + h * width_col + w_begin,
+              data_im + (c_im * height + h_pad) * width + w_begin - pad_w
+              + w_offset);
+        }
+      }
+      continue;
+    }
+    for (int h = 0; h < height_col; ++h) {
+      for (int w = 0; w < width_col; ++w) {
+        int h_pad = h * stride_h - pad_h + h_offset;
+        int w_pad = w * stride_w - pad_w + w_offset;
+        if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
+          data_im[(c_im * height + h_pad) * width + w_pad] +=
+              row[h * width_col + w];
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void col2im_ld_cpu<float>(const float* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int col_ld, float* data_im);
+template void col2im_ld_cpu<double>(const double* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int col_ld, double* data_im);
+
 }  // namespace caffe
@@ -16,6 +16,7 @@
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
+#include "caffe/util/video_pack.hpp"
 #include "matio.h"
 
 const int kProtoReadBytesLimit = INT_MAX;  // Max size of 2 GB minus 1 byte.
@@ -304,200 +305,186 @@ void hdf5_save_nd_dataset<double>(
 	CHECK_GE(status, 0) << "Failed to make double dataset " << dataset_name;
 }
 
-bool ReadSegmentRGBToDatum(const string& filename, const int label,
-		const vector<int> offsets, const int height, const int width, const int length, Datum* datum, bool is_color){
-	cv::Mat cv_img;
-	string* datum_string;
-	char tmp[30];
-	int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
-			CV_LOAD_IMAGE_GRAYSCALE);
-	for (int i = 0; i < offsets.size(); ++i){
-		int offset = offsets[i];
-		for (int file_id = 1; file_id < length+1; ++file_id){
-			sprintf(tmp,"image_%04d.jpg",int(file_id+offset));
-			string filename_t = filename + "/" + tmp;
-			cv::Mat cv_img_origin = cv::imread(filename_t, cv_read_flag);
-			if (!cv_img_origin.data){
-				LOG(ERROR) << "Could not load file " << filename_t;
-				return false;
-			}
-			if (height > 0 && width > 0){
-				cv::resize(cv_img_origin, cv_img, cv::Size(width, height));
-			}else{
-				cv_img = cv_img_origin;
-			}
-			int num_channels = (is_color ? 3 : 1);
-			if (file_id==1 && i==0){
-				datum->set_channels(num_channels*length*offsets.size());
-				datum->set_height(cv_img.rows);
-				datum->set_width(cv_img.cols);
-				datum->set_label(label);
-				datum->clear_data();
-				datum->clear_float_data();
-				datum_string = datum->mutable_data();
-			}
-			if (is_color) {
-				for (int c = 0; c < num_channels; ++c) {
-					for (int h = 0; h < cv_img.rows; ++h) {
-						for (int w = 0; w < cv_img.cols; ++w) {
-							datum_string->push_back(
-									static_cast<char>(cv_img.at<cv::Vec3b>(h, w)[c]));
-						}
-					}
-				}
-			} else {  // Faster than repeatedly testing is_color for each pixel w/i loop
-				for (int h = 0; h < cv_img.rows; ++h) {
-					for (int w = 0; w < cv_img.cols; ++w) {
-						datum_string->push_back(
-								static_cast<char>(cv_img.at<uchar>(h, w)));
-					}
-				}
-			}
+namespace {
+
+// The frames of one video: either a folder of image_%04d.jpg and
+// flow_{x,y}_%04d.jpg files or an EncodedVideo holding the same frames.
+class FrameSource {
+public:
+	explicit FrameSource(const string& folder) : folder_(folder), video_(NULL) {}
+	explicit FrameSource(const EncodedVideo& video) : video_(&video) {}
+
+	cv::Mat Read(EncodedVideo::Stream stream, int frame_id, int cv_read_flag) const {
+		if (video_) {
+			const char* data;
+			size_t size;
+			if (!video_->Frame(stream, frame_id, &data, &size))
+				return cv::Mat();
+			// imdecode does not write to its input, which may be read-only
+			cv::Mat encoded(1, size, CV_8UC1, const_cast<char*>(data));
+			return cv::imdecode(encoded, cv_read_flag);
 		}
+		return cv::imread(Describe(stream, frame_id), cv_read_flag);
 	}
-	return true;
+
+	string Describe(EncodedVideo::Stream stream, int frame_id) const {
+		static const char* const kPatterns[EncodedVideo::NUM_STREAMS] = {
+				"image_%04d.jpg", "flow_x_%04d.jpg", "flow_y_%04d.jpg"};
+		char tmp[30];
+		sprintf(tmp, kPatterns[stream], frame_id);
+		if (video_)
+			return video_->name() + ":" + tmp;
+		return folder_ + "/" + tmp;
+	}
+
+private:
+	string folder_;
+	const EncodedVideo* video_;
+};
+
+}  // namespace
+
+void DatumFrameSink::Reshape(const int channels, const int height, const int width) {
+	datum_->set_channels(channels);
+	datum_->set_height(height);
+	datum_->set_width(width);
+	datum_->set_label(label_);
+	datum_->clear_data();
+	datum_->clear_float_data();
+	datum_->mutable_data()->resize(channels * height * width);
 }
 
-bool ReadSegmentFlowToDatum(const string& filename, const int label,
-		const vector<int> offsets, const int height, const int width, const int length, Datum* datum){
-	cv::Mat cv_img_x, cv_img_y;
-	string* datum_string;
-	char tmp[30];
-	for (int i = 0; i < offsets.size(); ++i){
-		int offset = offsets[i];
-		for (int file_id = 1; file_id < length+1; ++file_id){
-			sprintf(tmp,"flow_x_%04d.jpg",int(file_id+offset));
-			string filename_x = filename + "/" + tmp;
-			cv::Mat cv_img_origin_x = cv::imread(filename_x, CV_LOAD_IMAGE_GRAYSCALE);
-			sprintf(tmp,"flow_y_%04d.jpg",int(file_id+offset));
-			string filename_y = filename + "/" + tmp;
-			cv::Mat cv_img_origin_y = cv::imread(filename_y, CV_LOAD_IMAGE_GRAYSCALE);
-			if (!cv_img_origin_x.data || !cv_img_origin_y.data){
-				LOG(ERROR) << "Could not load file " << filename_x << " or " << filename_y;
-				return false;
-			}
-			if (height > 0 && width > 0){
-				cv::resize(cv_img_origin_x, cv_img_x, cv::Size(width, height));
-				cv::resize(cv_img_origin_y, cv_img_y, cv::Size(width, height));
-			}else{
-				cv_img_x = cv_img_origin_x;
-				cv_img_y = cv_img_origin_y;
-			}
-			if (file_id==1 && i==0){
-				int num_channels = 2;
-				datum->set_channels(num_channels*length*offsets.size());
-				datum->set_height(cv_img_x.rows);
-				datum->set_width(cv_img_x.cols);
-				datum->set_label(label);
-				datum->clear_data();
-				datum->clear_float_data();
-				datum_string = datum->mutable_data();
-			}
-			for (int h = 0; h < cv_img_x.rows; ++h){
-				for (int w = 0; w < cv_img_x.cols; ++w){
-					datum_string->push_back(static_cast<char>(cv_img_x.at<uchar>(h,w)));
-				}
-			}
-			for (int h = 0; h < cv_img_y.rows; ++h){
-				for (int w = 0; w < cv_img_y.cols; ++w){
-					datum_string->push_back(static_cast<char>(cv_img_y.at<uchar>(h,w)));
-				}
+void DatumFrameSink::AddFrame(const cv::Mat& frame, const int first_channel) {
+	const int frame_channels = frame.channels();
+	CHECK_EQ(frame.rows, datum_->height());
+	CHECK_EQ(frame.cols, datum_->width());
+	CHECK_LE(first_channel + frame_channels, datum_->channels());
+	string* datum_string = datum_->mutable_data();
+	int index = first_channel * frame.rows * frame.cols;
+	for (int c = 0; c < frame_channels; ++c) {
+		for (int h = 0; h < frame.rows; ++h) {
+			const uchar* ptr = frame.ptr<uchar>(h) + c;
+			for (int w = 0; w < frame.cols; ++w, ptr += frame_channels) {
+				(*datum_string)[index++] = static_cast<char>(*ptr);
 			}
 		}
 	}
+}
+
+// Reads frame frame_id of stream, resized to height x width if both are given.
+static bool ReadSegmentFrame(const FrameSource& frames, EncodedVideo::Stream stream,
+		const int frame_id, const int height, const int width, const int cv_read_flag, cv::Mat* cv_img){
+	cv::Mat cv_img_origin = frames.Read(stream, frame_id, cv_read_flag);
+	if (!cv_img_origin.data){
+		LOG(ERROR) << "Could not load " << frames.Describe(stream, frame_id);
+		return false;
+	}
+	if (height > 0 && width > 0){
+		cv::resize(cv_img_origin, *cv_img, cv::Size(width, height));
+	}else{
+		*cv_img = cv_img_origin;
+	}
 	return true;
 }
 
-bool ReadSegmentRGBFlowToDatum(const vector<string>& root_folders, const string& filename, const int label,
-		const vector<int> offsets, const int height, const int width, const vector<int> &length, Datum* datum, bool is_color){
+static bool ReadSegmentFrames(const FrameSource& rgb_frames, const FrameSource& flow_frames,
+		const vector<int>& offsets, const int height, const int width,
+		const int rgb_length, const int flow_length, const bool is_color, SegmentFrameSink* sink){
 	cv::Mat cv_img, cv_img_x, cv_img_y;
-	string* datum_string;
-	char tmp[30];
 	int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
 			CV_LOAD_IMAGE_GRAYSCALE);
 	int num_channels_img = (is_color ? 3 : 1);
-	int total_length = 2*length[1] + num_channels_img*length[0];
-
+	int channels = (num_channels_img*rgb_length + 2*flow_length)*offsets.size();
+	int channel = 0;
+	// a sink that resizes frames itself gets them as decoded
+	const bool resize = height > 0 && width > 0;
+	const int read_height = sink->resizes_frames() ? 0 : height;
+	const int read_width = sink->resizes_frames() ? 0 : width;
+
+	// all the RGB frames of all the segments first, then all the flow frames
 	for (int i = 0; i < offsets.size(); ++i){
 		int offset = offsets[i];
-		for (int file_id = 1; file_id < length[0]+1; ++file_id){
-			sprintf(tmp,"image_%04d.jpg",int(file_id+offset));
-			string filename_t = root_folders[0] + filename + "/" + tmp;
-			cv::Mat cv_img_origin = cv::imread(filename_t, cv_read_flag);
-			if (!cv_img_origin.data){
-				LOG(ERROR) << "Could not load file " << filename_t;
+		for (int file_id = 1; file_id < rgb_length+1; ++file_id){
+			if (!ReadSegmentFrame(rgb_frames, EncodedVideo::IMAGE, file_id+offset, read_height, read_width, cv_read_flag, &cv_img))
 				return false;
-			}
-			if (height > 0 && width > 0){
-				cv::resize(cv_img_origin, cv_img, cv::Size(width, height));
-			}else{
-				cv_img = cv_img_origin;
-			}
-			if (file_id==1 && i==0){
-				datum->set_channels(total_length*offsets.size());
-				datum->set_height(cv_img.rows);
-				datum->set_width(cv_img.cols);
-				datum->set_label(label);
-				datum->clear_data();
-				datum->clear_float_data();
-				datum_string = datum->mutable_data();
-			}
-
-			if (is_color) {
-				for (int c = 0; c < num_channels_img; ++c) {
-					for (int h = 0; h < cv_img.rows; ++h) {
-						for (int w = 0; w < cv_img.cols; ++w) {
-							datum_string->push_back(
-									static_cast<char>(cv_img.at<cv::Vec3b>(h, w)[c]));
-						}
-					}
-				}
-			} else {  // Faster than repeatedly testing is_color for each pixel w/i loop
-				for (int h = 0; h < cv_img.rows; ++h) {
-					for (int w = 0; w < cv_img.cols; ++w) {
-						datum_string->push_back(
-								static_cast<char>(cv_img.at<uchar>(h, w)));
-					}
-				}
-			}
+			if (channel == 0)
+				sink->Reshape(channels, resize ? height : cv_img.rows, resize ? width : cv_img.cols);
+			sink->AddFrame(cv_img, channel);
+			channel += num_channels_img;
 		}
 	}
-
 	for (int i = 0; i < offsets.size(); ++i){
 		int offset = offsets[i];
-		for (int file_id = 1; file_id < length[1]+1; ++file_id){
-			sprintf(tmp,"flow_x_%04d.jpg",int(file_id+offset));
-			string filename_x = root_folders[1] + filename + "/" + tmp;
-			cv::Mat cv_img_origin_x = cv::imread(filename_x, CV_LOAD_IMAGE_GRAYSCALE);
-			sprintf(tmp,"flow_y_%04d.jpg",int(file_id+offset));
-			string filename_y = root_folders[1] + filename + "/" + tmp;
-			cv::Mat cv_img_origin_y = cv::imread(filename_y, CV_LOAD_IMAGE_GRAYSCALE);
-			if (!cv_img_origin_x.data || !cv_img_origin_y.data){
-				LOG(ERROR) << "Could not load file " << filename_x << " or " << filename_y;
+		for (int file_id = 1; file_id < flow_length+1; ++file_id){
+			if (!ReadSegmentFrame(flow_frames, EncodedVideo::FLOW_X, file_id+offset, read_height, read_width, CV_LOAD_IMAGE_GRAYSCALE, &cv_img_x)
+					|| !ReadSegmentFrame(flow_frames, EncodedVideo::FLOW_Y, file_id+offset, read_height, read_width, CV_LOAD_IMAGE_GRAYSCALE, &cv_img_y))
 				return false;
-			}
-			if (height > 0 && width > 0){
-				cv::resize(cv_img_origin_x, cv_img_x, cv::Size(width, height));
-				cv::resize(cv_img_origin_y, cv_img_y, cv::Size(width, height));
-			}else{
-				cv_img_x = cv_img_origin_x;
-				cv_img_y = cv_img_origin_y;
-			}
-			for (int h = 0; h < cv_img_x.rows; ++h){
-				for (int w = 0; w < cv_img_x.cols; ++w){
-					datum_string->push_back(static_cast<char>(cv_img_x.at<uchar>(h,w)));
-				}
-			}
-			for (int h = 0; h < cv_img_y.rows; ++h){
-				for (int w = 0; w < cv_img_y.cols; ++w){
-					datum_string->push_back(static_cast<char>(cv_img_y.at<uchar>(h,w)));
-				}
-			}
+			if (channel == 0)
+				sink->Reshape(channels, resize ? height : cv_img_x.rows, resize ? width : cv_img_x.cols);
+			sink->AddFrame(cv_img_x, channel);
+			sink->AddFrame(cv_img_y, channel + 1);
+			channel += 2;
 		}
 	}
 	return true;
 }
 
+bool ReadSegmentFrames(const string& rgb_folder, const string& flow_folder,
+		const vector<int>& offsets, const int height, const int width,
+		const int rgb_length, const int flow_length, const bool is_color, SegmentFrameSink* sink){
+	return ReadSegmentFrames(FrameSource(rgb_folder), FrameSource(flow_folder), offsets, height, width,
+			rgb_length, flow_length, is_color, sink);
+}
+
+bool ReadSegmentFrames(const EncodedVideo* rgb_video, const EncodedVideo* flow_video,
+		const vector<int>& offsets, const int height, const int width,
+		const int rgb_length, const int flow_length, const bool is_color, SegmentFrameSink* sink){
+	CHECK(rgb_video || rgb_length == 0) << "No video to read the RGB frames from";
+	CHECK(flow_video || flow_length == 0) << "No video to read the flow frames from";
+	const FrameSource none((string()));
+	return ReadSegmentFrames(rgb_video ? FrameSource(*rgb_video) : none,
+			flow_video ? FrameSource(*flow_video) : none, offsets, height, width,
+			rgb_length, flow_length, is_color, sink);
+}
+
+bool ReadSegmentRGBToDatum(const string& filename, const int label,
+		const vector<int> offsets, const int height, const int width, const int length, Datum* datum, bool is_color){
+	DatumFrameSink sink(label, datum);
+	return ReadSegmentFrames(filename, string(), offsets, height, width, length, 0, is_color, &sink);
+}
+
+bool ReadSegmentRGBToDatum(const EncodedVideo& video, const int label,
+		const vector<int> offsets, const int height, const int width, const int length, Datum* datum, bool is_color){
+	DatumFrameSink sink(label, datum);
+	return ReadSegmentFrames(&video, NULL, offsets, height, width, length, 0, is_color, &sink);
+}
+
+bool ReadSegmentFlowToDatum(const string& filename, const int label,
+		const vector<int> offsets, const int height, const int width, const int length, Datum* datum){
+	DatumFrameSink sink(label, datum);
+	return ReadSegmentFrames(string(), filename, offsets, height, width, 0, length, true, &sink);
+}
+
+bool ReadSegmentFlowToDatum(const EncodedVideo& video, const int label,
+		const vector<int> offsets, const int height, const int width, const int length, Datum* datum){
+	DatumFrameSink sink(label, datum);
+	return ReadSegmentFrames(NULL, &video, offsets, height, width, 0, length, true, &sink);
+}
+
+bool ReadSegmentRGBFlowToDatum(const vector<string>& root_folders, const string& filename, const int label,
+		const vector<int> offsets, const int height, const int width, const vector<int> &length, Datum* datum, bool is_color){
+	DatumFrameSink sink(label, datum);
+	return ReadSegmentFrames(root_folders[0] + filename, root_folders[1] + filename, offsets, height, width,
+			length[0], length[1], is_color, &sink);
+}
+
+bool ReadSegmentRGBFlowToDatum(const EncodedVideo& rgb_video, const EncodedVideo& flow_video, const int label,
+		const vector<int> offsets, const int height, const int width, const vector<int> &length, Datum* datum, bool is_color){
+	DatumFrameSink sink(label, datum);
+	return ReadSegmentFrames(&rgb_video, &flow_video, offsets, height, width,
+			length[0], length[1], is_color, &sink);
+}
+
 template <typename Dtype>
 bool ReadROI(const string roi_file, Blob<Dtype> &roi, const int id) {
 	mat_t * matfp;
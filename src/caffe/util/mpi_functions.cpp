@@ -4,57 +4,147 @@
 
 #ifdef USE_MPI
 
+#include <algorithm>
+
 #include "caffe/caffe.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/util/mpi_functions.hpp"
 #include "caffe/util/channel.hpp"
 
 namespace caffe {
   template <typename Dtype>
-  void caffe_iallreduce(Dtype* data, int count){
+  MPIJobHandle caffe_iallreduce(Dtype* data, int count){
     MPIJob job = {data, data, count, sizeof(Dtype), OP_SUM_ALL};
-    MPIComm::AddMPIJob(job);
+    return MPIComm::AddMPIJob(job);
   }
 
-  template void caffe_iallreduce<float>(float* data, int count);
-  template void caffe_iallreduce<double>(double* data, int count);
+  template MPIJobHandle caffe_iallreduce<float>(float* data, int count);
+  template MPIJobHandle caffe_iallreduce<double>(double* data, int count);
 
   template <typename Dtype>
-  void caffe_iallreduce(Dtype* src_data, Dtype* dst_data, int count){
+  MPIJobHandle caffe_iallreduce(Dtype* src_data, Dtype* dst_data, int count){
     MPIJob job = {src_data, dst_data, count, sizeof(Dtype), OP_SUM_ALL};
-    MPIComm::AddMPIJob(job);
+    return MPIComm::AddMPIJob(job);
+  }
+
+  template MPIJobHandle caffe_iallreduce<float>(float* src_data, float* dst_data, int count);
+  template MPIJobHandle caffe_iallreduce<double>(double* src_data, double* dst_data, int count);
+
+  template <typename Dtype>
+  MPIJobHandle caffe_iallreduce_gradient(Dtype* data, int count){
+    MPIJob job = {data, data, count, sizeof(Dtype), OP_SUM_GRADIENT};
+    return MPIComm::AddMPIJob(job);
   }
 
-  template void caffe_iallreduce<float>(float* src_data, float* dst_data, int count);
-  template void caffe_iallreduce<double>(double* src_data, double* dst_data, int count);
+  template MPIJobHandle caffe_iallreduce_gradient<float>(float*, int);
+  template MPIJobHandle caffe_iallreduce_gradient<double>(double*, int);
 
   template <typename Dtype>
-  void caffe_iallgather(Dtype* src_data, Dtype* dst_data, int count){
+  MPIJobHandle caffe_iallgather(Dtype* src_data, Dtype* dst_data, int count){
     MPIJob job = {src_data, dst_data, count, sizeof(Dtype), OP_GATHER};
-    MPIComm::AddMPIJob(job);
+    return MPIComm::AddMPIJob(job);
   }
-  template void caffe_iallgather<float>(float*, float*, int);
-  template void caffe_iallgather<double>(double*, double*, int);
+  template MPIJobHandle caffe_iallgather<float>(float*, float*, int);
+  template MPIJobHandle caffe_iallgather<double>(double*, double*, int);
 
   template <typename Dtype>
-  void caffe_iscatter(Dtype* src_data, Dtype* dst_data, int count){
+  MPIJobHandle caffe_iscatter(Dtype* src_data, Dtype* dst_data, int count){
     MPIJob job = {src_data, dst_data, count, sizeof(Dtype), OP_SCATTER};
-    MPIComm::AddMPIJob(job);
+    return MPIComm::AddMPIJob(job);
   }
 
-  template void caffe_iscatter<float>(float*, float*, int);
-  template void caffe_iscatter<double>(double*, double*, int);
+  template MPIJobHandle caffe_iscatter<float>(float*, float*, int);
+  template MPIJobHandle caffe_iscatter<double>(double*, double*, int);
 
   template <typename Dtype>
-  void caffe_ibcast(Dtype* data, int count){
+  MPIJobHandle caffe_ibcast(Dtype* data, int count){
     MPIJob job = {data, data, count, sizeof(Dtype), OP_BROADCAST};
-    MPIComm::AddMPIJob(job);
+    return MPIComm::AddMPIJob(job);
+  }
+  template MPIJobHandle caffe_ibcast<float>(float* data, int count);
+  template MPIJobHandle caffe_ibcast<double>(double* data, int count);
+
+  void mpi_wait(const MPIJobHandle& job){
+    MPIComm::Wait(job);
   }
-  template void caffe_ibcast<float>(float* data, int count);
-  template void caffe_ibcast<double>(double* data, int count);
 
   void mpi_force_synchronize(){
     MPIComm::Syncrhonize();
   }
+
+  template <typename Dtype>
+  GradientBuckets<Dtype>::GradientBuckets(size_t bucket_bytes)
+      : bucket_count_(std::max<size_t>(bucket_bytes / sizeof(Dtype), 1)),
+        current_(0), comm_seconds_(0), wait_seconds_(0) {}
+
+  template <typename Dtype>
+  void GradientBuckets<Dtype>::Add(Dtype* diff, int count){
+    if (count >= bucket_count_) {
+      jobs_.push_back(caffe_iallreduce_gradient(diff, count));
+      return;
+    }
+    if (current_ < buckets_.size() &&
+        buckets_[current_]->used + count > bucket_count_) {
+      Flush();
+    }
+    if (current_ == buckets_.size()) {
+      buckets_.push_back(shared_ptr<Bucket>(new Bucket(bucket_count_)));
+    }
+    Bucket& bucket = *buckets_[current_];
+    caffe_copy(count, diff, &bucket.data[bucket.used]);
+    bucket.blobs.push_back(std::make_pair(diff, count));
+    bucket.used += count;
+    if (bucket.used == bucket_count_) {
+      Flush();
+    }
+  }
+
+  template <typename Dtype>
+  void GradientBuckets<Dtype>::Flush(){
+    if (current_ < buckets_.size() && buckets_[current_]->used > 0) {
+      jobs_.push_back(caffe_iallreduce_gradient(&buckets_[current_]->data[0],
+                                       buckets_[current_]->used));
+      ++current_;
+    }
+  }
+
+  template <typename Dtype>
+  void GradientBuckets<Dtype>::Finish(){
+    Flush();
+    const double wait_start = MPI_Wtime();
+    for (size_t i = 0; i < jobs_.size(); ++i) {
+      mpi_wait(jobs_[i]);
+    }
+    wait_seconds_ = MPI_Wtime() - wait_start;
+    comm_seconds_ = 0;
+    if (!jobs_.empty()) {
+      double first_start = jobs_[0]->start_time();
+      double last_finish = jobs_[0]->finish_time();
+      for (size_t i = 1; i < jobs_.size(); ++i) {
+        first_start = std::min(first_start, jobs_[i]->start_time());
+        last_finish = std::max(last_finish, jobs_[i]->finish_time());
+      }
+      comm_seconds_ = last_finish - first_start;
+    }
+    jobs_.clear();
+    int num_blobs = 0;
+    for (int i = 0; i < current_; ++i) {
+      Bucket& bucket = *buckets_[i];
+      const Dtype* data = &bucket.data[0];
+      for (int j = 0; j < bucket.blobs.size(); ++j) {
+        caffe_copy(bucket.blobs[j].second, data, bucket.blobs[j].first);
+        data += bucket.blobs[j].second;
+      }
+      num_blobs += bucket.blobs.size();
+      bucket.blobs.clear();
+      bucket.used = 0;
+    }
+    DLOG(INFO) << "Summed " << num_blobs << " small gradients in "
+        << current_ << " bucket(s)";
+    current_ = 0;
+  }
+
+  INSTANTIATE_CLASS(GradientBuckets);
 }
 
 #endif //USE_MPI
@@ -0,0 +1,68 @@
+#include <boost/thread.hpp>
+
+#include <cstdio>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+
+#include "caffe/util/snapshot_writer.hpp"
+
+namespace caffe {
+
+SnapshotWriter::SnapshotWriter(int max_pending)
+    : max_pending_(max_pending) {
+  CHECK_GT(max_pending, 0);
+  for (int i = 0; i < max_pending_; ++i) {
+    free_.push(0);
+  }
+  CHECK(StartInternalThread()) << "Cannot start the snapshot thread";
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  WaitAll();
+  StopInternalThread();
+}
+
+void SnapshotWriter::Write(shared_ptr<Message> proto,
+    const string& filename) {
+  free_.pop("Waiting for the previous snapshot to be written");
+  Job* job = new Job();
+  job->proto = proto;
+  job->filename = filename;
+  pending_.push(job);
+}
+
+void SnapshotWriter::WaitAll() {
+  // every slot is free once nothing is pending
+  for (int i = 0; i < max_pending_; ++i) {
+    free_.pop();
+  }
+  for (int i = 0; i < max_pending_; ++i) {
+    free_.push(0);
+  }
+}
+
+void SnapshotWriter::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      Job* job = pending_.pop();
+      const string temp_filename = job->filename + ".tmp";
+      {
+        std::ofstream output(temp_filename.c_str(),
+            std::ios::out | std::ios::trunc | std::ios::binary);
+        CHECK(job->proto->SerializeToOstream(&output))
+            << "Cannot write " << temp_filename;
+        output.close();
+        CHECK(!output.fail()) << "Cannot write " << temp_filename;
+      }
+      CHECK_EQ(std::rename(temp_filename.c_str(), job->filename.c_str()), 0)
+          << "Cannot rename " << temp_filename << " to " << job->filename;
+      LOG(INFO) << "Snapshot written to " << job->filename;
+      delete job;
+      free_.push(0);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,111 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <list>
+#include <vector>
+
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+class ThreadPool::sync {
+ public:
+  // One ParallelFor call: items below next are taken, done of them finished.
+  struct Job {
+    const boost::function<void(int, int)>* body;
+    int n, next, done;
+    // slots handed out so far
+    int num_slots;
+  };
+
+  // Takes and runs the items of job until none is left; lock is held on
+  // entry and on return.
+  void Work(Job* job, int slot, boost::mutex::scoped_lock* lock) {
+    while (job->next < job->n) {
+      const int i = job->next++;
+      if (job->next == job->n) {
+        jobs_.remove(job);
+      }
+      lock->unlock();
+      (*job->body)(i, slot);
+      lock->lock();
+      if (++job->done == job->n) {
+        done_.notify_all();
+      }
+    }
+  }
+
+  boost::mutex mutex_;
+  // signals a new call, or stop, to the workers
+  boost::condition_variable start_;
+  // signals the last item of a call done
+  boost::condition_variable done_;
+  // the calls with items not taken yet, oldest first
+  std::list<Job*> jobs_;
+  bool stop_;
+};
+
+ThreadPool::ThreadPool(int num_threads)
+    : num_threads_(num_threads), sync_(new sync()) {
+  CHECK_GT(num_threads, 0);
+  sync_->stop_ = false;
+  for (int i = 1; i < num_threads_; ++i) {
+    workers_.push_back(shared_ptr<boost::thread>(new boost::thread(
+        boost::bind(&ThreadPool::WorkerEntry, this))));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    sync_->stop_ = true;
+  }
+  sync_->start_.notify_all();
+  for (int i = 0; i < workers_.size(); ++i) {
+    workers_[i]->join();
+  }
+}
+
+void ThreadPool::ParallelFor(int n,
+    const boost::function<void(int, int)>& body) {
+  if (num_threads_ == 1 || n <= 1) {
+    for (int i = 0; i < n; ++i) {
+      body(i, 0);
+    }
+    return;
+  }
+  // the workers use job and body, on this stack, until all items are done, so
+  // e.g. a stop request to a prefetch thread must not cut the wait short
+  boost::this_thread::disable_interruption no_interruption;
+  sync::Job job;
+  job.body = &body;
+  job.n = n;
+  job.next = 0;
+  job.done = 0;
+  job.num_slots = 1;
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  sync_->jobs_.push_back(&job);
+  sync_->start_.notify_all();
+  sync_->Work(&job, 0, &lock);
+  while (job.done < job.n) {
+    sync_->done_.wait(lock);
+  }
+}
+
+void ThreadPool::WorkerEntry() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (true) {
+    while (sync_->jobs_.empty() && !sync_->stop_) {
+      sync_->start_.wait(lock);
+    }
+    if (sync_->stop_) {
+      return;
+    }
+    // a worker leaves a call only once all its items are taken, so a call
+    // never has more than num_threads_ slots
+    sync::Job* job = sync_->jobs_.front();
+    sync_->Work(job, job->num_slots++, &lock);
+  }
+}
+
+}  // namespace caffe
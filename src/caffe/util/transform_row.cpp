@@ -0,0 +1,219 @@
+#include <algorithm>
+
+#include "caffe/util/transform_row.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+    && defined(__SSE2__)
+#define CAFFE_TRANSFORM_ROW_X86
+#include <immintrin.h>
+#endif
+
+namespace caffe {
+
+namespace {
+
+// Contiguous rows only; strided ones are gathered first, see below.
+template <typename Dtype>
+void TransformRowScalar(const int width, const uint8_t* src,
+    const Dtype* mean_row, const Dtype mean_value, const Dtype offset,
+    const Dtype scale, const bool invert, const bool mirror, Dtype* dst) {
+  for (int i = 0; i < width; ++i) {
+    const Dtype pixel = static_cast<Dtype>(invert ? 255 - src[i] : src[i]);
+    const Dtype mean = mean_row ? mean_row[i] : mean_value;
+    dst[mirror ? width - 1 - i : i] = (pixel - mean + offset) * scale;
+  }
+}
+
+typedef void (*TransformRowFloat)(const int, const uint8_t*, const float*,
+    const float, const float, const float, const bool, const bool, float*);
+
+#ifdef CAFFE_TRANSFORM_ROW_X86
+
+// The vector loops compute (p - m + offset) * scale with the same operations,
+// in the same order, as the scalar one, so all give identical results.
+
+inline __m128 ReverseSSE2(const __m128 v) {
+  return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+void TransformRowSSE2(const int width, const uint8_t* src,
+    const float* mean_row, const float mean_value, const float offset,
+    const float scale, const bool invert, const bool mirror, float* dst) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i all_ones = _mm_set1_epi16(255);
+  const __m128 mean = _mm_set1_ps(mean_value);
+  const __m128 offsets = _mm_set1_ps(offset);
+  const __m128 scales = _mm_set1_ps(scale);
+  int i = 0;
+  for (; i + 8 <= width; i += 8) {
+    __m128i words = _mm_unpacklo_epi8(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)), zero);
+    if (invert) {
+      words = _mm_sub_epi16(all_ones, words);
+    }
+    __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+    __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero));
+    const __m128 mean_lo = mean_row ? _mm_loadu_ps(mean_row + i) : mean;
+    const __m128 mean_hi = mean_row ? _mm_loadu_ps(mean_row + i + 4) : mean;
+    lo = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(lo, mean_lo), offsets), scales);
+    hi = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(hi, mean_hi), offsets), scales);
+    if (mirror) {
+      _mm_storeu_ps(dst + width - 4 - i, ReverseSSE2(lo));
+      _mm_storeu_ps(dst + width - 8 - i, ReverseSSE2(hi));
+    } else {
+      _mm_storeu_ps(dst + i, lo);
+      _mm_storeu_ps(dst + i + 4, hi);
+    }
+  }
+  // tail
+  TransformRowScalar(width - i, src + i, mean_row ? mean_row + i : NULL,
+      mean_value, offset, scale, invert, mirror, dst + (mirror ? 0 : i));
+}
+
+__attribute__((target("avx2")))
+void TransformRowAVX2(const int width, const uint8_t* src,
+    const float* mean_row, const float mean_value, const float offset,
+    const float scale, const bool invert, const bool mirror, float* dst) {
+  const __m256i all_ones = _mm256_set1_epi32(255);
+  const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256 mean = _mm256_set1_ps(mean_value);
+  const __m256 offsets = _mm256_set1_ps(offset);
+  const __m256 scales = _mm256_set1_ps(scale);
+  int i = 0;
+  for (; i + 8 <= width; i += 8) {
+    __m256i ints = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+    if (invert) {
+      ints = _mm256_sub_epi32(all_ones, ints);
+    }
+    __m256 pixels = _mm256_cvtepi32_ps(ints);
+    const __m256 means = mean_row ? _mm256_loadu_ps(mean_row + i) : mean;
+    pixels = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(pixels, means),
+        offsets), scales);
+    if (mirror) {
+      _mm256_storeu_ps(dst + width - 8 - i,
+          _mm256_permutevar8x32_ps(pixels, reverse));
+    } else {
+      _mm256_storeu_ps(dst + i, pixels);
+    }
+  }
+  // the tail runs legacy SSE code, which is slow with dirty upper halves
+  _mm256_zeroupper();
+  TransformRowScalar(width - i, src + i, mean_row ? mean_row + i : NULL,
+      mean_value, offset, scale, invert, mirror, dst + (mirror ? 0 : i));
+}
+
+#endif  // CAFFE_TRANSFORM_ROW_X86
+
+bool IsSupported(const TransformRowISA isa) {
+  switch (isa) {
+  case TRANSFORM_ROW_SCALAR:
+    return true;
+#ifdef CAFFE_TRANSFORM_ROW_X86
+  case TRANSFORM_ROW_SSE2:
+    return true;
+  case TRANSFORM_ROW_AVX2:
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+TransformRowFloat RowFunction(const TransformRowISA isa) {
+  switch (isa) {
+#ifdef CAFFE_TRANSFORM_ROW_X86
+  case TRANSFORM_ROW_SSE2:
+    return TransformRowSSE2;
+  case TRANSFORM_ROW_AVX2:
+    return TransformRowAVX2;
+#endif
+  default:
+    return TransformRowScalar<float>;
+  }
+}
+
+TransformRowISA BestISA() {
+  if (IsSupported(TRANSFORM_ROW_AVX2)) {
+    return TRANSFORM_ROW_AVX2;
+  }
+  if (IsSupported(TRANSFORM_ROW_SSE2)) {
+    return TRANSFORM_ROW_SSE2;
+  }
+  return TRANSFORM_ROW_SCALAR;
+}
+
+TransformRowISA row_isa = BestISA();
+TransformRowFloat row_float = RowFunction(row_isa);
+
+// Strided rows (interleaved channels of a cv::Mat) are gathered into a
+// contiguous buffer, a chunk at a time.
+const int kGatherChunk = 256;
+
+template <typename Dtype, typename RowFunc>
+void TransformRow(RowFunc row, const int width, const uint8_t* src,
+    const int stride, const Dtype* mean_row, const Dtype mean_value,
+    const Dtype offset, const Dtype scale, const bool invert,
+    const bool mirror, Dtype* dst) {
+  if (stride == 1) {
+    row(width, src, mean_row, mean_value, offset, scale, invert, mirror, dst);
+    return;
+  }
+  uint8_t buffer[kGatherChunk];
+  for (int start = 0; start < width; start += kGatherChunk) {
+    const int n = std::min(kGatherChunk, width - start);
+    const uint8_t* chunk = src + start * stride;
+    for (int i = 0; i < n; ++i) {
+      buffer[i] = chunk[i * stride];
+    }
+    // mirrored, the chunk lands in a reversed block at the other end
+    row(n, buffer, mean_row ? mean_row + start : NULL, mean_value, offset,
+        scale, invert, mirror, dst + (mirror ? width - start - n : start));
+  }
+}
+
+}  // namespace
+
+template <>
+void caffe_cpu_transform_row<float>(const int width, const uint8_t* src,
+    const int stride, const float* mean_row, const float mean_value,
+    const float offset, const float scale, const bool invert, const bool mirror,
+    float* dst) {
+  TransformRow(row_float, width, src, stride, mean_row, mean_value, offset,
+      scale, invert, mirror, dst);
+}
+
+template <>
+void caffe_cpu_transform_row<double>(const int width, const uint8_t* src,
+    const int stride, const double* mean_row, const double mean_value,
+    const double offset, const double scale, const bool invert,
+    const bool mirror, double* dst) {
+  TransformRow(TransformRowScalar<double>, width, src, stride, mean_row,
+      mean_value, offset, scale, invert, mirror, dst);
+}
+
+TransformRowISA caffe_transform_row_isa() {
+  return row_isa;
+}
+
+bool caffe_set_transform_row_isa(const TransformRowISA isa) {
+  if (!IsSupported(isa)) {
+    return false;
+  }
+  row_isa = isa;
+  row_float = RowFunction(isa);
+  return true;
+}
+
+const char* caffe_transform_row_isa_name(const TransformRowISA isa) {
+  switch (isa) {
+  case TRANSFORM_ROW_SSE2:
+    return "sse2";
+  case TRANSFORM_ROW_AVX2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
+
+}  // namespace caffe
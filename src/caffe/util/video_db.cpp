@@ -0,0 +1,93 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/util/video_db.hpp"
+
+namespace caffe {
+
+namespace {
+
+bool ReadFileToString(const string& filename, string* contents) {
+  std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  std::ostringstream buffer;
+  buffer << file.rdbuf();
+  *contents = buffer.str();
+  return true;
+}
+
+}  // namespace
+
+const char kVideoCountKey[] = "#count";
+
+string VideoRecordKey(int index) {
+  char key[16];
+  snprintf(key, sizeof(key), "v%08d", index);
+  return key;
+}
+
+string VideoFrameKey(int index, EncodedVideo::Stream stream, int frame_id) {
+  static const char kStreamChars[EncodedVideo::NUM_STREAMS] = {'i', 'x', 'y'};
+  char key[24];
+  snprintf(key, sizeof(key), "f%08d%c%06d", index, kStreamChars[stream],
+      frame_id);
+  return key;
+}
+
+int ReadVideoCount(db::Cursor* cursor) {
+  CHECK(cursor->SeekToKey(kVideoCountKey))
+      << "Not a video db: missing key " << kVideoCountKey;
+  return atoi(cursor->value().c_str());
+}
+
+void WriteVideoCount(int count, db::Transaction* txn) {
+  std::ostringstream num_videos;
+  num_videos << count;
+  txn->Put(kVideoCountKey, num_videos.str());
+}
+
+bool WriteVideoToDB(const vector<vector<string> >& frame_files, int index,
+    VideoRecord* record, db::Transaction* txn) {
+  CHECK_EQ(frame_files.size(), EncodedVideo::NUM_STREAMS);
+  // Every frame is read before any key is put, so that a video given up
+  // half way leaves nothing behind under its index.
+  vector<vector<string> > frames(EncodedVideo::NUM_STREAMS);
+  for (int s = 0; s < EncodedVideo::NUM_STREAMS; ++s) {
+    frames[s].resize(frame_files[s].size());
+    for (size_t i = 0; i < frame_files[s].size(); ++i) {
+      if (!ReadFileToString(frame_files[s][i], &frames[s][i])) {
+        LOG(ERROR) << "Could not read frame " << frame_files[s][i];
+        return false;
+      }
+    }
+  }
+  record->clear_num_frames();
+  for (int s = 0; s < EncodedVideo::NUM_STREAMS; ++s) {
+    record->add_num_frames(frames[s].size());
+    const EncodedVideo::Stream stream = static_cast<EncodedVideo::Stream>(s);
+    for (size_t i = 0; i < frames[s].size(); ++i) {
+      txn->Put(VideoFrameKey(index, stream, i + 1), frames[s][i]);
+    }
+  }
+  string out;
+  CHECK(record->SerializeToString(&out));
+  txn->Put(VideoRecordKey(index), out);
+  return true;
+}
+
+bool DBVideo::Frame(Stream stream, int frame_id, const char** data,
+    size_t* size) const {
+  if (!cursor_->SeekToKey(VideoFrameKey(index_, stream, frame_id))) {
+    return false;
+  }
+  cursor_->value_data(data, size);
+  return true;
+}
+
+}  // namespace caffe
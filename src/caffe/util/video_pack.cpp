@@ -0,0 +1,207 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/util/video_pack.hpp"
+
+namespace caffe {
+
+const char VideoPack::kMagic[4] = {'C', 'V', 'P', 'K'};
+
+namespace {
+
+const size_t kHeaderSize = sizeof(VideoPack::kMagic) + sizeof(uint32_t)
+    + VideoPack::NUM_STREAMS * sizeof(uint32_t);
+const size_t kIndexEntrySize = 2 * sizeof(uint64_t);
+
+template <typename T>
+T ReadScalar(const char* p) {
+  T value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+template <typename T>
+void WriteScalar(std::ofstream* out, T value) {
+  out->write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+}  // namespace
+
+VideoPack::VideoPack()
+    : data_(NULL), size_(0), index_(NUM_STREAMS) {
+  for (int s = 0; s < NUM_STREAMS; ++s) {
+    num_frames_[s] = 0;
+  }
+}
+
+VideoPack::~VideoPack() {
+  Close();
+}
+
+bool VideoPack::Open(const string& filename) {
+  Close();
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not open video pack " << filename;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(kHeaderSize)) {
+    LOG(ERROR) << "Video pack " << filename << " is too short";
+    close(fd);
+    return false;
+  }
+  void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after the descriptor is closed
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    LOG(ERROR) << "Could not map video pack " << filename;
+    return false;
+  }
+  // frames are read front to back within a segment
+  madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+  data_ = static_cast<const char*>(mapped);
+  size_ = st.st_size;
+  filename_ = filename;
+
+  const char* p = data_;
+  if (memcmp(p, kMagic, sizeof(kMagic)) != 0) {
+    LOG(ERROR) << filename << " is not a video pack";
+    Close();
+    return false;
+  }
+  p += sizeof(kMagic);
+  const uint32_t version = ReadScalar<uint32_t>(p);
+  p += sizeof(uint32_t);
+  if (version != kVersion) {
+    LOG(ERROR) << "Unsupported video pack version " << version << " in "
+        << filename;
+    Close();
+    return false;
+  }
+  uint64_t total_frames = 0;
+  for (int s = 0; s < NUM_STREAMS; ++s) {
+    num_frames_[s] = ReadScalar<uint32_t>(p);
+    p += sizeof(uint32_t);
+    total_frames += num_frames_[s];
+  }
+  if (kHeaderSize + total_frames * kIndexEntrySize > size_) {
+    LOG(ERROR) << "Truncated index in video pack " << filename;
+    Close();
+    return false;
+  }
+  for (int s = 0; s < NUM_STREAMS; ++s) {
+    index_[s].resize(num_frames_[s]);
+    for (uint32_t i = 0; i < num_frames_[s]; ++i) {
+      const uint64_t offset = ReadScalar<uint64_t>(p);
+      const uint64_t size = ReadScalar<uint64_t>(p + sizeof(uint64_t));
+      p += kIndexEntrySize;
+      if (offset > size_ || size > size_ - offset) {
+        LOG(ERROR) << "Frame " << i + 1 << " of stream " << s
+            << " lies outside video pack " << filename;
+        Close();
+        return false;
+      }
+      index_[s][i] = std::make_pair(offset, size);
+    }
+  }
+  return true;
+}
+
+void VideoPack::Close() {
+  if (data_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+  data_ = NULL;
+  size_ = 0;
+  filename_.clear();
+  for (int s = 0; s < NUM_STREAMS; ++s) {
+    num_frames_[s] = 0;
+    index_[s].clear();
+  }
+}
+
+bool VideoPack::Frame(Stream stream, int frame_id, const char** data,
+    size_t* size) const {
+  CHECK(is_open()) << "Video pack is not open";
+  if (frame_id < 1 || frame_id > num_frames(stream)) {
+    return false;
+  }
+  const std::pair<uint64_t, uint64_t>& entry = index_[stream][frame_id - 1];
+  *data = data_ + entry.first;
+  *size = entry.second;
+  return true;
+}
+
+bool WriteVideoPack(const vector<vector<string> >& frame_files,
+    const string& pack_file) {
+  CHECK_EQ(frame_files.size(), VideoPack::NUM_STREAMS);
+  uint64_t total_frames = 0;
+  for (int s = 0; s < VideoPack::NUM_STREAMS; ++s) {
+    total_frames += frame_files[s].size();
+  }
+  // Sizes of all frames are needed for the index before any payload.
+  vector<vector<uint64_t> > sizes(VideoPack::NUM_STREAMS);
+  for (int s = 0; s < VideoPack::NUM_STREAMS; ++s) {
+    for (size_t i = 0; i < frame_files[s].size(); ++i) {
+      std::ifstream file(frame_files[s][i].c_str(),
+          std::ios::in | std::ios::binary | std::ios::ate);
+      if (!file.is_open()) {
+        LOG(ERROR) << "Could not open frame " << frame_files[s][i];
+        return false;
+      }
+      sizes[s].push_back(file.tellg());
+    }
+  }
+
+  std::ofstream out(pack_file.c_str(),
+      std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out.is_open()) {
+    LOG(ERROR) << "Could not create video pack " << pack_file;
+    return false;
+  }
+  out.write(VideoPack::kMagic, sizeof(VideoPack::kMagic));
+  WriteScalar<uint32_t>(&out, VideoPack::kVersion);
+  for (int s = 0; s < VideoPack::NUM_STREAMS; ++s) {
+    WriteScalar<uint32_t>(&out, frame_files[s].size());
+  }
+  uint64_t offset = kHeaderSize + total_frames * kIndexEntrySize;
+  for (int s = 0; s < VideoPack::NUM_STREAMS; ++s) {
+    for (size_t i = 0; i < sizes[s].size(); ++i) {
+      WriteScalar<uint64_t>(&out, offset);
+      WriteScalar<uint64_t>(&out, sizes[s][i]);
+      offset += sizes[s][i];
+    }
+  }
+  vector<char> buffer;
+  for (int s = 0; s < VideoPack::NUM_STREAMS; ++s) {
+    for (size_t i = 0; i < frame_files[s].size(); ++i) {
+      std::ifstream file(frame_files[s][i].c_str(),
+          std::ios::in | std::ios::binary);
+      buffer.resize(sizes[s][i]);
+      if (!buffer.empty() && !file.read(&buffer[0], buffer.size())) {
+        LOG(ERROR) << "Could not read frame " << frame_files[s][i];
+        return false;
+      }
+      if (!buffer.empty()) {
+        out.write(&buffer[0], buffer.size());
+      }
+    }
+  }
+  out.close();
+  if (out.fail()) {
+    LOG(ERROR) << "Failed writing video pack " << pack_file;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace caffe
@@ -0,0 +1,395 @@
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include <opencv2/core/core.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/data_transformer.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
+#include "caffe/util/video_predictor.hpp"
+
+namespace caffe {
+
+namespace {
+
+// Packs the frames of one snippet into its channel planes.
+class SnippetFrameSink : public SegmentFrameSink {
+ public:
+  SnippetFrameSink(uint8_t* data, int channels, int height, int width)
+      : data_(data), channels_(channels), height_(height), width_(width) {}
+
+  virtual void Reshape(const int channels, const int height,
+      const int width) {
+    CHECK_EQ(channels_, channels);
+    CHECK_EQ(height_, height);
+    CHECK_EQ(width_, width);
+  }
+
+  virtual void AddFrame(const cv::Mat& frame, const int first_channel) {
+    const int frame_channels = frame.channels();
+    uint8_t* plane = data_ + first_channel * height_ * width_;
+    for (int c = 0; c < frame_channels; ++c) {
+      for (int h = 0; h < height_; ++h) {
+        const uchar* ptr = frame.ptr<uchar>(h) + c;
+        for (int w = 0; w < width_; ++w, ptr += frame_channels) {
+          *plane++ = *ptr;
+        }
+      }
+    }
+  }
+
+ private:
+  uint8_t* data_;
+  int channels_;
+  int height_;
+  int width_;
+};
+
+// Counts the frames of stream in folder up to the first missing one.
+int CountFrames(const string& folder, bool flow) {
+  const char* pattern = flow ? "flow_x_%04d.jpg" : "image_%04d.jpg";
+  char tmp[30];
+  int frame_id = 1;
+  for (; ; ++frame_id) {
+    snprintf(tmp, sizeof(tmp), pattern, frame_id);
+    if (!boost::filesystem::exists(folder + "/" + tmp)) {
+      break;
+    }
+  }
+  return frame_id - 1;
+}
+
+}  // namespace
+
+template <typename Dtype>
+VideoPredictor<Dtype>::VideoPredictor(const vector<VideoModality>& modalities,
+    const vector<shared_ptr<Net<Dtype> > >& nets, int prefetch)
+    : modalities_(modalities), nets_(nets), videos_(NULL), slots_(prefetch) {
+  CHECK_EQ(modalities_.size(), nets_.size())
+      << "Need one net per modality";
+  CHECK_GT(prefetch, 0);
+  float total_weight = 0;
+  for (int m = 0; m < modalities_.size(); ++m) {
+    const VideoModality& modality = modalities_[m];
+    CHECK_GT(modality.num_samples, 0);
+    CHECK_GT(modality.length, 0);
+    CHECK_GE(modality.weight, 0);
+    total_weight += modality.weight;
+    CHECK_EQ(nets_[m]->num_inputs(), 1)
+        << "The net of modality " << m << " should take the crops only";
+    CHECK(nets_[m]->has_blob(modality.score_blob))
+        << "Unknown score blob " << modality.score_blob;
+    const Blob<Dtype>& input = *nets_[m]->input_blobs()[0];
+    channels_.push_back((modality.flow ? 2 : 3) * modality.length);
+    CHECK_EQ(input.num_axes(), 4);
+    CHECK_EQ(input.channels(), channels_[m])
+        << "The net input should have the channels of a snippet";
+    CHECK_LE(input.height(), modality.height);
+    CHECK_LE(input.width(), modality.width);
+    batch_sizes_.push_back(input.num());
+    crop_offsets_.push_back(vector<pair<int, int> >());
+    fillFixOffset(modality.height, modality.width, input.height(),
+        input.width(), false, crop_offsets_.back());
+
+    shared_ptr<Blob<Dtype> > mean(new Blob<Dtype>());
+    if (!modality.mean_file.empty()) {
+      CHECK(modality.mean_values.empty()) <<
+          "Cannot specify mean_file and mean_values at the same time";
+      BlobProto blob_proto;
+      ReadProtoFromBinaryFileOrDie(modality.mean_file, &blob_proto);
+      mean->FromProto(blob_proto);
+      CHECK_EQ(mean->channels(), channels_[m]);
+      CHECK((mean->height() == input.height() &&
+          mean->width() == input.width()) ||
+          (mean->height() == modality.height &&
+          mean->width() == modality.width))
+          << "The mean should be of the net input or of the frame size";
+    } else {
+      const vector<float>& values = modality.mean_values;
+      CHECK(values.size() <= 1 || values.size() == channels_[m]) <<
+          "Specify either 1 mean_value or as many as channels: "
+          << channels_[m];
+      mean->Reshape(1, channels_[m], 1, 1);
+      for (int c = 0; c < channels_[m]; ++c) {
+        mean->mutable_cpu_data()[c] = values.empty() ? 0 :
+            values[values.size() == 1 ? 0 : c];
+      }
+    }
+    means_.push_back(mean);
+  }
+  CHECK_GT(total_weight, 0) << "The modalities should not all weigh 0";
+  for (int i = 0; i < prefetch; ++i) {
+    free_.push(i);
+  }
+}
+
+template <typename Dtype>
+VideoPredictor<Dtype>::~VideoPredictor() {
+  StopInternalThread();
+}
+
+template <typename Dtype>
+vector<int> VideoPredictor<Dtype>::SnippetOffsets(
+    const VideoModality& modality, int num_frames) {
+  const int num_samples = modality.num_samples;
+  int step;
+  if (modality.flow) {
+    // VideoTemporalPrediction.py
+    step = (num_frames - modality.length + 1) / num_samples;
+  } else {
+    // VideoSpatialPrediction.py, from the first frame to the last
+    step = num_samples > 1 ?
+        (num_frames - modality.length) / (num_samples - 1) : 0;
+  }
+  step = std::max(step, 0);
+  vector<int> offsets(num_samples);
+  for (int i = 0; i < num_samples; ++i) {
+    offsets[i] = i * step;
+  }
+  return offsets;
+}
+
+template <typename Dtype>
+void VideoPredictor<Dtype>::Predict(
+    const vector<std::pair<string, int> >& videos,
+    vector<vector<Dtype> >* scores) {
+  scores->clear();
+  scores->resize(videos.size());
+  if (videos.empty()) {
+    return;
+  }
+  videos_ = &videos;
+  CHECK(StartInternalThread()) << "Could not start the decode thread";
+  for (int i = 0; i < videos.size(); ++i) {
+    const int slot = full_.pop("Waiting for video frames");
+    const DecodedVideo& decoded = slots_[slot];
+    CHECK_EQ(decoded.index, i);
+    if (decoded.ok) {
+      ForwardVideo(decoded, &(*scores)[i]);
+    } else {
+      LOG(ERROR) << "Could not read the frames of " << videos[i].first;
+    }
+    free_.push(slot);
+  }
+  WaitForInternalThreadToExit();
+  videos_ = NULL;
+}
+
+template <typename Dtype>
+void VideoPredictor<Dtype>::InternalThreadEntry() {
+  try {
+    for (int i = 0; i < videos_->size() && !must_stop(); ++i) {
+      const int slot = free_.pop();
+      DecodedVideo& decoded = slots_[slot];
+      decoded.index = i;
+      decoded.ok = Decode((*videos_)[i], &decoded);
+      full_.push(slot);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+template <typename Dtype>
+bool VideoPredictor<Dtype>::Decode(const std::pair<string, int>& video,
+    DecodedVideo* decoded) {
+  const string& name = video.first;
+  const int num_modalities = modalities_.size();
+  decoded->frames.resize(num_modalities);
+  decoded->offsets.resize(num_modalities);
+  decoded->packs.resize(num_modalities);
+  int num_snippets = 0;
+  bool ok = true;
+  for (int m = 0; m < num_modalities; ++m) {
+    const VideoModality& modality = modalities_[m];
+    shared_ptr<VideoPack>& pack = decoded->packs[m];
+    pack.reset();
+    int num_frames = video.second;
+    if (modality.packed) {
+      // one mapped file per video, shared by the threads decoding it
+      pack.reset(new VideoPack());
+      if (!pack->Open(modality.root + name + ".vpk")) {
+        LOG(ERROR) << "Could not open " << modality.root + name + ".vpk";
+        ok = false;
+        break;
+      }
+      if (num_frames == 0) {
+        num_frames = pack->num_frames(modality.flow ?
+            EncodedVideo::FLOW_X : EncodedVideo::IMAGE);
+      }
+    } else if (num_frames == 0) {
+      num_frames = CountFrames(modality.root + name, modality.flow);
+    }
+    if (num_frames < modality.length) {
+      LOG(ERROR) << name << " has " << num_frames << " frames, fewer than "
+          << modality.length;
+      ok = false;
+      break;
+    }
+    decoded->offsets[m] = SnippetOffsets(modality, num_frames);
+    decoded->frames[m].resize(modality.num_samples * channels_[m] *
+        modality.height * modality.width);
+    num_snippets += modality.num_samples;
+  }
+  if (ok) {
+    decoded->snippet_ok.assign(num_snippets, 0);
+    Caffe::thread_pool()->ParallelFor(num_snippets, boost::bind(
+        &VideoPredictor<Dtype>::DecodeSnippet, this, &name, decoded, _1, _2));
+    ok = std::count(decoded->snippet_ok.begin(), decoded->snippet_ok.end(),
+        0) == 0;
+  }
+  for (int m = 0; m < decoded->packs.size(); ++m) {
+    decoded->packs[m].reset();
+  }
+  return ok;
+}
+
+template <typename Dtype>
+void VideoPredictor<Dtype>::DecodeSnippet(const string* name,
+    DecodedVideo* decoded, int job, int thread_id) {
+  int m = 0;
+  int sample = job;
+  while (sample >= modalities_[m].num_samples) {
+    sample -= modalities_[m].num_samples;
+    ++m;
+  }
+  const VideoModality& modality = modalities_[m];
+  const int snippet_size = channels_[m] * modality.height * modality.width;
+  SnippetFrameSink sink(&decoded->frames[m][sample * snippet_size],
+      channels_[m], modality.height, modality.width);
+  const vector<int> offsets(1, decoded->offsets[m][sample]);
+  const int rgb_length = modality.flow ? 0 : modality.length;
+  const int flow_length = modality.flow ? modality.length : 0;
+  bool ok;
+  if (modality.packed) {
+    const VideoPack* pack = decoded->packs[m].get();
+    ok = ReadSegmentFrames(modality.flow ? NULL : pack,
+        modality.flow ? pack : NULL, offsets, modality.height, modality.width,
+        rgb_length, flow_length, true, &sink);
+  } else {
+    const string folder = modality.root + *name;
+    ok = ReadSegmentFrames(modality.flow ? string() : folder,
+        modality.flow ? folder : string(), offsets, modality.height,
+        modality.width, rgb_length, flow_length, true, &sink);
+  }
+  decoded->snippet_ok[job] = ok;
+}
+
+template <typename Dtype>
+void VideoPredictor<Dtype>::FillCrop(const DecodedVideo* decoded, int m,
+    int first_item, Dtype* input, int item, int thread_id) {
+  const VideoModality& modality = modalities_[m];
+  const int height = modality.height;
+  const int width = modality.width;
+  const int channels = channels_[m];
+  const Blob<Dtype>& input_blob = *nets_[m]->input_blobs()[0];
+  const int crop_height = input_blob.height();
+  const int crop_width = input_blob.width();
+  // all the snippets in one crop, then in the next, as the scripts do
+  const int index = first_item + item;
+  const int sample = index % modality.num_samples;
+  const int crop = index / modality.num_samples;
+  const int num_offsets = crop_offsets_[m].size();
+  const bool mirror = crop >= num_offsets;
+  const int h_off = crop_offsets_[m][crop % num_offsets].first;
+  const int w_off = crop_offsets_[m][crop % num_offsets].second;
+
+  const Blob<Dtype>& mean = *means_[m];
+  const Dtype* mean_data = mean.cpu_data();
+  const bool crop_mean = mean.height() == crop_height &&
+      mean.width() == crop_width;
+  const bool frame_mean = !crop_mean && mean.height() == height &&
+      mean.width() == width;
+  const uint8_t* snippet =
+      &decoded->frames[m][sample * channels * height * width];
+  Dtype* output = input + item * channels * crop_height * crop_width;
+  for (int c = 0; c < channels; ++c) {
+    const bool invert = modality.flow && mirror && c % 2 == 0;
+    for (int h = 0; h < crop_height; ++h) {
+      const uint8_t* row = snippet + (c * height + h_off + h) * width + w_off;
+      Dtype* output_row = output + (c * crop_height + h) * crop_width;
+      for (int w = 0; w < crop_width; ++w) {
+        const int value = invert ? 255 - row[w] : row[w];
+        output_row[mirror ? crop_width - 1 - w : w] = value;
+      }
+      // a mean of the net input size is subtracted where it lands, one of
+      // the frame size where it is read from, as DataTransformer does
+      if (crop_mean) {
+        const Dtype* mean_row = mean_data + (c * crop_height + h) * crop_width;
+        caffe_sub(crop_width, output_row, mean_row, output_row);
+      } else if (frame_mean) {
+        const Dtype* mean_row =
+            mean_data + (c * height + h_off + h) * width + w_off;
+        for (int w = 0; w < crop_width; ++w) {
+          output_row[mirror ? crop_width - 1 - w : w] -= mean_row[w];
+        }
+      } else {
+        caffe_add_scalar(crop_width, -mean_data[c], output_row);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void VideoPredictor<Dtype>::ForwardVideo(const DecodedVideo& decoded,
+    vector<Dtype>* scores) {
+  scores->clear();
+  Dtype total_weight = 0;
+  for (int m = 0; m < modalities_.size(); ++m) {
+    const VideoModality& modality = modalities_[m];
+    Net<Dtype>* net = nets_[m].get();
+    Blob<Dtype>* input = net->input_blobs()[0];
+    const int num_items = 2 * crop_offsets_[m].size() * modality.num_samples;
+    vector<Dtype> sums;
+    for (int first = 0; first < num_items; first += batch_sizes_[m]) {
+      const int batch = std::min(batch_sizes_[m], num_items - first);
+      if (input->num() != batch) {
+        input->Reshape(batch, input->channels(), input->height(),
+            input->width());
+        net->Reshape();
+      }
+      Caffe::thread_pool()->ParallelFor(batch, boost::bind(
+          &VideoPredictor<Dtype>::FillCrop, this, &decoded, m, first,
+          input->mutable_cpu_data(), _1, _2));
+      net->ForwardPrefilled();
+      const Blob<Dtype>& score = *net->blob_by_name(modality.score_blob);
+      CHECK_EQ(score.num(), batch);
+      const int num_classes = score.count() / batch;
+      sums.resize(num_classes, Dtype(0));
+      for (int i = 0; i < batch; ++i) {
+        caffe_axpy(num_classes, Dtype(1), score.cpu_data() + i * num_classes,
+            &sums[0]);
+      }
+    }
+
+    // softmax of the average scores
+    const int num_classes = sums.size();
+    const Dtype max_sum = *std::max_element(sums.begin(), sums.end());
+    Dtype denominator = 0;
+    for (int k = 0; k < num_classes; ++k) {
+      sums[k] = std::exp((sums[k] - max_sum) / num_items);
+      denominator += sums[k];
+    }
+    if (scores->empty()) {
+      scores->resize(num_classes, Dtype(0));
+    }
+    CHECK_EQ(scores->size(), num_classes)
+        << "The modalities predict different numbers of classes";
+    caffe_axpy(num_classes, modality.weight / denominator, &sums[0],
+        &(*scores)[0]);
+    total_weight += modality.weight;
+  }
+  caffe_scal(scores->size(), Dtype(1) / total_weight, &(*scores)[0]);
+}
+
+INSTANTIATE_CLASS(VideoPredictor);
+
+}  // namespace caffe
@@ -0,0 +1,299 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/util/weight_pack.hpp"
+
+namespace caffe {
+
+const char WeightPack::kMagic[4] = {'C', 'W', 'P', 'K'};
+
+namespace {
+
+const size_t kHeaderSize = sizeof(WeightPack::kMagic) + 2 * sizeof(uint32_t);
+
+// Reads the index front to back, failing instead of reading past its end.
+class IndexReader {
+ public:
+  IndexReader(const char* begin, size_t size)
+      : p_(begin), end_(begin + size) {}
+
+  template <typename T>
+  bool Read(T* value) {
+    if (end_ - p_ < sizeof(T)) {
+      return false;
+    }
+    memcpy(value, p_, sizeof(T));
+    p_ += sizeof(T);
+    return true;
+  }
+
+  bool ReadString(string* value) {
+    uint32_t length;
+    if (!Read(&length) || end_ - p_ < length) {
+      return false;
+    }
+    value->assign(p_, length);
+    p_ += length;
+    return true;
+  }
+
+ private:
+  const char* p_;
+  const char* end_;
+};
+
+template <typename T>
+void WriteScalar(std::ofstream* out, T value) {
+  out->write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+uint64_t Align(uint64_t offset) {
+  return (offset + WeightPack::kAlignment - 1) / WeightPack::kAlignment
+      * WeightPack::kAlignment;
+}
+
+bool IsLegacy(const BlobProto& blob) {
+  return blob.has_num() || blob.has_channels() || blob.has_height()
+      || blob.has_width();
+}
+
+vector<int> ProtoShape(const BlobProto& blob) {
+  vector<int> shape;
+  if (IsLegacy(blob)) {
+    shape.push_back(blob.num());
+    shape.push_back(blob.channels());
+    shape.push_back(blob.height());
+    shape.push_back(blob.width());
+  } else {
+    for (int i = 0; i < blob.shape().dim_size(); ++i) {
+      shape.push_back(blob.shape().dim(i));
+    }
+  }
+  return shape;
+}
+
+}  // namespace
+
+WeightPack::WeightPack()
+    : data_(NULL), size_(0) {
+}
+
+WeightPack::~WeightPack() {
+  Close();
+}
+
+bool WeightPack::Open(const string& filename) {
+  Close();
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not open weight pack " << filename;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < kHeaderSize) {
+    LOG(ERROR) << "Weight pack " << filename << " is too short";
+    close(fd);
+    return false;
+  }
+  void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after the descriptor is closed
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    LOG(ERROR) << "Could not map weight pack " << filename;
+    return false;
+  }
+  // all of it is about to be copied, front to back
+  madvise(mapped, st.st_size, MADV_WILLNEED);
+  madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+  data_ = static_cast<const char*>(mapped);
+  size_ = st.st_size;
+  filename_ = filename;
+
+  if (memcmp(data_, kMagic, sizeof(kMagic)) != 0) {
+    LOG(ERROR) << filename << " is not a weight pack";
+    Close();
+    return false;
+  }
+  IndexReader reader(data_ + sizeof(kMagic), size_ - sizeof(kMagic));
+  uint32_t version, num_layers;
+  reader.Read(&version);
+  reader.Read(&num_layers);
+  if (version != kVersion) {
+    LOG(ERROR) << "Unsupported weight pack version " << version << " in "
+        << filename;
+    Close();
+    return false;
+  }
+  bool valid = true;
+  for (uint32_t i = 0; valid && i < num_layers; ++i) {
+    layers_.push_back(LayerEntry());
+    LayerEntry& layer = layers_.back();
+    uint32_t check_shape, num_blobs;
+    valid = reader.ReadString(&layer.name) && reader.Read(&check_shape)
+        && reader.Read(&num_blobs);
+    layer.check_shape = check_shape;
+    for (uint32_t j = 0; valid && j < num_blobs; ++j) {
+      layer.blobs.push_back(BlobEntry());
+      BlobEntry& blob = layer.blobs.back();
+      uint32_t legacy, num_axes;
+      valid = reader.Read(&legacy) && reader.Read(&num_axes);
+      blob.legacy = legacy;
+      uint64_t count = 1;
+      for (uint32_t k = 0; valid && k < num_axes; ++k) {
+        int32_t dim;
+        valid = reader.Read(&dim) && dim >= 0;
+        blob.shape.push_back(dim);
+        count *= dim;
+        valid = valid && count <= INT_MAX;
+      }
+      uint64_t offset;
+      valid = valid && reader.Read(&offset);
+      if (valid && (offset % sizeof(float) != 0 || offset > size_
+          || count > (size_ - offset) / sizeof(float))) {
+        LOG(ERROR) << "Blob " << j << " of layer " << layer.name
+            << " lies outside weight pack " << filename;
+        Close();
+        return false;
+      }
+      blob.count = count;
+      blob.data = reinterpret_cast<const float*>(data_ + offset);
+    }
+  }
+  if (!valid) {
+    LOG(ERROR) << "Truncated index in weight pack " << filename;
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void WeightPack::Close() {
+  if (data_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+  data_ = NULL;
+  size_ = 0;
+  filename_.clear();
+  layers_.clear();
+}
+
+BlobProto WeightPack::ShapeProto(const BlobEntry& entry) {
+  BlobProto proto;
+  if (entry.legacy) {
+    CHECK_EQ(entry.shape.size(), 4);
+    proto.set_num(entry.shape[0]);
+    proto.set_channels(entry.shape[1]);
+    proto.set_height(entry.shape[2]);
+    proto.set_width(entry.shape[3]);
+  } else {
+    for (int i = 0; i < entry.shape.size(); ++i) {
+      proto.mutable_shape()->add_dim(entry.shape[i]);
+    }
+  }
+  return proto;
+}
+
+void WeightPack::ToProto(NetParameter* param) const {
+  CHECK(is_open()) << "Weight pack is not open";
+  param->clear_layer();
+  for (int i = 0; i < layers_.size(); ++i) {
+    LayerParameter* layer = param->add_layer();
+    layer->set_name(layers_[i].name);
+    if (!layers_[i].check_shape) {
+      layer->set_check_shape(false);
+    }
+    for (int j = 0; j < layers_[i].blobs.size(); ++j) {
+      const BlobEntry& entry = layers_[i].blobs[j];
+      BlobProto* blob = layer->add_blobs();
+      *blob = ShapeProto(entry);
+      blob->mutable_data()->Reserve(entry.count);
+      for (int k = 0; k < entry.count; ++k) {
+        blob->add_data(entry.data[k]);
+      }
+    }
+  }
+}
+
+bool IsWeightPack(const string& filename) {
+  std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+  char magic[sizeof(WeightPack::kMagic)];
+  return file.read(magic, sizeof(magic))
+      && memcmp(magic, WeightPack::kMagic, sizeof(magic)) == 0;
+}
+
+bool WriteWeightPack(const NetParameter& param, const string& pack_file) {
+  // The index comes before any payload, so its size is needed first.
+  uint64_t index_size = kHeaderSize;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer = param.layer(i);
+    index_size += 3 * sizeof(uint32_t) + layer.name().size();
+    for (int j = 0; j < layer.blobs_size(); ++j) {
+      index_size += 2 * sizeof(uint32_t) + sizeof(uint64_t)
+          + ProtoShape(layer.blobs(j)).size() * sizeof(int32_t);
+    }
+  }
+
+  std::ofstream out(pack_file.c_str(),
+      std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out.is_open()) {
+    LOG(ERROR) << "Could not create weight pack " << pack_file;
+    return false;
+  }
+  out.write(WeightPack::kMagic, sizeof(WeightPack::kMagic));
+  WriteScalar<uint32_t>(&out, WeightPack::kVersion);
+  WriteScalar<uint32_t>(&out, param.layer_size());
+  uint64_t offset = Align(index_size);
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer = param.layer(i);
+    WriteScalar<uint32_t>(&out, layer.name().size());
+    out.write(layer.name().data(), layer.name().size());
+    WriteScalar<uint32_t>(&out, layer.check_shape());
+    WriteScalar<uint32_t>(&out, layer.blobs_size());
+    for (int j = 0; j < layer.blobs_size(); ++j) {
+      const BlobProto& blob = layer.blobs(j);
+      const vector<int> shape = ProtoShape(blob);
+      uint64_t count = 1;
+      WriteScalar<uint32_t>(&out, IsLegacy(blob));
+      WriteScalar<uint32_t>(&out, shape.size());
+      for (int k = 0; k < shape.size(); ++k) {
+        WriteScalar<int32_t>(&out, shape[k]);
+        count *= shape[k];
+      }
+      if (blob.data_size() != count) {
+        LOG(ERROR) << "Blob " << j << " of layer " << layer.name() << " has "
+            << blob.data_size() << " values for a shape of " << count;
+        return false;
+      }
+      WriteScalar<uint64_t>(&out, offset);
+      offset = Align(offset + count * sizeof(float));
+    }
+  }
+  const vector<char> padding(WeightPack::kAlignment, 0);
+  uint64_t written = index_size;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer = param.layer(i);
+    for (int j = 0; j < layer.blobs_size(); ++j) {
+      const BlobProto& blob = layer.blobs(j);
+      out.write(&padding[0], Align(written) - written);
+      out.write(reinterpret_cast<const char*>(blob.data().data()),
+          blob.data_size() * sizeof(float));
+      written = Align(written) + blob.data_size() * sizeof(float);
+    }
+  }
+  out.close();
+  if (out.fail()) {
+    LOG(ERROR) << "Failed writing weight pack " << pack_file;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace caffe
@@ -29,6 +29,22 @@ DEFINE_string(weights, "",
     "Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_int32(threads, 1,
+    "The number of CPU threads the layers, and data layers with "
+    "num_decode_threads 0, split their work over.");
+DEFINE_bool(huge_pages, false,
+    "Optional; back the large host blobs by transparent huge pages.");
+DEFINE_int32(host_cache_mb, 256,
+    "Optional; the MB of freed host blob memory kept for reuse.");
+
+// Logs how much host memory the blobs took, and how often it was reused.
+static void LogHostMemory() {
+  const caffe::HostAllocator::Stats stats = Caffe::host_allocator().stats();
+  LOG(INFO) << "Host memory: " << (stats.in_use >> 20) << " MB in use, "
+      << (stats.cached >> 20) << " MB cached, " << (stats.peak >> 20)
+      << " MB at peak; " << stats.num_cache_hits << " of "
+      << stats.num_allocs << " allocations from the cache.";
+}
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -185,6 +201,7 @@ int train() {
     solver->Solve();
   }
   LOG(INFO) << "Optimization Done.";
+  LogHostMemory();
   return 0;
 }
 RegisterBrewFunction(train);
@@ -338,6 +355,7 @@ int time() {
   LOG(INFO) << "Average Forward-Backward: " << total_timer.MilliSeconds() /
     FLAGS_iterations << " ms.";
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() << " ms.";
+  LogHostMemory();
   LOG(INFO) << "*** Benchmark ends ***";
   return 0;
 }
@@ -356,6 +374,10 @@ int main(int argc, char** argv) {
       "  time            benchmark model execution time");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  caffe::Caffe::set_num_threads(FLAGS_threads);
+  caffe::Caffe::host_allocator().set_huge_pages(FLAGS_huge_pages);
+  caffe::Caffe::host_allocator().set_cache_limit(
+      static_cast<size_t>(FLAGS_host_cache_mb) << 20);
 
   if (argc == 2) {
     int ret = GetBrewFunction(caffe::string(argv[1]))();
@@ -0,0 +1,125 @@
+// This program packs the frame folders of a set of videos into one file per
+// video (see caffe/util/video_pack.hpp), to be read by a VideoData layer with
+// video_data_param { packed: true }.
+// Usage:
+//   convert_videoset [FLAGS] LISTFILE OUTPUT_FOLDER/
+//
+// where LISTFILE is the list used as the VideoData source, in the format
+//   subfolder1/video1 NUM_FRAMES LABEL
+//   ....
+// Frames are taken from RGB_ROOT/subfolder1/video1/image_%04d.jpg and
+// FLOW_ROOT/subfolder1/video1/flow_{x,y}_%04d.jpg, and the pack is written to
+// OUTPUT_FOLDER/subfolder1/video1.vpk.
+
+#include <cstdio>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/util/video_pack.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_string(rgb_root, "",
+    "Root folder of the RGB frames (image_%04d.jpg); empty to skip RGB");
+DEFINE_string(flow_root, "",
+    "Root folder of the flow frames (flow_{x,y}_%04d.jpg); empty to skip flow");
+DEFINE_bool(skip_existing, false,
+    "When this option is on, keep packs that already exist");
+
+// Lists pattern % 1, pattern % 2, ... under folder up to the first missing one.
+static vector<string> ListFrames(const string& folder, const char* pattern) {
+  vector<string> files;
+  char tmp[30];
+  for (int frame_id = 1; ; ++frame_id) {
+    snprintf(tmp, sizeof(tmp), pattern, frame_id);
+    const string file = folder + "/" + tmp;
+    if (!boost::filesystem::exists(file)) {
+      break;
+    }
+    files.push_back(file);
+  }
+  return files;
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Pack the frames of a set of videos into one file\n"
+        "per video, as read by the VideoData layer in packed mode.\n"
+        "Usage:\n"
+        "    convert_videoset [FLAGS] LISTFILE OUTPUT_FOLDER/\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc < 3 || (FLAGS_rgb_root.empty() && FLAGS_flow_root.empty())) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/convert_videoset");
+    return 1;
+  }
+
+  std::ifstream infile(argv[1]);
+  vector<string> videos;
+  string line;
+  while (std::getline(infile, line)) {
+    std::istringstream iss(line);
+    string video;
+    if (iss >> video) {
+      videos.push_back(video);
+    }
+  }
+  LOG(INFO) << "A total of " << videos.size() << " videos.";
+
+  const string output_folder(argv[2]);
+  int count = 0;
+  int failed = 0;
+  for (size_t i = 0; i < videos.size(); ++i) {
+    const string pack_file = output_folder + videos[i] + ".vpk";
+    if (FLAGS_skip_existing && boost::filesystem::exists(pack_file)) {
+      continue;
+    }
+    vector<vector<string> > frames(VideoPack::NUM_STREAMS);
+    if (!FLAGS_rgb_root.empty()) {
+      frames[VideoPack::IMAGE] =
+          ListFrames(FLAGS_rgb_root + videos[i], "image_%04d.jpg");
+    }
+    if (!FLAGS_flow_root.empty()) {
+      frames[VideoPack::FLOW_X] =
+          ListFrames(FLAGS_flow_root + videos[i], "flow_x_%04d.jpg");
+      frames[VideoPack::FLOW_Y] =
+          ListFrames(FLAGS_flow_root + videos[i], "flow_y_%04d.jpg");
+      if (frames[VideoPack::FLOW_X].size() !=
+          frames[VideoPack::FLOW_Y].size()) {
+        LOG(WARNING) << videos[i] << " has " << frames[VideoPack::FLOW_X].size()
+            << " flow_x but " << frames[VideoPack::FLOW_Y].size()
+            << " flow_y frames";
+      }
+    }
+    if (frames[VideoPack::IMAGE].empty() && frames[VideoPack::FLOW_X].empty()) {
+      LOG(ERROR) << "No frames found for " << videos[i];
+      ++failed;
+      continue;
+    }
+    const boost::filesystem::path pack_dir =
+        boost::filesystem::path(pack_file).parent_path();
+    if (!pack_dir.empty()) {
+      boost::filesystem::create_directories(pack_dir);
+    }
+    if (!WriteVideoPack(frames, pack_file)) {
+      ++failed;
+      continue;
+    }
+    if (++count % 1000 == 0) {
+      LOG(ERROR) << "Processed " << count << " videos.";
+    }
+  }
+  LOG(ERROR) << "Processed " << count << " videos, " << failed << " failed.";
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,156 @@
+// This program converts the frame folders of a set of videos to a lmdb/leveldb
+// video db (see caffe/util/video_db.hpp), to be read by a VideoData layer with
+// video_data_param { backend: LMDB }.
+// Usage:
+//   convert_videoset_db [FLAGS] LISTFILE DB_NAME
+//
+// where LISTFILE is the list used as the VideoData source, in the format
+//   subfolder1/video1 NUM_FRAMES LABEL [LABEL ...]
+//   ....
+// Frames are taken from RGB_ROOT/subfolder1/video1/image_%04d.jpg and
+// FLOW_ROOT/subfolder1/video1/flow_{x,y}_%04d.jpg and stored still encoded.
+// Under MPI every rank reads a contiguous range of videos, so --shuffle is
+// recommended to mix the classes across ranks.
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "boost/scoped_ptr.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/rng.hpp"
+#include "caffe/util/video_db.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using boost::scoped_ptr;
+
+DEFINE_string(rgb_root, "",
+    "Root folder of the RGB frames (image_%04d.jpg); empty to skip RGB");
+DEFINE_string(flow_root, "",
+    "Root folder of the flow frames (flow_{x,y}_%04d.jpg); empty to skip flow");
+DEFINE_bool(shuffle, false,
+    "Randomly shuffle the order of the videos");
+DEFINE_string(backend, "lmdb",
+        "The backend {lmdb, leveldb} for storing the result");
+
+struct VideoLine {
+  string name;
+  int length;
+  vector<int> labels;
+};
+
+// Lists pattern % 1, pattern % 2, ... under folder up to the first missing one.
+static vector<string> ListFrames(const string& folder, const char* pattern) {
+  vector<string> files;
+  char tmp[30];
+  for (int frame_id = 1; ; ++frame_id) {
+    snprintf(tmp, sizeof(tmp), pattern, frame_id);
+    const string file = folder + "/" + tmp;
+    if (!boost::filesystem::exists(file)) {
+      break;
+    }
+    files.push_back(file);
+  }
+  return files;
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Convert the frames of a set of videos to the\n"
+        "leveldb/lmdb video db read by the VideoData layer.\n"
+        "Usage:\n"
+        "    convert_videoset_db [FLAGS] LISTFILE DB_NAME\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc < 3 || (FLAGS_rgb_root.empty() && FLAGS_flow_root.empty())) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/convert_videoset_db");
+    return 1;
+  }
+
+  std::ifstream infile(argv[1]);
+  vector<VideoLine> lines;
+  string line;
+  while (std::getline(infile, line)) {
+    std::istringstream iss(line);
+    VideoLine video;
+    if (!(iss >> video.name >> video.length)) {
+      continue;
+    }
+    int label;
+    while (iss >> label) {
+      video.labels.push_back(label);
+    }
+    lines.push_back(video);
+  }
+  if (FLAGS_shuffle) {
+    // randomly shuffle data
+    LOG(INFO) << "Shuffling data";
+    shuffle(lines.begin(), lines.end());
+  }
+  LOG(INFO) << "A total of " << lines.size() << " videos.";
+
+  // Create new DB
+  scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
+  db->Open(argv[2], db::NEW);
+  scoped_ptr<db::Transaction> txn(db->NewTransaction());
+
+  // Videos without any frame, or with one that cannot be read, are dropped
+  // without leaving keys behind, so indices stay contiguous.
+  int count = 0;
+  VideoRecord record;
+  for (int line_id = 0; line_id < lines.size(); ++line_id) {
+    const VideoLine& video = lines[line_id];
+    record.Clear();
+    record.set_name(video.name);
+    record.set_length(video.length);
+    for (int i = 0; i < video.labels.size(); ++i) {
+      record.add_label(video.labels[i]);
+    }
+    vector<vector<string> > frames(EncodedVideo::NUM_STREAMS);
+    if (!FLAGS_rgb_root.empty()) {
+      frames[EncodedVideo::IMAGE] =
+          ListFrames(FLAGS_rgb_root + video.name, "image_%04d.jpg");
+    }
+    if (!FLAGS_flow_root.empty()) {
+      frames[EncodedVideo::FLOW_X] =
+          ListFrames(FLAGS_flow_root + video.name, "flow_x_%04d.jpg");
+      frames[EncodedVideo::FLOW_Y] =
+          ListFrames(FLAGS_flow_root + video.name, "flow_y_%04d.jpg");
+    }
+    if (frames[EncodedVideo::IMAGE].empty() &&
+        frames[EncodedVideo::FLOW_X].empty()) {
+      LOG(ERROR) << "No frames found for " << video.name;
+      continue;
+    }
+    // nothing is stored under count unless the whole video is
+    if (!WriteVideoToDB(frames, count, &record, txn.get())) {
+      LOG(ERROR) << "Could not store " << video.name;
+      continue;
+    }
+
+    if (++count % 100 == 0) {
+      // Commit db
+      txn->Commit();
+      txn.reset(db->NewTransaction());
+      LOG(ERROR) << "Processed " << count << " videos.";
+    }
+  }
+  WriteVideoCount(count, txn.get());
+  // write the last batch
+  txn->Commit();
+  LOG(ERROR) << "Processed " << count << " videos.";
+  return 0;
+}
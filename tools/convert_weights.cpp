@@ -0,0 +1,43 @@
+// This is a script to convert trained weights between .caffemodel files and
+// weight packs, which Net::CopyTrainedLayersFrom maps instead of parsing.
+// The direction follows the format of the input.
+// Usage:
+//    convert_weights weights_in weights_out
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+#include "caffe/util/weight_pack.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3) {
+    LOG(ERROR) << "Usage: "
+        << "convert_weights weights_in weights_out";
+    return 1;
+  }
+
+  const string input_filename(argv[1]);
+  const string output_filename(argv[2]);
+  NetParameter net_param;
+  if (IsWeightPack(input_filename)) {
+    WeightPack pack;
+    if (!pack.Open(input_filename)) {
+      return 2;
+    }
+    pack.ToProto(&net_param);
+    WriteProtoToBinaryFile(net_param, output_filename);
+    LOG(ERROR) << "Wrote NetParameter binary proto to " << output_filename;
+  } else {
+    ReadNetParamsFromBinaryFileOrDie(input_filename, &net_param);
+    if (!WriteWeightPack(net_param, output_filename)) {
+      return 3;
+    }
+    LOG(ERROR) << "Wrote weight pack to " << output_filename;
+  }
+  return 0;
+}
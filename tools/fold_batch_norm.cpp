@@ -0,0 +1,55 @@
+// This is a script to fold the BN layers of a deploy net into the Convolution
+// and InnerProduct layers they follow, for faster inference: it writes the
+// net without them, and its weights with their scale and shift folded in.
+// Usage:
+//    fold_batch_norm net_proto_file_in weights_in
+//        net_proto_file_out weights_out
+
+#include <map>
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: "
+        << "fold_batch_norm net_proto_file_in weights_in "
+        << "net_proto_file_out weights_out";
+    return 1;
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  NetParameter test_param(net_param);
+  test_param.mutable_state()->set_phase(TEST);
+  test_param.set_fold_batch_norm(true);
+
+  // The net as Net::Init folds it, without the phase set above.
+  NetParameter filtered_param, folded_param;
+  map<string, string> folded;
+  Net<float>::FilterNet(test_param, &filtered_param);
+  Net<float>::FoldBatchNorm(filtered_param, &folded_param, &folded);
+  folded_param.clear_fold_batch_norm();
+  if (!net_param.has_state()) {
+    folded_param.clear_state();
+  }
+  for (map<string, string>::const_iterator bn = folded.begin();
+      bn != folded.end(); ++bn) {
+    LOG(ERROR) << "Folded " << bn->first << " into " << bn->second;
+  }
+  WriteProtoToTextFile(folded_param, argv[3]);
+  LOG(ERROR) << "Wrote NetParameter text proto to " << argv[3];
+
+  Net<float> net(test_param);
+  net.CopyTrainedLayersFrom(argv[2]);
+  NetParameter weights;
+  net.ToProto(&weights, false);
+  WriteProtoToBinaryFile(weights, argv[4]);
+  LOG(ERROR) << "Wrote NetParameter binary proto to " << argv[4];
+  return 0;
+}
@@ -0,0 +1,189 @@
+// This program predicts the class of a set of videos with the spatial (RGB)
+// and/or temporal (flow) net of a two-stream model, from 25 snippets of each
+// video cut into 10 crops, as action_python/demo.py does.
+// Usage:
+//   predict_videos [FLAGS] LISTFILE OUTFILE
+//
+// where LISTFILE is the list used as the VideoData source, in the format
+//   subfolder1/video1 NUM_FRAMES [LABEL ...]
+//   ....
+// with NUM_FRAMES 0 to count the frames of each video. Frames are taken from
+// RGB_ROOT/subfolder1/video1/image_%04d.jpg and
+// FLOW_ROOT/subfolder1/video1/flow_{x,y}_%04d.jpg, or from the packs
+// RGB_ROOT/subfolder1/video1.vpk with --packed. OUTFILE gets a line per video
+// with its name, predicted class and class probabilities.
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/video_predictor.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_int32(gpu, -1,
+    "Run in GPU mode on the given device ID; CPU mode if negative");
+DEFINE_int32(threads, 1,
+    "The number of threads decoding the frames and running CPU layers");
+DEFINE_string(rgb_model, "",
+    "The deploy prototxt of the spatial net; empty to skip RGB");
+DEFINE_string(rgb_weights, "", "The trained weights of the spatial net");
+DEFINE_string(rgb_root, "", "Root folder of the RGB frames or packs");
+DEFINE_string(rgb_mean_file, "", "BlobProto mean of the RGB crops or frames");
+DEFINE_string(rgb_mean_values, "104,117,123",
+    "Comma separated mean of each RGB channel, or of all");
+DEFINE_double(rgb_weight, 1, "Weight of the spatial net in the fusion");
+DEFINE_string(flow_model, "",
+    "The deploy prototxt of the temporal net; empty to skip flow");
+DEFINE_string(flow_weights, "", "The trained weights of the temporal net");
+DEFINE_string(flow_root, "", "Root folder of the flow frames or packs");
+DEFINE_string(flow_mean_file, "",
+    "BlobProto mean of the flow crops or frames");
+DEFINE_string(flow_mean_values, "128",
+    "Comma separated mean of each flow channel, or of all");
+DEFINE_double(flow_weight, 2, "Weight of the temporal net in the fusion");
+DEFINE_int32(flow_length, 10, "The flow_x/flow_y pairs of a flow snippet");
+DEFINE_int32(num_samples, 25, "The snippets taken from every video");
+DEFINE_int32(new_height, 256, "Height the frames are resized to");
+DEFINE_int32(new_width, 340, "Width the frames are resized to");
+DEFINE_bool(packed, false, "Read the frames of each video from its .vpk pack");
+DEFINE_string(score_blob, "",
+    "The blob of the nets holding the class scores; their output if empty");
+DEFINE_int32(prefetch, 2, "The videos decoded ahead of the nets");
+
+static void AddModality(const string& model, const string& weights,
+    const string& root, const string& mean_file, const string& mean_values,
+    float weight, bool flow, vector<VideoModality>* modalities,
+    vector<shared_ptr<Net<float> > >* nets) {
+  shared_ptr<Net<float> > net(new Net<float>(model, TEST));
+  net->CopyTrainedLayersFrom(weights);
+  VideoModality modality;
+  modality.flow = flow;
+  modality.length = flow ? FLAGS_flow_length : 1;
+  modality.num_samples = FLAGS_num_samples;
+  modality.height = FLAGS_new_height;
+  modality.width = FLAGS_new_width;
+  modality.root = root;
+  modality.packed = FLAGS_packed;
+  modality.mean_file = mean_file;
+  if (mean_file.empty() && !mean_values.empty()) {
+    vector<string> values;
+    boost::split(values, mean_values, boost::is_any_of(","));
+    for (int i = 0; i < values.size(); ++i) {
+      modality.mean_values.push_back(atof(values[i].c_str()));
+    }
+  }
+  modality.score_blob = FLAGS_score_blob;
+  if (modality.score_blob.empty()) {
+    CHECK_EQ(net->num_outputs(), 1) << "Specify the --score_blob of " << model;
+    modality.score_blob = net->blob_names()[net->output_blob_indices()[0]];
+  }
+  modality.weight = weight;
+  modalities->push_back(modality);
+  nets->push_back(net);
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Predict the class of videos with two-stream nets.\n"
+        "Usage:\n"
+        "    predict_videos [FLAGS] LISTFILE OUTFILE\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc < 3 || (FLAGS_rgb_model.empty() && FLAGS_flow_model.empty())) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/predict_videos");
+    return 1;
+  }
+
+  if (FLAGS_gpu >= 0) {
+    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  Caffe::set_num_threads(FLAGS_threads);
+
+  vector<VideoModality> modalities;
+  vector<shared_ptr<Net<float> > > nets;
+  if (!FLAGS_rgb_model.empty()) {
+    AddModality(FLAGS_rgb_model, FLAGS_rgb_weights, FLAGS_rgb_root,
+        FLAGS_rgb_mean_file, FLAGS_rgb_mean_values, FLAGS_rgb_weight, false,
+        &modalities, &nets);
+  }
+  if (!FLAGS_flow_model.empty()) {
+    AddModality(FLAGS_flow_model, FLAGS_flow_weights, FLAGS_flow_root,
+        FLAGS_flow_mean_file, FLAGS_flow_mean_values, FLAGS_flow_weight, true,
+        &modalities, &nets);
+  }
+
+  std::ifstream infile(argv[1]);
+  CHECK(infile.is_open()) << "Could not open " << argv[1];
+  vector<std::pair<string, int> > videos;
+  vector<int> labels;
+  string line;
+  while (std::getline(infile, line)) {
+    std::istringstream iss(line);
+    std::pair<string, int> video;
+    if (!(iss >> video.first >> video.second)) {
+      continue;
+    }
+    int label = -1;
+    iss >> label;
+    videos.push_back(video);
+    labels.push_back(label);
+  }
+  LOG(INFO) << "A total of " << videos.size() << " videos.";
+
+  VideoPredictor<float> predictor(modalities, nets, FLAGS_prefetch);
+  vector<vector<float> > scores;
+  CPUTimer timer;
+  timer.Start();
+  predictor.Predict(videos, &scores);
+  timer.Stop();
+
+  std::ofstream outfile(argv[2]);
+  CHECK(outfile.is_open()) << "Could not open " << argv[2];
+  int num_predicted = 0, num_labeled = 0, num_correct = 0;
+  for (int i = 0; i < videos.size(); ++i) {
+    if (scores[i].empty()) {
+      continue;
+    }
+    const int prediction = std::max_element(scores[i].begin(),
+        scores[i].end()) - scores[i].begin();
+    outfile << videos[i].first << " " << prediction;
+    for (int k = 0; k < scores[i].size(); ++k) {
+      outfile << " " << scores[i][k];
+    }
+    outfile << "\n";
+    ++num_predicted;
+    if (labels[i] >= 0) {
+      ++num_labeled;
+      num_correct += prediction == labels[i];
+    }
+  }
+  LOG(INFO) << "Predicted " << num_predicted << " of " << videos.size()
+      << " videos in " << timer.Seconds() << " s, "
+      << num_predicted / timer.Seconds() << " videos/sec.";
+  if (num_labeled > 0) {
+    LOG(INFO) << "Accuracy: " << static_cast<float>(num_correct) / num_labeled
+        << " on " << num_labeled << " labeled videos.";
+  }
+  return 0;
+}